@@ -0,0 +1,72 @@
+# - macro_check_gfapi(_prefix _includes [_definitions...])
+# Probes the libgfapi API declared by the api/glfs.h found under
+# ${_includes}, the calls are only looked at in sizeof() so nothing
+# needs to link.  Sets ${_prefix}_DEFINITIONS to the definitions the
+# gluster driver is built with:
+#
+#  HAVE_GLFS_STAT_PREPOST - I/O calls and their callbacks take the file's
+#                           stat before and after the operation (gfapi 6)
+#  HAVE_GLFS_COPY_FILE_RANGE - glfs_copy_file_range(), the bricks copy
+#                              the data (gfapi 6)
+#
+# Example:
+# macro_check_gfapi(GFAPI "${GFAPI_INCLUDE_DIRS}" ${GFAPI_CFLAGS_OTHER})
+# target_compile_definitions(gluster PRIVATE ${GFAPI_DEFINITIONS})
+#
+# Copyright (c) 2013      Harshavardhana <fharshav@redhat.com>
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+include(CheckCSourceCompiles)
+
+macro (macro_check_gfapi _prefix _includes)
+  set(CMAKE_REQUIRED_INCLUDES ${_includes})
+  set(CMAKE_REQUIRED_DEFINITIONS ${ARGN})
+  set(${_prefix}_DEFINITIONS)
+
+  check_c_source_compiles("
+#include <stddef.h>
+#include <api/glfs.h>
+
+int main(void)
+{
+    return (int) sizeof (glfs_fsync ((glfs_fd_t *) NULL,
+                                     (struct glfs_stat *) NULL,
+                                     (struct glfs_stat *) NULL));
+}" ${_prefix}_STAT_PREPOST)
+  if (${_prefix}_STAT_PREPOST)
+    list(APPEND ${_prefix}_DEFINITIONS HAVE_GLFS_STAT_PREPOST)
+  endif (${_prefix}_STAT_PREPOST)
+
+  check_c_source_compiles("
+#include <stddef.h>
+#include <api/glfs.h>
+
+int main(void)
+{
+    off64_t in = 0;
+    off64_t out = 0;
+
+    return (int) sizeof (glfs_copy_file_range ((glfs_fd_t *) NULL, &in,
+                                               (glfs_fd_t *) NULL, &out,
+                                               (size_t) 0, 0U,
+                                               (struct glfs_stat *) NULL,
+                                               (struct glfs_stat *) NULL,
+                                               (struct glfs_stat *) NULL));
+}" ${_prefix}_COPY_FILE_RANGE)
+  if (${_prefix}_COPY_FILE_RANGE)
+    list(APPEND ${_prefix}_DEFINITIONS HAVE_GLFS_COPY_FILE_RANGE)
+  endif (${_prefix}_COPY_FILE_RANGE)
+
+  set(CMAKE_REQUIRED_INCLUDES)
+  set(CMAKE_REQUIRED_DEFINITIONS)
+endmacro (macro_check_gfapi)
@@ -0,0 +1,517 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Process wide cache of initialized volumes.  glfs_init() fetches the
+  volfile and builds the whole client graph, done once per volume it
+  leaves a driver instance with nothing but path lookups to do.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/statvfs.h>
+
+#include "gluster-cache.h"
+
+static pthread_mutex_t   glfs_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    glfs_cond  = PTHREAD_COND_INITIALIZER;
+static struct bobjs_glfs *glfs_list = NULL;
+
+static
+void __bobjs_glfs_free (bobjs_glfs_t *vol)
+{
+        if (vol->fs)
+                glfs_fini (vol->fs);
+        free (vol->server);
+        free (vol->volume);
+        free (vol);
+}
+
+/* Take 'vol' out of the cache, callers hold glfs_lock */
+static
+void __bobjs_glfs_unlink (bobjs_glfs_t *vol)
+{
+        struct bobjs_glfs **pp = &glfs_list;
+
+        for (; *pp; pp = &(*pp)->next) {
+                if (*pp == vol) {
+                        *pp = vol->next;
+                        break;
+                }
+        }
+        vol->next = NULL;
+        vol->dead = 1;
+}
+
+/* Entry 'n' of a comma separated server list, "host[:port]" */
+int32_t bobjs_glfs_server (const char *list, int32_t n, char *host,
+                           size_t size, int32_t *port)
+{
+        const char *end  = NULL;
+        const char *sep  = NULL;
+        size_t     len   = 0;
+
+        for (; n > 0; n--) {
+                list = strchr (list, ',');
+                if (!list)
+                        return -1;
+                list++;
+        }
+
+        end = strchr (list, ',');
+        len = end ? (size_t) (end - list) : strlen (list);
+        sep = memchr (list, ':', len);
+        if (sep) {
+                *port = atoi (sep + 1);
+                len   = sep - list;
+        }
+        if ((!len) || (len >= size))
+                return -1;
+
+        memcpy (host, list, len);
+        host[len] = '\0';
+        return 0;
+}
+
+static
+int32_t __bobjs_glfs_nservers (const char *list)
+{
+        int32_t n = 1;
+
+        for (list = strchr (list, ','); list; list = strchr (list + 1, ','))
+                n++;
+        return n;
+}
+
+/*
+  Attempts at connecting one volume, each starting the server list at
+  a different entry.  Shared with the attempts still running once the
+  caller went away with a volume, the last one out frees it.
+*/
+struct bobjs_glfs_race {
+        pthread_mutex_t lock;
+        pthread_cond_t  cond;
+        char            *server;
+        char            *volume;
+        int32_t         port;
+        int32_t         running;        /* attempts in flight */
+        int32_t         refs;
+        glfs_t          *fs;            /* the first to init */
+        int32_t         err;            /* of the last failed attempt */
+};
+
+struct bobjs_glfs_attempt {
+        struct bobjs_glfs_race *race;
+        int32_t                first;   /* server list entry tried first */
+};
+
+static
+void __bobjs_glfs_race_unref (struct bobjs_glfs_race *race)
+{
+        int32_t refs = 0;
+
+        pthread_mutex_lock (&race->lock);
+        refs = --race->refs;
+        pthread_mutex_unlock (&race->lock);
+        if (refs)
+                return;
+
+        pthread_cond_destroy (&race->cond);
+        pthread_mutex_destroy (&race->lock);
+        free (race->server);
+        free (race->volume);
+        free (race);
+}
+
+/*
+  Every server goes to gfapi, the one given first fetches the volfile
+  and the others back it up once the volume is up.  A first server
+  that cannot be reached fails glfs_init() as a whole.
+*/
+static
+glfs_t *__bobjs_glfs_attempt (struct bobjs_glfs_race *race, int32_t first,
+                              int32_t nservers)
+{
+        glfs_t  *fs   = NULL;
+        char    host[256];
+        int32_t hport = 0;
+        int32_t i     = 0;
+
+        fs = glfs_new (race->volume);
+        if (!fs) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+
+        for (i = 0; i < nservers; i++) {
+                hport = race->port;
+                if (bobjs_glfs_server (race->server, (first + i) % nservers,
+                                       host, sizeof(host), &hport) < 0) {
+                        errno = -EINVAL;
+                        goto err;
+                }
+                if (glfs_set_volfile_server (fs, "tcp", host, hport) < 0)
+                        goto err;
+        }
+
+        /*
+         * FIXME: Use GF_LOG_ERROR instead of hard code value of 4
+         * here when GlusterFS makes GF_LOG_* macros available to
+         * libgfapi users.
+         */
+
+        if ((glfs_set_logging (fs, "-", 4) < 0) || (glfs_init (fs) < 0))
+                goto err;
+
+        return fs;
+err:
+        /* gfapi sets errno the system way, ours is negative already */
+        i = (errno > 0) ? -errno : (errno < 0) ? errno : -ENOTCONN;
+        glfs_fini (fs);
+        errno = i;
+        return NULL;
+}
+
+static
+void *__bobjs_glfs_attempt_run (void *arg)
+{
+        struct bobjs_glfs_attempt *attempt  = arg;
+        struct bobjs_glfs_race    *race     = attempt->race;
+        glfs_t                    *fs       = NULL;
+        int32_t                   err       = 0;
+
+        fs = __bobjs_glfs_attempt (race, attempt->first,
+                                   __bobjs_glfs_nservers (race->server));
+        err = errno;
+        free (attempt);
+
+        pthread_mutex_lock (&race->lock);
+        race->running--;
+        if ((fs) && (!race->fs)) {
+                race->fs = fs;
+                fs       = NULL;
+        } else if (!fs) {
+                race->err = err;
+        }
+        pthread_cond_broadcast (&race->cond);
+        pthread_mutex_unlock (&race->lock);
+
+        /* Lost the race */
+        if (fs)
+                glfs_fini (fs);
+        __bobjs_glfs_race_unref (race);
+
+        return NULL;
+}
+
+/*
+  Up to BOBJS_GLFS_RACE attempts run at once, each starting the server
+  list at the next entry, and the first volume to come up is kept.  A
+  management node down or hanging holds nobody up, the attempt
+  starting at the next one is already running; another starts as soon
+  as one fails.
+*/
+static
+glfs_t *__bobjs_glfs_connect (const char *server, int32_t port,
+                              const char *volume, unsigned long *bsize)
+{
+        struct statvfs            buf;
+        struct bobjs_glfs_race    *race    = NULL;
+        struct bobjs_glfs_attempt *attempt = NULL;
+        pthread_t                 thread;
+        glfs_t                    *fs      = NULL;
+        int32_t                   nservers = __bobjs_glfs_nservers (server);
+        int32_t                   first    = 0;
+        int32_t                   err      = 0;
+
+        race = calloc (1, sizeof(*race));
+        if (!race) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+        pthread_mutex_init (&race->lock, NULL);
+        pthread_cond_init (&race->cond, NULL);
+        race->server = strdup (server);
+        race->volume = strdup (volume);
+        race->port   = port;
+        race->refs   = 1;
+        race->err    = -ENOTCONN;
+        if ((!race->server) || (!race->volume)) {
+                __bobjs_glfs_race_unref (race);
+                errno = -ENOMEM;
+                return NULL;
+        }
+
+        pthread_mutex_lock (&race->lock);
+        while (!race->fs) {
+                while ((race->running < BOBJS_GLFS_RACE) &&
+                       (first < nservers)) {
+                        attempt = calloc (1, sizeof(*attempt));
+                        if (!attempt) {
+                                race->err = -ENOMEM;
+                                break;
+                        }
+                        attempt->race  = race;
+                        attempt->first = first++;
+                        race->refs++;
+                        race->running++;
+                        if (pthread_create (&thread, NULL,
+                                            __bobjs_glfs_attempt_run,
+                                            attempt)) {
+                                race->refs--;
+                                race->running--;
+                                race->err = -EAGAIN;
+                                free (attempt);
+                                break;
+                        }
+                        pthread_detach (thread);
+                }
+                if (!race->running)
+                        break;
+                pthread_cond_wait (&race->cond, &race->lock);
+        }
+        fs  = race->fs;
+        err = race->err;
+        pthread_mutex_unlock (&race->lock);
+        __bobjs_glfs_race_unref (race);
+
+        if (!fs) {
+                errno = err;
+                return NULL;
+        }
+
+        *bsize = BOBJS_GLFS_BSIZE;
+        if ((glfs_statvfs (fs, "/", &buf) == 0) && (buf.f_bsize))
+                *bsize = buf.f_bsize;
+
+        return fs;
+}
+
+/* A cheap round trip to the bricks, fails once they are unreachable */
+static
+int32_t __bobjs_glfs_healthy (glfs_t *fs)
+{
+        struct statvfs buf;
+
+        return (glfs_statvfs (fs, "/", &buf) == 0);
+}
+
+/* Volumes nobody used for 'secs', callers hold glfs_lock */
+static
+bobjs_glfs_t *__bobjs_glfs_reap (time_t now, time_t secs)
+{
+        struct bobjs_glfs **pp   = &glfs_list;
+        bobjs_glfs_t      *vol   = NULL;
+        bobjs_glfs_t      *idle  = NULL;
+
+        while (*pp) {
+                vol = *pp;
+                if ((vol->refs) || (vol->connecting) ||
+                    (now - vol->used < secs)) {
+                        pp = &vol->next;
+                        continue;
+                }
+                *pp       = vol->next;
+                vol->dead = 1;
+                vol->next = idle;
+                idle      = vol;
+        }
+
+        return idle;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_glfs_get: initialized volume for (server, port, volume)
+
+  DESCRIPTION
+
+  Returns the cached volume when there is one, checking it first when
+  BOBJS_GLFS_CHECK went by or a user reported it failing.  A volume
+  failing the check is dropped and connected again, concurrent callers
+  for a volume being connected wait for it rather than connecting
+  themselves.
+
+  PARAMETERS:
+  @server - volfile servers, "host[:port][,host[:port]...]"
+  @port - volfile server port where none is given, 0 for the default
+  @volume - volume name
+
+  RETURN VALUES:
+  vol : Referenced volume, release with bobjs_glfs_put()
+  NULL : Failure, errno set appropriately
+*/
+
+bobjs_glfs_t *bobjs_glfs_get (const char *server, int32_t port,
+                              const char *volume)
+{
+        bobjs_glfs_t  *vol   = NULL;
+        bobjs_glfs_t  *idle  = NULL;
+        bobjs_glfs_t  *next  = NULL;
+        glfs_t        *fs    = NULL;
+        unsigned long bsize  = 0;
+        time_t        now    = time (NULL);
+        int32_t       check  = 0;
+        int32_t       err    = 0;
+
+        if ((!server) || (!volume)) {
+                errno = -EINVAL;
+                return NULL;
+        }
+
+        pthread_mutex_lock (&glfs_lock);
+        idle = __bobjs_glfs_reap (now, BOBJS_GLFS_IDLE);
+again:
+        for (vol = glfs_list; vol; vol = vol->next) {
+                if ((vol->port == port) && (!strcmp (vol->server, server)) &&
+                    (!strcmp (vol->volume, volume)))
+                        break;
+        }
+
+        if (vol) {
+                if (vol->connecting) {
+                        pthread_cond_wait (&glfs_cond, &glfs_lock);
+                        goto again;
+                }
+                vol->refs++;
+                check = ((vol->suspect) ||
+                         (now - vol->checked >= BOBJS_GLFS_CHECK));
+                if (check) {
+                        vol->checked = now;
+                        vol->suspect = 0;
+                }
+                pthread_mutex_unlock (&glfs_lock);
+
+                if ((!check) || (__bobjs_glfs_healthy (vol->fs)))
+                        goto out;
+
+                /* Broken, whoever still uses it lets go of it */
+                pthread_mutex_lock (&glfs_lock);
+                if (!vol->dead)
+                        __bobjs_glfs_unlink (vol);
+                if (--vol->refs == 0) {
+                        vol->next = idle;
+                        idle      = vol;
+                }
+                goto again;
+        }
+
+        vol = calloc (1, sizeof(*vol));
+        if (vol) {
+                vol->server = strdup (server);
+                vol->volume = strdup (volume);
+        }
+        if ((!vol) || (!vol->server) || (!vol->volume)) {
+                pthread_mutex_unlock (&glfs_lock);
+                if (vol) {
+                        free (vol->server);
+                        free (vol->volume);
+                        free (vol);
+                }
+                vol = NULL;
+                err = -ENOMEM;
+                goto out;
+        }
+        vol->port       = port;
+        vol->refs       = 1;
+        vol->connecting = 1;
+        vol->next       = glfs_list;
+        glfs_list       = vol;
+        pthread_mutex_unlock (&glfs_lock);
+
+        /* Slow, the volfile is fetched and the graph built */
+        fs  = __bobjs_glfs_connect (server, port, volume, &bsize);
+        err = errno;
+
+        pthread_mutex_lock (&glfs_lock);
+        vol->connecting = 0;
+        vol->fs         = fs;
+        vol->bsize      = bsize;
+        vol->checked    = time (NULL);
+        if (!fs)
+                __bobjs_glfs_unlink (vol);
+        pthread_cond_broadcast (&glfs_cond);
+        pthread_mutex_unlock (&glfs_lock);
+
+        if (!fs) {
+                __bobjs_glfs_free (vol);
+                vol = NULL;
+        }
+out:
+        for (; idle; idle = next) {
+                next = idle->next;
+                __bobjs_glfs_free (idle);
+        }
+
+        if (!vol)
+                errno = err;
+        return vol;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_glfs_put: drop a reference taken with bobjs_glfs_get()
+
+  PARAMETERS:
+  @vol - volume
+  @failed - the volume failed its user, it is checked before being
+            handed out again
+
+  RETURN VALUES:
+  None
+*/
+
+void bobjs_glfs_put (bobjs_glfs_t *vol, int32_t failed)
+{
+        int32_t last = 0;
+
+        if (!vol)
+                return;
+
+        pthread_mutex_lock (&glfs_lock);
+        if (failed)
+                vol->suspect = 1;
+        vol->used = time (NULL);
+        last = ((--vol->refs == 0) && (vol->dead));
+        pthread_mutex_unlock (&glfs_lock);
+
+        if (last)
+                __bobjs_glfs_free (vol);
+}
+
+/* Idle volumes go when the driver is unloaded */
+static __attribute__ ((destructor))
+void __bobjs_glfs_cleanup (void)
+{
+        bobjs_glfs_t *vol  = NULL;
+        bobjs_glfs_t *next = NULL;
+        bobjs_glfs_t *idle = NULL;
+
+        pthread_mutex_lock (&glfs_lock);
+        idle = __bobjs_glfs_reap (time (NULL), 0);
+        pthread_mutex_unlock (&glfs_lock);
+
+        for (vol = idle; vol; vol = next) {
+                next = vol->next;
+                __bobjs_glfs_free (vol);
+        }
+}
@@ -0,0 +1,70 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __GLUSTER_CACHE_H__
+#define __GLUSTER_CACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include <api/glfs.h>
+
+/* Seconds between health checks of a cached volume */
+#define BOBJS_GLFS_CHECK        10
+
+/* Seconds an unused volume stays connected */
+#define BOBJS_GLFS_IDLE         300
+
+/* Connection attempts, each from another volfile server, run at once */
+#define BOBJS_GLFS_RACE         2
+
+/* I/O size assumed when the volume does not tell */
+#define BOBJS_GLFS_BSIZE        (128 * 1024)
+
+struct bobjs_glfs;
+typedef struct bobjs_glfs bobjs_glfs_t;
+
+/*
+  One initialized volume, shared by every driver instance talking to
+  the same (server, port, volume).  'fs' never changes, a connection
+  found broken is dropped from the cache and the next lookup builds a
+  new one.
+*/
+
+struct bobjs_glfs {
+        char            *server;
+        int32_t         port;
+        char            *volume;
+        glfs_t          *fs;
+        unsigned long   bsize;          /* preferred I/O size */
+
+        int32_t         refs;
+        int32_t         connecting;     /* glfs_init() in progress */
+        int32_t         suspect;        /* a user saw it fail */
+        int32_t         dead;           /* out of the cache */
+        time_t          checked;        /* last health check */
+        time_t          used;           /* last reference dropped */
+        struct bobjs_glfs *next;
+};
+
+bobjs_glfs_t *bobjs_glfs_get (const char *server, int32_t port,
+                              const char *volume);
+void bobjs_glfs_put (bobjs_glfs_t *vol, int32_t failed);
+int32_t bobjs_glfs_server (const char *list, int32_t n, char *host,
+                           size_t size, int32_t *port);
+
+#endif /* __GLUSTER_CACHE_H__ */
@@ -0,0 +1,1190 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Objects as a directory of fixed size chunk files named by index.
+  DHT places each name on its own, the chunks of one object spread
+  over every brick of the volume and are moved by several threads at
+  once.  The manifest is written last, a directory without one is an
+  object never completed.  It lives in an xattr of the directory when
+  the volume allows, a file in the directory otherwise.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "gluster-priv.h"
+
+/* One put, get or copy, chunks handed out to the workers by index */
+struct bobjs_gluster_chunks {
+        pthread_mutex_t lock;
+        bobjs_gluster_t *priv;
+        const char      *dir;
+        bobjs_gluster_t *src;           /* copy source volume */
+        const char      *from;          /* copy source object */
+        int32_t         plain;          /* source is a plain file */
+        int32_t         fd;
+        off_t           base;           /* offset of the object in 'fd' */
+        int32_t         sparse;         /* zero blocks may be skipped */
+        uint64_t        size;
+        uint64_t        chunk;
+        uint64_t        nchunks;
+        uint64_t        next;
+        int32_t         err;
+        int32_t         (*io) (struct bobjs_gluster_chunks *chunks,
+                               uint64_t idx);
+};
+
+static
+char *__bobjs_gluster_chunk_path (const char *dir, const char *name)
+{
+        size_t len  = strlen (dir) + strlen (name) + 2;
+        char   *path = malloc (len);
+
+        if (!path) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+        snprintf (path, len, "%s/%s", dir, name);
+        return path;
+}
+
+static
+char *__bobjs_gluster_chunk_name (const char *dir, uint64_t idx)
+{
+        char name[32];
+
+        snprintf (name, sizeof(name), "%010" PRIu64, idx);
+        return __bobjs_gluster_chunk_path (dir, name);
+}
+
+/* An empty last chunk, streams only know their end once there */
+static
+void __bobjs_gluster_chunk_unlink (bobjs_gluster_t *priv, const char *dir,
+                                   uint64_t idx)
+{
+        char *path = __bobjs_gluster_chunk_name (dir, idx);
+
+        if (path)
+                glfs_unlink (priv->vol->fs, path);
+        free (path);
+}
+
+static
+uint64_t __bobjs_gluster_chunk_len (struct bobjs_gluster_chunks *chunks,
+                                    uint64_t idx)
+{
+        uint64_t off = idx * chunks->chunk;
+
+        return ((chunks->size - off) < chunks->chunk) ?
+                (chunks->size - off) : chunks->chunk;
+}
+
+/* Where the data of a chunk comes from */
+struct bobjs_gluster_from {
+        int32_t         fd;             /* local file, 'in' NULL */
+        glfs_fd_t       *in;            /* file of the cluster */
+        int32_t         range;          /* 'in' on the volume written */
+        off_t           off;            /* negative reads 'fd' as it is */
+};
+
+#ifdef HAVE_GLFS_COPY_FILE_RANGE
+/*
+  Copy inside the volume, the bricks move the data.  Returns 1 when
+  the volume cannot, before anything was copied.
+*/
+static
+int32_t __bobjs_gluster_chunk_range (bobjs_gluster_t *priv, glfs_fd_t *in,
+                                     off_t src, glfs_fd_t *out, off_t limit,
+                                     off_t *copied)
+{
+        off64_t ioff = src;
+        off64_t ooff = 0;
+        ssize_t ret  = 0;
+
+        while (ooff < limit) {
+                ret = glfs_copy_file_range (in, &ioff, out, &ooff,
+                                            limit - ooff, 0, NULL, NULL,
+                                            NULL);
+                if ((ret < 0) && (ooff == 0) &&
+                    ((errno == ENOSYS) || (errno == EXDEV) ||
+                     (errno == EOPNOTSUPP) || (errno == EINVAL)))
+                        return 1;
+                if (ret < 0) {
+                        bobjs_gluster_errno (priv);
+                        return -1;
+                }
+                if (ret == 0)
+                        break;
+        }
+
+        *copied = ooff;
+        return 0;
+}
+#endif /* HAVE_GLFS_COPY_FILE_RANGE */
+
+/*
+  Write chunk 'idx' from 'from', at most 'limit' bytes.  'copied' says
+  how much there was.  A chunk of known size is preallocated whole, it
+  grows in one extent rather than block by block.
+*/
+static
+int32_t __bobjs_gluster_chunk_write (bobjs_gluster_t *priv, const char *dir,
+                                     uint64_t idx,
+                                     const struct bobjs_gluster_from *from,
+                                     off_t limit, off_t *copied)
+{
+        bobjs_gluster_pipe_t pipe;
+        glfs_fd_t            *glfd  = NULL;
+        char                 *path  = NULL;
+        int32_t              ret    = -1;
+        int32_t              err    = 0;
+
+        path = __bobjs_gluster_chunk_name (dir, idx);
+        if (!path)
+                return -1;
+
+        glfd = glfs_creat (priv->vol->fs, path, O_WRONLY|O_TRUNC, 0644);
+        if (!glfd) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+
+#ifdef HAVE_GLFS_COPY_FILE_RANGE
+        ret = 1;
+        if (from->range)
+                ret = __bobjs_gluster_chunk_range (priv, from->in, from->off,
+                                                   glfd, limit, copied);
+        if (ret < 0)
+                goto out;
+        if (ret == 0)
+                goto sync;
+#endif /* HAVE_GLFS_COPY_FILE_RANGE */
+
+        ret = -1;
+        if (bobjs_gluster_pipe_init (&pipe, priv, glfd) < 0)
+                goto out;
+        pipe.in       = from->in;
+        pipe.sparse   = priv->sparse;
+        pipe.prealloc = ((from->off >= 0) && (limit > 0) &&
+                         (glfs_fallocate (glfd, 0, 0, limit) == 0));
+        ret = bobjs_gluster_pipe_write (&pipe, from->fd, from->off, limit,
+                                        copied);
+        bobjs_gluster_pipe_fini (&pipe);
+        if (ret < 0)
+                goto out;
+#ifdef HAVE_GLFS_COPY_FILE_RANGE
+sync:
+#endif
+
+        ret = -1;
+        if (bobjs_glfs_fsync (glfd) < 0) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+        ret = 0;
+out:
+        if (glfd) {
+                err = errno;
+                if ((glfs_close (glfd) < 0) && (ret == 0)) {
+                        bobjs_gluster_errno (priv);
+                        ret = -1;
+                } else {
+                        errno = err;
+                }
+        }
+        free (path);
+        return ret;
+}
+
+static
+int32_t __bobjs_gluster_chunk_put (struct bobjs_gluster_chunks *chunks,
+                                   uint64_t idx)
+{
+        struct bobjs_gluster_from from;
+        off_t                     len    = __bobjs_gluster_chunk_len (chunks,
+                                                                      idx);
+        off_t                     copied = 0;
+
+        memset (&from, 0, sizeof(from));
+        from.fd  = chunks->fd;
+        from.off = chunks->base + idx * chunks->chunk;
+
+        if (__bobjs_gluster_chunk_write (chunks->priv, chunks->dir, idx,
+                                         &from, len, &copied) < 0)
+                return -1;
+
+        /* Input truncated under us */
+        if (copied != len) {
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Chunk 'idx' to its place in 'fd', or to where 'fd' is when 'dst' < 0 */
+static
+int32_t __bobjs_gluster_chunk_read (struct bobjs_gluster_chunks *chunks,
+                                    uint64_t idx, off_t dst)
+{
+        bobjs_gluster_pipe_t pipe;
+        bobjs_gluster_t      *priv  = chunks->priv;
+        glfs_fd_t            *glfd  = NULL;
+        char                 *path  = NULL;
+        struct stat          st;
+        off_t                len    = __bobjs_gluster_chunk_len (chunks, idx);
+        int32_t              ret    = -1;
+        int32_t              err    = 0;
+
+        path = __bobjs_gluster_chunk_name (chunks->dir, idx);
+        if (!path)
+                return -1;
+
+        glfd = glfs_open (priv->vol->fs, path, O_RDONLY);
+        if ((!glfd) || (glfs_fstat (glfd, &st) < 0)) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+
+        /* Does not match the manifest */
+        if (st.st_size != len) {
+                errno = -EIO;
+                goto out;
+        }
+
+        if (bobjs_gluster_pipe_init (&pipe, priv, glfd) < 0)
+                goto out;
+        pipe.sparse = chunks->sparse;
+        ret = bobjs_gluster_pipe_read (&pipe, chunks->fd, dst, len);
+        bobjs_gluster_pipe_fini (&pipe);
+out:
+        err = errno;
+        if (glfd)
+                glfs_close (glfd);
+        errno = err;
+        free (path);
+        return ret;
+}
+
+static
+int32_t __bobjs_gluster_chunk_get (struct bobjs_gluster_chunks *chunks,
+                                   uint64_t idx)
+{
+        return __bobjs_gluster_chunk_read (chunks, idx, chunks->base +
+                                           idx * chunks->chunk);
+}
+
+static
+void *__bobjs_gluster_chunk_worker (void *arg)
+{
+        struct bobjs_gluster_chunks *chunks = arg;
+        uint64_t                    idx     = 0;
+
+        for (;;) {
+                pthread_mutex_lock (&chunks->lock);
+                if ((chunks->err) || (chunks->next >= chunks->nchunks)) {
+                        pthread_mutex_unlock (&chunks->lock);
+                        break;
+                }
+                idx = chunks->next++;
+                pthread_mutex_unlock (&chunks->lock);
+
+                if (chunks->io (chunks, idx) < 0) {
+                        pthread_mutex_lock (&chunks->lock);
+                        if (!chunks->err)
+                                chunks->err = errno;
+                        pthread_mutex_unlock (&chunks->lock);
+                        break;
+                }
+        }
+
+        return NULL;
+}
+
+/* priv->threads chunks at a time, in this thread when none can start */
+static
+int32_t __bobjs_gluster_chunk_run (struct bobjs_gluster_chunks *chunks)
+{
+        pthread_t threads[BOBJS_GLUSTER_THREADS_MAX];
+        int32_t   nthreads = 0;
+        int32_t   i        = 0;
+
+        pthread_mutex_init (&chunks->lock, NULL);
+        for (i = 0; (i < chunks->priv->threads) &&
+                     ((uint64_t) i < chunks->nchunks); i++) {
+                if (pthread_create (&threads[nthreads], NULL,
+                                    __bobjs_gluster_chunk_worker, chunks))
+                        break;
+                nthreads++;
+        }
+        if (!nthreads)
+                __bobjs_gluster_chunk_worker (chunks);
+        for (i = 0; i < nthreads; i++)
+                pthread_join (threads[i], NULL);
+        pthread_mutex_destroy (&chunks->lock);
+
+        if (chunks->err) {
+                errno = chunks->err;
+                return -1;
+        }
+
+        return 0;
+}
+
+/* The volume or the attribute cannot hold it, the manifest file can */
+static
+int32_t __bobjs_gluster_xattr_unfit (int32_t err)
+{
+        return ((err == ENOTSUP) || (err == E2BIG) || (err == ERANGE) ||
+                (err == ENOSPC));
+}
+
+static
+int32_t __bobjs_gluster_manifest_file (bobjs_gluster_t *priv,
+                                       const char *dir, const char *buf,
+                                       ssize_t len)
+{
+        glfs_fd_t *glfd  = NULL;
+        char      *path  = NULL;
+        int32_t   ret    = -1;
+        int32_t   err    = 0;
+
+        path = __bobjs_gluster_chunk_path (dir, BOBJS_GLUSTER_MANIFEST);
+        if (!path)
+                return -1;
+
+        glfd = glfs_creat (priv->vol->fs, path, O_WRONLY|O_TRUNC, 0644);
+        if ((!glfd) || (glfs_write (glfd, buf, len, 0) != len) ||
+            (bobjs_glfs_fsync (glfd) < 0)) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+        ret = 0;
+out:
+        if (glfd) {
+                err = errno;
+                if ((glfs_close (glfd) < 0) && (ret == 0)) {
+                        bobjs_gluster_errno (priv);
+                        ret = -1;
+                } else {
+                        errno = err;
+                }
+        }
+        free (path);
+        return ret;
+}
+
+/*
+  The manifest goes in an xattr of the directory, read back with the
+  same lookup that finds the object.  A file in the directory holds it
+  when the volume refuses the xattr, whatever the reason it gives:
+  bricks limit xattrs differently and only the setxattr can tell.
+*/
+static
+int32_t __bobjs_gluster_manifest_write (bobjs_gluster_t *priv,
+                                        const char *dir, uint64_t size,
+                                        uint64_t chunk, uint64_t nchunks)
+{
+        char    buf[BOBJS_GLUSTER_MANIFEST_MAX];
+        ssize_t len = 0;
+
+        len = snprintf (buf, sizeof(buf), "bigobjects %d\nsize %" PRIu64
+                        "\nchunk %" PRIu64 "\nchunks %" PRIu64 "\n",
+                        BOBJS_GLUSTER_LAYOUT, size, chunk, nchunks);
+
+        if (glfs_setxattr (priv->vol->fs, dir, BOBJS_GLUSTER_XATTR, buf,
+                           len, 0) == 0)
+                return 0;
+        if (!__bobjs_gluster_xattr_unfit (errno)) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        return __bobjs_gluster_manifest_file (priv, dir, buf, len);
+}
+
+static
+int32_t __bobjs_gluster_manifest_read (bobjs_gluster_t *priv,
+                                       struct bobjs_gluster_chunks *chunks)
+{
+        glfs_fd_t *glfd    = NULL;
+        char      *path    = NULL;
+        char      buf[BOBJS_GLUSTER_MANIFEST_MAX];
+        ssize_t   len      = 0;
+        int32_t   layout   = 0;
+        int32_t   ret      = -1;
+
+        len = glfs_getxattr (priv->vol->fs, chunks->dir, BOBJS_GLUSTER_XATTR,
+                             buf, sizeof(buf) - 1);
+        if (len >= 0)
+                goto parse;
+        /* Only a missing xattr sends to the file, one that does not fit
+           the buffer (ERANGE) is no manifest this driver wrote */
+        if ((errno != ENODATA) && (errno != ENOTSUP)) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        path = __bobjs_gluster_chunk_path (chunks->dir,
+                                           BOBJS_GLUSTER_MANIFEST);
+        if (!path)
+                return -1;
+
+        glfd = glfs_open (priv->vol->fs, path, O_RDONLY);
+        if (!glfd) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+
+        len = glfs_read (glfd, buf, sizeof(buf) - 1, 0);
+        if (len < 0) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+parse:
+        buf[len] = '\0';
+
+        if ((sscanf (buf, "bigobjects %d\nsize %" SCNu64 "\nchunk %" SCNu64
+                     "\nchunks %" SCNu64, &layout, &chunks->size,
+                     &chunks->chunk, &chunks->nchunks) != 4) ||
+            (layout != BOBJS_GLUSTER_LAYOUT) || (!chunks->chunk) ||
+            (chunks->nchunks != (chunks->size + chunks->chunk - 1) /
+             chunks->chunk)) {
+                errno = -EIO;
+                goto out;
+        }
+        ret = 0;
+out:
+        if (glfd)
+                glfs_close (glfd);
+        free (path);
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_delete: remove a chunked object's directory
+
+  DESCRIPTION
+
+  The manifest goes first, what is left after a failure reads as an
+  incomplete object rather than a corrupt one.  The chunks are
+  unlinked in parallel, see bobjs_gluster_walk_delete().
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_chunk_delete (bobjs_gluster_t *priv, const char *dir)
+{
+        char *path = NULL;
+
+        if ((glfs_removexattr (priv->vol->fs, dir, BOBJS_GLUSTER_XATTR) < 0) &&
+            (errno != ENODATA) && (errno != ENOTSUP)) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        path = __bobjs_gluster_chunk_path (dir, BOBJS_GLUSTER_MANIFEST);
+        if (!path)
+                return -1;
+        if ((glfs_unlink (priv->vol->fs, path) < 0) && (errno != ENOENT)) {
+                bobjs_gluster_errno (priv);
+                free (path);
+                return -1;
+        }
+        free (path);
+
+        return bobjs_gluster_walk_delete (priv, dir);
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_size: size of chunked object 'dir'
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately, -ENOENT when 'dir' has no
+       manifest
+*/
+
+int32_t bobjs_gluster_chunk_size (bobjs_gluster_t *priv, const char *dir,
+                                  uint64_t *size)
+{
+        struct bobjs_gluster_chunks chunks;
+
+        memset (&chunks, 0, sizeof(chunks));
+        chunks.dir = dir;
+
+        if (__bobjs_gluster_manifest_read (priv, &chunks) < 0)
+                return -1;
+
+        *size = chunks.size;
+        return 0;
+}
+
+/* Whatever 'path' is, object directory or plain file */
+static
+int32_t __bobjs_gluster_remove (bobjs_gluster_t *priv, const char *path)
+{
+        struct stat st;
+
+        if (glfs_lstat (priv->vol->fs, path, &st) < 0) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        if (S_ISDIR (st.st_mode))
+                return bobjs_gluster_chunk_delete (priv, path);
+
+        if (glfs_unlink (priv->vol->fs, path) < 0) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Names handed out by this process, see __bobjs_gluster_chunk_aside() */
+static uint32_t bobjs_gluster_chunk_seq = 0;
+
+/*
+  A name next to 'object' no other call uses.  The pid tells processes
+  apart, the thread and a counter the calls within one, a name taken
+  anyway is one a crashed process with the same pid left behind.
+*/
+static
+char *__bobjs_gluster_chunk_aside (const char *object, const char *suffix)
+{
+        size_t len   = strlen (object) + strlen (suffix) + 64;
+        char   *path = malloc (len);
+
+        if (!path) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+        snprintf (path, len, "%s.%ld.%lx.%" PRIu32 "%s", object,
+                  (long) getpid (), (unsigned long) pthread_self (),
+                  __atomic_fetch_add (&bobjs_gluster_chunk_seq, 1,
+                                      __ATOMIC_RELAXED), suffix);
+        return path;
+}
+
+/* Skip 'set' characters back from 'end', at least one, to a '.' */
+static
+const char *__bobjs_gluster_chunk_field (const char *start, const char *end,
+                                         const char *set)
+{
+        const char *p = end;
+
+        while ((p > start) && (strchr (set, p[-1])))
+                p--;
+        if ((p == end) || (p == start) || (p[-1] != '.'))
+                return NULL;
+
+        return p - 1;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_owner: object 'aside' was moved aside from
+
+  DESCRIPTION
+
+  Names made by __bobjs_gluster_chunk_aside() for ".bobjs-old" end in
+  pid, thread and counter, anything else is not taken for one.
+
+  RETURN VALUES:
+  object path, to be freed, NULL when 'aside' is no such name
+*/
+
+char *bobjs_gluster_chunk_owner (const char *aside)
+{
+        static const char suffix[] = ".bobjs-old";
+        const char        *end     = NULL;
+        size_t            len      = strlen (aside);
+        char              *object  = NULL;
+
+        if (len <= sizeof(suffix) - 1)
+                return NULL;
+        end = aside + len - (sizeof(suffix) - 1);
+        if (strcmp (end, suffix))
+                return NULL;
+
+        end = __bobjs_gluster_chunk_field (aside, end, "0123456789");
+        if (end)
+                end = __bobjs_gluster_chunk_field (aside, end,
+                                                   "0123456789abcdef");
+        if (end)
+                end = __bobjs_gluster_chunk_field (aside, end, "0123456789");
+        if ((!end) || (end[-1] == '/'))
+                return NULL;
+
+        object = strndup (aside, end - aside);
+        if (!object)
+                errno = -ENOMEM;
+        return object;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_recover: put back an object left moved aside
+
+  DESCRIPTION
+
+  __bobjs_gluster_chunk_swap() moves the object in place aside before
+  renaming the new one in, between the two 'object' is missing.  A
+  process dying there leaves the object only under its aside name.
+  Called once 'object' was found missing, any one aside copy of it is
+  renamed back.  A swap still running finds its copy gone and moves
+  the object aside again, see there.
+
+  PARAMETERS:
+  @priv - instance, priv->vol is searched
+  @object - object found missing
+
+  RETURN VALUES:
+   0 : Success, 'object' is there again
+  -1 : Failure, errno set appropriately, -ENOENT when nothing was aside
+*/
+
+int32_t bobjs_gluster_chunk_recover (bobjs_gluster_t *priv,
+                                     const char *object)
+{
+        struct stat   st;
+        struct dirent entry;
+        struct dirent *result = NULL;
+        glfs_fd_t     *glfd   = NULL;
+        const char    *slash  = strrchr (object, '/');
+        size_t        dlen    = (slash) ? (size_t) (slash - object) + 1 : 0;
+        size_t        blen    = strlen (object + dlen);
+        char          *aside  = NULL;
+        char          *owner  = NULL;
+        int32_t       ret     = -1;
+
+        aside = malloc (dlen + NAME_MAX + 1);
+        if (!aside) {
+                errno = -ENOMEM;
+                return -1;
+        }
+        memcpy (aside, object, dlen);
+        aside[dlen] = '\0';
+
+        glfd = glfs_opendir (priv->vol->fs, (dlen) ? aside : "/");
+        if (!glfd) {
+                bobjs_gluster_errno (priv);
+                goto out;
+        }
+
+        for (;;) {
+                if (glfs_readdir_r (glfd, &entry, &result)) {
+                        bobjs_gluster_errno (priv);
+                        goto out;
+                }
+                if (!result)
+                        break;
+                if ((strncmp (entry.d_name, object + dlen, blen)) ||
+                    (entry.d_name[blen] != '.'))
+                        continue;
+
+                snprintf (aside + dlen, NAME_MAX + 1, "%s", entry.d_name);
+                owner = bobjs_gluster_chunk_owner (aside);
+                if ((!owner) || (strcmp (owner, object))) {
+                        free (owner);
+                        continue;
+                }
+                free (owner);
+
+                /* Taken by now, put back by someone else or replaced */
+                if ((glfs_rename (priv->vol->fs, aside, object) == 0) ||
+                    (errno == EEXIST) || (errno == ENOTEMPTY)) {
+                        ret = 0;
+                        goto out;
+                }
+                if (errno != ENOENT) {
+                        bobjs_gluster_errno (priv);
+                        goto out;
+                }
+        }
+
+        /* The swap was done before we looked */
+        if (glfs_lstat (priv->vol->fs, object, &st) == 0) {
+                ret = 0;
+                goto out;
+        }
+        errno = -ENOENT;
+out:
+        if (glfd)
+                glfs_closedir (glfd);
+        free (aside);
+        return ret;
+}
+
+/*
+  Move what is at 'object' aside, under a name of its own.  NULL with
+  -ENOENT when nothing is there anymore.
+*/
+static
+char *__bobjs_gluster_chunk_away (bobjs_gluster_t *priv, const char *object)
+{
+        char    *old   = NULL;
+        int32_t tries  = 0;
+
+        for (;;) {
+                old = __bobjs_gluster_chunk_aside (object, ".bobjs-old");
+                if (!old)
+                        return NULL;
+                if (glfs_rename (priv->vol->fs, object, old) == 0)
+                        return old;
+                free (old);
+
+                /* Never over a directory of someone else, a taken name
+                   is skipped */
+                if (((errno != EEXIST) && (errno != ENOTEMPTY)) ||
+                    (++tries >= BOBJS_GLUSTER_ASIDE_TRIES)) {
+                        bobjs_gluster_errno (priv);
+                        return NULL;
+                }
+        }
+}
+
+/*
+  Move the finished 'tmp' in place of 'object'.  A directory cannot be
+  renamed over a non empty one, an object already there is moved aside
+  first and removed once the new one is in.  Between the two renames
+  'object' is missing, a reader coming then puts the aside copy back
+  and the rename of 'tmp' finds the name taken: what is there is moved
+  aside again.  So is an object another put swapped in meanwhile, the
+  last put wins.
+*/
+static
+int32_t __bobjs_gluster_chunk_swap (bobjs_gluster_t *priv, const char *tmp,
+                                    const char *object)
+{
+        struct stat st;
+        char        *old   = NULL;
+        int32_t     swaps  = 0;
+        int32_t     err    = 0;
+
+        for (swaps = 0; swaps < BOBJS_GLUSTER_ASIDE_TRIES; swaps++) {
+                if (glfs_lstat (priv->vol->fs, object, &st) == 0) {
+                        old = __bobjs_gluster_chunk_away (priv, object);
+                        if ((!old) && (errno != -ENOENT))
+                                return -1;
+                } else if (errno != ENOENT) {
+                        bobjs_gluster_errno (priv);
+                        return -1;
+                } else if (bobjs_gluster_chunk_recover (priv, object) == 0) {
+                        /* Left aside by a swap that died, replaced now */
+                        continue;
+                } else if (errno != -ENOENT) {
+                        return -1;
+                }
+
+                if (glfs_rename (priv->vol->fs, tmp, object) == 0) {
+                        /* The new object is in, a leftover old one is only
+                           wasted space */
+                        if (old)
+                                __bobjs_gluster_remove (priv, old);
+                        free (old);
+                        return 0;
+                }
+
+                err = errno;
+                if ((err != EEXIST) && (err != ENOTEMPTY)) {
+                        if (old)
+                                glfs_rename (priv->vol->fs, old, object);
+                        free (old);
+                        errno = err;
+                        bobjs_gluster_errno (priv);
+                        return -1;
+                }
+
+                /* Taken again: 'old' put back by a reader, or superseded */
+                if (old)
+                        __bobjs_gluster_remove (priv, old);
+                free (old);
+                old = NULL;
+        }
+
+        errno = -EBUSY;
+        return -1;
+}
+
+/*
+  Empty directory next to 'object' for its new chunks.  Made by this
+  call alone, what is in the way under the same name is left alone.
+*/
+static
+char *__bobjs_gluster_chunk_tmp (bobjs_gluster_t *priv, const char *object)
+{
+        char    *tmp    = NULL;
+        int32_t tries   = 0;
+        int32_t parents = 0;
+        int32_t err     = 0;
+
+        for (;;) {
+                tmp = __bobjs_gluster_chunk_aside (object, ".bobjs-tmp");
+                if (!tmp)
+                        return NULL;
+                if (glfs_mkdir (priv->vol->fs, tmp, 0755) == 0)
+                        return tmp;
+                err = errno;
+                free (tmp);
+
+                if ((err == ENOENT) && (!parents)) {
+                        parents = 1;
+                        if (bobjs_gluster_mkdirs (priv, object) < 0)
+                                return NULL;
+                        continue;
+                }
+                if ((err != EEXIST) ||
+                    (++tries >= BOBJS_GLUSTER_ASIDE_TRIES)) {
+                        errno = err;
+                        bobjs_gluster_errno (priv);
+                        return NULL;
+                }
+        }
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_put: store what 'fd' holds as chunked 'object'
+
+  DESCRIPTION
+
+  Chunks are written to a temporary directory next to the object,
+  priv->threads of them at once when 'fd' is a regular file, one after
+  the other as 'fd' is read otherwise.  Each chunk is synced, the
+  manifest follows and the directory takes the place of the object.
+
+  PARAMETERS:
+  @priv - driver instance
+  @object - object name
+  @fd - data, read from its current offset
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_chunk_put (bobjs_gluster_t *priv, const char *object,
+                                 int32_t fd)
+{
+        struct bobjs_gluster_chunks chunks;
+        struct bobjs_gluster_from   from;
+        struct stat                 st;
+        char                        *tmp    = NULL;
+        off_t                       copied  = 0;
+        int32_t                     ret     = -1;
+        int32_t                     err     = 0;
+
+        memset (&chunks, 0, sizeof(chunks));
+        chunks.priv  = priv;
+        chunks.fd    = fd;
+        chunks.chunk = priv->chunk;
+        chunks.io    = __bobjs_gluster_chunk_put;
+
+        if (fstat (fd, &st) < 0) {
+                errno = -errno;
+                return -1;
+        }
+
+        tmp = __bobjs_gluster_chunk_tmp (priv, object);
+        if (!tmp)
+                return -1;
+        chunks.dir = tmp;
+
+        chunks.base = S_ISREG (st.st_mode) ? lseek (fd, 0, SEEK_CUR) : -1;
+        if (chunks.base >= 0) {
+                chunks.size    = (st.st_size > chunks.base) ?
+                        (uint64_t) (st.st_size - chunks.base) : 0;
+                chunks.nchunks = (chunks.size + chunks.chunk - 1) /
+                        chunks.chunk;
+                if (__bobjs_gluster_chunk_run (&chunks) < 0)
+                        goto unlink;
+                lseek (fd, chunks.base + chunks.size, SEEK_SET);
+        } else {
+                memset (&from, 0, sizeof(from));
+                from.fd  = fd;
+                from.off = -1;
+                for (;;) {
+                        if (__bobjs_gluster_chunk_write (priv, tmp,
+                                                         chunks.nchunks,
+                                                         &from, chunks.chunk,
+                                                         &copied) < 0)
+                                goto unlink;
+                        if (!copied) {
+                                __bobjs_gluster_chunk_unlink (priv, tmp,
+                                                              chunks.nchunks);
+                                break;
+                        }
+                        chunks.size += copied;
+                        chunks.nchunks++;
+                        if ((uint64_t) copied < chunks.chunk)
+                                break;
+                }
+        }
+
+        if (__bobjs_gluster_manifest_write (priv, tmp, chunks.size,
+                                            chunks.chunk,
+                                            chunks.nchunks) < 0)
+                goto unlink;
+
+        if (__bobjs_gluster_chunk_swap (priv, tmp, object) < 0)
+                goto unlink;
+
+        ret = 0;
+        goto out;
+unlink:
+        err = errno;
+        __bobjs_gluster_remove (priv, tmp);
+        errno = err;
+out:
+        free (tmp);
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_get: write chunked object 'dir' into 'fd'
+
+  DESCRIPTION
+
+  The manifest says how many chunks to expect and how large, each
+  chunk is checked against it.  A regular file 'fd' gets
+  priv->threads chunks at once, each at its place, anything else
+  gets them in order.  Written past the end of a regular file the
+  object comes out sparse, blocks of zeros are not written.
+
+  PARAMETERS:
+  @priv - driver instance
+  @dir - object directory
+  @fd - output, written from its current offset
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_chunk_get (bobjs_gluster_t *priv, const char *dir,
+                                 int32_t fd)
+{
+        struct bobjs_gluster_chunks chunks;
+        struct stat                 st;
+        uint64_t                    idx  = 0;
+
+        memset (&chunks, 0, sizeof(chunks));
+        chunks.priv = priv;
+        chunks.dir  = dir;
+        chunks.fd   = fd;
+        chunks.io   = __bobjs_gluster_chunk_get;
+
+        if (fstat (fd, &st) < 0) {
+                errno = -errno;
+                return -1;
+        }
+
+        if (__bobjs_gluster_manifest_read (priv, &chunks) < 0)
+                return -1;
+
+        chunks.base = S_ISREG (st.st_mode) ? lseek (fd, 0, SEEK_CUR) : -1;
+        if (chunks.base < 0) {
+                for (idx = 0; idx < chunks.nchunks; idx++) {
+                        if (__bobjs_gluster_chunk_read (&chunks, idx, -1) < 0)
+                                return -1;
+                }
+                return 0;
+        }
+
+        /* Nothing there yet, what is not written reads as zeros */
+        chunks.sparse = ((priv->sparse) && (chunks.base >= st.st_size));
+
+        if (__bobjs_gluster_chunk_run (&chunks) < 0)
+                return -1;
+
+        if ((chunks.sparse) &&
+            (ftruncate (fd, chunks.base + chunks.size) < 0)) {
+                errno = -errno;
+                return -1;
+        }
+        lseek (fd, chunks.base + chunks.size, SEEK_SET);
+
+        return 0;
+}
+
+static
+int32_t __bobjs_gluster_chunk_copy (struct bobjs_gluster_chunks *chunks,
+                                    uint64_t idx)
+{
+        struct bobjs_gluster_from from;
+        bobjs_gluster_t           *src    = chunks->src;
+        char                      *path   = NULL;
+        struct stat               st;
+        off_t                     len     = __bobjs_gluster_chunk_len (chunks,
+                                                                       idx);
+        off_t                     copied  = 0;
+        int32_t                   ret     = -1;
+
+        memset (&from, 0, sizeof(from));
+        from.fd    = -1;
+        from.range = (src->vol == chunks->priv->vol);
+        from.off   = chunks->plain ? (off_t) (idx * chunks->chunk) : 0;
+
+        path = chunks->plain ? strdup (chunks->from) :
+                __bobjs_gluster_chunk_name (chunks->from, idx);
+        if (!path) {
+                errno = -ENOMEM;
+                return -1;
+        }
+
+        from.in = glfs_open (src->vol->fs, path, O_RDONLY);
+        if ((!from.in) || (glfs_fstat (from.in, &st) < 0)) {
+                bobjs_gluster_errno (src);
+                goto out;
+        }
+
+        /* Does not match the manifest */
+        if ((!chunks->plain) && (st.st_size != len)) {
+                errno = -EIO;
+                goto out;
+        }
+
+        if (__bobjs_gluster_chunk_write (chunks->priv, chunks->dir, idx,
+                                         &from, len, &copied) < 0)
+                goto out;
+
+        /* Source truncated under us */
+        if (copied != len) {
+                errno = -EIO;
+                goto out;
+        }
+        ret = 0;
+out:
+        if (from.in)
+                glfs_close (from.in);
+        free (path);
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_chunk_copy: copy 'object' to 'target' inside the cluster
+
+  DESCRIPTION
+
+  The target is built as a chunked object like bobjs_gluster_chunk_put()
+  does, priv->threads chunks at a time.  A chunked source keeps its
+  chunk size, a plain file is cut in dst->chunk pieces.  Within one
+  volume each chunk is a glfs_copy_file_range() the bricks carry out
+  where gfapi has it (HAVE_GLFS_COPY_FILE_RANGE).  Across volumes, or
+  where the volume cannot, the data goes through the async pipeline
+  over the handles the cache already holds, it never touches local
+  disk.
+
+  PARAMETERS:
+  @src - instance, src->vol holds 'object'
+  @object - source object
+  @dst - instance, dst->vol is where 'target' goes
+  @target - target object
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_chunk_copy (bobjs_gluster_t *src, const char *object,
+                                  bobjs_gluster_t *dst, const char *target)
+{
+        struct bobjs_gluster_chunks chunks;
+        struct stat                 st;
+        char                        *tmp    = NULL;
+        int32_t                     ret     = -1;
+        int32_t                     err     = 0;
+
+        memset (&chunks, 0, sizeof(chunks));
+        chunks.priv = src;
+        chunks.dir  = object;
+        chunks.src  = src;
+        chunks.from = object;
+        chunks.io   = __bobjs_gluster_chunk_copy;
+
+        if ((glfs_stat (src->vol->fs, object, &st) < 0) &&
+            ((errno != ENOENT) ||
+             (bobjs_gluster_chunk_recover (src, object) < 0) ||
+             (glfs_stat (src->vol->fs, object, &st) < 0))) {
+                if (errno > 0)
+                        bobjs_gluster_errno (src);
+                return -1;
+        }
+
+        if (S_ISDIR (st.st_mode)) {
+                if (__bobjs_gluster_manifest_read (src, &chunks) < 0)
+                        return -1;
+        } else {
+                chunks.plain   = 1;
+                chunks.size    = st.st_size;
+                chunks.chunk   = dst->chunk;
+                chunks.nchunks = (chunks.size + chunks.chunk - 1) /
+                        chunks.chunk;
+        }
+
+        tmp = __bobjs_gluster_chunk_tmp (dst, target);
+        if (!tmp)
+                return -1;
+        chunks.priv = dst;
+        chunks.dir  = tmp;
+
+        if (__bobjs_gluster_chunk_run (&chunks) < 0)
+                goto unlink;
+
+        if (__bobjs_gluster_manifest_write (dst, tmp, chunks.size,
+                                            chunks.chunk,
+                                            chunks.nchunks) < 0)
+                goto unlink;
+
+        if (__bobjs_gluster_chunk_swap (dst, tmp, target) < 0)
+                goto unlink;
+
+        ret = 0;
+        goto out;
+unlink:
+        err = errno;
+        __bobjs_gluster_remove (dst, tmp);
+        errno = err;
+out:
+        free (tmp);
+        return ret;
+}
@@ -0,0 +1,492 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Blocks of a file moving through gfapi's async calls, several in
+  flight so that one thread keeps every brick busy.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "gluster-priv.h"
+
+/*
+  Fill 'buf' from 'fd' at 'off', or from where 'fd' is when 'off' is
+  negative.  Short only at the end of the input.
+*/
+static
+ssize_t __bobjs_gluster_fill (int32_t fd, char *buf, size_t size, off_t off)
+{
+        ssize_t ret = 0;
+        size_t  len = 0;
+
+        while (len < size) {
+                if (off < 0)
+                        ret = read (fd, buf + len, size - len);
+                else
+                        ret = pread (fd, buf + len, size - len, off + len);
+                if ((ret < 0) && (errno == EINTR))
+                        continue;
+                if (ret < 0) {
+                        errno = -errno;
+                        return -1;
+                }
+                if (ret == 0)
+                        break;
+                len += ret;
+        }
+
+        return len;
+}
+
+/* Fill 'buf' from pipe->in at 'off', for copies inside the cluster */
+static
+ssize_t __bobjs_gluster_fill_glfd (bobjs_gluster_pipe_t *pipe, char *buf,
+                                   size_t size, off_t off)
+{
+        ssize_t ret = 0;
+        size_t  len = 0;
+
+        while (len < size) {
+                ret = bobjs_glfs_pread (pipe->in, buf + len, size - len,
+                                        off + len, 0);
+                if (ret < 0) {
+                        bobjs_gluster_errno (pipe->priv);
+                        return -1;
+                }
+                if (ret == 0)
+                        break;
+                len += ret;
+        }
+
+        return len;
+}
+
+/* Same for writing, 'off' negative writes where 'fd' is */
+static
+int32_t __bobjs_gluster_drain (int32_t fd, const char *buf, size_t len,
+                               off_t off)
+{
+        ssize_t ret = 0;
+
+        while (len) {
+                if (off < 0)
+                        ret = write (fd, buf, len);
+                else
+                        ret = pwrite (fd, buf, len, off);
+                if ((ret < 0) && (errno == EINTR))
+                        continue;
+                if (ret < 0) {
+                        errno = -errno;
+                        return -1;
+                }
+                buf += ret;
+                len -= ret;
+                if (off >= 0)
+                        off += ret;
+        }
+
+        return 0;
+}
+
+/*
+  All of 'buf' zero.  Data blocks fail on their first bytes, runs of
+  zeros go 64 bytes per round; pipe buffers are BOBJS_GLUSTER_ALIGN
+  aligned.
+*/
+int32_t bobjs_gluster_zero (const char *buf, size_t len)
+{
+        size_t  i   = 0;
+#if defined(__SSE2__)
+        __m128i acc;
+
+        for (; i + 64 <= len; i += 64) {
+                acc = _mm_or_si128 (
+                        _mm_or_si128 (
+                                _mm_load_si128 ((const __m128i *) (buf + i)),
+                                _mm_load_si128 ((const __m128i *)
+                                                (buf + i + 16))),
+                        _mm_or_si128 (
+                                _mm_load_si128 ((const __m128i *)
+                                                (buf + i + 32)),
+                                _mm_load_si128 ((const __m128i *)
+                                                (buf + i + 48))));
+                if (_mm_movemask_epi8 (_mm_cmpeq_epi8
+                                       (acc, _mm_setzero_si128 ())) != 0xffff)
+                        return 0;
+        }
+#endif /* __SSE2__ */
+
+        for (; i < len; i++) {
+                if (buf[i])
+                        return 0;
+        }
+
+        return 1;
+}
+
+/*
+  A zero block left out of a sparse file.  Preallocated space under it
+  is given back, where that is not supported the zeros are written.
+*/
+static
+int32_t __bobjs_gluster_pipe_hole (bobjs_gluster_pipe_t *pipe,
+                                   bobjs_gluster_io_t *io)
+{
+        if ((!pipe->sparse) || (!bobjs_gluster_zero (io->buf, io->len)))
+                return 0;
+
+        if ((pipe->prealloc) &&
+            (glfs_discard (pipe->glfd, io->off, io->len) < 0)) {
+                pipe->prealloc = 0;
+                pipe->sparse   = 0;
+                return 0;
+        }
+
+        return 1;
+}
+
+static
+void __bobjs_gluster_done (BOBJS_GLFS_CBK_ARGS (glfd, ret, data))
+{
+        bobjs_gluster_io_t   *io   = data;
+        bobjs_gluster_pipe_t *pipe = io->pipe;
+
+        (void) glfd;
+        BOBJS_GLFS_CBK_UNUSED;
+
+        pthread_mutex_lock (&pipe->lock);
+        io->ret  = ret;
+        io->err  = (ret < 0) ? errno : 0;
+        io->busy = 0;
+        pipe->inflight--;
+        pthread_cond_broadcast (&pipe->cond);
+        pthread_mutex_unlock (&pipe->lock);
+}
+
+int32_t bobjs_gluster_pipe_init (bobjs_gluster_pipe_t *pipe,
+                                   bobjs_gluster_t *priv, glfs_fd_t *glfd)
+{
+        int32_t i = 0;
+
+        memset (pipe, 0, sizeof(*pipe));
+        pipe->priv  = priv;
+        pipe->glfd  = glfd;
+        pipe->block = bobjs_gluster_block (priv);
+        pipe->depth = priv->depth;
+
+        for (i = 0; i < pipe->depth; i++) {
+                pipe->io[i].pipe = pipe;
+                pipe->io[i].buf  = bobjs_gluster_buf (pipe->block);
+                if (!pipe->io[i].buf)
+                        break;
+        }
+        /* Shallower when memory is short, one block at least */
+        if (i == 0)
+                return -1;
+        pipe->depth = i;
+
+        pthread_mutex_init (&pipe->lock, NULL);
+        pthread_cond_init (&pipe->cond, NULL);
+
+        return 0;
+}
+
+/* Buffers cannot go while gfapi may still write into them */
+void bobjs_gluster_pipe_fini (bobjs_gluster_pipe_t *pipe)
+{
+        int32_t i = 0;
+
+        pthread_mutex_lock (&pipe->lock);
+        while (pipe->inflight)
+                pthread_cond_wait (&pipe->cond, &pipe->lock);
+        pthread_mutex_unlock (&pipe->lock);
+
+        for (i = 0; i < pipe->depth; i++)
+                free (pipe->io[i].buf);
+
+        pthread_cond_destroy (&pipe->cond);
+        pthread_mutex_destroy (&pipe->lock);
+}
+
+static
+void __bobjs_gluster_pipe_wait (bobjs_gluster_pipe_t *pipe,
+                                bobjs_gluster_io_t *io)
+{
+        pthread_mutex_lock (&pipe->lock);
+        while (io->busy)
+                pthread_cond_wait (&pipe->cond, &pipe->lock);
+        pthread_mutex_unlock (&pipe->lock);
+}
+
+static
+int32_t __bobjs_gluster_pipe_issue (bobjs_gluster_pipe_t *pipe,
+                                    bobjs_gluster_io_t *io, int32_t write)
+{
+        int32_t ret = 0;
+
+        pthread_mutex_lock (&pipe->lock);
+        io->busy = 1;
+        io->ret  = 0;
+        io->err  = 0;
+        pipe->inflight++;
+        pthread_mutex_unlock (&pipe->lock);
+
+        if (write)
+                ret = glfs_pwrite_async (pipe->glfd, io->buf, io->len,
+                                         io->off, 0, __bobjs_gluster_done,
+                                         io);
+        else
+                ret = glfs_pread_async (pipe->glfd, io->buf, io->len,
+                                        io->off, 0, __bobjs_gluster_done,
+                                        io);
+        if (ret < 0) {
+                bobjs_gluster_errno (pipe->priv);
+                pthread_mutex_lock (&pipe->lock);
+                io->busy = 0;
+                pipe->inflight--;
+                pthread_mutex_unlock (&pipe->lock);
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  Result of a completed block, short transfers are finished with
+  blocking calls.  Reads hitting the end early shrink io->len.
+*/
+static
+int32_t __bobjs_gluster_pipe_check (bobjs_gluster_pipe_t *pipe,
+                                    bobjs_gluster_io_t *io, int32_t write)
+{
+        size_t  done = 0;
+        ssize_t ret  = 0;
+
+        if (io->ret < 0) {
+                errno = io->err;
+                bobjs_gluster_errno (pipe->priv);
+                return -1;
+        }
+
+        for (done = io->ret; done < io->len; done += ret) {
+                if (write)
+                        ret = bobjs_glfs_pwrite (pipe->glfd, io->buf + done,
+                                                 io->len - done,
+                                                 io->off + done, 0);
+                else
+                        ret = bobjs_glfs_pread (pipe->glfd, io->buf + done,
+                                                io->len - done,
+                                                io->off + done, 0);
+                if (ret < 0) {
+                        bobjs_gluster_errno (pipe->priv);
+                        return -1;
+                }
+                if (ret == 0) {
+                        if (write) {
+                                errno = -EIO;
+                                return -1;
+                        }
+                        io->len = done;
+                        break;
+                }
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_pipe_write: copy 'fd' to the start of the file
+
+  DESCRIPTION
+
+  Blocks are read from 'fd' into free slots of the ring and written
+  asynchronously, pipe->depth of them in flight while the next ones
+  are read.  The file is expected empty, with pipe->sparse set blocks
+  of zeros are not written and left as holes.  With pipe->in set the
+  data comes from that file at 'src' instead of from 'fd'.
+
+  PARAMETERS:
+  @pipe - pipeline on the file
+  @fd - input
+  @src - where in 'fd' to start, negative to read 'fd' as it comes
+  @limit - bytes to copy at most, negative for all of 'fd'
+  @copied - bytes copied
+
+  RETURN VALUES:
+   0 : Success, 'limit' bytes or the end of 'fd' reached
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_pipe_write (bobjs_gluster_pipe_t *pipe, int32_t fd,
+                                  off_t src, off_t limit, off_t *copied)
+{
+        bobjs_gluster_io_t *io   = NULL;
+        off_t              off   = 0;
+        size_t             want  = 0;
+        ssize_t            len   = 0;
+        int64_t            seq   = 0;
+        int32_t            ret   = 0;
+        int32_t            hole  = 0;
+        int32_t            i     = 0;
+
+        for (;; seq++) {
+                io = &pipe->io[seq % pipe->depth];
+                __bobjs_gluster_pipe_wait (pipe, io);
+                if ((io->len) && (__bobjs_gluster_pipe_check (pipe, io,
+                                                              1) < 0))
+                        return -1;
+                io->len = 0;
+
+                want = pipe->block;
+                if ((limit >= 0) && (limit - off < (off_t) want))
+                        want = limit - off;
+                if (!want)
+                        break;
+
+                if (pipe->in)
+                        len = __bobjs_gluster_fill_glfd (pipe, io->buf, want,
+                                                         src + off);
+                else
+                        len = __bobjs_gluster_fill (fd, io->buf, want,
+                                                    (src < 0) ? -1 :
+                                                    src + off);
+                if (len <= 0) {
+                        ret = len;
+                        break;
+                }
+
+                io->off = off;
+                io->len = len;
+                hole    = __bobjs_gluster_pipe_hole (pipe, io);
+                if (hole)
+                        io->len = 0;
+                else if (__bobjs_gluster_pipe_issue (pipe, io, 1) < 0) {
+                        io->len = 0;
+                        return -1;
+                }
+                off += len;
+
+                if ((size_t) len < want)
+                        break;
+        }
+
+        /* What is still in flight */
+        for (i = 0; i < pipe->depth; i++) {
+                io = &pipe->io[i];
+                __bobjs_gluster_pipe_wait (pipe, io);
+                if ((io->len) && (__bobjs_gluster_pipe_check (pipe, io,
+                                                              1) < 0))
+                        ret = -1;
+                io->len = 0;
+        }
+
+        /* A hole at the end leaves the file short of its size */
+        if ((ret == 0) && (hole) &&
+            (bobjs_glfs_ftruncate (pipe->glfd, off) < 0)) {
+                bobjs_gluster_errno (pipe->priv);
+                ret = -1;
+        }
+
+        if (copied)
+                *copied = off;
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_pipe_read: copy 'size' bytes of the file to 'fd'
+
+  DESCRIPTION
+
+  pipe->depth blocks are read ahead asynchronously, they complete in
+  any order and are written to 'fd' in file order, each slot being
+  issued again as soon as it was written out.  'dst' negative writes
+  'fd' as it comes, otherwise the data goes at 'dst' in 'fd' and with
+  pipe->sparse set blocks of zeros are skipped, the caller knows that
+  range of 'fd' reads as zeros.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately, -EIO when the file ended
+       before 'size'
+*/
+
+int32_t bobjs_gluster_pipe_read (bobjs_gluster_pipe_t *pipe, int32_t fd,
+                                 off_t dst, off_t size)
+{
+        bobjs_gluster_io_t *io     = NULL;
+        off_t              issued  = 0;
+        off_t              drained = 0;
+        int64_t            seq     = 0;
+        int32_t            i       = 0;
+
+        for (i = 0; (i < pipe->depth) && (issued < size); i++) {
+                io      = &pipe->io[i];
+                io->off = issued;
+                io->len = ((size - issued) < (off_t) pipe->block) ?
+                        (size_t) (size - issued) : pipe->block;
+                if (__bobjs_gluster_pipe_issue (pipe, io, 0) < 0)
+                        return -1;
+                issued += io->len;
+        }
+
+        for (; seq * (int64_t) pipe->block < (int64_t) size; seq++) {
+                io = &pipe->io[seq % pipe->depth];
+                __bobjs_gluster_pipe_wait (pipe, io);
+                if (__bobjs_gluster_pipe_check (pipe, io, 0) < 0)
+                        return -1;
+                if (((dst < 0) || (!pipe->sparse) ||
+                     (!bobjs_gluster_zero (io->buf, io->len))) &&
+                    (__bobjs_gluster_drain (fd, io->buf, io->len,
+                                            (dst < 0) ? -1 :
+                                            dst + io->off) < 0))
+                        return -1;
+                drained += io->len;
+                /* Truncated while being read */
+                if (io->len < pipe->block)
+                        break;
+
+                if (issued < size) {
+                        io->off = issued;
+                        io->len = ((size - issued) < (off_t) pipe->block) ?
+                                (size_t) (size - issued) : pipe->block;
+                        if (__bobjs_gluster_pipe_issue (pipe, io, 0) < 0)
+                                return -1;
+                        issued += io->len;
+                }
+        }
+
+        if (drained < size) {
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
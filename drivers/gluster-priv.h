@@ -0,0 +1,200 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __GLUSTER_PRIV_H__
+#define __GLUSTER_PRIV_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <api/glfs.h>
+
+#include "bigobjects/driver.h"
+#include "gluster.h"
+#include "gluster-cache.h"
+
+/*
+  gfapi 6 hands the I/O calls and their callbacks the file's stat
+  before and after the operation (HAVE_GLFS_STAT_PREPOST, probed at
+  configure time), the driver never needs them.
+*/
+#ifdef HAVE_GLFS_STAT_PREPOST
+#define BOBJS_GLFS_CBK_ARGS(glfd, ret, data)                            \
+        glfs_fd_t *glfd, ssize_t ret, struct glfs_stat *prestat,        \
+        struct glfs_stat *poststat, void *data
+#define BOBJS_GLFS_CBK_UNUSED                                           \
+        do { (void) prestat; (void) poststat; } while (0)
+#else
+#define BOBJS_GLFS_CBK_ARGS(glfd, ret, data)                            \
+        glfs_fd_t *glfd, ssize_t ret, void *data
+#define BOBJS_GLFS_CBK_UNUSED do { } while (0)
+#endif
+
+static inline
+ssize_t bobjs_glfs_pread (glfs_fd_t *glfd, void *buf, size_t count,
+                          off_t off, int flags)
+{
+#ifdef HAVE_GLFS_STAT_PREPOST
+        return glfs_pread (glfd, buf, count, off, flags, NULL);
+#else
+        return glfs_pread (glfd, buf, count, off, flags);
+#endif
+}
+
+static inline
+ssize_t bobjs_glfs_pwrite (glfs_fd_t *glfd, const void *buf, size_t count,
+                           off_t off, int flags)
+{
+#ifdef HAVE_GLFS_STAT_PREPOST
+        return glfs_pwrite (glfd, buf, count, off, flags, NULL, NULL);
+#else
+        return glfs_pwrite (glfd, buf, count, off, flags);
+#endif
+}
+
+static inline
+int bobjs_glfs_ftruncate (glfs_fd_t *glfd, off_t len)
+{
+#ifdef HAVE_GLFS_STAT_PREPOST
+        return glfs_ftruncate (glfd, len, NULL, NULL);
+#else
+        return glfs_ftruncate (glfd, len);
+#endif
+}
+
+static inline
+int bobjs_glfs_fsync (glfs_fd_t *glfd)
+{
+#ifdef HAVE_GLFS_STAT_PREPOST
+        return glfs_fsync (glfd, NULL, NULL);
+#else
+        return glfs_fsync (glfd);
+#endif
+}
+
+/* Blocks moved per call, rounded up to the volume's I/O size */
+#define BOBJS_GLUSTER_BLOCK       (1024 * 1024)
+#define BOBJS_GLUSTER_BLOCK_MAX   (16 * 1024 * 1024)
+#define BOBJS_GLUSTER_ALIGN       4096
+
+/* Async reads or writes in flight per file, GLUSTER_IO_DEPTH overrides */
+#define BOBJS_GLUSTER_DEPTH       8
+#define BOBJS_GLUSTER_DEPTH_MAX   64
+
+/* Chunk files of an object, GLUSTER_CHUNK_SIZE overrides */
+#define BOBJS_GLUSTER_CHUNK       (64 * 1024 * 1024)
+
+/* Chunks moved at once, GLUSTER_THREADS overrides */
+#define BOBJS_GLUSTER_THREADS     8
+#define BOBJS_GLUSTER_THREADS_MAX 64
+
+/* Work items a tree walk queues, beyond that they are handled inline */
+#define BOBJS_GLUSTER_WALK_QUEUE  4096
+
+/* Chunked object manifest, an xattr of the object directory or a
+   file in it when the xattr cannot be set */
+#define BOBJS_GLUSTER_XATTR        "user.bigobjects.manifest"
+#define BOBJS_GLUSTER_MANIFEST     "manifest"
+#define BOBJS_GLUSTER_MANIFEST_MAX 256
+#define BOBJS_GLUSTER_LAYOUT       1
+
+/* Names tried for a temporary or moved aside object directory */
+#define BOBJS_GLUSTER_ASIDE_TRIES  16
+
+/* Volumes objects are placed across */
+#define BOBJS_GLUSTER_VOLUMES_MAX 32
+
+/* Per instance state, the volumes themselves are shared through the
+   cache.  'vol' is the one holding the object being worked on. */
+typedef struct {
+        bobjs_glfs_t *vol;
+        bobjs_glfs_t *vols[BOBJS_GLUSTER_VOLUMES_MAX];
+        int32_t      nvols;
+        int32_t      failed;    /* the volume failed an operation */
+        int32_t      depth;     /* async I/Os in flight */
+        uint64_t     chunk;     /* chunk size of new objects */
+        int32_t      threads;   /* chunks in flight */
+        int32_t      sparse;    /* zero blocks left as holes */
+} bobjs_gluster_t;
+
+struct bobjs_gluster_pipe;
+
+/* One block of the pipeline, issued or waiting to be */
+typedef struct {
+        struct bobjs_gluster_pipe *pipe;
+        char                      *buf;
+        size_t                    len;
+        off_t                     off;
+        ssize_t                   ret;
+        int32_t                   err;      /* errno of a failed I/O */
+        int32_t                   busy;     /* issued, not completed */
+} bobjs_gluster_io_t;
+
+/*
+  Blocks of a file moving through gfapi's async calls.  Completions
+  come in on gfapi's threads, they mark their block done and wake the
+  issuing thread, which consumes blocks in file order as a ring.
+*/
+typedef struct bobjs_gluster_pipe {
+        pthread_mutex_t           lock;
+        pthread_cond_t            cond;
+        bobjs_gluster_t           *priv;
+        glfs_fd_t                 *glfd;
+        glfs_fd_t                 *in;      /* source of a copy, or NULL */
+        size_t                    block;
+        int32_t                   depth;
+        int32_t                   inflight;
+        int32_t                   sparse;   /* skip blocks of zeros */
+        int32_t                   prealloc; /* the file is preallocated */
+        bobjs_gluster_io_t        io[BOBJS_GLUSTER_DEPTH_MAX];
+} bobjs_gluster_pipe_t;
+
+void bobjs_gluster_errno (bobjs_gluster_t *priv);
+size_t bobjs_gluster_block (bobjs_gluster_t *priv);
+void *bobjs_gluster_buf (size_t size);
+int32_t bobjs_gluster_mkdirs (bobjs_gluster_t *priv, const char *path);
+void bobjs_gluster_place (bobjs_gluster_t *priv, const char *object);
+int32_t bobjs_gluster_zero (const char *buf, size_t len);
+
+int32_t bobjs_gluster_pipe_init (bobjs_gluster_pipe_t *pipe,
+                                 bobjs_gluster_t *priv, glfs_fd_t *glfd);
+void bobjs_gluster_pipe_fini (bobjs_gluster_pipe_t *pipe);
+int32_t bobjs_gluster_pipe_write (bobjs_gluster_pipe_t *pipe, int32_t fd,
+                                  off_t src, off_t limit, off_t *copied);
+int32_t bobjs_gluster_pipe_read (bobjs_gluster_pipe_t *pipe, int32_t fd,
+                                 off_t dst, off_t size);
+
+int32_t bobjs_gluster_chunk_put (bobjs_gluster_t *priv, const char *object,
+                                 int32_t fd);
+int32_t bobjs_gluster_chunk_get (bobjs_gluster_t *priv, const char *dir,
+                                 int32_t fd);
+int32_t bobjs_gluster_chunk_delete (bobjs_gluster_t *priv, const char *dir);
+int32_t bobjs_gluster_chunk_size (bobjs_gluster_t *priv, const char *dir,
+                                  uint64_t *size);
+int32_t bobjs_gluster_chunk_copy (bobjs_gluster_t *src, const char *object,
+                                  bobjs_gluster_t *dst, const char *target);
+char *bobjs_gluster_chunk_owner (const char *aside);
+int32_t bobjs_gluster_chunk_recover (bobjs_gluster_t *priv,
+                                     const char *object);
+
+int32_t bobjs_gluster_walk_delete (bobjs_gluster_t *priv, const char *dir);
+int32_t bobjs_gluster_walk_list (bobjs_gluster_t *priv, const char *prefix,
+                                 bobjs_gluster_list_t cb, void *opaque);
+
+#endif /* __GLUSTER_PRIV_H__ */
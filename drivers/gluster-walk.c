@@ -0,0 +1,470 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Directory trees walked by a pool of priv->threads workers.  Every
+  unlink, lookup or directory read is a round trip to a brick, the pool
+  keeps that many of them in flight instead of one.  Directories read
+  turn into work items on a shared queue, the workers reading them
+  are the ones filling it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "gluster-priv.h"
+
+/* One file or directory waiting for a worker */
+struct bobjs_gluster_item {
+        struct bobjs_gluster_item *next;
+        struct stat               st;
+        int32_t                   dir;
+        char                      path[];
+};
+
+struct bobjs_gluster_walk {
+        pthread_mutex_t           lock;
+        pthread_cond_t            cond;
+        bobjs_gluster_t           *priv;
+        struct bobjs_gluster_item *head;
+        struct bobjs_gluster_item *tail;
+        int32_t                   queued;
+        int32_t                   busy;     /* workers on an item */
+        int32_t                   err;
+        int32_t                   (*fn) (struct bobjs_gluster_walk *walk,
+                                         struct bobjs_gluster_item *item);
+
+        /* Listing, calls to 'cb' never overlap */
+        pthread_mutex_t           cb_lock;
+        bobjs_gluster_list_t      cb;
+        void                      *opaque;
+};
+
+static
+struct bobjs_gluster_item *__bobjs_gluster_item (const char *dir,
+                                                 const char *name,
+                                                 int32_t isdir)
+{
+        struct bobjs_gluster_item *item = NULL;
+        size_t                    len   = strlen (dir) + strlen (name) + 2;
+
+        item = calloc (1, sizeof(*item) + len);
+        if (!item) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+
+        if (!name[0])
+                snprintf (item->path, len, "%s", dir);
+        else if (dir[0] && (dir[strlen (dir) - 1] == '/'))
+                snprintf (item->path, len, "%s%s", dir, name);
+        else
+                snprintf (item->path, len, "%s/%s", dir, name);
+        item->dir = isdir;
+
+        return item;
+}
+
+/*
+  Queue 'item' for the pool.  With BOBJS_GLUSTER_WALK_QUEUE waiting
+  already the caller handles it, which bounds memory on huge
+  directories and keeps workers from all waiting on each other.
+*/
+static
+int32_t __bobjs_gluster_walk_push (struct bobjs_gluster_walk *walk,
+                                   struct bobjs_gluster_item *item)
+{
+        int32_t ret = 0;
+
+        pthread_mutex_lock (&walk->lock);
+        if (walk->queued < BOBJS_GLUSTER_WALK_QUEUE) {
+                if (walk->tail)
+                        walk->tail->next = item;
+                else
+                        walk->head = item;
+                walk->tail = item;
+                walk->queued++;
+                pthread_cond_signal (&walk->cond);
+                pthread_mutex_unlock (&walk->lock);
+                return 0;
+        }
+        pthread_mutex_unlock (&walk->lock);
+
+        ret = walk->fn (walk, item);
+        free (item);
+        return ret;
+}
+
+/* Set when some worker failed, the others stop early */
+static
+int32_t __bobjs_gluster_walk_failed (struct bobjs_gluster_walk *walk)
+{
+        int32_t err = 0;
+
+        pthread_mutex_lock (&walk->lock);
+        err = walk->err;
+        pthread_mutex_unlock (&walk->lock);
+
+        return err;
+}
+
+static
+void *__bobjs_gluster_walk_worker (void *arg)
+{
+        struct bobjs_gluster_walk *walk = arg;
+        struct bobjs_gluster_item *item = NULL;
+        int32_t                   ret   = 0;
+
+        pthread_mutex_lock (&walk->lock);
+        for (;;) {
+                while ((!walk->head) && (walk->busy) && (!walk->err))
+                        pthread_cond_wait (&walk->cond, &walk->lock);
+                /* Failed, or nothing queued and nobody to queue more */
+                if ((walk->err) || (!walk->head))
+                        break;
+
+                item       = walk->head;
+                walk->head = item->next;
+                if (!walk->head)
+                        walk->tail = NULL;
+                walk->queued--;
+                walk->busy++;
+                pthread_mutex_unlock (&walk->lock);
+
+                ret = walk->fn (walk, item);
+                free (item);
+
+                pthread_mutex_lock (&walk->lock);
+                walk->busy--;
+                if ((ret < 0) && (!walk->err))
+                        walk->err = errno ? errno : -EIO;
+                if ((walk->err) || (!walk->busy))
+                        pthread_cond_broadcast (&walk->cond);
+        }
+        pthread_cond_broadcast (&walk->cond);
+        pthread_mutex_unlock (&walk->lock);
+
+        return NULL;
+}
+
+/* Walk from 'root', in this thread when no worker can start */
+static
+int32_t __bobjs_gluster_walk_run (struct bobjs_gluster_walk *walk,
+                                  struct bobjs_gluster_item *root)
+{
+        struct bobjs_gluster_item *item = NULL;
+        pthread_t                 threads[BOBJS_GLUSTER_THREADS_MAX];
+        int32_t                   nthreads = 0;
+        int32_t                   i        = 0;
+
+        pthread_mutex_init (&walk->lock, NULL);
+        pthread_cond_init (&walk->cond, NULL);
+        pthread_mutex_init (&walk->cb_lock, NULL);
+
+        walk->head   = root;
+        walk->tail   = root;
+        walk->queued = 1;
+
+        for (i = 0; i < walk->priv->threads; i++) {
+                if (pthread_create (&threads[nthreads], NULL,
+                                    __bobjs_gluster_walk_worker, walk))
+                        break;
+                nthreads++;
+        }
+        if (!nthreads)
+                __bobjs_gluster_walk_worker (walk);
+        for (i = 0; i < nthreads; i++)
+                pthread_join (threads[i], NULL);
+
+        /* Left over by a failure */
+        while (walk->head) {
+                item       = walk->head;
+                walk->head = item->next;
+                free (item);
+        }
+
+        pthread_mutex_destroy (&walk->cb_lock);
+        pthread_cond_destroy (&walk->cond);
+        pthread_mutex_destroy (&walk->lock);
+
+        if (walk->err) {
+                errno = walk->err;
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Every entry of directory 'item' but "." and "..", as work items */
+static
+int32_t __bobjs_gluster_walk_dir (struct bobjs_gluster_walk *walk,
+                                  struct bobjs_gluster_item *item,
+                                  int32_t plus)
+{
+        bobjs_gluster_t           *priv   = walk->priv;
+        struct bobjs_gluster_item *child  = NULL;
+        struct dirent             entry;
+        struct dirent             *result = NULL;
+        struct stat               st;
+        glfs_fd_t                 *glfd   = NULL;
+        int32_t                   ret     = -1;
+
+        glfd = glfs_opendir (priv->vol->fs, item->path);
+        if (!glfd) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        memset (&st, 0, sizeof(st));
+        for (;;) {
+                if (__bobjs_gluster_walk_failed (walk))
+                        goto out;
+
+                /* readdirplus brings the attributes along, no lookups */
+                if (((plus) && (glfs_readdirplus_r (glfd, &st, &entry,
+                                                    &result))) ||
+                    ((!plus) && (glfs_readdir_r (glfd, &entry, &result)))) {
+                        bobjs_gluster_errno (priv);
+                        goto out;
+                }
+                if (!result)
+                        break;
+                if ((!strcmp (entry.d_name, ".")) ||
+                    (!strcmp (entry.d_name, "..")))
+                        continue;
+
+                child = __bobjs_gluster_item (item->path, entry.d_name,
+                                              (plus) && S_ISDIR (st.st_mode));
+                if (!child)
+                        goto out;
+                child->st = st;
+
+                if (__bobjs_gluster_walk_push (walk, child) < 0)
+                        goto out;
+        }
+        ret = 0;
+out:
+        glfs_closedir (glfd);
+        return ret;
+}
+
+static
+int32_t __bobjs_gluster_walk_unlink (struct bobjs_gluster_walk *walk,
+                                     struct bobjs_gluster_item *item)
+{
+        if (item->dir)
+                return __bobjs_gluster_walk_dir (walk, item, 0);
+
+        if ((glfs_unlink (walk->priv->vol->fs, item->path) < 0) &&
+            (errno != ENOENT)) {
+                bobjs_gluster_errno (walk->priv);
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_walk_delete: remove the files of 'dir' and 'dir'
+
+  DESCRIPTION
+
+  One worker reads the directory, the others unlink what it finds,
+  priv->threads unlinks in flight.  Chunked objects are flat, entries
+  of 'dir' are all taken for files.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_walk_delete (bobjs_gluster_t *priv, const char *dir)
+{
+        struct bobjs_gluster_walk walk;
+        struct bobjs_gluster_item *root = NULL;
+
+        memset (&walk, 0, sizeof(walk));
+        walk.priv = priv;
+        walk.fn   = __bobjs_gluster_walk_unlink;
+
+        root = __bobjs_gluster_item (dir, "", 1);
+        if (!root)
+                return -1;
+
+        if (__bobjs_gluster_walk_run (&walk, root) < 0)
+                return -1;
+
+        if (glfs_rmdir (priv->vol->fs, dir) < 0) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Names of objects being written or replaced, not objects yet */
+static
+int32_t __bobjs_gluster_walk_hidden (const char *path)
+{
+        static const char *suffixes[] = { ".bobjs-tmp", ".bobjs-old" };
+        size_t            len         = strlen (path);
+        size_t            slen        = 0;
+        size_t            i           = 0;
+
+        for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+                slen = strlen (suffixes[i]);
+                if ((len > slen) && (!strcmp (path + len - slen,
+                                              suffixes[i])))
+                        return 1;
+        }
+
+        return 0;
+}
+
+static
+int32_t __bobjs_gluster_walk_report (struct bobjs_gluster_walk *walk,
+                                     struct bobjs_gluster_item *item,
+                                     int64_t size)
+{
+        bobjs_gluster_entry_t entry;
+        int32_t               ret   = 0;
+
+        entry.object = item->path;
+        while (entry.object[0] == '/')
+                entry.object++;
+        entry.size   = size;
+        entry.mtime  = item->st.st_mtime;
+
+        pthread_mutex_lock (&walk->cb_lock);
+        ret = walk->cb (&entry, walk->opaque);
+        pthread_mutex_unlock (&walk->cb_lock);
+
+        if (ret) {
+                errno = -ECANCELED;
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  An object a swap that died left moved aside, with nothing in its
+  place, is renamed back and listed under its name.  Returns 0 for an
+  item to be skipped.
+*/
+static
+int32_t __bobjs_gluster_walk_restore (struct bobjs_gluster_walk *walk,
+                                      struct bobjs_gluster_item *item)
+{
+        struct stat st;
+        char        *object = bobjs_gluster_chunk_owner (item->path);
+        int32_t     ret     = 0;
+
+        if (!object)
+                return 0;
+
+        if ((glfs_lstat (walk->priv->vol->fs, object, &st) < 0) &&
+            (errno == ENOENT) &&
+            (glfs_rename (walk->priv->vol->fs, item->path, object) == 0)) {
+                strcpy (item->path, object);
+                ret = 1;
+        }
+
+        free (object);
+        return ret;
+}
+
+static
+int32_t __bobjs_gluster_walk_list (struct bobjs_gluster_walk *walk,
+                                   struct bobjs_gluster_item *item)
+{
+        uint64_t size = 0;
+
+        if ((__bobjs_gluster_walk_hidden (item->path)) &&
+            (!__bobjs_gluster_walk_restore (walk, item)))
+                return 0;
+
+        if (!item->dir)
+                return __bobjs_gluster_walk_report (walk, item,
+                                                    item->st.st_size);
+
+        /* A chunked object, or a directory of them */
+        if (bobjs_gluster_chunk_size (walk->priv, item->path, &size) == 0)
+                return __bobjs_gluster_walk_report (walk, item, size);
+        if (errno != -ENOENT)
+                return -1;
+
+        return __bobjs_gluster_walk_dir (walk, item, 1);
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_walk_list: every object under 'prefix' to 'cb'
+
+  DESCRIPTION
+
+  Directories are read with readdirplus by priv->threads workers, plain
+  files are reported from the attributes that came with the entry and
+  object directories with one manifest lookup each.  Objects come in
+  no particular order, calls to 'cb' never overlap, non-zero from 'cb'
+  stops the listing with -ECANCELED.  An object found only moved aside
+  is renamed back and listed, see bobjs_gluster_chunk_recover().
+
+  PARAMETERS:
+  @priv - instance, priv->vol is the volume listed
+  @prefix - directory to list, "" or "/" for the whole volume
+  @cb - called with every object
+  @opaque - passed to 'cb'
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_walk_list (bobjs_gluster_t *priv, const char *prefix,
+                                 bobjs_gluster_list_t cb, void *opaque)
+{
+        struct bobjs_gluster_walk walk;
+        struct bobjs_gluster_item *root = NULL;
+
+        memset (&walk, 0, sizeof(walk));
+        walk.priv   = priv;
+        walk.fn     = __bobjs_gluster_walk_list;
+        walk.cb     = cb;
+        walk.opaque = opaque;
+
+        root = __bobjs_gluster_item (prefix[0] ? prefix : "/", "", 0);
+        if (!root)
+                return -1;
+
+        if (glfs_stat (priv->vol->fs, root->path, &root->st) < 0) {
+                bobjs_gluster_errno (priv);
+                free (root);
+                return -1;
+        }
+        root->dir = S_ISDIR (root->st.st_mode);
+
+        return __bobjs_gluster_walk_run (&walk, root);
+}
@@ -20,11 +20,16 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include <api/glfs.h>
 
 #include "bigobjects/driver.h"
 #include "gluster.h"
+#include "gluster-priv.h"
 
 class_methods_t class_methods = {
         .init           = bobjs_gluster_init,
@@ -34,54 +39,218 @@ class_methods_t class_methods = {
 struct driver_ops ops = {
         .put            = bobjs_gluster_put,
         .get            = bobjs_gluster_get,
-        .delete         = bobjs_gluster_delete
+        .delete         = bobjs_gluster_delete,
+        .copy           = bobjs_gluster_copy
 };
 
+/*
+  gfapi sets errno the libc way, callers of the driver expect it
+  negated.  Errors meaning the connection to the bricks is in trouble
+  get the volume checked before it is handed out again.
+*/
+void bobjs_gluster_errno (bobjs_gluster_t *priv)
+{
+        int32_t err = (errno > 0) ? errno : EIO;
+
+        switch (err) {
+        case ENOTCONN:
+        case ETIMEDOUT:
+        case EIO:
+        case ESTALE:
+                priv->failed = 1;
+                break;
+        default:
+                break;
+        }
+
+        errno = -err;
+}
+
+/* Large blocks, a whole multiple of the volume's preferred I/O size */
+size_t bobjs_gluster_block (bobjs_gluster_t *priv)
+{
+        size_t bsize = priv->vol->bsize;
+        size_t block = 0;
+
+        if ((!bsize) || (bsize > BOBJS_GLUSTER_BLOCK_MAX))
+                bsize = BOBJS_GLFS_BSIZE;
+
+        block = ((BOBJS_GLUSTER_BLOCK + bsize - 1) / bsize) * bsize;
+        if (block > BOBJS_GLUSTER_BLOCK_MAX)
+                block = bsize;
+
+        return block;
+}
+
+void *bobjs_gluster_buf (size_t size)
+{
+        void *buf = NULL;
+
+        if (posix_memalign (&buf, BOBJS_GLUSTER_ALIGN, size)) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+
+        return buf;
+}
+
+/* Parents of 'path', for objects named like paths */
+int32_t bobjs_gluster_mkdirs (bobjs_gluster_t *priv, const char *path)
+{
+        char    *dir  = strdup (path);
+        char    *p    = NULL;
+        int32_t ret   = -1;
+
+        if (!dir) {
+                errno = -ENOMEM;
+                return -1;
+        }
+
+        for (p = strchr (dir + 1, '/'); p; p = strchr (p + 1, '/')) {
+                *p = '\0';
+                if ((glfs_mkdir (priv->vol->fs, dir, 0755) < 0) &&
+                    (errno != EEXIST)) {
+                        bobjs_gluster_errno (priv);
+                        goto out;
+                }
+                *p = '/';
+        }
+        ret = 0;
+out:
+        free (dir);
+        return ret;
+}
+
+/* Every volume of the comma separated this->bucket, all or none */
+static
+int32_t __bobjs_gluster_volumes (bobjs_gluster_t *priv, driver_t *this)
+{
+        const char *name = this->bucket;
+        const char *end  = NULL;
+        char       volume[256];
+        size_t     len   = 0;
+        int32_t    err   = 0;
+
+        for (; name; name = end ? end + 1 : NULL) {
+                end = strchr (name, ',');
+                len = end ? (size_t) (end - name) : strlen (name);
+                if ((!len) || (len >= sizeof(volume)) ||
+                    (priv->nvols == BOBJS_GLUSTER_VOLUMES_MAX)) {
+                        errno = -EINVAL;
+                        goto err;
+                }
+                memcpy (volume, name, len);
+                volume[len] = '\0';
+
+                priv->vols[priv->nvols] = bobjs_glfs_get (this->server,
+                                                          this->port,
+                                                          volume);
+                if (!priv->vols[priv->nvols])
+                        goto err;
+                priv->nvols++;
+        }
+
+        return 0;
+err:
+        err = errno;
+        while (priv->nvols)
+                bobjs_glfs_put (priv->vols[--priv->nvols], 0);
+        errno = err;
+        return -1;
+}
+
+/*
+  Volume holding 'object', by rendezvous hashing: each volume scores
+  the key and the highest score wins.  Adding or removing a volume only
+  moves the objects that scored highest on it.
+*/
+void bobjs_gluster_place (bobjs_gluster_t *priv, const char *object)
+{
+        const char *p     = NULL;
+        uint64_t   h      = 0;
+        uint64_t   best   = 0;
+        int32_t    i      = 0;
+
+        priv->vol = priv->vols[0];
+        if (priv->nvols == 1)
+                return;
+
+        for (i = 0; i < priv->nvols; i++) {
+                /* FNV-1a of "volume\0object", then a 64 bit finalizer */
+                h = 0xcbf29ce484222325ULL;
+                for (p = priv->vols[i]->volume; *p; p++)
+                        h = (h ^ (unsigned char) *p) * 0x100000001b3ULL;
+                h *= 0x100000001b3ULL;
+                for (p = object; *p; p++)
+                        h = (h ^ (unsigned char) *p) * 0x100000001b3ULL;
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+
+                if ((i == 0) || (h > best)) {
+                        best      = h;
+                        priv->vol = priv->vols[i];
+                }
+        }
+}
+
 int32_t
 bobjs_gluster_init (driver_t *this)
 {
-        glfs_t *glfs = NULL;
-        int32_t ret  = -1;
+        bobjs_gluster_t *priv  = NULL;
+        size_t          block  = 0;
 
-        if (!this) {
+        if ((!this) || (!this->server) || (!this->bucket)) {
                 errno = -EINVAL;
                 goto out;
         }
 
-        /* Bucket name is volume name for GlusterFS */
-        glfs = glfs_new (this->bucket);
-
-        if (!glfs)
+        priv = calloc (1, sizeof(*priv));
+        if (!priv) {
+                errno = -ENOMEM;
                 goto out;
+        }
 
-        ret = glfs_set_volfile_server (glfs, "tcp",
-                                       this->server,
-                                       this->port);
-        if (ret < 0)
-                goto out;
+        priv->depth = BOBJS_GLUSTER_DEPTH;
+        if (getenv ("GLUSTER_IO_DEPTH"))
+                priv->depth = atoi (getenv ("GLUSTER_IO_DEPTH"));
+        if (priv->depth < 1)
+                priv->depth = 1;
+        if (priv->depth > BOBJS_GLUSTER_DEPTH_MAX)
+                priv->depth = BOBJS_GLUSTER_DEPTH_MAX;
 
-        /*
-         * FIXME: Use GF_LOG_ERROR instead of hard code value of 4 here when
-         * GlusterFS makes GF_LOG_* macros available to libgfapi users.
-         */
+        priv->threads = BOBJS_GLUSTER_THREADS;
+        if (getenv ("GLUSTER_THREADS"))
+                priv->threads = atoi (getenv ("GLUSTER_THREADS"));
+        if (priv->threads < 1)
+                priv->threads = 1;
+        if (priv->threads > BOBJS_GLUSTER_THREADS_MAX)
+                priv->threads = BOBJS_GLUSTER_THREADS_MAX;
 
-        ret = glfs_set_logging (glfs, "-", 4);
-        if (ret < 0)
-                goto out;
+        /* Zero blocks become holes unless GLUSTER_SPARSE=0 */
+        priv->sparse = 1;
+        if (getenv ("GLUSTER_SPARSE"))
+                priv->sparse = atoi (getenv ("GLUSTER_SPARSE"));
 
-        ret = glfs_init (glfs);
-        if (ret) {
-                fprintf(stderr, "Gluster connection failed for"
-                        " server=%s port=%d "
-                        "volume=%s file=%s transport=tcp",
-                        this->server,
-                        this->port,
-                        this->bucket,
-                        this->object);
+        /* Bucket name is volume name for GlusterFS, a list of them
+           places objects across volumes */
+        if (__bobjs_gluster_volumes (priv, this) < 0) {
+                free (priv);
                 goto out;
         }
+        priv->vol = priv->vols[0];
+
+        /* Whole blocks, a chunk ends where a block does */
+        block       = bobjs_gluster_block (priv);
+        priv->chunk = BOBJS_GLUSTER_CHUNK;
+        if (getenv ("GLUSTER_CHUNK_SIZE"))
+                priv->chunk = strtoull (getenv ("GLUSTER_CHUNK_SIZE"),
+                                        NULL, 10);
+        priv->chunk = ((priv->chunk + block - 1) / block) * block;
+        if (!priv->chunk)
+                priv->chunk = block;
 
-        this->private = glfs;
+        this->private = priv;
 
         return 0;
 out:
@@ -90,45 +259,288 @@ out:
 
 void bobjs_gluster_fini (driver_t *this)
 {
-        glfs_t *glfs = NULL;
+        bobjs_gluster_t *priv = NULL;
+        int32_t         i     = 0;
 
         if (!this) {
                 errno = -EINVAL;
                 goto out;
         }
 
-        glfs = this->private;
+        priv = this->private;
+        if (!priv)
+                goto out;
 
-        if (glfs)
-                glfs_fini (glfs);
+        for (i = 0; i < priv->nvols; i++)
+                bobjs_glfs_put (priv->vols[i], priv->failed);
+        free (priv);
+        this->private = NULL;
 out:
         return;
 }
 
+/* 'object' or, missing in the middle of a swap, its aside copy put back */
+static
+int32_t __bobjs_gluster_lookup (bobjs_gluster_t *priv, const char *object,
+                                struct stat *st, int32_t follow)
+{
+        int32_t (*lookup) (glfs_t *, const char *, struct stat *) =
+                (follow) ? glfs_stat : glfs_lstat;
+
+        if (lookup (priv->vol->fs, object, st) == 0)
+                return 0;
+        if ((errno != ENOENT) ||
+            (bobjs_gluster_chunk_recover (priv, object) < 0)) {
+                if (errno > 0)
+                        bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        if (lookup (priv->vol->fs, object, st) < 0) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_put: store what this->fd holds as this->object
+
+  DESCRIPTION
+
+  The object becomes a directory of chunk files, see gluster-chunk.c.
+  It is built next to the object and renamed in once complete, readers
+  never see a partial object.  An object already there is moved aside
+  first, for the moment between the two renames the name is missing.
+  Readers finding it so, or left so by a put that died in between,
+  rename the aside copy back, see bobjs_gluster_chunk_recover().
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
 int32_t bobjs_gluster_put (driver_t *this)
 {
-        int32_t ret = 0;
-        glfs_t *glfs = NULL;
+        bobjs_gluster_t *priv = NULL;
 
-        if (!this) {
+        if ((!this) || (!this->object) || (this->fd < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        priv = this->private;
+
+        if (!priv) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        bobjs_gluster_place (priv, this->object);
+
+        return bobjs_gluster_chunk_put (priv, this->object, this->fd);
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_get: write this->object into this->fd
+
+  DESCRIPTION
+
+  Chunked objects are read through their manifest, a plain file is
+  copied as it is.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_get (driver_t *this)
+{
+        bobjs_gluster_pipe_t pipe;
+        bobjs_gluster_t      *priv  = NULL;
+        glfs_fd_t            *glfd  = NULL;
+        struct stat          st;
+        int32_t              ret    = -1;
+
+        if ((!this) || (!this->object) || (this->fd < 0)) {
                 errno = -EINVAL;
-                ret = -1;
                 goto out;
         }
 
-        glfs = this->private;
+        priv = this->private;
 
-        if (!glfs) {
+        if (!priv) {
                 errno = -ENODATA;
-                ret = -1;
                 goto out;
         }
 
-        ret = glfs_mkdir (glfs, this->object, 0755);
-        if (ret) {
-                ret = -1;
+        bobjs_gluster_place (priv, this->object);
+
+        if (__bobjs_gluster_lookup (priv, this->object, &st, 1) < 0)
+                goto out;
+
+        if (S_ISDIR (st.st_mode))
+                return bobjs_gluster_chunk_get (priv, this->object, this->fd);
+
+        glfd = glfs_open (priv->vol->fs, this->object, O_RDONLY);
+        if ((!glfd) || (glfs_fstat (glfd, &st) < 0)) {
+                bobjs_gluster_errno (priv);
                 goto out;
         }
+
+        if (bobjs_gluster_pipe_init (&pipe, priv, glfd) < 0)
+                goto out;
+        ret = bobjs_gluster_pipe_read (&pipe, this->fd, -1, st.st_size);
+        bobjs_gluster_pipe_fini (&pipe);
 out:
+        if (glfd)
+                glfs_close (glfd);
+        return ret;
+}
+
+int32_t bobjs_gluster_delete (driver_t *this)
+{
+        bobjs_gluster_t *priv = NULL;
+        struct stat     st;
+
+        if ((!this) || (!this->object)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        priv = this->private;
+
+        if (!priv) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        bobjs_gluster_place (priv, this->object);
+
+        if (__bobjs_gluster_lookup (priv, this->object, &st, 0) < 0)
+                return -1;
+
+        if (S_ISDIR (st.st_mode))
+                return bobjs_gluster_chunk_delete (priv, this->object);
+
+        if (glfs_unlink (priv->vol->fs, this->object) < 0) {
+                bobjs_gluster_errno (priv);
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_copy: copy this->object to dst->object on the cluster
+
+  DESCRIPTION
+
+  Within one volume the bricks copy the data where gfapi provides
+  glfs_copy_file_range(), otherwise it goes through this host's
+  pipeline and never touches local disk, see
+  bobjs_gluster_chunk_copy().  The target may be on other volumes of
+  the same cluster, named by dst->bucket, they are taken from the
+  connection cache.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_copy (driver_t *this, driver_t *dst)
+{
+        bobjs_gluster_t *priv  = NULL;
+        bobjs_gluster_t target;
+        int32_t         same   = 0;
+        int32_t         ret    = -1;
+        int32_t         err    = 0;
+        int32_t         i      = 0;
+
+        if ((!this) || (!dst) || (!this->object) || (!dst->object) ||
+            (!dst->bucket)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        priv = this->private;
+
+        if (!priv) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        bobjs_gluster_place (priv, this->object);
+
+        target       = *priv;
+        target.nvols = 0;
+        same         = (!strcmp (dst->bucket, this->bucket));
+        if (same)
+                target.nvols = priv->nvols;
+        else if (__bobjs_gluster_volumes (&target, dst) < 0)
+                return -1;
+        target.failed = 0;
+        bobjs_gluster_place (&target, dst->object);
+
+        ret = bobjs_gluster_chunk_copy (priv, this->object, &target,
+                                        dst->object);
+
+        err = errno;
+        if (same)
+                priv->failed |= target.failed;
+        for (i = 0; (!same) && (i < target.nvols); i++)
+                bobjs_glfs_put (target.vols[i], target.failed);
+        errno = err;
+
         return ret;
 }
+
+/*
+  SYNOPSIS
+
+  bobjs_gluster_list: every object under 'prefix', on every volume
+
+  DESCRIPTION
+
+  See bobjs_gluster_walk_list(), the volumes are walked one after the
+  other.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t bobjs_gluster_list (driver_t *this, const char *prefix,
+                            bobjs_gluster_list_t cb, void *opaque)
+{
+        bobjs_gluster_t *priv = NULL;
+        int32_t         i     = 0;
+
+        if ((!this) || (!cb)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        priv = this->private;
+
+        if (!priv) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        for (i = 0; i < priv->nvols; i++) {
+                priv->vol = priv->vols[i];
+                if (bobjs_gluster_walk_list (priv, prefix ? prefix : "",
+                                             cb, opaque) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
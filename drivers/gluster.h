@@ -16,9 +16,31 @@
  * Author: Harshavardhana <fharshav@redhat.com>
  */
 
+#ifndef __GLUSTER_H__
+#define __GLUSTER_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* One object of a listing */
+typedef struct {
+        const char  *object;
+        int64_t     size;
+        time_t      mtime;
+} bobjs_gluster_entry_t;
+
+/* Returns 0 to go on, anything else stops the listing */
+typedef int32_t (*bobjs_gluster_list_t) (const bobjs_gluster_entry_t *entry,
+                                         void *opaque);
+
 int32_t bobjs_gluster_init (driver_t *this);
 void    bobjs_gluster_fini (driver_t *this);
 
 int32_t bobjs_gluster_put (driver_t *this);
 int32_t bobjs_gluster_get (driver_t *this);
 int32_t bobjs_gluster_delete (driver_t *this);
+int32_t bobjs_gluster_copy (driver_t *this, driver_t *dst);
+int32_t bobjs_gluster_list (driver_t *this, const char *prefix,
+                            bobjs_gluster_list_t cb, void *opaque);
+
+#endif /* __GLUSTER_H__ */
@@ -0,0 +1,224 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  bigobjects driver entry points, the bucket is the S3 bucket and the
+  credentials come from AWS_ACCESS_KEY_ID/AWS_SECRET_ACCESS_KEY.  Port
+  443 talks HTTPS, checked against AWS_CA_BUNDLE when it is set.
+  S3_BYTES_PER_SEC and S3_REQUESTS_PER_SEC rate limit the driver.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bigobjects/driver.h"
+#include "s3.h"
+#include "s3-driver.h"
+
+class_methods_t class_methods = {
+        .init           = bobjs_s3_init,
+        .fini           = bobjs_s3_fini
+};
+
+struct driver_ops ops = {
+        .put            = bobjs_s3_put,
+        .get            = bobjs_s3_get,
+        .delete         = bobjs_s3_delete,
+        .copy           = bobjs_s3_copy
+};
+
+static
+s3_conf_t *__bobjs_s3_conf (driver_t *this, const char *bucket)
+{
+        s3_conf_t  *s3conf = NULL;
+        const char *key_id = getenv ("AWS_ACCESS_KEY_ID");
+        const char *key    = getenv ("AWS_SECRET_ACCESS_KEY");
+        const char *region = getenv ("AWS_REGION");
+        const char *ca     = getenv ("AWS_CA_BUNDLE");
+        const char *bps    = getenv ("S3_BYTES_PER_SEC");
+        const char *rps    = getenv ("S3_REQUESTS_PER_SEC");
+        char       host[256];
+
+        if ((!key_id) || (!key)) {
+                errno = -EACCES;
+                return NULL;
+        }
+
+        if (this->port)
+                snprintf (host, sizeof(host), "%s:%d", this->server,
+                          this->port);
+        else
+                snprintf (host, sizeof(host), "%s", this->server);
+
+        s3conf = s3_init (this->name, key_id, key, host, bucket);
+        if (!s3conf)
+                return NULL;
+
+        if (((region) && (s3_set_region (s3conf, region) < 0)) ||
+            ((this->port == 443) && (s3_set_https (s3conf, 1) < 0)) ||
+            ((ca) && (s3_set_ca_file (s3conf, ca) < 0)) ||
+            (((bps) || (rps)) &&
+             (s3_set_rate_limit (s3conf,
+                                 (bps) ? strtoull (bps, NULL, 10) : 0,
+                                 (rps) ? strtoull (rps, NULL, 10) : 0) < 0))) {
+                s3_fini (s3conf);
+                return NULL;
+        }
+
+        return s3conf;
+}
+
+int32_t
+bobjs_s3_init (driver_t *this)
+{
+        s3_conf_t *s3conf = NULL;
+
+        if ((!this) || (!this->server) || (!this->bucket)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        s3conf = __bobjs_s3_conf (this, this->bucket);
+        if (!s3conf)
+                return -1;
+
+        this->private = s3conf;
+
+        return 0;
+}
+
+void bobjs_s3_fini (driver_t *this)
+{
+        if ((!this) || (!this->private))
+                return;
+
+        s3_fini (this->private);
+        this->private = NULL;
+}
+
+/* this->fd from where it stands to its end */
+int32_t bobjs_s3_put (driver_t *this)
+{
+        off_t offset = 0;
+
+        if ((!this) || (!this->object) || (this->fd < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (!this->private) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        offset = lseek (this->fd, 0, SEEK_CUR);
+        if (offset < 0) {
+                errno = -errno;
+                return -1;
+        }
+
+        return s3_put_fd (this->fd, offset, -1, this->private,
+                          this->object, NULL);
+}
+
+/* Written into this->fd where it stands */
+int32_t bobjs_s3_get (driver_t *this)
+{
+        off_t offset = 0;
+
+        if ((!this) || (!this->object) || (this->fd < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (!this->private) {
+                errno = -ENODATA;
+                return -1;
+        }
+
+        offset = lseek (this->fd, 0, SEEK_CUR);
+        if (offset < 0) {
+                errno = -errno;
+                return -1;
+        }
+
+        return s3_get_fd (this->fd, offset, this->private, this->object,
+                          NULL);
+}
+
+int32_t bobjs_s3_delete (driver_t *this)
+{
+        iobuf_t *buf = NULL;
+        int32_t ret  = -1;
+
+        if ((!this) || (!this->object)) {
+                errno = -EINVAL;
+                goto out;
+        }
+
+        if (!this->private) {
+                errno = -ENODATA;
+                goto out;
+        }
+
+        buf = s3_iobuf_new ();
+        if (!buf) {
+                errno = -ENOMEM;
+                goto out;
+        }
+
+        ret = s3_delete (buf, this->private, this->object);
+        s3_iobuf_free (buf);
+out:
+        return ret;
+}
+
+/* Same endpoint, possibly another bucket, copied by the S3 server */
+int32_t bobjs_s3_copy (driver_t *this, driver_t *dst)
+{
+        s3_conf_t *s3conf = NULL;
+        int32_t   ret     = -1;
+
+        if ((!this) || (!dst) || (!this->object) || (!dst->object) ||
+            (!dst->bucket)) {
+                errno = -EINVAL;
+                goto out;
+        }
+
+        if (!this->private) {
+                errno = -ENODATA;
+                goto out;
+        }
+
+        s3conf = this->private;
+        if (strcmp (dst->bucket, this->bucket)) {
+                s3conf = __bobjs_s3_conf (this, dst->bucket);
+                if (!s3conf)
+                        goto out;
+        }
+
+        ret = s3_copy (s3conf, this->bucket, this->object, dst->object,
+                       NULL);
+
+        if (s3conf != this->private)
+                s3_fini (s3conf);
+out:
+        return ret;
+}
@@ -0,0 +1,25 @@
+/**
+ * Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Uless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Author: Harshavardhana <fharshav@redhat.com>
+ */
+
+int32_t bobjs_s3_init (driver_t *this);
+void    bobjs_s3_fini (driver_t *this);
+
+int32_t bobjs_s3_put (driver_t *this);
+int32_t bobjs_s3_get (driver_t *this);
+int32_t bobjs_s3_delete (driver_t *this);
+int32_t bobjs_s3_copy (driver_t *this, driver_t *dst);
@@ -0,0 +1,423 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Endpoint selection.  Requests keep s3host in their URL (and so in
+  what is signed), only the address curl connects to changes.  Each
+  request goes to the endpoint with the fewest requests in flight,
+  endpoints failing S3_EJECT_ERRORS times in a row sit out for a while.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+
+#include "s3-priv.h"
+#include "s3.h"
+
+static
+int64_t __s3_now_ms (void)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static
+void __s3_share_lock (CURL *handle, curl_lock_data data,
+                      curl_lock_access access, void *userptr)
+{
+        struct s3_conf *s3conf = userptr;
+
+        (void) handle;
+        (void) access;
+        pthread_mutex_lock (&s3conf->share_locks[data % S3_SHARE_LOCKS]);
+}
+
+static
+void __s3_share_unlock (CURL *handle, curl_lock_data data, void *userptr)
+{
+        struct s3_conf *s3conf = userptr;
+
+        (void) handle;
+        pthread_mutex_unlock (&s3conf->share_locks[data % S3_SHARE_LOCKS]);
+}
+
+int32_t s3_endpoints_init (struct s3_conf *s3conf)
+{
+        CURLSH  *share = NULL;
+        int32_t i      = 0;
+
+        for (i = 0; i < S3_SHARE_LOCKS; i++)
+                pthread_mutex_init (&s3conf->share_locks[i], NULL);
+
+        share = curl_share_init ();
+        if (!share) {
+                errno = -ENOMEM;
+                return -1;
+        }
+
+        curl_share_setopt (share, CURLSHOPT_LOCKFUNC, __s3_share_lock);
+        curl_share_setopt (share, CURLSHOPT_UNLOCKFUNC, __s3_share_unlock);
+        curl_share_setopt (share, CURLSHOPT_USERDATA, s3conf);
+        curl_share_setopt (share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        /* Resumed TLS sessions skip the full handshake */
+        curl_share_setopt (share, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_SSL_SESSION);
+        s3conf->share = share;
+
+        return 0;
+}
+
+void s3_endpoints_fini (struct s3_conf *s3conf)
+{
+        int32_t i = 0;
+
+        for (i = 0; i < s3conf->nhandles; i++)
+                curl_easy_cleanup (s3conf->handles[i]);
+        s3conf->nhandles = 0;
+
+        if (s3conf->share)
+                curl_share_cleanup (s3conf->share);
+        s3conf->share = NULL;
+
+        for (i = 0; i < S3_SHARE_LOCKS; i++)
+                pthread_mutex_destroy (&s3conf->share_locks[i]);
+}
+
+/* "host", "host:port" or "[v6]:port" */
+static
+int32_t __s3_split_host (const char *hostport, char *host, size_t hsize,
+                         char *port, size_t psize)
+{
+        const char *end   = NULL;
+        const char *colon = NULL;
+
+        if (*hostport == '[') {
+                end = strchr (hostport, ']');
+                if (!end)
+                        return -1;
+                colon = (end[1] == ':') ? end + 1 : NULL;
+                snprintf (host, hsize, "%.*s", (int) (end - hostport - 1),
+                          hostport + 1);
+        } else {
+                colon = strrchr (hostport, ':');
+                snprintf (host, hsize, "%.*s", (int) ((colon) ?
+                          (size_t) (colon - hostport) : strlen (hostport)),
+                          hostport);
+        }
+
+        snprintf (port, psize, "%s", (colon) ? colon + 1 : "");
+        return (host[0]) ? 0 : -1;
+}
+
+static
+void __s3_endpoint_set (struct s3_endpoint *ep, const char *host,
+                        const char *port)
+{
+        memset (ep, 0, sizeof(*ep));
+        snprintf (ep->host, sizeof(ep->host), "%s", host);
+        snprintf (ep->connect_to, sizeof(ep->connect_to), "::%s:%s",
+                  host, port);
+        ep->active = 1;
+}
+
+/*
+  Take the addresses of a lookup in, endpoints keep their state (and
+  their slot, while requests are in flight) across lookups.  Known
+  addresses are all marked first, so a slot recycled for a new one can
+  never be one a later address of the same lookup still matches.
+*/
+static
+void __s3_endpoints_merge (struct s3_conf *s3conf,
+                           char (*hosts)[INET6_ADDRSTRLEN + 2],
+                           int32_t count)
+{
+        struct s3_endpoint *ep = NULL;
+        int32_t            known[S3_ENDPOINTS_MAX];
+        int32_t            i   = 0;
+        int32_t            j   = 0;
+
+        for (i = 0; i < s3conf->nendpoints; i++)
+                s3conf->endpoints[i].active = 0;
+
+        for (i = 0; i < count; i++) {
+                known[i] = 0;
+                for (j = 0; j < s3conf->nendpoints; j++) {
+                        if (!strcmp (s3conf->endpoints[j].host, hosts[i])) {
+                                s3conf->endpoints[j].active = 1;
+                                known[i] = 1;
+                                break;
+                        }
+                }
+        }
+
+        for (i = 0; i < count; i++) {
+                if (known[i])
+                        continue;
+
+                for (j = 0; j < s3conf->nendpoints; j++) {
+                        ep = &s3conf->endpoints[j];
+                        if ((!ep->active) && (!ep->outstanding))
+                                break;
+                }
+                if (j == s3conf->nendpoints) {
+                        if (s3conf->nendpoints == S3_ENDPOINTS_MAX)
+                                break;
+                        ep = &s3conf->endpoints[s3conf->nendpoints++];
+                }
+                __s3_endpoint_set (ep, hosts[i], "");
+        }
+}
+
+/*
+  SYNOPSIS
+
+  __s3_endpoints_resolve: look s3host up once every S3_DNS_TTL seconds
+
+  DESCRIPTION
+
+  Called with s3conf->lock held, drops it for the lookup.  A failed
+  lookup keeps the endpoints there are, with none at all curl
+  resolves s3host itself.
+*/
+
+static
+void __s3_endpoints_resolve (struct s3_conf *s3conf)
+{
+        struct addrinfo hints;
+        struct addrinfo *res   = NULL;
+        struct addrinfo *ai    = NULL;
+        char            hosts[S3_ENDPOINTS_MAX][INET6_ADDRSTRLEN + 2];
+        char            addr[INET6_ADDRSTRLEN];
+        char            host[256];
+        char            port[16];
+        time_t          now    = time (NULL);
+        int32_t         count  = 0;
+        int32_t         i      = 0;
+
+        if ((s3conf->static_endpoints) || (s3conf->resolving) ||
+            ((s3conf->resolved) && (now - s3conf->resolved < S3_DNS_TTL)))
+                return;
+
+        s3conf->resolving = 1;
+        pthread_mutex_unlock (&s3conf->lock);
+
+        memset (&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if ((__s3_split_host (s3conf->s3host, host, sizeof(host), port,
+                              sizeof(port)) == 0) &&
+            (getaddrinfo (host, (port[0]) ? port :
+                          (s3conf->https) ? "443" : "80", &hints,
+                          &res) == 0)) {
+                for (ai = res; (ai) && (count < S3_ENDPOINTS_MAX);
+                     ai = ai->ai_next) {
+                        if (ai->ai_family == AF_INET)
+                                inet_ntop (AF_INET, &((struct sockaddr_in *)
+                                           ai->ai_addr)->sin_addr, addr,
+                                           sizeof(addr));
+                        else if (ai->ai_family == AF_INET6)
+                                inet_ntop (AF_INET6, &((struct sockaddr_in6 *)
+                                           ai->ai_addr)->sin6_addr, addr,
+                                           sizeof(addr));
+                        else
+                                continue;
+                        snprintf (hosts[count], sizeof(hosts[count]),
+                                  (ai->ai_family == AF_INET6) ? "[%s]" :
+                                  "%s", addr);
+                        for (i = 0; i < count; i++) {
+                                if (!strcmp (hosts[i], hosts[count]))
+                                        break;
+                        }
+                        if (i == count)
+                                count++;
+                }
+                freeaddrinfo (res);
+        }
+
+        pthread_mutex_lock (&s3conf->lock);
+        if ((count) && (!s3conf->static_endpoints))
+                __s3_endpoints_merge (s3conf, hosts, count);
+        s3conf->resolved  = now;
+        s3conf->resolving = 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_endpoint_get: pick the endpoint for the next request
+
+  DESCRIPTION
+
+  The endpoint with the fewest requests in flight wins, ties go round
+  robin.  'avoid' (the endpoint a retry or hedge follows) and ejected
+  endpoints are only picked when there is nothing else.
+
+  RETURN VALUES:
+   N : Endpoint, to be given back with s3_endpoint_put()
+  -1 : No endpoints, connect to s3host
+*/
+
+int32_t s3_endpoint_get (struct s3_conf *s3conf, int32_t avoid)
+{
+        struct s3_endpoint *ep    = NULL;
+        int64_t            now    = __s3_now_ms ();
+        int32_t            best   = -1;
+        int32_t            backup = -1;
+        int32_t            start  = 0;
+        int32_t            n      = 0;
+        int32_t            i      = 0;
+        int32_t            k      = 0;
+
+        pthread_mutex_lock (&s3conf->lock);
+        __s3_endpoints_resolve (s3conf);
+
+        n = s3conf->nendpoints;
+        if (n)
+                start = s3conf->ep_next++ % n;
+
+        for (k = 0; k < n; k++) {
+                i  = (start + k) % n;
+                ep = &s3conf->endpoints[i];
+                if (!ep->active)
+                        continue;
+
+                if ((i == avoid) || (ep->ejected_until > now)) {
+                        if ((backup < 0) ||
+                            (ep->ejected_until <
+                             s3conf->endpoints[backup].ejected_until))
+                                backup = i;
+                        continue;
+                }
+
+                if ((best < 0) || (ep->outstanding <
+                                   s3conf->endpoints[best].outstanding))
+                        best = i;
+        }
+
+        if (best < 0)
+                best = backup;
+        if (best >= 0) {
+                s3conf->endpoints[best].outstanding++;
+                s3conf->endpoints[best].requests++;
+        }
+        pthread_mutex_unlock (&s3conf->lock);
+
+        return best;
+}
+
+/*
+  SYNOPSIS
+
+  s3_endpoint_put: give back an endpoint from s3_endpoint_get()
+
+  DESCRIPTION
+
+  'failed' is 1 when the request failed in a way that may be the
+  endpoint's fault, 0 when it was answered and -1 when there is no
+  telling (a hedged copy dropped).  Endpoints failing S3_EJECT_ERRORS
+  times in a row are ejected, one back from ejection goes out again on
+  its first failure and for twice as long.
+*/
+
+void s3_endpoint_put (struct s3_conf *s3conf, int32_t ep, int32_t failed)
+{
+        struct s3_endpoint *e     = NULL;
+        int64_t            ms     = S3_EJECT_MS;
+        uint32_t           shift  = 0;
+
+        if ((ep < 0) || (ep >= S3_ENDPOINTS_MAX))
+                return;
+
+        pthread_mutex_lock (&s3conf->lock);
+        e = &s3conf->endpoints[ep];
+        if (e->outstanding)
+                e->outstanding--;
+
+        if (!failed) {
+                e->failures  = 0;
+                e->ejections = 0;
+        } else if ((failed > 0) &&
+                   ((++e->failures >= S3_EJECT_ERRORS) || (e->ejections))) {
+                shift = (e->ejections < 5) ? e->ejections : 5;
+                ms <<= shift;
+                if (ms > S3_EJECT_MAX_MS)
+                        ms = S3_EJECT_MAX_MS;
+                e->ejected_until = __s3_now_ms () + ms;
+                e->ejections++;
+                e->failures = 0;
+        }
+        pthread_mutex_unlock (&s3conf->lock);
+}
+
+int32_t s3_set_endpoints (struct s3_conf *s3conf,
+                          const char *const *endpoints, int32_t count)
+{
+        char    host[256];
+        char    literal[260];
+        char    port[16];
+        int32_t i = 0;
+
+        if ((!s3conf) || (count < 0) || (count > S3_ENDPOINTS_MAX) ||
+            ((count) && (!endpoints))) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        for (i = 0; i < count; i++) {
+                if ((!endpoints[i]) ||
+                    (__s3_split_host (endpoints[i], host, sizeof(host), port,
+                                      sizeof(port)) < 0)) {
+                        errno = -EINVAL;
+                        return -1;
+                }
+        }
+
+        pthread_mutex_lock (&s3conf->lock);
+        for (i = 0; i < s3conf->nendpoints; i++) {
+                if (s3conf->endpoints[i].outstanding) {
+                        pthread_mutex_unlock (&s3conf->lock);
+                        errno = -EBUSY;
+                        return -1;
+                }
+        }
+
+        memset (s3conf->endpoints, 0, sizeof(s3conf->endpoints));
+        for (i = 0; i < count; i++) {
+                __s3_split_host (endpoints[i], host, sizeof(host), port,
+                                 sizeof(port));
+                /* IPv6 literals keep their brackets for CONNECT_TO */
+                snprintf (literal, sizeof(literal),
+                          (endpoints[i][0] == '[') ? "[%s]" : "%s", host);
+                __s3_endpoint_set (&s3conf->endpoints[i], literal, port);
+        }
+        s3conf->nendpoints       = count;
+        s3conf->static_endpoints = (count > 0);
+        s3conf->resolved         = 0;
+        pthread_mutex_unlock (&s3conf->lock);
+
+        return 0;
+}
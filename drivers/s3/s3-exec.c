@@ -0,0 +1,1021 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <curl/curl.h>
+
+#include "s3-priv.h"
+
+/*
+  One transfer of a request.  A hedged GET runs two of them against
+  the same sink, the first to deliver a byte of the object wins.
+*/
+
+struct s3_xfer {
+        s3_req_t          *req;
+        struct s3_conf    *s3conf;
+        CURL              *ch;
+        struct curl_slist *slist;
+        struct curl_slist *connect_to;
+        int32_t           ep;          /* endpoint, -1 for s3host */
+        struct s3_xfer    **winner;    /* NULL unless hedged */
+        CURLcode          result;
+        int32_t           done;
+        char              url[S3_URI_MAX + S3_QUERY_MAX + 256];
+        char              errbuf[CURL_ERROR_SIZE];
+};
+
+/*
+  SYNOPSIS
+
+  s3_curl_write: handles writing to the download sink
+
+  PARAMETERS:
+  @ptr - pointer to the incoming data
+  @size - size of the individual data member
+  @nmemb - total number of data members
+  @stream - stream pointer to the transfer
+
+  RETURN VALUES:
+  N : Total number of bytes processed
+  CURL_WRITEFUNC_PAUSE : Sink is full, pause the transfer
+  0 : Hedged copy lost the race, abort it
+*/
+
+/* Keep why the source or sink failed, errno will not last until the
+   transfer is classified */
+static
+void __s3_io_failed (s3_req_t *req)
+{
+        req->io_err = (errno > 0) ? -errno : errno;
+        if (!req->io_err)
+                req->io_err = -EIO;
+}
+
+static size_t s3_curl_write (void *ptr, size_t size, size_t nmemb, void *stream)
+{
+        struct s3_xfer *xfer = stream;
+        s3_req_t       *req  = xfer->req;
+        s3_sink_t      *sink = req->sink;
+        size_t         len   = (nmemb * size);
+        size_t         ret   = 0;
+
+        /* Waiting here holds the data back from the socket */
+        s3_limit_wait (&xfer->s3conf->limit_recv, len);
+
+        /* Error documents are not part of the object, S3 explains
+           itself in them */
+        if (req->resp.code >= 300) {
+                ret = sizeof(req->errdoc) - 1 - req->errlen;
+                if (ret > len)
+                        ret = len;
+                memcpy (req->errdoc + req->errlen, ptr, ret);
+                req->errlen += ret;
+                req->errdoc[req->errlen] = '\0';
+                return len;
+        }
+
+        if (xfer->winner) {
+                if (!*xfer->winner)
+                        *xfer->winner = xfer;
+                else if (*xfer->winner != xfer)
+                        return 0;
+        }
+
+        if (!sink)
+                return len;
+
+        sink->handle = xfer->ch;
+        ret = s3_sink_write (sink, ptr, len);
+        if (ret == S3_SINK_PAUSE)
+                return CURL_WRITEFUNC_PAUSE;
+        if (ret == (size_t) -1)
+                __s3_io_failed (req);
+
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  s3_curl_progress: Resumes a paused download once the sink drained
+
+  PARAMETERS:
+  @clientp - pointer to the transfer
+
+  RETURN VALUES:
+  0 : Continue the transfer
+*/
+
+static int s3_curl_progress (void *clientp, curl_off_t dltotal,
+                             curl_off_t dlnow, curl_off_t ultotal,
+                             curl_off_t ulnow)
+{
+        struct s3_xfer *xfer = clientp;
+        s3_sink_t      *sink = xfer->req->sink;
+
+        (void) dltotal;
+        (void) dlnow;
+        (void) ultotal;
+        (void) ulnow;
+
+        if ((sink) && (sink->paused) && (sink->handle == xfer->ch) &&
+            (s3_sink_ready (sink))) {
+                sink->paused = 0;
+                curl_easy_pause (sink->handle, CURLPAUSE_CONT);
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_curl_read: Handles reading from the upload source
+
+  PARAMETERS:
+  @ptr - pointer to the outgoing data
+  @size - size of the individual data member
+  @nmemb - total number of data members
+  @stream - stream pointer to the transfer
+
+  RETURN VALUES:
+  N : Total number of bytes sent
+*/
+
+static size_t s3_curl_read (void *ptr, size_t size, size_t nmemb, void *stream)
+{
+        struct s3_xfer *xfer = stream;
+        s3_req_t       *req  = xfer->req;
+        size_t         ret   = 0;
+
+        if (req->chunked) {
+                ret = s3_chunked_read (req->chunked, ptr, (nmemb * size));
+        } else {
+                ret = s3_source_read (req->src, ptr, (nmemb * size));
+                if ((ret != (size_t) -1) && (req->md5))
+                        s3_md5_update (req->md5, ptr, ret);
+        }
+        if (ret == (size_t) -1) {
+                __s3_io_failed (req);
+                return CURL_READFUNC_ABORT;
+        }
+
+        s3_limit_wait (&xfer->s3conf->limit_send, ret);
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  s3_curl_seek: Rewinds the upload source when curl resends the body
+
+  PARAMETERS:
+  @stream - stream pointer to the request being sent
+  @offset - offset to seek to
+  @origin - SEEK_SET, SEEK_CUR or SEEK_END
+
+  RETURN VALUES:
+  CURL_SEEKFUNC_OK : Success
+  CURL_SEEKFUNC_CANTSEEK : Source is not seekable
+*/
+
+static int s3_curl_seek (void *stream, curl_off_t offset, int origin)
+{
+        s3_req_t *req = stream;
+
+        if (origin != SEEK_SET)
+                return CURL_SEEKFUNC_CANTSEEK;
+
+        /* Chunk signatures are chained, only a full restart works */
+        if (req->chunked) {
+                if ((offset != 0) || (s3_chunked_rewind (req->chunked) < 0))
+                        return CURL_SEEKFUNC_CANTSEEK;
+                return CURL_SEEKFUNC_OK;
+        }
+
+        /* The payload MD5 is only right for a body sent start to end */
+        if ((req->md5) && (offset != 0))
+                return CURL_SEEKFUNC_CANTSEEK;
+
+        if (s3_source_seek (req->src, offset) < 0)
+                return CURL_SEEKFUNC_CANTSEEK;
+
+        if (req->md5)
+                s3_md5_init (req->md5);
+
+        return CURL_SEEKFUNC_OK;
+}
+
+/*
+  SYNOPSIS
+
+  process_header: Process incoming header
+
+  PARAMETERS:
+  @ptr - pointer to the incoming data
+  @size - size of the individual data member
+  @nmemb - total number of data members
+  @stream - stream pointer to the request, the header lands in its
+            response
+
+  RETURN VALUES:
+  N : Total number of bytes processed
+  0 : Failure, abort the transfer
+*/
+
+static size_t process_header (void *ptr, size_t size, size_t nmemb,
+                              void *stream)
+{
+        s3_req_t *req = stream;
+
+        if (!req)
+                return 0;
+
+        if (s3_resp_header (&req->resp, ptr, (nmemb * size)) < 0)
+                return 0;
+
+        return (nmemb * size);
+}
+
+
+/*
+  curl handles are kept for the next request of any thread, so their
+  connections (and the TLS sessions on them) outlive the request.  A
+  handle is only ever used by one thread at a time, curl cannot share
+  a connection cache between threads safely.  Requests run on the
+  multiplexer use the connections of its multi handle instead, see
+  s3-mux.c.
+*/
+static
+CURL *__s3_handle_get (struct s3_conf *s3conf)
+{
+        CURL *ch = NULL;
+
+        pthread_mutex_lock (&s3conf->lock);
+        if (s3conf->nhandles)
+                ch = s3conf->handles[--s3conf->nhandles];
+        pthread_mutex_unlock (&s3conf->lock);
+
+        if (!ch)
+                ch = curl_easy_init ();
+
+        return ch;
+}
+
+static
+void __s3_handle_put (struct s3_conf *s3conf, CURL *ch)
+{
+        /* Options point into the request, connections are kept */
+        curl_easy_reset (ch);
+
+        pthread_mutex_lock (&s3conf->lock);
+        if (s3conf->nhandles < S3_HANDLES_MAX) {
+                s3conf->handles[s3conf->nhandles++] = ch;
+                ch = NULL;
+        }
+        pthread_mutex_unlock (&s3conf->lock);
+
+        if (ch)
+                curl_easy_cleanup (ch);
+}
+
+/* An endpoint still held has no verdict, it is given back as such */
+static
+void __s3_xfer_cleanup (struct s3_xfer *xfer)
+{
+        if (xfer->ch)
+                __s3_handle_put (xfer->s3conf, xfer->ch);
+        if (xfer->slist)
+                curl_slist_free_all (xfer->slist);
+        if (xfer->connect_to)
+                curl_slist_free_all (xfer->connect_to);
+        if (xfer->ep >= 0)
+                s3_endpoint_put (xfer->s3conf, xfer->ep, -1);
+        xfer->ch         = NULL;
+        xfer->slist      = NULL;
+        xfer->connect_to = NULL;
+        xfer->ep         = -1;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_xfer_setup: sign 'req' and prepare a curl handle sending it to
+  an endpoint other than 'avoid' if there is one
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_xfer_setup (struct s3_xfer *xfer, s3_req_t *req,
+                         struct s3_conf *s3conf, int32_t avoid)
+{
+        char              header[1024];
+        char              auth[512];
+        CURL              *ch    = NULL;
+        int32_t           i      = 0;
+
+        memset (xfer, 0, sizeof(*xfer));
+        xfer->req    = req;
+        xfer->s3conf = s3conf;
+        xfer->ep     = -1;
+        xfer->result = CURLE_OK;
+
+        if (s3_sigv4_sign (s3conf, req, time (NULL), auth, sizeof(auth)) < 0)
+                return -1;
+
+        ch = __s3_handle_get (s3conf);
+        if (!ch) {
+                errno = -ENOMEM;
+                return -1;
+        }
+        xfer->ch = ch;
+
+        for (i = 0; i < req->nhdrs; i++) {
+                snprintf (header, sizeof(header), "%s: %s",
+                          req->hdrs[i].name, req->hdrs[i].value);
+                xfer->slist = curl_slist_append (xfer->slist, header);
+        }
+
+        snprintf (header, sizeof(header), "Authorization: %s", auth);
+        xfer->slist = curl_slist_append (xfer->slist, header);
+
+        snprintf (xfer->url, sizeof(xfer->url), "%s://%s%s%s%s",
+                  (s3conf->https) ? "https" : "http", s3conf->s3host,
+                  req->uri, req->query[0] ? "?" : "", req->query);
+
+        curl_easy_setopt (ch, CURLOPT_HTTPHEADER, xfer->slist);
+        curl_easy_setopt (ch, CURLOPT_URL, xfer->url);
+        curl_easy_setopt (ch, CURLOPT_HEADERFUNCTION, process_header);
+        curl_easy_setopt (ch, CURLOPT_HEADERDATA, req);
+        curl_easy_setopt (ch, CURLOPT_WRITEFUNCTION, s3_curl_write);
+        curl_easy_setopt (ch, CURLOPT_WRITEDATA, xfer);
+        curl_easy_setopt (ch, CURLOPT_ERRORBUFFER, xfer->errbuf);
+        curl_easy_setopt (ch, CURLOPT_NOSIGNAL, 1);
+        curl_easy_setopt (ch, CURLOPT_VERBOSE, 0);
+        curl_easy_setopt (ch, CURLOPT_SHARE, s3conf->share);
+        curl_easy_setopt (ch, CURLOPT_TCP_KEEPALIVE, 1L);
+
+        /* HTTP/2 over TLS when ALPN agrees on it, on the multiplexer
+           a request waits for a stream on a connection being set up
+           rather than opening its own */
+        curl_easy_setopt (ch, CURLOPT_HTTP_VERSION,
+                          (long) CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt (ch, CURLOPT_PIPEWAIT, 1L);
+        if (s3conf->ca_file)
+                curl_easy_setopt (ch, CURLOPT_CAINFO, s3conf->ca_file);
+
+        /* The URL (and the signature) stay on s3host, only where curl
+           connects to changes */
+        xfer->ep = s3_endpoint_get (s3conf, avoid);
+        if (xfer->ep >= 0) {
+                xfer->connect_to =
+                        curl_slist_append (NULL, s3conf->endpoints[
+                                           xfer->ep].connect_to);
+                curl_easy_setopt (ch, CURLOPT_CONNECT_TO, xfer->connect_to);
+        }
+
+        /* A dead connection or a stalled transfer is retried, not
+           waited on forever */
+        curl_easy_setopt (ch, CURLOPT_CONNECTTIMEOUT_MS,
+                          (long) s3conf->connect_timeout_ms);
+        curl_easy_setopt (ch, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt (ch, CURLOPT_LOW_SPEED_TIME,
+                          (long) s3conf->stall_timeout);
+
+        if (req->src) {
+                curl_easy_setopt (ch, CURLOPT_UPLOAD, 1);
+                curl_easy_setopt (ch, CURLOPT_READFUNCTION, s3_curl_read);
+                curl_easy_setopt (ch, CURLOPT_READDATA, xfer);
+                curl_easy_setopt (ch, CURLOPT_SEEKFUNCTION, s3_curl_seek);
+                curl_easy_setopt (ch, CURLOPT_SEEKDATA, req);
+                curl_easy_setopt (ch, CURLOPT_INFILESIZE_LARGE,
+                                  (curl_off_t) ((req->chunked) ?
+                                  s3_chunked_length (req->chunked) :
+                                  s3_source_length (req->src)));
+        }
+
+        if (req->sink) {
+                curl_easy_setopt (ch, CURLOPT_XFERINFOFUNCTION,
+                                  s3_curl_progress);
+                curl_easy_setopt (ch, CURLOPT_XFERINFODATA, xfer);
+                curl_easy_setopt (ch, CURLOPT_NOPROGRESS, 0);
+        }
+
+        if (!strcmp (req->method, "HEAD"))
+                curl_easy_setopt (ch, CURLOPT_NOBODY, 1);
+        else if ((strcmp (req->method, "GET")) &&
+                 (strcmp (req->method, "PUT")))
+                curl_easy_setopt (ch, CURLOPT_CUSTOMREQUEST, req->method);
+
+        return 0;
+}
+
+/*
+  Time to first byte of successful GETs, the hedging delay is taken
+  from these
+*/
+static
+void __s3_latency_add (struct s3_conf *s3conf, CURL *ch)
+{
+        curl_off_t ttfb = 0;
+
+        if (curl_easy_getinfo (ch, CURLINFO_STARTTRANSFER_TIME_T, &ttfb) !=
+            CURLE_OK)
+                return;
+
+        pthread_mutex_lock (&s3conf->lock);
+        s3conf->latency[s3conf->lat_next] = ttfb;
+        s3conf->lat_next = (s3conf->lat_next + 1) % S3_LATENCY_SAMPLES;
+        if (s3conf->lat_count < S3_LATENCY_SAMPLES)
+                s3conf->lat_count++;
+        pthread_mutex_unlock (&s3conf->lock);
+}
+
+static
+int __s3_cmp_latency (const void *a, const void *b)
+{
+        int64_t x = *(const int64_t *) a;
+        int64_t y = *(const int64_t *) b;
+
+        return (x > y) - (x < y);
+}
+
+/*
+  SYNOPSIS
+
+  __s3_hedge_delay: how long a GET may go without its first byte
+  before a second copy is sent
+
+  RETURN VALUES:
+  N : Delay in milliseconds, the s3conf->hedge_pct percentile of
+      recent GETs
+  -1 : Do not hedge, disabled or not enough samples yet
+*/
+
+static
+int64_t __s3_hedge_delay (struct s3_conf *s3conf)
+{
+        int64_t  samples[S3_LATENCY_SAMPLES];
+        uint32_t count = 0;
+        int64_t  ms    = 0;
+
+        if (!s3conf->hedge_pct)
+                return -1;
+
+        pthread_mutex_lock (&s3conf->lock);
+        count = s3conf->lat_count;
+        memcpy (samples, s3conf->latency, count * sizeof(samples[0]));
+        pthread_mutex_unlock (&s3conf->lock);
+
+        if (count < S3_HEDGE_MIN_SAMPLES)
+                return -1;
+
+        qsort (samples, count, sizeof(samples[0]), __s3_cmp_latency);
+        ms = samples[(count - 1) * s3conf->hedge_pct / 100] / 1000;
+
+        return (ms < S3_HEDGE_MIN_MS) ? S3_HEDGE_MIN_MS : ms;
+}
+
+static
+int64_t __s3_elapsed_ms (const struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return ((now.tv_sec - start->tv_sec) * 1000 +
+                (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/*
+  A copy that finished without winning is only good enough to end the
+  request when retrying it would not help
+*/
+static
+int32_t __s3_xfer_final (struct s3_xfer *xfer)
+{
+        int32_t code = xfer->req->resp.code;
+
+        if (xfer->result != CURLE_OK)
+                return 0;
+
+        return ((code < 500) && (code != 429));
+}
+
+/*
+  Requests whose callbacks never block go through the multiplexer,
+  where they share HTTP/2 connections.  File bodies and sinks that can
+  pause, and rate limits which sleep in the callbacks, would hold up
+  every other request on it.
+*/
+static
+int32_t __s3_in_memory (s3_req_t *req, struct s3_conf *s3conf)
+{
+        if ((s3conf->limit_send.rate) || (s3conf->limit_recv.rate))
+                return 0;
+        if ((req->src) && (req->src->type != S3_SOURCE_IOBUF) &&
+            (req->src->type != S3_SOURCE_BUFFER))
+                return 0;
+        if ((req->sink) && (req->sink->type != S3_SINK_IOBUF) &&
+            (req->sink->type != S3_SINK_BUFFER))
+                return 0;
+
+        return 1;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_perform_hedged: GET 'req', sending a second copy when the first
+  has not answered within 'delay' milliseconds
+
+  DESCRIPTION
+
+  Both copies write into the same sink, whichever hands over the first
+  byte of the object claims it and the other one is dropped.  The
+  winner's response ends up in 'req', its endpoint in '*ep'.  The
+  second copy goes to another endpoint.
+
+  RETURN VALUES:
+   0 : Transfer done, '*result' set
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_perform_hedged (s3_req_t *req, struct s3_conf *s3conf,
+                             int32_t avoid, int64_t delay, int32_t *ep,
+                             CURLcode *result)
+{
+        struct s3_xfer  xfers[2];
+        struct s3_xfer  *winner = NULL;
+        struct s3_xfer  *last   = NULL;
+        struct timespec start;
+        s3_req_t        *hreq   = NULL;
+        CURLM           *multi  = NULL;
+        CURLMsg         *msg    = NULL;
+        int64_t         wait    = 0;
+        int             running = 0;
+        int             left    = 0;
+        int32_t         nxfers  = 0;
+        int32_t         i       = 0;
+        int32_t         ret     = -1;
+
+        multi = curl_multi_init ();
+        if (!multi) {
+                errno = -ENOMEM;
+                return -1;
+        }
+        /* Multiplexed onto the slow connection a hedge would not help */
+        curl_multi_setopt (multi, CURLMOPT_PIPELINING,
+                           (long) CURLPIPE_NOTHING);
+
+        memset (xfers, 0, sizeof(xfers));
+        xfers[0].ep = -1;
+        xfers[1].ep = -1;
+
+        nxfers = 1;
+        if (__s3_xfer_setup (&xfers[0], req, s3conf, avoid) < 0)
+                goto out;
+        xfers[0].winner = &winner;
+        curl_multi_add_handle (multi, xfers[0].ch);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+
+        for (;;) {
+                curl_multi_perform (multi, &running);
+
+                while ((msg = curl_multi_info_read (multi, &left))) {
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+                        for (i = 0; i < nxfers; i++) {
+                                if (xfers[i].ch == msg->easy_handle)
+                                        break;
+                        }
+                        if (i == nxfers)
+                                continue;
+                        xfers[i].result = msg->data.result;
+                        xfers[i].done   = 1;
+                        curl_multi_remove_handle (multi, xfers[i].ch);
+                        last = &xfers[i];
+
+                        /* No body (error, empty object), still final */
+                        if ((!winner) && (__s3_xfer_final (last)))
+                                winner = last;
+                }
+
+                if ((winner) && (winner->done))
+                        break;
+
+                /* Every copy failed, the last one speaks for all */
+                for (i = 0; (i < nxfers) && (xfers[i].done); i++)
+                        ;
+                if (i == nxfers) {
+                        winner = last;
+                        break;
+                }
+
+                /* Drop the copy that lost */
+                for (i = 0; (winner) && (i < nxfers); i++) {
+                        if ((&xfers[i] == winner) || (xfers[i].done))
+                                continue;
+                        curl_multi_remove_handle (multi, xfers[i].ch);
+                        xfers[i].result = CURLE_ABORTED_BY_CALLBACK;
+                        xfers[i].done   = 1;
+                }
+
+                wait = 100;
+                if ((!winner) && (nxfers == 1)) {
+                        wait = delay - __s3_elapsed_ms (&start);
+                        /* A hedge over the request rate has to wait */
+                        if ((wait <= 0) &&
+                            (s3_limit_try (&s3conf->limit_reqs, 1) < 0))
+                                wait = 10;
+                        if (wait <= 0) {
+                                hreq = malloc (sizeof(*hreq));
+                                if (hreq) {
+                                        memcpy (hreq, req, sizeof(*hreq));
+                                        s3_resp_reset (&hreq->resp);
+                                        hreq->errlen = 0;
+                                        hreq->io_err = 0;
+                                }
+                                if ((hreq) &&
+                                    (__s3_xfer_setup (&xfers[1], hreq,
+                                                      s3conf,
+                                                      xfers[0].ep) == 0)) {
+                                        xfers[1].winner = &winner;
+                                        curl_multi_add_handle (multi,
+                                                               xfers[1].ch);
+                                        nxfers = 2;
+                                        continue;
+                                }
+                                /* No hedge then, just wait it out */
+                                __s3_xfer_cleanup (&xfers[1]);
+                                delay = INT64_MAX;
+                                wait  = 100;
+                        }
+                }
+
+                curl_multi_poll (multi, NULL, 0, (int) wait, NULL);
+        }
+
+        *result = winner->result;
+        if (winner->req != req) {
+                s3_resp_copy (&req->resp, &winner->req->resp);
+                memcpy (req->errdoc, winner->req->errdoc,
+                        winner->req->errlen + 1);
+                req->errlen = winner->req->errlen;
+                req->io_err = winner->req->io_err;
+        }
+        if ((winner->result == CURLE_OK) && (req->resp.code == 200))
+                __s3_latency_add (s3conf, winner->ch);
+        *ep        = winner->ep;
+        winner->ep = -1;
+
+        ret = 0;
+out:
+        for (i = 0; i < nxfers; i++) {
+                if (!xfers[i].done)
+                        curl_multi_remove_handle (multi, xfers[i].ch);
+                __s3_xfer_cleanup (&xfers[i]);
+        }
+        if (req->sink)
+                req->sink->handle = NULL;
+        if (hreq)
+                free (hreq);
+        curl_multi_cleanup (multi);
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_perform: send 'req' once, hedging GETs when latency allows
+
+  DESCRIPTION
+
+  The endpoint it went to is handed over in '*ep', for the caller to
+  give back with the verdict on the outcome.
+
+  RETURN VALUES:
+   0 : Transfer done, '*result' and '*ep' set
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_perform (s3_req_t *req, struct s3_conf *s3conf, int32_t avoid,
+                      int32_t *ep, CURLcode *result)
+{
+        struct s3_xfer xfer;
+        int64_t        delay = -1;
+        int32_t        code  = CURLE_OK;
+
+        *ep = -1;
+        if ((!strcmp (req->method, "GET")) && (req->sink))
+                delay = __s3_hedge_delay (s3conf);
+
+        if (delay >= 0)
+                return __s3_perform_hedged (req, s3conf, avoid, delay, ep,
+                                            result);
+
+        if (__s3_xfer_setup (&xfer, req, s3conf, avoid) < 0) {
+                __s3_xfer_cleanup (&xfer);
+                return -1;
+        }
+
+        if ((__s3_in_memory (req, s3conf)) &&
+            (s3_mux_perform (s3conf, xfer.ch, &code) == 0))
+                *result = (CURLcode) code;
+        else
+                *result = curl_easy_perform (xfer.ch);
+
+        if ((*result == CURLE_OK) && (req->sink) &&
+            (!strcmp (req->method, "GET")) && (req->resp.code == 200))
+                __s3_latency_add (s3conf, xfer.ch);
+
+        if (req->sink)
+                req->sink->handle = NULL;
+
+        *ep     = xfer.ep;
+        xfer.ep = -1;
+        __s3_xfer_cleanup (&xfer);
+        return 0;
+}
+
+enum {
+        S3_REQ_OK = 0,
+        S3_REQ_RETRY,          /* 5xx, broken connections */
+        S3_REQ_THROTTLED,      /* 429, 503 SlowDown */
+        S3_REQ_TIMEOUT,        /* connect or stall timeouts */
+        S3_REQ_FATAL
+};
+
+/*
+  SYNOPSIS
+
+  __s3_classify: what to do about the outcome of an attempt
+
+  PARAMETERS:
+  @req - request, its response, error document and I/O error
+  @result - curl's result for the transfer
+  @err - set to the errno to fail with
+
+  RETURN VALUES:
+  One of S3_REQ_*
+*/
+
+static
+int32_t __s3_classify (s3_req_t *req, CURLcode result, int32_t *err)
+{
+        const char *error = req->resp.error;
+        int32_t    code   = req->resp.code;
+
+        switch (result) {
+        case CURLE_OK:
+                break;
+        case CURLE_OPERATION_TIMEDOUT:
+                *err = -ETIMEDOUT;
+                return S3_REQ_TIMEOUT;
+        case CURLE_COULDNT_CONNECT:
+                *err = -ECONNREFUSED;
+                return S3_REQ_RETRY;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+        case CURLE_SSL_CONNECT_ERROR:
+                *err = -EIO;
+                return S3_REQ_RETRY;
+        default:
+                /* Source or sink failed, kept by the callback that saw
+                   it */
+                *err = (req->io_err < 0) ? req->io_err : -EIO;
+                return S3_REQ_FATAL;
+        }
+
+        if (((code >= 200) && (code < 300)) || (code == 304))
+                return S3_REQ_OK;
+
+        if ((code == 429) || (code == 503) ||
+            (!strcmp (error, "SlowDown")) ||
+            (!strcmp (error, "Throttling")) ||
+            (!strcmp (error, "RequestLimitExceeded"))) {
+                *err = -EAGAIN;
+                return S3_REQ_THROTTLED;
+        }
+
+        if (!strcmp (error, "RequestTimeout")) {
+                *err = -ETIMEDOUT;
+                return S3_REQ_TIMEOUT;
+        }
+
+        if ((code >= 500) || (!strcmp (error, "InternalError"))) {
+                *err = -EIO;
+                return S3_REQ_RETRY;
+        }
+
+        switch (code) {
+        case 400:
+                *err = -EINVAL;
+                break;
+        case 403:
+                *err = -EACCES;
+                break;
+        case 404:
+                *err = -ENOENT;
+                break;
+        case 409:
+                *err = -EBUSY;
+                break;
+        case 412:
+                /* The object is not the one the caller had in mind */
+                *err = -ESTALE;
+                break;
+        default:
+                *err = -EIO;
+                break;
+        }
+
+        return S3_REQ_FATAL;
+}
+
+/*
+  Retry budget shared by all requests of an s3_conf, so an outage does
+  not turn every request into max_retries more load
+*/
+static
+int32_t __s3_retry_take (struct s3_conf *s3conf, int32_t cost)
+{
+        int32_t ret = -1;
+
+        pthread_mutex_lock (&s3conf->lock);
+        if (s3conf->retry_tokens >= cost) {
+                s3conf->retry_tokens -= cost;
+                ret = 0;
+        }
+        pthread_mutex_unlock (&s3conf->lock);
+
+        return ret;
+}
+
+static
+void __s3_retry_refund (struct s3_conf *s3conf, int32_t tokens)
+{
+        pthread_mutex_lock (&s3conf->lock);
+        s3conf->retry_tokens += tokens;
+        if (s3conf->retry_tokens > S3_RETRY_TOKENS)
+                s3conf->retry_tokens = S3_RETRY_TOKENS;
+        pthread_mutex_unlock (&s3conf->lock);
+}
+
+/* Exponential backoff with full jitter */
+static
+void __s3_backoff (int32_t attempt, int32_t throttled, uint32_t *seed)
+{
+        struct timespec ts;
+        uint64_t        ceil = 0;
+        uint64_t        ms   = 0;
+
+        ceil = (throttled) ? S3_BACKOFF_THROTTLED_MS : S3_BACKOFF_BASE_MS;
+        ceil <<= (attempt < 16) ? attempt : 16;
+        if (ceil > S3_BACKOFF_MAX_MS)
+                ceil = S3_BACKOFF_MAX_MS;
+
+        ms = rand_r (seed) % (ceil + 1);
+        ts.tv_sec  = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000;
+        while ((nanosleep (&ts, &ts) < 0) && (errno == EINTR))
+                ;
+}
+
+/*
+  Put 'req' back to where it was before it was sent, so it can be sent
+  again
+*/
+static
+int32_t __s3_req_rewind (s3_req_t *req)
+{
+        if (req->src) {
+                if (req->chunked) {
+                        if (s3_chunked_rewind (req->chunked) < 0)
+                                return -1;
+                } else {
+                        if (s3_source_seek (req->src, 0) < 0)
+                                return -1;
+                        if (req->md5)
+                                s3_md5_init (req->md5);
+                }
+        }
+
+        if ((req->sink) && (s3_sink_rewind (req->sink) < 0))
+                return -1;
+
+        s3_resp_reset (&req->resp);
+        req->errlen    = 0;
+        req->errdoc[0] = '\0';
+        req->io_err    = 0;
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_do_request: sign and perform an S3 request, retrying it when the
+  failure is transient
+
+  DESCRIPTION
+
+  5xx answers, throttling and broken or stalled connections are
+  retried up to s3conf->max_retries times after an exponential,
+  jittered backoff, as long as the retry budget of 's3conf' lasts and
+  the body can be sent (or received) again.  A retry goes to another
+  endpoint when there is one.  Every attempt waits its turn under the
+  request rate limit.
+
+  PARAMETERS:
+  @req - request built with s3_req_init()
+  @s3conf - S3 configuration
+
+  RETURN VALUES:
+   0 : Success, S3 answered 2xx (or 304)
+  -1 : Failure, errno set appropriately, details in req->resp
+*/
+
+int32_t s3_do_request (s3_req_t *req, struct s3_conf *s3conf)
+{
+        CURLcode result  = CURLE_OK;
+        uint32_t seed    = 0;
+        int32_t  ep      = -1;
+        int32_t  attempt = 0;
+        int32_t  class   = S3_REQ_OK;
+        int32_t  cost    = 0;
+        int32_t  err     = 0;
+
+        if ((!req) || (!s3conf)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        seed = (uint32_t) time (NULL) ^ (uint32_t) (uintptr_t) req;
+
+        for (attempt = 0; ; attempt++) {
+                if ((attempt) && (__s3_req_rewind (req) < 0)) {
+                        errno = err;
+                        return -1;
+                }
+
+                s3_limit_wait (&s3conf->limit_reqs, 1);
+                if (__s3_perform (req, s3conf, ep, &ep, &result) < 0)
+                        return -1;
+
+                if ((req->resp.code >= 300) && (req->errlen))
+                        _xml_get_tag (req->errdoc, "Code", req->resp.error,
+                                      sizeof(req->resp.error));
+
+                class = __s3_classify (req, result, &err);
+                s3_endpoint_put (s3conf, ep, ((class == S3_REQ_RETRY) ||
+                                              (class == S3_REQ_TIMEOUT)));
+                if (class == S3_REQ_OK) {
+                        __s3_retry_refund (s3conf, (cost) ? cost : 1);
+                        return 0;
+                }
+
+                if ((class == S3_REQ_FATAL) ||
+                    (attempt >= s3conf->max_retries))
+                        break;
+
+                cost = (class == S3_REQ_TIMEOUT) ?
+                        S3_RETRY_TIMEOUT_COST : S3_RETRY_COST;
+                if (__s3_retry_take (s3conf, cost) < 0)
+                        break;
+
+                __s3_backoff (attempt, (class == S3_REQ_THROTTLED), &seed);
+        }
+
+        errno = err;
+        return -1;
+}
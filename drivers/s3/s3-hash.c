@@ -0,0 +1,615 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "s3-hash.h"
+
+/* Bytes read from every part per round in s3_etag_fd() */
+#define S3_ETAG_READ (1024 * 1024)
+
+static const uint32_t md5_k[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+        0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+        0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+        0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+        0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+        0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+        0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+        0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+        0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+        0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+        0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+        0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+        0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+        0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+/*
+  The 64 MD5 steps, OP (function, a, b, c, d, word, shift, step), shared
+  by the scalar and the SIMD block functions so both stay unrolled
+*/
+#define MD5_ROUNDS(OP)                                                  \
+        OP (F, a, b, c, d,  0,  7,  0);                                 \
+        OP (F, d, a, b, c,  1, 12,  1);                                 \
+        OP (F, c, d, a, b,  2, 17,  2);                                 \
+        OP (F, b, c, d, a,  3, 22,  3);                                 \
+        OP (F, a, b, c, d,  4,  7,  4);                                 \
+        OP (F, d, a, b, c,  5, 12,  5);                                 \
+        OP (F, c, d, a, b,  6, 17,  6);                                 \
+        OP (F, b, c, d, a,  7, 22,  7);                                 \
+        OP (F, a, b, c, d,  8,  7,  8);                                 \
+        OP (F, d, a, b, c,  9, 12,  9);                                 \
+        OP (F, c, d, a, b, 10, 17, 10);                                 \
+        OP (F, b, c, d, a, 11, 22, 11);                                 \
+        OP (F, a, b, c, d, 12,  7, 12);                                 \
+        OP (F, d, a, b, c, 13, 12, 13);                                 \
+        OP (F, c, d, a, b, 14, 17, 14);                                 \
+        OP (F, b, c, d, a, 15, 22, 15);                                 \
+        OP (G, a, b, c, d,  1,  5, 16);                                 \
+        OP (G, d, a, b, c,  6,  9, 17);                                 \
+        OP (G, c, d, a, b, 11, 14, 18);                                 \
+        OP (G, b, c, d, a,  0, 20, 19);                                 \
+        OP (G, a, b, c, d,  5,  5, 20);                                 \
+        OP (G, d, a, b, c, 10,  9, 21);                                 \
+        OP (G, c, d, a, b, 15, 14, 22);                                 \
+        OP (G, b, c, d, a,  4, 20, 23);                                 \
+        OP (G, a, b, c, d,  9,  5, 24);                                 \
+        OP (G, d, a, b, c, 14,  9, 25);                                 \
+        OP (G, c, d, a, b,  3, 14, 26);                                 \
+        OP (G, b, c, d, a,  8, 20, 27);                                 \
+        OP (G, a, b, c, d, 13,  5, 28);                                 \
+        OP (G, d, a, b, c,  2,  9, 29);                                 \
+        OP (G, c, d, a, b,  7, 14, 30);                                 \
+        OP (G, b, c, d, a, 12, 20, 31);                                 \
+        OP (H, a, b, c, d,  5,  4, 32);                                 \
+        OP (H, d, a, b, c,  8, 11, 33);                                 \
+        OP (H, c, d, a, b, 11, 16, 34);                                 \
+        OP (H, b, c, d, a, 14, 23, 35);                                 \
+        OP (H, a, b, c, d,  1,  4, 36);                                 \
+        OP (H, d, a, b, c,  4, 11, 37);                                 \
+        OP (H, c, d, a, b,  7, 16, 38);                                 \
+        OP (H, b, c, d, a, 10, 23, 39);                                 \
+        OP (H, a, b, c, d, 13,  4, 40);                                 \
+        OP (H, d, a, b, c,  0, 11, 41);                                 \
+        OP (H, c, d, a, b,  3, 16, 42);                                 \
+        OP (H, b, c, d, a,  6, 23, 43);                                 \
+        OP (H, a, b, c, d,  9,  4, 44);                                 \
+        OP (H, d, a, b, c, 12, 11, 45);                                 \
+        OP (H, c, d, a, b, 15, 16, 46);                                 \
+        OP (H, b, c, d, a,  2, 23, 47);                                 \
+        OP (I, a, b, c, d,  0,  6, 48);                                 \
+        OP (I, d, a, b, c,  7, 10, 49);                                 \
+        OP (I, c, d, a, b, 14, 15, 50);                                 \
+        OP (I, b, c, d, a,  5, 21, 51);                                 \
+        OP (I, a, b, c, d, 12,  6, 52);                                 \
+        OP (I, d, a, b, c,  3, 10, 53);                                 \
+        OP (I, c, d, a, b, 10, 15, 54);                                 \
+        OP (I, b, c, d, a,  1, 21, 55);                                 \
+        OP (I, a, b, c, d,  8,  6, 56);                                 \
+        OP (I, d, a, b, c, 15, 10, 57);                                 \
+        OP (I, c, d, a, b,  6, 15, 58);                                 \
+        OP (I, b, c, d, a, 13, 21, 59);                                 \
+        OP (I, a, b, c, d,  4,  6, 60);                                 \
+        OP (I, d, a, b, c, 11, 10, 61);                                 \
+        OP (I, c, d, a, b,  2, 15, 62);                                 \
+        OP (I, b, c, d, a,  9, 21, 63);
+
+static const unsigned char md5_zero[S3_MD5_BLOCK];
+
+static const char hex_table[] = "0123456789abcdef";
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static inline
+uint32_t __le32 (const unsigned char *p)
+{
+        return ((uint32_t) p[0]) | ((uint32_t) p[1] << 8) |
+                ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_OP(f, a, b, c, d, j, s, i)                                  \
+        do {                                                            \
+                a += MD5_##f (b, c, d) + w[j] + md5_k[i];               \
+                a  = b + ROTL32 (a, s);                                 \
+        } while (0)
+
+static
+void __md5_block (uint32_t *h, const unsigned char *p)
+{
+        uint32_t w[16];
+        uint32_t a = h[0];
+        uint32_t b = h[1];
+        uint32_t c = h[2];
+        uint32_t d = h[3];
+        int32_t  i = 0;
+
+        for (i = 0; i < 16; i++)
+                w[i] = __le32 (p + 4 * i);
+
+        MD5_ROUNDS (MD5_OP);
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+}
+
+void s3_md5_init (s3_md5_t *ctx)
+{
+        ctx->h[0] = 0x67452301;
+        ctx->h[1] = 0xefcdab89;
+        ctx->h[2] = 0x98badcfe;
+        ctx->h[3] = 0x10325476;
+        ctx->len  = 0;
+        ctx->fill = 0;
+}
+
+void s3_md5_update (s3_md5_t *ctx, const void *data, size_t len)
+{
+        const unsigned char *p = data;
+        size_t              n  = 0;
+
+        ctx->len += len;
+
+        if (ctx->fill) {
+                n = S3_MD5_BLOCK - ctx->fill;
+                if (n > len)
+                        n = len;
+                memcpy (ctx->block + ctx->fill, p, n);
+                ctx->fill += n;
+                p   += n;
+                len -= n;
+                if (ctx->fill < S3_MD5_BLOCK)
+                        return;
+                __md5_block (ctx->h, ctx->block);
+                ctx->fill = 0;
+        }
+
+        while (len >= S3_MD5_BLOCK) {
+                __md5_block (ctx->h, p);
+                p   += S3_MD5_BLOCK;
+                len -= S3_MD5_BLOCK;
+        }
+
+        if (len) {
+                memcpy (ctx->block, p, len);
+                ctx->fill = len;
+        }
+}
+
+void s3_md5_final (s3_md5_t *ctx, unsigned char *md)
+{
+        uint64_t bits = ctx->len << 3;
+        int32_t  i    = 0;
+
+        ctx->block[ctx->fill++] = 0x80;
+        if (ctx->fill > S3_MD5_BLOCK - 8) {
+                memset (ctx->block + ctx->fill, 0, S3_MD5_BLOCK - ctx->fill);
+                __md5_block (ctx->h, ctx->block);
+                ctx->fill = 0;
+        }
+        memset (ctx->block + ctx->fill, 0, S3_MD5_BLOCK - 8 - ctx->fill);
+
+        for (i = 0; i < 8; i++)
+                ctx->block[S3_MD5_BLOCK - 8 + i] = (bits >> (8 * i)) & 0xff;
+        __md5_block (ctx->h, ctx->block);
+
+        for (i = 0; i < 16; i++)
+                md[i] = (ctx->h[i / 4] >> (8 * (i % 4))) & 0xff;
+}
+
+#if defined(__SSE2__)
+
+/*
+  Four MD5 streams side by side, one per 32 bit lane: lane 'l' of every
+  vector belongs to stream 'l'.  MD5 is a serial chain within a stream,
+  so this is the only way to keep the vector units busy (isa-l style
+  multi-buffer hashing).
+*/
+
+#define V_ROTL(x, n)                                                    \
+        _mm_or_si128 (_mm_slli_epi32 ((x), (n)),                        \
+                      _mm_srli_epi32 ((x), 32 - (n)))
+
+#define V_F(x, y, z)                                                    \
+        _mm_xor_si128 ((z), _mm_and_si128 ((x), _mm_xor_si128 ((y), (z))))
+#define V_G(x, y, z)                                                    \
+        _mm_xor_si128 ((y), _mm_and_si128 ((z), _mm_xor_si128 ((x), (y))))
+#define V_H(x, y, z)                                                    \
+        _mm_xor_si128 (_mm_xor_si128 ((x), (y)), (z))
+#define V_I(x, y, z)                                                    \
+        _mm_xor_si128 ((y), _mm_or_si128 ((x), _mm_xor_si128 ((z), ones)))
+
+#define V_OP(f, a, b, c, d, j, s, i)                                    \
+        do {                                                            \
+                a = _mm_add_epi32 (a, _mm_add_epi32 (V_##f (b, c, d),   \
+                        _mm_add_epi32 (w[j], _mm_set1_epi32 (md5_k[i])))); \
+                a = _mm_add_epi32 (b, V_ROTL (a, s));                   \
+        } while (0)
+
+static
+void __md5_block_x4 (__m128i *h, const unsigned char *p[S3_MD5_LANES])
+{
+        __m128i w[16];
+        __m128i v0, v1, v2, v3;
+        __m128i t0, t1, t2, t3;
+        __m128i a    = h[0];
+        __m128i b    = h[1];
+        __m128i c    = h[2];
+        __m128i d    = h[3];
+        __m128i ones = _mm_set1_epi32 (-1);
+        int32_t i    = 0;
+
+        /* Transpose 4x4 words so w[i] holds word i of every lane */
+        for (i = 0; i < 16; i += 4) {
+                v0 = _mm_loadu_si128 ((const __m128i *) (p[0] + 4 * i));
+                v1 = _mm_loadu_si128 ((const __m128i *) (p[1] + 4 * i));
+                v2 = _mm_loadu_si128 ((const __m128i *) (p[2] + 4 * i));
+                v3 = _mm_loadu_si128 ((const __m128i *) (p[3] + 4 * i));
+                t0 = _mm_unpacklo_epi32 (v0, v1);
+                t1 = _mm_unpacklo_epi32 (v2, v3);
+                t2 = _mm_unpackhi_epi32 (v0, v1);
+                t3 = _mm_unpackhi_epi32 (v2, v3);
+                w[i]     = _mm_unpacklo_epi64 (t0, t1);
+                w[i + 1] = _mm_unpackhi_epi64 (t0, t1);
+                w[i + 2] = _mm_unpacklo_epi64 (t2, t3);
+                w[i + 3] = _mm_unpackhi_epi64 (t2, t3);
+        }
+
+        MD5_ROUNDS (V_OP);
+
+        h[0] = _mm_add_epi32 (h[0], a);
+        h[1] = _mm_add_epi32 (h[1], b);
+        h[2] = _mm_add_epi32 (h[2], c);
+        h[3] = _mm_add_epi32 (h[3], d);
+}
+
+void s3_md5_update_x4 (s3_md5_t *ctx[S3_MD5_LANES],
+                       const unsigned char *data[S3_MD5_LANES], size_t len)
+{
+        const unsigned char *p[S3_MD5_LANES];
+        uint32_t            st[4][S3_MD5_LANES];
+        __m128i             h[4];
+        size_t              off = 0;
+        int32_t             i   = 0;
+        int32_t             l   = 0;
+
+        for (l = 0; l < S3_MD5_LANES; l++) {
+                for (i = 0; i < 4; i++)
+                        st[i][l] = (ctx[l]) ? ctx[l]->h[i] : 0;
+        }
+        for (i = 0; i < 4; i++)
+                h[i] = _mm_loadu_si128 ((const __m128i *) st[i]);
+
+        for (off = 0; off + S3_MD5_BLOCK <= len; off += S3_MD5_BLOCK) {
+                /* Idle lanes chew on a zero block, their result is dropped */
+                for (l = 0; l < S3_MD5_LANES; l++)
+                        p[l] = (ctx[l]) ? data[l] + off : md5_zero;
+                __md5_block_x4 (h, p);
+        }
+
+        for (i = 0; i < 4; i++)
+                _mm_storeu_si128 ((__m128i *) st[i], h[i]);
+
+        for (l = 0; l < S3_MD5_LANES; l++) {
+                if (!ctx[l])
+                        continue;
+                for (i = 0; i < 4; i++)
+                        ctx[l]->h[i] = st[i][l];
+                ctx[l]->len += off;
+        }
+}
+
+#else /* !__SSE2__ */
+
+void s3_md5_update_x4 (s3_md5_t *ctx[S3_MD5_LANES],
+                       const unsigned char *data[S3_MD5_LANES], size_t len)
+{
+        int32_t l = 0;
+
+        for (l = 0; l < S3_MD5_LANES; l++) {
+                if (ctx[l])
+                        s3_md5_update (ctx[l], data[l],
+                                       len - (len % S3_MD5_BLOCK));
+        }
+}
+
+#endif /* __SSE2__ */
+
+static
+void __hex (const unsigned char *in, size_t len, char *out)
+{
+        while (len--) {
+                *out++ = hex_table[*in >> 4];
+                *out++ = hex_table[*in & 0x0f];
+                in++;
+        }
+        *out = '\0';
+}
+
+void s3_etag_single (const unsigned char *md5, char *etag)
+{
+        __hex (md5, S3_MD5_LEN, etag);
+}
+
+void s3_etag_multipart (const unsigned char (*md5)[S3_MD5_LEN],
+                        int32_t nparts, char *etag)
+{
+        s3_md5_t      ctx;
+        unsigned char md[S3_MD5_LEN];
+
+        s3_md5_init (&ctx);
+        s3_md5_update (&ctx, md5, (size_t) nparts * S3_MD5_LEN);
+        s3_md5_final (&ctx, md);
+
+        __hex (md, S3_MD5_LEN, etag);
+        snprintf (etag + S3_MD5_HEXLEN, S3_ETAG_MAX - S3_MD5_HEXLEN,
+                  "-%d", nparts);
+}
+
+/*
+  SYNOPSIS
+
+  s3_etag_verifiable: tell whether 'etag' is an MD5 based ETag
+
+  DESCRIPTION
+
+  Objects encrypted with SSE-C or SSE-KMS carry opaque ETags, those
+  cannot be checked against the data.
+
+  RETURN VALUES:
+  1 : ETag is "<32 hex>" or "<32 hex>-<parts>"
+  0 : Opaque ETag
+*/
+
+int32_t s3_etag_verifiable (const char *etag)
+{
+        int32_t i = 0;
+
+        if (!etag)
+                return 0;
+
+        if (*etag == '"')
+                etag++;
+
+        for (i = 0; i < S3_MD5_HEXLEN; i++) {
+                if (!(((etag[i] >= '0') && (etag[i] <= '9')) ||
+                      ((etag[i] >= 'a') && (etag[i] <= 'f')) ||
+                      ((etag[i] >= 'A') && (etag[i] <= 'F'))))
+                        return 0;
+        }
+
+        etag += S3_MD5_HEXLEN;
+        if (*etag == '-') {
+                etag++;
+                if ((*etag < '0') || (*etag > '9'))
+                        return 0;
+                while ((*etag >= '0') && (*etag <= '9'))
+                        etag++;
+        }
+
+        return ((*etag == '\0') || ((*etag == '"') && (etag[1] == '\0')));
+}
+
+/*
+  SYNOPSIS
+
+  s3_etag_match: compare two ETags ignoring quotes and hex case
+
+  RETURN VALUES:
+  1 : Match
+  0 : Mismatch
+*/
+
+int32_t s3_etag_match (const char *etag, const char *expected)
+{
+        size_t len1 = 0;
+        size_t len2 = 0;
+
+        if ((!etag) || (!expected))
+                return 0;
+
+        if (*etag == '"')
+                etag++;
+        if (*expected == '"')
+                expected++;
+
+        len1 = strcspn (etag, "\"");
+        len2 = strcspn (expected, "\"");
+
+        return ((len1 == len2) && (!strncasecmp (etag, expected, len1)));
+}
+
+static
+ssize_t __pread_full (int32_t fd, unsigned char *buf, size_t len, off_t off)
+{
+        size_t  done = 0;
+        ssize_t ret  = 0;
+
+        while (done < len) {
+                ret = pread (fd, buf + done, len - done, off + done);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                if (ret == 0)
+                        break;
+                done += ret;
+        }
+
+        return done;
+}
+
+/*
+  SYNOPSIS
+
+  s3_etag_fd: ETag S3 would report for 'length' bytes at 'offset' of
+  'fd' uploaded in 'part_size' parts
+
+  DESCRIPTION
+
+  Parts are hashed S3_MD5_LANES at a time, reading the same window of
+  each part per round, so the file is read once at SIMD speed.  A
+  'part_size' of 0 (or one covering the whole range) gives the single
+  part ETag.
+
+  RETURN VALUES:
+   0 : Success, ETag written to 'etag' (S3_ETAG_MAX bytes)
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_etag_fd (int32_t fd, off_t offset, off_t length,
+                    size_t part_size, char *etag)
+{
+        unsigned char       (*digests)[S3_MD5_LEN] = NULL;
+        unsigned char       *bufs[S3_MD5_LANES]    = {NULL,};
+        const unsigned char *data[S3_MD5_LANES];
+        s3_md5_t            ctx[S3_MD5_LANES];
+        s3_md5_t            *lane[S3_MD5_LANES];
+        ssize_t             got[S3_MD5_LANES];
+        off_t               plen[S3_MD5_LANES];
+        off_t               pos     = 0;
+        off_t               nparts  = 0;
+        off_t               part    = 0;
+        size_t              common  = 0;
+        int32_t             active  = 0;
+        int32_t             aligned = 0;
+        int32_t             l       = 0;
+        int32_t             ret     = -1;
+
+        if ((fd < 0) || (offset < 0) || (length < 0) || (!etag)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if ((!part_size) || ((off_t) part_size >= length))
+                part_size = (length) ? length : 1;
+
+        nparts = (length + part_size - 1) / part_size;
+        if (!nparts)
+                nparts = 1;
+
+        digests = calloc (nparts, S3_MD5_LEN);
+        if (!digests) {
+                errno = -ENOMEM;
+                goto out;
+        }
+
+        for (l = 0; l < S3_MD5_LANES; l++) {
+                bufs[l] = malloc (S3_ETAG_READ);
+                if (!bufs[l]) {
+                        errno = -ENOMEM;
+                        goto out;
+                }
+        }
+
+        for (part = 0; part < nparts; part += S3_MD5_LANES) {
+                for (l = 0; l < S3_MD5_LANES; l++) {
+                        s3_md5_init (&ctx[l]);
+                        plen[l] = 0;
+                        if (part + l >= nparts)
+                                continue;
+                        plen[l] = length - (part + l) * part_size;
+                        if (plen[l] > (off_t) part_size)
+                                plen[l] = part_size;
+                }
+
+                for (pos = 0; ; pos += S3_ETAG_READ) {
+                        active  = 0;
+                        aligned = 1;
+                        common  = S3_ETAG_READ;
+
+                        for (l = 0; l < S3_MD5_LANES; l++) {
+                                got[l]  = 0;
+                                lane[l] = NULL;
+                                data[l] = bufs[l];
+                                if (pos >= plen[l])
+                                        continue;
+
+                                got[l] = plen[l] - pos;
+                                if (got[l] > S3_ETAG_READ)
+                                        got[l] = S3_ETAG_READ;
+                                if (__pread_full (fd, bufs[l], got[l],
+                                                  offset + (part + l) *
+                                                  part_size + pos)
+                                    != got[l]) {
+                                        errno = -EIO;
+                                        goto out;
+                                }
+
+                                lane[l] = &ctx[l];
+                                if ((size_t) got[l] < common)
+                                        common = got[l];
+                                if (ctx[l].fill)
+                                        aligned = 0;
+                                active++;
+                        }
+
+                        if (!active)
+                                break;
+
+                        common -= common % S3_MD5_BLOCK;
+                        if ((active > 1) && (aligned) && (common))
+                                s3_md5_update_x4 (lane, data, common);
+                        else
+                                common = 0;
+
+                        for (l = 0; l < S3_MD5_LANES; l++) {
+                                if (lane[l])
+                                        s3_md5_update (&ctx[l],
+                                                       bufs[l] + common,
+                                                       got[l] - common);
+                        }
+                }
+
+                for (l = 0; (l < S3_MD5_LANES) && (part + l < nparts); l++)
+                        s3_md5_final (&ctx[l], digests[part + l]);
+        }
+
+        if (nparts == 1)
+                s3_etag_single (digests[0], etag);
+        else
+                s3_etag_multipart ((const unsigned char (*)[S3_MD5_LEN])
+                                   digests, nparts, etag);
+        ret = 0;
+out:
+        for (l = 0; l < S3_MD5_LANES; l++) {
+                if (bufs[l])
+                        free (bufs[l]);
+        }
+        if (digests)
+                free (digests);
+        return ret;
+}
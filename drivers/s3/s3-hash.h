@@ -0,0 +1,77 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3_HASH_H__
+#define __S3_HASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define S3_MD5_LEN        16
+#define S3_MD5_HEXLEN     32
+#define S3_MD5_BLOCK      64
+
+/* Number of MD5 streams hashed at once by s3_md5_update_x4() */
+#define S3_MD5_LANES      4
+
+/* 32 hex digits, "-", part count and the surrounding quotes */
+#define S3_ETAG_MAX       48
+
+struct s3_md5;
+typedef struct s3_md5 s3_md5_t;
+
+struct s3_md5 {
+        uint32_t      h[4];
+        uint64_t      len;
+        unsigned char block[S3_MD5_BLOCK];
+        size_t        fill;
+};
+
+/*
+  MD5, one stream at a time
+*/
+
+void s3_md5_init (s3_md5_t *ctx);
+void s3_md5_update (s3_md5_t *ctx, const void *data, size_t len);
+void s3_md5_final (s3_md5_t *ctx, unsigned char *md);
+
+/*
+  MD5, S3_MD5_LANES independent streams at once in SIMD lanes
+
+  Every non-NULL context must be block aligned (no buffered bytes) and
+  'len' must be a multiple of S3_MD5_BLOCK, which is the case while
+  hashing equally sized parts of an object.
+*/
+
+void s3_md5_update_x4 (s3_md5_t *ctx[S3_MD5_LANES],
+                       const unsigned char *data[S3_MD5_LANES], size_t len);
+
+/*
+  ETags, hex MD5 for single part uploads and
+  hex(MD5(MD5(part 1) .. MD5(part N)))-N for multipart uploads
+*/
+
+void s3_etag_single (const unsigned char *md5, char *etag);
+void s3_etag_multipart (const unsigned char (*md5)[S3_MD5_LEN],
+                        int32_t nparts, char *etag);
+int32_t s3_etag_verifiable (const char *etag);
+int32_t s3_etag_match (const char *etag, const char *expected);
+int32_t s3_etag_fd (int32_t fd, off_t offset, off_t length,
+                    size_t part_size, char *etag);
+
+#endif /* __S3_HASH_H__ */
@@ -102,13 +102,20 @@ int32_t s3_iobuf_getline (iobuf_t *iob, char *line, int32_t size)
 void s3_iobuf_free (iobuf_t *iob)
 {
         iobufnode_t *iobnode = NULL;
+        iobufnode_t *tmp_iobnode = NULL;
+
         if (!iob)
                 return;
 
         iobnode = iob->first;
+        while (iobnode) {
+                tmp_iobnode = iobnode->next;
+                if (iobnode->buf)
+                        free (iobnode->buf);
+                free (iobnode);
+                iobnode = tmp_iobnode;
+        }
 
-        if (!iobnode)
-                return;
         if (iob->reply)
                 free (iob->reply);
         if (iob->lastmod)
@@ -117,16 +124,5 @@ void s3_iobuf_free (iobuf_t *iob)
                 free (iob->etag);
         free (iob);
 
-        while (iobnode->next) {
-                iobufnode_t *tmp_iobnode = iobnode->next;
-                if (iobnode->buf)
-                        free (iobnode->buf);
-                free(iobnode);
-                iobnode = tmp_iobnode;
-        }
-
-        if(iobnode)
-                free(iobnode);
-
         return;
 }
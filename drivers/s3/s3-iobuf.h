@@ -15,8 +15,12 @@
   limitations under the License.
 */
 
+#ifndef __S3_IOBUF_H__
+#define __S3_IOBUF_H__
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 struct _iobufnode;
 typedef struct _iobufnode iobufnode_t;
@@ -52,3 +56,5 @@ iobuf_t *s3_iobuf_new (void);
 int32_t s3_iobuf_add (iobuf_t *iob, char *data, int32_t len);
 int32_t s3_iobuf_getline (iobuf_t *iob, char *line, int32_t size);
 void s3_iobuf_free (iobuf_t *iob);
+
+#endif /* __S3_IOBUF_H__ */
@@ -0,0 +1,115 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Rate limits.  Callers reserve tokens and wait out the debt they ran
+  up, so the limit holds as a steady rate whatever the number of
+  threads instead of a burst and a stall.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "s3-limit.h"
+
+#define NSEC_PER_SEC  1000000000LL
+
+static
+int64_t __s3_limit_now (void)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return (now.tv_sec * NSEC_PER_SEC + now.tv_nsec);
+}
+
+void s3_limit_init (s3_limit_t *limit, uint64_t rate, uint64_t burst)
+{
+        __atomic_store_n (&limit->burst, (burst) ? burst : 1,
+                          __ATOMIC_RELAXED);
+        __atomic_store_n (&limit->rate, rate, __ATOMIC_RELAXED);
+        __atomic_store_n (&limit->tat, 0, __ATOMIC_RELAXED);
+}
+
+/*
+  SYNOPSIS
+
+  __s3_limit_take: move the dry time of 'limit' on by 'n' tokens
+
+  DESCRIPTION
+
+  The bucket holds 'burst' tokens, so it is allowed to run dry up to
+  'burst' tokens worth of time ahead of now.  What goes beyond that is
+  the wait.  With 'try' set nothing is taken when there would be one.
+
+  RETURN VALUES:
+  N : Nanoseconds to wait, -1 when 'try' found a wait
+*/
+
+static
+int64_t __s3_limit_take (s3_limit_t *limit, uint64_t n, int32_t try)
+{
+        uint64_t rate  = __atomic_load_n (&limit->rate, __ATOMIC_RELAXED);
+        uint64_t burst = __atomic_load_n (&limit->burst, __ATOMIC_RELAXED);
+        int64_t  now   = 0;
+        int64_t  tat   = 0;
+        int64_t  next  = 0;
+        int64_t  wait  = 0;
+
+        if (!rate)
+                return 0;
+
+        now = __s3_limit_now ();
+        tat = __atomic_load_n (&limit->tat, __ATOMIC_RELAXED);
+        do {
+                next = ((tat > now) ? tat : now) +
+                        (int64_t) (n * NSEC_PER_SEC / rate);
+                wait = next - now - (int64_t) (burst * NSEC_PER_SEC / rate);
+                if ((try) && (wait > 0))
+                        return -1;
+        } while (!__atomic_compare_exchange_n (&limit->tat, &tat, next, 1,
+                                               __ATOMIC_RELAXED,
+                                               __ATOMIC_RELAXED));
+
+        return (wait > 0) ? wait : 0;
+}
+
+int64_t s3_limit_reserve (s3_limit_t *limit, uint64_t n)
+{
+        return __s3_limit_take (limit, n, 0);
+}
+
+int32_t s3_limit_try (s3_limit_t *limit, uint64_t n)
+{
+        return (__s3_limit_take (limit, n, 1) < 0) ? -1 : 0;
+}
+
+void s3_limit_wait (s3_limit_t *limit, uint64_t n)
+{
+        struct timespec ts;
+        int64_t         wait = s3_limit_reserve (limit, n);
+
+        if (!wait)
+                return;
+
+        ts.tv_sec  = wait / NSEC_PER_SEC;
+        ts.tv_nsec = wait % NSEC_PER_SEC;
+        while ((nanosleep (&ts, &ts) < 0) && (errno == EINTR))
+                ;
+}
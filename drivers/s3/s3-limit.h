@@ -0,0 +1,52 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3_LIMIT_H__
+#define __S3_LIMIT_H__
+
+#include <stdint.h>
+
+/* Bursts let through at full speed, a tenth of a second worth */
+#define S3_LIMIT_BURST_DIV  10
+
+struct s3_limit;
+typedef struct s3_limit s3_limit_t;
+
+/*
+  Token bucket kept as the time it runs dry (GCRA).  Taking tokens is a
+  compare and swap on 'tat', no lock is held and callers that have to
+  wait sleep on their own.
+*/
+
+struct s3_limit {
+        int64_t  tat;      /* CLOCK_MONOTONIC nsecs the bucket is dry at */
+        uint64_t rate;     /* tokens per second, 0 for no limit */
+        uint64_t burst;    /* tokens let through at once */
+};
+
+void s3_limit_init (s3_limit_t *limit, uint64_t rate, uint64_t burst);
+
+/* Nanoseconds to wait before using 'n' tokens, which are taken */
+int64_t s3_limit_reserve (s3_limit_t *limit, uint64_t n);
+
+/* Take 'n' tokens, sleeping until they are there */
+void s3_limit_wait (s3_limit_t *limit, uint64_t n);
+
+/* Take 'n' tokens only if that needs no waiting, returns 0 then */
+int32_t s3_limit_try (s3_limit_t *limit, uint64_t n);
+
+#endif /* __S3_LIMIT_H__ */
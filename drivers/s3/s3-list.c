@@ -0,0 +1,787 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "s3-priv.h"
+#include "s3.h"
+
+enum {
+        S3_XML_TEXT = 0,
+        S3_XML_TAG,
+        S3_XML_SKIP,            /* <?xml ...?> and comments */
+};
+
+/*
+  Streaming parser
+*/
+
+void s3_list_parser_init (s3_list_parser_t *parser, s3_list_cb_t entry_cb,
+                          s3_list_token_t token_cb, void *opaque)
+{
+        memset (parser, 0, sizeof(*parser));
+        parser->entry_cb = entry_cb;
+        parser->token_cb = token_cb;
+        parser->opaque   = opaque;
+        parser->state    = S3_XML_TEXT;
+}
+
+static
+int32_t __s3_list_text (s3_list_parser_t *parser, char *out, size_t size)
+{
+        if (_xml_unescape (parser->text, parser->textlen, out, size) ==
+            (size_t) -1) {
+                errno = -ENAMETOOLONG;
+                return -1;
+        }
+
+        return 0;
+}
+
+static
+void __s3_list_open (s3_list_parser_t *parser, const char *name)
+{
+        if ((!strcmp (name, "Contents")) ||
+            (!strcmp (name, "CommonPrefixes"))) {
+                memset (&parser->entry, 0, sizeof(parser->entry));
+                parser->entry.size = -1;
+                parser->in_contents = (name[2] == 'n');
+                parser->in_prefixes = !parser->in_contents;
+        }
+}
+
+static
+int32_t __s3_list_close (s3_list_parser_t *parser, const char *name)
+{
+        s3_entry_t *entry = &parser->entry;
+        char       value[64];
+        char       token[S3_TOKEN_MAX + 1];
+        struct tm  tm;
+
+        if ((parser->in_contents) && (!strcmp (name, "Contents"))) {
+                parser->in_contents = 0;
+                goto deliver;
+        }
+        if ((parser->in_prefixes) && (!strcmp (name, "CommonPrefixes"))) {
+                parser->in_prefixes = 0;
+                entry->is_prefix    = 1;
+                goto deliver;
+        }
+
+        if ((parser->in_contents) || (parser->in_prefixes)) {
+                if ((!strcmp (name, "Key")) || (!strcmp (name, "Prefix")))
+                        return __s3_list_text (parser, entry->key,
+                                               sizeof(entry->key));
+                if (!strcmp (name, "ETag"))
+                        return __s3_list_text (parser, entry->etag,
+                                               sizeof(entry->etag));
+                if (!strcmp (name, "Size")) {
+                        if (__s3_list_text (parser, value,
+                                            sizeof(value)) < 0)
+                                return -1;
+                        entry->size = strtoll (value, NULL, 10);
+                } else if (!strcmp (name, "LastModified")) {
+                        if (__s3_list_text (parser, value,
+                                            sizeof(value)) < 0)
+                                return -1;
+                        memset (&tm, 0, sizeof(tm));
+                        if (strptime (value, "%Y-%m-%dT%H:%M:%S", &tm))
+                                entry->mtime = timegm (&tm);
+                }
+                return 0;
+        }
+
+        if (!strcmp (name, "NextContinuationToken")) {
+                if (__s3_list_text (parser, token, sizeof(token)) < 0)
+                        return -1;
+                if ((token[0]) && (parser->token_cb))
+                        parser->token_cb (token, parser->opaque);
+        } else if (!strcmp (name, "IsTruncated")) {
+                parser->truncated = ((parser->textlen >= 4) &&
+                                     (!strncmp (parser->text, "true", 4)));
+        } else if (!strcmp (name, "KeyCount")) {
+                if (__s3_list_text (parser, value, sizeof(value)) < 0)
+                        return -1;
+                parser->keys = strtoll (value, NULL, 10);
+        }
+
+        return 0;
+
+deliver:
+        if ((parser->stopped) || (!parser->entry_cb))
+                return 0;
+        if (parser->entry_cb (entry, parser->opaque))
+                parser->stopped = 1;
+        return 0;
+}
+
+static
+int32_t __s3_list_tag (s3_list_parser_t *parser)
+{
+        char    *name    = parser->tag;
+        int32_t closing  = 0;
+        int32_t empty    = 0;
+        int32_t ret      = 0;
+
+        parser->tag[parser->taglen] = '\0';
+
+        if (name[0] == '/') {
+                closing = 1;
+                name++;
+        } else if ((parser->taglen) &&
+                   (parser->tag[parser->taglen - 1] == '/')) {
+                empty = 1;
+        }
+        name[strcspn (name, " \t\r\n/")] = '\0';
+
+        if (closing) {
+                ret = __s3_list_close (parser, name);
+        } else {
+                __s3_list_open (parser, name);
+                if (empty) {
+                        parser->textlen = 0;
+                        ret = __s3_list_close (parser, name);
+                }
+        }
+
+        parser->textlen = 0;
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  s3_list_parse: feed the next 'len' bytes of a ListObjectsV2 response
+
+  DESCRIPTION
+
+  Entries go to 'entry_cb' as soon as their closing tag is read and the
+  continuation token to 'token_cb' as soon as it is complete, S3 sends
+  it ahead of the keys so the next page can be asked for while this
+  one is still arriving.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_list_parse (s3_list_parser_t *parser, const char *data,
+                       size_t len)
+{
+        const char *end = data + len;
+        const char *lt  = NULL;
+        size_t     n    = 0;
+        char       c    = 0;
+
+        if ((!parser) || ((!data) && (len))) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        while (data < end) {
+                switch (parser->state) {
+                case S3_XML_TEXT:
+                        lt = memchr (data, '<', end - data);
+                        n  = ((lt) ? lt : end) - data;
+                        if (parser->textlen + n >= sizeof(parser->text)) {
+                                errno = -ENAMETOOLONG;
+                                return -1;
+                        }
+                        memcpy (parser->text + parser->textlen, data, n);
+                        parser->textlen += n;
+                        data += n;
+                        if (lt) {
+                                data++;
+                                parser->state  = S3_XML_TAG;
+                                parser->taglen = 0;
+                        }
+                        break;
+                case S3_XML_TAG:
+                        c = *data++;
+                        if (c == '>') {
+                                parser->state = S3_XML_TEXT;
+                                if (__s3_list_tag (parser) < 0)
+                                        return -1;
+                        } else if ((!parser->taglen) &&
+                                   ((c == '?') || (c == '!'))) {
+                                parser->state = S3_XML_SKIP;
+                        } else if (parser->taglen + 1 <
+                                   sizeof(parser->tag)) {
+                                parser->tag[parser->taglen++] = c;
+                        }
+                        break;
+                case S3_XML_SKIP:
+                        lt = memchr (data, '>', end - data);
+                        if (!lt) {
+                                data = end;
+                                break;
+                        }
+                        data = lt + 1;
+                        parser->state   = S3_XML_TEXT;
+                        parser->textlen = 0;
+                        break;
+                }
+        }
+
+        return 0;
+}
+
+/*
+  Parallel listing
+
+  The key space under the prefix is split into ranges listed at once.
+  It starts as a single range, whenever a page completes with fewer
+  ranges than s3conf->list_parallel the rest of its range is cut in
+  half at a key between the last one listed and the end of the range.
+  The halves follow where the keys actually are without knowing their
+  distribution up front.
+
+  Every range prefetches: its next page is queued the moment the
+  continuation token of the current one is parsed.
+*/
+
+struct s3_list_range {
+        char                 lo[S3_KEY_MAX + 1];   /* start-after, "" from
+                                                      the start */
+        char                 hi[S3_KEY_MAX + 1];   /* last key, "" no end */
+        char                 last[S3_KEY_MAX + 1]; /* last key delivered */
+        int32_t              done;
+        struct s3_list_range *next;
+};
+
+struct s3_list_job {
+        struct s3_list_range *range;
+        char                 token[S3_TOKEN_MAX + 1];  /* "" first page */
+        struct s3_list_job   *next;
+};
+
+struct s3_list_ctx {
+        struct s3_conf       *s3conf;
+        const char           *prefix;
+        const char           *delimiter;
+        s3_list_cb_t         cb;
+        void                 *opaque;
+        int32_t              parallel;
+
+        /* Queue and ranges, guarded by 'lock' */
+        pthread_mutex_t      lock;
+        pthread_cond_t       cond;
+        struct s3_list_job   *head;
+        struct s3_list_job   **tail;
+        struct s3_list_range *ranges;
+        int32_t              nranges;       /* not done yet */
+        int32_t              running;
+        int32_t              stop;
+        int32_t              err;
+
+        /* Calls to 'cb' are serialized */
+        pthread_mutex_t      cb_lock;
+        int32_t              cancelled;
+};
+
+struct s3_list_page {
+        struct s3_list_ctx   *ctx;
+        struct s3_list_job   *job;
+        s3_list_parser_t     parser;
+        int64_t              seen;          /* entries parsed this attempt */
+        int64_t              delivered;     /* entries handed to 'cb' */
+        int32_t              queued;        /* next page is queued */
+        int32_t              past;          /* went past the range end */
+};
+
+/* Called with ctx->lock held */
+static
+void __s3_list_queue (struct s3_list_ctx *ctx, struct s3_list_range *range,
+                      const char *token)
+{
+        struct s3_list_job *job = NULL;
+
+        job = calloc (1, sizeof(*job));
+        if (!job) {
+                if (!ctx->stop) {
+                        ctx->stop = 1;
+                        ctx->err  = -ENOMEM;
+                }
+                return;
+        }
+
+        job->range = range;
+        if (token)
+                snprintf (job->token, sizeof(job->token), "%s", token);
+
+        *ctx->tail = job;
+        ctx->tail  = &job->next;
+        pthread_cond_signal (&ctx->cond);
+}
+
+/* Called with ctx->lock held */
+static
+void __s3_list_range_done (struct s3_list_ctx *ctx,
+                           struct s3_list_range *range)
+{
+        if (range->done)
+                return;
+
+        range->done = 1;
+        ctx->nranges--;
+}
+
+static inline
+int32_t __s3_list_digit (unsigned char c)
+{
+        if (c < 0x20)
+                return 0;
+        if (c > 0x7e)
+                return 94;
+        return c - 0x20;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_list_mid: a key half way between 'lo' and 'hi' ("" for no end)
+
+  DESCRIPTION
+
+  Keys after the prefix are read as base-95 numbers over printable
+  ASCII, anything outside counts as the nearest printable character.
+  With a delimiter the key is cut before it so a common prefix never
+  straddles two ranges.
+
+  RETURN VALUES:
+   0 : Success, lo < mid < hi
+  -1 : No such key
+*/
+
+static
+int32_t __s3_list_mid (struct s3_list_ctx *ctx, const char *lo,
+                       const char *hi, char *mid)
+{
+        size_t  plen  = strlen (ctx->prefix);
+        size_t  alen  = strlen (lo) - plen;
+        size_t  blen  = (hi[0]) ? strlen (hi) - plen : 0;
+        size_t  n     = ((alen > blen) ? alen : blen) + 1;
+        int32_t sum[S3_KEY_MAX + 1];
+        int32_t carry = 0;
+        int32_t v     = 0;
+        size_t  i     = 0;
+        char    *cut  = NULL;
+        char    c     = 0;
+
+        if (plen + n > S3_KEY_MAX)
+                n = S3_KEY_MAX - plen;
+        if (!n)
+                return -1;
+
+        for (i = 0; i < n; i++) {
+                sum[i]  = (i < alen) ?
+                        __s3_list_digit (lo[plen + i]) : 0;
+                sum[i] += (!hi[0]) ? 94 : (i < blen) ?
+                        __s3_list_digit (hi[plen + i]) : 0;
+        }
+        for (i = n; i-- > 0; ) {
+                sum[i] += carry;
+                carry   = sum[i] / 95;
+                sum[i] %= 95;
+        }
+
+        memcpy (mid, ctx->prefix, plen);
+        for (i = 0; i < n; i++) {
+                v        = carry * 95 + sum[i];
+                carry    = v % 2;
+                mid[plen + i] = 0x20 + v / 2;
+        }
+        while ((n) && (mid[plen + n - 1] == ' '))
+                n--;
+        mid[plen + n] = '\0';
+
+        if ((ctx->delimiter[0]) &&
+            ((cut = strstr (mid + plen, ctx->delimiter))))
+                *cut = '\0';
+
+        if ((strcmp (mid, lo) <= 0) || ((hi[0]) && (strcmp (mid, hi) >= 0)))
+                return -1;
+
+        /* Shortest leading part still past 'lo' keeps queries short */
+        for (n = plen + 1; n < strlen (mid); n++) {
+                c      = mid[n];
+                mid[n] = '\0';
+                if (strcmp (mid, lo) > 0)
+                        break;
+                mid[n] = c;
+        }
+
+        return 0;
+}
+
+/* Called with ctx->lock held */
+static
+void __s3_list_split (struct s3_list_ctx *ctx, struct s3_list_range *range)
+{
+        struct s3_list_range *half = NULL;
+        char                 mid[S3_KEY_MAX + 1];
+
+        if ((ctx->stop) || (ctx->nranges >= ctx->parallel) ||
+            (!range->last[0]))
+                return;
+
+        if (__s3_list_mid (ctx, range->last, range->hi, mid) < 0)
+                return;
+
+        half = calloc (1, sizeof(*half));
+        if (!half)
+                return;
+
+        strcpy (half->lo, mid);
+        strcpy (half->hi, range->hi);
+        strcpy (range->hi, mid);
+
+        half->next  = ctx->ranges;
+        ctx->ranges = half;
+        ctx->nranges++;
+
+        __s3_list_queue (ctx, half, NULL);
+}
+
+static
+int32_t __s3_list_entry (const s3_entry_t *entry, void *opaque)
+{
+        struct s3_list_page  *page  = opaque;
+        struct s3_list_ctx   *ctx   = page->ctx;
+        struct s3_list_range *range = page->job->range;
+        int32_t              ret    = 0;
+
+        /* A retried page comes again from the start */
+        if ((page->past) || (++page->seen <= page->delivered))
+                return 0;
+
+        pthread_mutex_lock (&ctx->lock);
+        if ((range->hi[0]) && (strcmp (entry->key, range->hi) > 0)) {
+                page->past = 1;
+                __s3_list_range_done (ctx, range);
+        } else if (strcmp (entry->key, range->last) > 0) {
+                strcpy (range->last, entry->key);
+        }
+        pthread_mutex_unlock (&ctx->lock);
+
+        if (page->past)
+                return 0;
+
+        page->delivered++;
+
+        pthread_mutex_lock (&ctx->cb_lock);
+        if (ctx->cancelled)
+                ret = 1;
+        else if ((ret = ctx->cb (entry, ctx->opaque)))
+                ctx->cancelled = 1;
+        pthread_mutex_unlock (&ctx->cb_lock);
+
+        return ret;
+}
+
+static
+void __s3_list_token (const char *token, void *opaque)
+{
+        struct s3_list_page  *page  = opaque;
+        struct s3_list_ctx   *ctx   = page->ctx;
+        struct s3_list_range *range = page->job->range;
+
+        pthread_mutex_lock (&ctx->lock);
+        if ((!page->queued) && (!range->done) && (!ctx->stop)) {
+                __s3_list_queue (ctx, range, token);
+                page->queued = 1;
+        }
+        pthread_mutex_unlock (&ctx->lock);
+}
+
+static
+size_t __s3_list_consume (const char *data, size_t len, void *opaque)
+{
+        struct s3_list_page *page = opaque;
+
+        if (s3_list_parse (&page->parser, data, len) < 0)
+                return (size_t) -1;
+
+        return len;
+}
+
+static
+int32_t __s3_list_rewind (void *opaque)
+{
+        struct s3_list_page *page = opaque;
+
+        s3_list_parser_init (&page->parser, __s3_list_entry,
+                             __s3_list_token, page);
+        page->seen = 0;
+
+        return 0;
+}
+
+static
+int32_t __s3_list_query (s3_req_t *req, struct s3_list_ctx *ctx,
+                         struct s3_list_job *job)
+{
+        char   enc[3 * S3_KEY_MAX + 1];
+        size_t size = sizeof(req->query);
+        size_t n    = 0;
+
+        /* Canonical order, the names sort as written */
+        if (job->token[0]) {
+                if (_uri_encode (job->token, enc, sizeof(enc), 0) ==
+                    (size_t) -1)
+                        goto toolong;
+                n += snprintf (req->query + n, size - n,
+                               "continuation-token=%s&", enc);
+        }
+        if ((ctx->delimiter[0]) && (n < size)) {
+                if (_uri_encode (ctx->delimiter, enc, sizeof(enc), 0) ==
+                    (size_t) -1)
+                        goto toolong;
+                n += snprintf (req->query + n, size - n, "delimiter=%s&",
+                               enc);
+        }
+        if (n < size)
+                n += snprintf (req->query + n, size - n,
+                               "list-type=2&max-keys=%d",
+                               S3_LIST_PAGE_KEYS);
+        if ((ctx->prefix[0]) && (n < size)) {
+                if (_uri_encode (ctx->prefix, enc, sizeof(enc), 0) ==
+                    (size_t) -1)
+                        goto toolong;
+                n += snprintf (req->query + n, size - n, "&prefix=%s", enc);
+        }
+        if ((!job->token[0]) && (job->range->lo[0]) && (n < size)) {
+                if (_uri_encode (job->range->lo, enc, sizeof(enc), 0) ==
+                    (size_t) -1)
+                        goto toolong;
+                n += snprintf (req->query + n, size - n, "&start-after=%s",
+                               enc);
+        }
+        if (n >= size)
+                goto toolong;
+
+        return 0;
+toolong:
+        errno = -ENAMETOOLONG;
+        return -1;
+}
+
+static
+void __s3_list_page (struct s3_list_ctx *ctx, struct s3_list_page *page)
+{
+        struct s3_list_range *range = page->job->range;
+        s3_req_t             req;
+        s3_sink_t            sink;
+        int32_t              ret    = -1;
+
+        pthread_mutex_lock (&ctx->lock);
+        ret = ((ctx->stop) || (range->done)) ? 1 : 0;
+        pthread_mutex_unlock (&ctx->lock);
+        if (ret)
+                return;
+
+        page->seen      = 0;
+        page->delivered = 0;
+        page->queued    = 0;
+        page->past      = 0;
+        s3_list_parser_init (&page->parser, __s3_list_entry,
+                             __s3_list_token, page);
+
+        ret = s3_req_init (&req, "GET", ctx->s3conf, NULL);
+        if (ret == 0)
+                ret = __s3_list_query (&req, ctx, page->job);
+        if (ret == 0)
+                ret = s3_sink_init_callback (&sink, __s3_list_consume, NULL,
+                                             page);
+        if (ret == 0) {
+                sink.rewind = __s3_list_rewind;
+                req.sink    = &sink;
+                ret = s3_do_request (&req, ctx->s3conf);
+        }
+
+        pthread_mutex_lock (&ctx->lock);
+        if (ret < 0) {
+                if (!ctx->stop) {
+                        ctx->stop = 1;
+                        ctx->err  = errno;
+                }
+        } else if (page->parser.stopped) {
+                if (!ctx->stop) {
+                        ctx->stop = 1;
+                        ctx->err  = -ECANCELED;
+                }
+        } else if ((page->past) || (!page->parser.truncated)) {
+                __s3_list_range_done (ctx, range);
+        } else if (!page->queued) {
+                /* Truncated without a token, nothing to continue from */
+                ctx->stop = 1;
+                ctx->err  = -EPROTO;
+        } else if (!range->done) {
+                __s3_list_split (ctx, range);
+        }
+        pthread_mutex_unlock (&ctx->lock);
+}
+
+static
+void *__s3_list_worker (void *arg)
+{
+        struct s3_list_ctx  *ctx  = arg;
+        struct s3_list_page *page = NULL;
+        struct s3_list_job  *job  = NULL;
+
+        page = calloc (1, sizeof(*page));
+        if (!page) {
+                pthread_mutex_lock (&ctx->lock);
+                if (!ctx->stop) {
+                        ctx->stop = 1;
+                        ctx->err  = -ENOMEM;
+                }
+                pthread_mutex_unlock (&ctx->lock);
+        }
+
+        pthread_mutex_lock (&ctx->lock);
+        for (;;) {
+                while ((!ctx->head) && (ctx->running))
+                        pthread_cond_wait (&ctx->cond, &ctx->lock);
+                if (!ctx->head)
+                        break;
+
+                job = ctx->head;
+                ctx->head = job->next;
+                if (!ctx->head)
+                        ctx->tail = &ctx->head;
+                ctx->running++;
+                pthread_mutex_unlock (&ctx->lock);
+
+                if (page) {
+                        page->ctx = ctx;
+                        page->job = job;
+                        __s3_list_page (ctx, page);
+                }
+                free (job);
+
+                pthread_mutex_lock (&ctx->lock);
+                ctx->running--;
+                pthread_cond_broadcast (&ctx->cond);
+        }
+        pthread_mutex_unlock (&ctx->lock);
+
+        free (page);
+        return NULL;
+}
+
+/*
+  SYNOPSIS
+
+  s3_list: list the bucket keys under 'prefix' with ListObjectsV2
+
+  DESCRIPTION
+
+  'cb' gets every key, and every common prefix when 'delimiter' is
+  set, while the pages stream in.  Pages and key ranges are fetched
+  in parallel (see s3_set_list_parallel()) so entries arrive in no
+  particular order, calls to 'cb' never overlap but come from internal
+  threads.
+
+  PARAMETERS:
+  @s3conf - S3 configuration
+  @prefix - only keys starting with it, NULL for all
+  @delimiter - group keys into common prefixes, NULL for none
+  @cb - called for every entry, non-zero stops the listing
+  @opaque - handed to 'cb'
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately (-ECANCELED when 'cb' stopped)
+*/
+
+int32_t s3_list (struct s3_conf *s3conf, const char *prefix,
+                 const char *delimiter, s3_list_cb_t cb, void *opaque)
+{
+        struct s3_list_ctx   ctx;
+        struct s3_list_range *range   = NULL;
+        pthread_t            threads[2 * S3_LIST_PARALLEL_MAX];
+        int32_t              nthreads = 0;
+        int32_t              i        = 0;
+        int32_t              ret      = -1;
+
+        if ((!s3conf) || (!cb)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (&ctx, 0, sizeof(ctx));
+        ctx.s3conf    = s3conf;
+        ctx.prefix    = (prefix) ? prefix : "";
+        ctx.delimiter = (delimiter) ? delimiter : "";
+        ctx.cb        = cb;
+        ctx.opaque    = opaque;
+        ctx.parallel  = s3conf->list_parallel;
+        ctx.tail      = &ctx.head;
+        pthread_mutex_init (&ctx.lock, NULL);
+        pthread_cond_init (&ctx.cond, NULL);
+        pthread_mutex_init (&ctx.cb_lock, NULL);
+
+        if (strlen (ctx.prefix) > S3_KEY_MAX) {
+                errno = -ENAMETOOLONG;
+                goto out;
+        }
+
+        range = calloc (1, sizeof(*range));
+        if (!range) {
+                errno = -ENOMEM;
+                goto out;
+        }
+        ctx.ranges  = range;
+        ctx.nranges = 1;
+        __s3_list_queue (&ctx, range, NULL);
+
+        /* Every range keeps its page and the prefetched next one going */
+        for (i = 0; i < 2 * ctx.parallel; i++) {
+                if (pthread_create (&threads[nthreads], NULL,
+                                    __s3_list_worker, &ctx))
+                        break;
+                nthreads++;
+        }
+
+        /* No threads to be had, list one page after the other */
+        if (!nthreads)
+                __s3_list_worker (&ctx);
+        for (i = 0; i < nthreads; i++)
+                pthread_join (threads[i], NULL);
+
+        ret = (ctx.err) ? -1 : 0;
+        if (ret < 0)
+                errno = ctx.err;
+out:
+        while (ctx.ranges) {
+                range = ctx.ranges;
+                ctx.ranges = range->next;
+                free (range);
+        }
+        pthread_mutex_destroy (&ctx.lock);
+        pthread_cond_destroy (&ctx.cond);
+        pthread_mutex_destroy (&ctx.cb_lock);
+
+        return ret;
+}
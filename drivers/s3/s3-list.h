@@ -0,0 +1,82 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3_LIST_H__
+#define __S3_LIST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "s3-hash.h"
+
+/* S3 keys are at most 1024 bytes of UTF-8 */
+#define S3_KEY_MAX        1024
+#define S3_TOKEN_MAX      1024
+
+/* Escaped text of a single element, keys may come &#x..; encoded */
+#define S3_LIST_TEXT_MAX  (4 * S3_KEY_MAX)
+
+/* One key, or one common prefix, of a listing */
+typedef struct {
+        char        key[S3_KEY_MAX + 1];
+        int32_t     is_prefix;          /* <CommonPrefixes> entry */
+        int64_t     size;
+        char        etag[S3_ETAG_MAX];  /* with the quotes */
+        time_t      mtime;
+} s3_entry_t;
+
+/* Returns 0 to go on, anything else stops the listing */
+typedef int32_t (*s3_list_cb_t) (const s3_entry_t *entry, void *opaque);
+
+/* Called with <NextContinuationToken> as soon as it is parsed */
+typedef void (*s3_list_token_t) (const char *token, void *opaque);
+
+struct s3_list_parser;
+typedef struct s3_list_parser s3_list_parser_t;
+
+/*
+  Incremental ListObjectsV2 parser, fed the response as it arrives.
+  Elements may be split anywhere across calls, nothing but the element
+  being read is kept so memory does not grow with the page.
+*/
+
+struct s3_list_parser {
+        s3_list_cb_t    entry_cb;
+        s3_list_token_t token_cb;
+        void            *opaque;
+
+        int32_t         state;
+        char            tag[64];
+        size_t          taglen;
+        char            text[S3_LIST_TEXT_MAX];
+        size_t          textlen;
+        int32_t         in_contents;
+        int32_t         in_prefixes;
+        s3_entry_t      entry;
+
+        int32_t         truncated;      /* <IsTruncated>true */
+        int64_t         keys;           /* <KeyCount> */
+        int32_t         stopped;        /* 'entry_cb' said stop */
+};
+
+void s3_list_parser_init (s3_list_parser_t *parser, s3_list_cb_t entry_cb,
+                          s3_list_token_t token_cb, void *opaque);
+int32_t s3_list_parse (s3_list_parser_t *parser, const char *data,
+                       size_t len);
+
+#endif /* __S3_LIST_H__ */
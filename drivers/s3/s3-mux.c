@@ -0,0 +1,212 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Request multiplexer.  curl only multiplexes HTTP/2 streams of
+  transfers driven by the same multi handle, a connection cache shared
+  between threads each running curl_easy_perform() never does.  Small
+  requests of every thread of an s3_conf are therefore handed to one
+  thread driving one multi handle, where they share its connections.
+
+  Callbacks of these transfers run on that thread, so only requests
+  whose body and answer live in memory come here, see s3-exec.c.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "s3-priv.h"
+
+/* A transfer handed to the multiplexer */
+struct s3_mux_item {
+        CURL               *ch;
+        CURLcode           result;
+        int32_t            done;
+        struct s3_mux_item *next;
+};
+
+static
+void __s3_mux_done (struct s3_conf *s3conf, CURL *ch, CURLcode result)
+{
+        struct s3_mux_item *item = NULL;
+
+        curl_easy_getinfo (ch, CURLINFO_PRIVATE, (char **) &item);
+
+        pthread_mutex_lock (&s3conf->mux_lock);
+        item->result = result;
+        item->done   = 1;
+        pthread_cond_broadcast (&s3conf->mux_cond);
+        pthread_mutex_unlock (&s3conf->mux_lock);
+}
+
+static
+void *__s3_mux_loop (void *arg)
+{
+        struct s3_conf     *s3conf  = arg;
+        CURLM              *multi   = s3conf->mux;
+        struct s3_mux_item *item    = NULL;
+        CURLMsg            *msg     = NULL;
+        CURLcode           result   = CURLE_OK;
+        CURL               *ch      = NULL;
+        long               limit    = -1;
+        int                running  = 0;
+        int                left     = 0;
+
+        pthread_mutex_lock (&s3conf->mux_lock);
+        while (!s3conf->mux_stop) {
+                if (limit != s3conf->max_connections) {
+                        limit = s3conf->max_connections;
+                        curl_multi_setopt (multi,
+                                           CURLMOPT_MAX_HOST_CONNECTIONS,
+                                           limit);
+                }
+                while ((item = s3conf->mux_queue)) {
+                        s3conf->mux_queue = item->next;
+                        curl_easy_setopt (item->ch, CURLOPT_PRIVATE, item);
+                        if (curl_multi_add_handle (multi, item->ch) !=
+                            CURLM_OK) {
+                                item->result = CURLE_OUT_OF_MEMORY;
+                                item->done   = 1;
+                                pthread_cond_broadcast (&s3conf->mux_cond);
+                        }
+                }
+                pthread_mutex_unlock (&s3conf->mux_lock);
+
+                curl_multi_perform (multi, &running);
+                while ((msg = curl_multi_info_read (multi, &left))) {
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+                        /* 'msg' goes with the handle */
+                        ch     = msg->easy_handle;
+                        result = msg->data.result;
+                        curl_multi_remove_handle (multi, ch);
+                        __s3_mux_done (s3conf, ch, result);
+                }
+
+                curl_multi_poll (multi, NULL, 0, S3_MUX_POLL_MS, NULL);
+                pthread_mutex_lock (&s3conf->mux_lock);
+        }
+        pthread_mutex_unlock (&s3conf->mux_lock);
+
+        return NULL;
+}
+
+int32_t s3_mux_init (struct s3_conf *s3conf)
+{
+        pthread_mutex_init (&s3conf->mux_lock, NULL);
+        pthread_cond_init (&s3conf->mux_cond, NULL);
+        s3conf->mux         = NULL;
+        s3conf->mux_queue   = NULL;
+        s3conf->mux_running = 0;
+        s3conf->mux_stop    = 0;
+
+        return 0;
+}
+
+void s3_mux_fini (struct s3_conf *s3conf)
+{
+        pthread_mutex_lock (&s3conf->mux_lock);
+        s3conf->mux_stop = 1;
+        pthread_mutex_unlock (&s3conf->mux_lock);
+
+        if (s3conf->mux_running) {
+                curl_multi_wakeup (s3conf->mux);
+                pthread_join (s3conf->mux_thread, NULL);
+                s3conf->mux_running = 0;
+        }
+        if (s3conf->mux)
+                curl_multi_cleanup (s3conf->mux);
+        s3conf->mux = NULL;
+
+        pthread_cond_destroy (&s3conf->mux_cond);
+        pthread_mutex_destroy (&s3conf->mux_lock);
+}
+
+/* Called with 'mux_lock' held, the thread starts with the first request */
+static
+int32_t __s3_mux_start (struct s3_conf *s3conf)
+{
+        if (s3conf->mux_running)
+                return 0;
+
+        if (!s3conf->mux) {
+                s3conf->mux = curl_multi_init ();
+                if (!s3conf->mux) {
+                        errno = -ENOMEM;
+                        return -1;
+                }
+                curl_multi_setopt (s3conf->mux, CURLMOPT_PIPELINING,
+                                   (long) CURLPIPE_MULTIPLEX);
+        }
+
+        if (pthread_create (&s3conf->mux_thread, NULL, __s3_mux_loop,
+                            s3conf)) {
+                errno = -EAGAIN;
+                return -1;
+        }
+        s3conf->mux_running = 1;
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_mux_perform: run the transfer set up on 'handle' on the
+  multiplexer and wait for it
+
+  RETURN VALUES:
+   0 : Transfer done, '*result' holds its CURLcode
+  -1 : Failure, errno set appropriately, nothing was sent
+*/
+
+int32_t s3_mux_perform (struct s3_conf *s3conf, void *handle,
+                        int32_t *result)
+{
+        struct s3_mux_item item;
+        struct s3_mux_item **tail = NULL;
+
+        memset (&item, 0, sizeof(item));
+        item.ch = handle;
+
+        pthread_mutex_lock (&s3conf->mux_lock);
+        if ((s3conf->mux_stop) || (__s3_mux_start (s3conf) < 0)) {
+                pthread_mutex_unlock (&s3conf->mux_lock);
+                if (s3conf->mux_stop)
+                        errno = -ESHUTDOWN;
+                return -1;
+        }
+        for (tail = &s3conf->mux_queue; *tail; tail = &(*tail)->next)
+                ;
+        *tail = &item;
+        pthread_mutex_unlock (&s3conf->mux_lock);
+
+        curl_multi_wakeup (s3conf->mux);
+
+        pthread_mutex_lock (&s3conf->mux_lock);
+        while (!item.done)
+                pthread_cond_wait (&s3conf->mux_cond, &s3conf->mux_lock);
+        pthread_mutex_unlock (&s3conf->mux_lock);
+
+        curl_easy_setopt (handle, CURLOPT_PRIVATE, NULL);
+        *result = (int32_t) item.result;
+        return 0;
+}
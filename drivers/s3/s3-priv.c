@@ -15,37 +15,126 @@
   limitations under the License.
 */
 
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
 #include "s3-priv.h"
 
-char *_base64_encode(const uchar_t *input)
+static const char base64_table[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char hex_table[] = "0123456789abcdef";
+static const char HEX_table[] = "0123456789ABCDEF";
+
+/*
+  RFC 3986 unreserved characters, the only ones SigV4 leaves unescaped
+*/
+static const uchar_t unreserved_table[256] = {
+        ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1,
+        ['G'] = 1, ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1,
+        ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1,
+        ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1,
+        ['Y'] = 1, ['Z'] = 1,
+        ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1,
+        ['g'] = 1, ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1,
+        ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+        ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+        ['y'] = 1, ['z'] = 1,
+        ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1,
+        ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+        ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+};
+
+/*
+  SYNOPSIS
+
+  _base64_encode: encode 'len' bytes of 'in' into 'out', which must
+  hold 4 * ((len + 2) / 3) + 1 bytes
+
+  RETURN VALUES:
+  N : Length of the encoded string
+*/
+
+size_t _base64_encode (const uchar_t *in, size_t len, char *out)
 {
-        BIO *bmem;
-        BIO *b64;
-        BIO *bio;
-        BUF_MEM *bptr = {0,};
-        char *buf = NULL;
+        char     *p = out;
+        uint32_t v  = 0;
 
-        b64 = BIO_new (BIO_f_base64());
-        bmem = BIO_new (BIO_s_mem());
-        bio = BIO_push (b64, bmem);
+        while (len >= 3) {
+                v = (in[0] << 16) | (in[1] << 8) | in[2];
+                *p++ = base64_table[(v >> 18) & 0x3f];
+                *p++ = base64_table[(v >> 12) & 0x3f];
+                *p++ = base64_table[(v >> 6) & 0x3f];
+                *p++ = base64_table[v & 0x3f];
+                in  += 3;
+                len -= 3;
+        }
 
-        BIO_set_flags (bio, BIO_FLAGS_BASE64_NO_NL);
-        BIO_write (bio, input, strlen((char *)input));
+        if (len) {
+                v = in[0] << 16;
+                if (len == 2)
+                        v |= in[1] << 8;
+                *p++ = base64_table[(v >> 18) & 0x3f];
+                *p++ = base64_table[(v >> 12) & 0x3f];
+                *p++ = (len == 2) ? base64_table[(v >> 6) & 0x3f] : '=';
+                *p++ = '=';
+        }
 
-        if(BIO_flush(bio) <= 0)
-                return NULL;
+        *p = '\0';
+        return (p - out);
+}
 
-        BIO_get_mem_ptr (bio, &bptr);
+/*
+  SYNOPSIS
 
-        buf = calloc (1, bptr->length);
-        if (!buf)
-                return NULL;
+  _hex_encode: lower case hex of 'len' bytes of 'in' into 'out', which
+  must hold 2 * len + 1 bytes
+*/
 
-        memcpy (buf, bptr->data, (bptr->length - 1));
-        buf [bptr->length - 1] = 0;
+void _hex_encode (const uchar_t *in, size_t len, char *out)
+{
+        while (len--) {
+                *out++ = hex_table[*in >> 4];
+                *out++ = hex_table[*in & 0x0f];
+                in++;
+        }
+        *out = '\0';
+}
 
-        BIO_free_all (bio);
-        return buf;
+/*
+  SYNOPSIS
+
+  _uri_encode: SigV4 URI encoding of 'in' into 'out', '/' is kept
+  as-is when 'keep_slash' is set (object keys)
+
+  RETURN VALUES:
+  N : Length of the encoded string
+  -1 : 'out' is too small
+*/
+
+size_t _uri_encode (const char *in, char *out, size_t size,
+                    int32_t keep_slash)
+{
+        const uchar_t *p   = (const uchar_t *) in;
+        size_t        len  = 0;
+
+        for (; *p; p++) {
+                if ((unreserved_table[*p]) || ((keep_slash) && (*p == '/'))) {
+                        if (len + 1 >= size)
+                                return (size_t) -1;
+                        out[len++] = *p;
+                } else {
+                        if (len + 3 >= size)
+                                return (size_t) -1;
+                        out[len++] = '%';
+                        out[len++] = HEX_table[*p >> 4];
+                        out[len++] = HEX_table[*p & 0x0f];
+                }
+        }
+
+        out[len] = '\0';
+        return len;
 }
 
 void _chomp(char *str)
@@ -54,3 +143,191 @@ void _chomp(char *str)
                 str++;
         *str = '\0';
 }
+
+/*
+  SYNOPSIS
+
+  _xml_unescape: copy 'len' bytes of XML text into 'out' undoing entity
+  escapes, numeric references come out UTF-8 encoded
+
+  RETURN VALUES:
+  N : Length of 'out', NUL terminated
+  -1 : 'out' too small
+*/
+
+size_t _xml_unescape (const char *in, size_t len, char *out, size_t size)
+{
+        static const struct {
+                const char *name;
+                size_t     len;
+                char       c;
+        } entities[] = {
+                { "&quot;", 6, '"' },
+                { "&amp;",  5, '&' },
+                { "&lt;",   4, '<' },
+                { "&gt;",   4, '>' },
+                { "&apos;", 6, '\'' },
+        };
+        const char *end  = in + len;
+        const char *semi = NULL;
+        char       *tail = NULL;
+        uint32_t   cp    = 0;
+        size_t     olen  = 0;
+        size_t     i     = 0;
+
+        if (!size)
+                return (size_t) -1;
+
+        while (in < end) {
+                if (olen + 4 >= size)
+                        return (size_t) -1;
+                if (*in != '&') {
+                        out[olen++] = *in++;
+                        continue;
+                }
+
+                for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+                        if (((size_t) (end - in) >= entities[i].len) &&
+                            (!strncmp (in, entities[i].name,
+                                       entities[i].len)))
+                                break;
+                }
+                if (i < sizeof(entities) / sizeof(entities[0])) {
+                        out[olen++] = entities[i].c;
+                        in += entities[i].len;
+                        continue;
+                }
+
+                semi = memchr (in, ';', end - in);
+                if ((!semi) || (end - in < 4) || (in[1] != '#')) {
+                        out[olen++] = *in++;
+                        continue;
+                }
+                if ((in[2] == 'x') || (in[2] == 'X'))
+                        cp = strtoul (in + 3, &tail, 16);
+                else
+                        cp = strtoul (in + 2, &tail, 10);
+                if ((tail != semi) || (!cp) || (cp > 0x10ffff)) {
+                        out[olen++] = *in++;
+                        continue;
+                }
+                in = semi + 1;
+
+                if (cp < 0x80) {
+                        out[olen++] = cp;
+                } else if (cp < 0x800) {
+                        out[olen++] = 0xc0 | (cp >> 6);
+                        out[olen++] = 0x80 | (cp & 0x3f);
+                } else if (cp < 0x10000) {
+                        out[olen++] = 0xe0 | (cp >> 12);
+                        out[olen++] = 0x80 | ((cp >> 6) & 0x3f);
+                        out[olen++] = 0x80 | (cp & 0x3f);
+                } else {
+                        out[olen++] = 0xf0 | (cp >> 18);
+                        out[olen++] = 0x80 | ((cp >> 12) & 0x3f);
+                        out[olen++] = 0x80 | ((cp >> 6) & 0x3f);
+                        out[olen++] = 0x80 | (cp & 0x3f);
+                }
+        }
+
+        out[olen] = '\0';
+        return olen;
+}
+
+/*
+  SYNOPSIS
+
+  _xml_escape: copy 'in' into 'out' as XML text, control characters
+  (which S3 keys may hold) as numeric references.  Takes at most six
+  bytes per byte of 'in'.
+
+  RETURN VALUES:
+  N : Length of 'out', NUL terminated
+  -1 : 'out' too small
+*/
+
+size_t _xml_escape (const char *in, char *out, size_t size)
+{
+        const char *ent = NULL;
+        char       num[8];
+        size_t     olen = 0;
+        size_t     elen = 0;
+
+        for (; *in; in++) {
+                switch (*in) {
+                case '&':  ent = "&amp;";  break;
+                case '<':  ent = "&lt;";   break;
+                case '>':  ent = "&gt;";   break;
+                case '"':  ent = "&quot;"; break;
+                case '\'': ent = "&apos;"; break;
+                default:
+                        ent = NULL;
+                        if ((unsigned char) *in < 0x20) {
+                                snprintf (num, sizeof(num), "&#x%x;",
+                                          (unsigned char) *in);
+                                ent = num;
+                        }
+                        break;
+                }
+
+                elen = (ent) ? strlen (ent) : 1;
+                if (olen + elen >= size)
+                        return (size_t) -1;
+                if (ent)
+                        memcpy (out + olen, ent, elen);
+                else
+                        out[olen] = *in;
+                olen += elen;
+        }
+
+        if (olen >= size)
+                return (size_t) -1;
+        out[olen] = '\0';
+        return olen;
+}
+
+/*
+  SYNOPSIS
+
+  _xml_get_tag: copy the text of the first <tag> element of 'xml' into
+  'out', undoing the XML entity escapes S3 uses
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, no such element (-ENOENT) or 'out' too small (-ENOBUFS)
+*/
+
+int32_t _xml_get_tag (const char *xml, const char *tag, char *out,
+                      size_t size)
+{
+        const char *p    = NULL;
+        const char *end  = NULL;
+        size_t     tlen  = 0;
+
+        if ((!xml) || (!tag) || (!out) || (!size)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        tlen = strlen (tag);
+        for (p = strchr (xml, '<'); p; p = strchr (p + 1, '<')) {
+                if ((!strncmp (p + 1, tag, tlen)) && (p[tlen + 1] == '>'))
+                        break;
+        }
+        if (!p) {
+                errno = -ENOENT;
+                return -1;
+        }
+
+        p  += tlen + 2;
+        end = strchr (p, '<');
+        if (!end)
+                end = p + strlen (p);
+
+        if (_xml_unescape (p, end - p, out, size) == (size_t) -1) {
+                errno = -ENOBUFS;
+                return -1;
+        }
+
+        return 0;
+}
@@ -15,23 +15,184 @@
   limitations under the License.
 */
 
+#ifndef __S3_PRIV_H__
+#define __S3_PRIV_H__
+
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <openssl/sha.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
+
+#include "s3-stream.h"
+#include "s3-resp.h"
+#include "s3-list.h"
+#include "s3-limit.h"
 
 typedef unsigned char uchar_t;
 
+#define S3_DEFAULT_REGION "us-east-1"
+#define S3_SERVICE        "s3"
+
+/* Number of (date, region, service) signing keys kept per s3_conf */
+#define S3_SIGV4_KEYS     4
+
+#define S3_SHA256_LEN     32
+#define S3_SHA256_HEXLEN  64
+
+/* SHA-256 of an empty payload */
+#define S3_EMPTY_SHA256                                                 \
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+#define S3_UNSIGNED_PAYLOAD "UNSIGNED-PAYLOAD"
+
+/* Multipart upload limits */
+#define S3_PART_SIZE      (64 * 1024 * 1024)
+#define S3_PART_SIZE_MIN  (5 * 1024 * 1024)
+#define S3_PARTS_MAX      10000
+
+/* Server side copies, larger objects are copied part by part */
+#define S3_COPY_MAX       (5LL * 1024 * 1024 * 1024)
+#define S3_COPY_PART_SIZE (512 * 1024 * 1024)
+#define S3_COPY_PARALLEL  8
+
+/* DeleteObjects, keys per request and requests in flight */
+#define S3_DELETE_KEYS     1000
+#define S3_DELETE_PARALLEL 8
+
+/* Responses read into memory (multipart initiate/complete) */
+#define S3_XML_MAX        4096
+
+/* Start of an error document kept to tell why a request failed */
+#define S3_ERRDOC_MAX     1024
+
+/*
+  Retries, see s3_do_request().  The budget works like the AWS SDKs'
+  retry quota: every retry spends tokens, every success earns one back.
+*/
+#define S3_RETRIES              3
+#define S3_RETRY_TOKENS         500
+#define S3_RETRY_COST           5
+#define S3_RETRY_TIMEOUT_COST   10
+#define S3_BACKOFF_BASE_MS      50
+#define S3_BACKOFF_THROTTLED_MS 500
+#define S3_BACKOFF_MAX_MS       20000
+#define S3_CONNECT_TIMEOUT_MS   5000
+#define S3_STALL_TIMEOUT        30      /* seconds without a byte */
+
+/* GET hedging, a second copy goes out past the hedge_pct percentile */
+#define S3_HEDGE_PCT            95
+#define S3_HEDGE_MIN_MS         10
+#define S3_HEDGE_MIN_SAMPLES    32
+#define S3_LATENCY_SAMPLES      256
+
+/* Listing, pages and key ranges fetched at once by s3_list() */
+#define S3_LIST_PARALLEL        4
+#define S3_LIST_PARALLEL_MAX    64
+#define S3_LIST_PAGE_KEYS       1000
+
+/*
+  Endpoints, requests are spread over the gateways given to
+  s3_set_endpoints() or over the addresses s3host resolves to
+*/
+#define S3_ENDPOINTS_MAX        16
+#define S3_DNS_TTL              60      /* seconds between lookups */
+#define S3_EJECT_ERRORS         3       /* failures in a row */
+#define S3_EJECT_MS             1000
+#define S3_EJECT_MAX_MS         30000
+#define S3_SHARE_LOCKS          8       /* curl_lock_data kinds */
+
+/* Idle curl handles kept per s3_conf, each with its live connections */
+#define S3_HANDLES_MAX          64
+
+/* Longest the multiplexer sleeps without being woken, see s3-mux.c */
+#define S3_MUX_POLL_MS          100
+
+struct s3_mux_item;
+
+struct s3_endpoint {
+        char     host[256];       /* "gw1", "10.0.0.1", "[::1]" */
+        char     connect_to[300]; /* "::host:port" for CURLOPT_CONNECT_TO */
+        int32_t  active;          /* may be picked */
+        uint32_t outstanding;     /* requests in flight */
+        uint32_t failures;        /* in a row */
+        uint32_t ejections;       /* in a row, sets the ejection time */
+        int64_t  ejected_until;   /* CLOCK_MONOTONIC, msecs */
+        uint64_t requests;
+};
+
+struct s3_sigv4_key {
+        char     date[9];          /* YYYYMMDD */
+        char     region[32];
+        char     service[16];
+        uchar_t  key[S3_SHA256_LEN];
+        int32_t  valid;
+};
+
 struct s3_conf {
         char *account_id; /* AWS Account ID */
         char *awskey_id; /* AWS Key ID */
         char *awskey; /* AWS Key */
         char *s3host; /* AWS S3 Hostname eg: "s3.amazonaws.com" */
         char *bucket_name; /* S3 bucket name */
+        char *region; /* AWS region eg: "us-east-1" */
+        int32_t https; /* TLS, HTTP/2 where the endpoint speaks it */
+        char *ca_file; /* CA bundle, NULL for the system one */
+        int32_t sign_payload; /* Sign uploads aws-chunked as they stream */
+        int32_t verify; /* Check ETags against the data sent/received */
+        size_t part_size; /* Multipart upload part size */
+
+        /* Derived SigV4 signing keys, guarded by 'lock' */
+        pthread_mutex_t     lock;
+        struct s3_sigv4_key keys[S3_SIGV4_KEYS];
+        uint32_t            key_next;
+
+        /* Retries and hedging, counters guarded by 'lock' */
+        int32_t  max_retries;
+        int32_t  retry_tokens;
+        int32_t  connect_timeout_ms;
+        int32_t  stall_timeout;
+        int32_t  hedge_pct;   /* 0 disables hedging */
+        int64_t  latency[S3_LATENCY_SAMPLES];  /* GET first byte, usecs */
+        uint32_t lat_next;
+        uint32_t lat_count;
+
+        int32_t  list_parallel;  /* key ranges listed at once */
+
+        /* Endpoints, guarded by 'lock' */
+        struct s3_endpoint endpoints[S3_ENDPOINTS_MAX];
+        int32_t  nendpoints;
+        int32_t  static_endpoints;  /* set by s3_set_endpoints() */
+        int32_t  resolving;
+        time_t   resolved;          /* last lookup of s3host */
+        uint32_t ep_next;           /* rotates ties between endpoints */
+
+        /* DNS and TLS session caches shared by all curl handles of
+           this s3_conf */
+        void            *share;
+        pthread_mutex_t share_locks[S3_SHARE_LOCKS];
+
+        /* Rate limits, lock free, see s3-limit.c */
+        s3_limit_t      limit_send;     /* bytes sent */
+        s3_limit_t      limit_recv;     /* bytes received */
+        s3_limit_t      limit_reqs;     /* requests sent */
+
+        /* Idle curl handles, guarded by 'lock' */
+        void            *handles[S3_HANDLES_MAX];
+        int32_t         nhandles;
+
+        /* Multiplexer, one multi handle all in-memory requests share
+           HTTP/2 connections on, guarded by 'mux_lock' */
+        void               *mux;
+        pthread_t          mux_thread;
+        pthread_mutex_t    mux_lock;
+        pthread_cond_t     mux_cond;
+        struct s3_mux_item *mux_queue;
+        int32_t            mux_running;
+        int32_t            mux_stop;
+        int32_t            max_connections;  /* per host, 0 no limit */
 
         /* Not supported yet */
         int32_t use_rrs; /* Use reduced redundancy storage */
@@ -39,5 +200,125 @@ struct s3_conf {
         char *acls;
 };
 
-char *_base64_encode (const uchar_t *input);
+/*
+  A single S3 request, everything lives in fixed size buffers so
+  building and signing a request does not allocate.
+*/
+
+#define S3_MAX_HDRS   16
+#define S3_URI_MAX    2048
+#define S3_QUERY_MAX  4096
+
+typedef struct {
+        const char *name;  /* lower case */
+        const char *value;
+} s3_hdr_t;
+
+/*
+  aws-chunked payload, every chunk of the upload carries a signature
+  chained to the previous one so the body is signed as it streams
+*/
+
+#define S3_STREAMING_PAYLOAD "STREAMING-AWS4-HMAC-SHA256-PAYLOAD"
+#define S3_CHUNK_SIZE        (64 * 1024)
+
+/* "<hex size>;chunk-signature=<64 hex>\r\n" */
+#define S3_CHUNK_HDR_MAX     (16 + 17 + S3_SHA256_HEXLEN + 2)
+
+struct s3_req;
+typedef struct s3_req s3_req_t;
+
+struct s3_chunked {
+        s3_source_t    *src;        /* decoded payload */
+        s3_req_t       *req;        /* key, scope and seed signature */
+        size_t         chunk_size;
+        off_t          remaining;   /* decoded bytes not yet framed */
+        char           prev[S3_SHA256_HEXLEN + 1];
+
+        char           *buf;        /* one framed chunk */
+        char           *data;       /* start of the framed chunk */
+        size_t         len;
+        size_t         pos;
+        int32_t        started;
+        int32_t        done;
+
+        char           encoded_len[24];
+        char           decoded_len[24];
+};
+
+typedef struct s3_chunked s3_chunked_t;
+
+struct s3_req {
+        const char   *method;
+        char         uri[S3_URI_MAX];      /* escaped "/bucket/key" */
+        char         query[S3_QUERY_MAX];  /* canonical query string */
+        const char   *payload_hash;
+
+        /* Headers sent and signed in addition to host and x-amz-* */
+        s3_hdr_t     hdrs[S3_MAX_HDRS];
+        int32_t      nhdrs;
+
+        s3_source_t  *src;
+        s3_sink_t    *sink;
+        s3_chunked_t *chunked;     /* set when 'src' is sent aws-chunked */
+        s3_md5_t     *md5;         /* hashes the payload as it is sent */
+
+        /* If-Modified-Since and If-Unmodified-Since values */
+        char         since[32];
+        char         unmodified[32];
+
+        /* Filled in by s3_sigv4_sign() */
+        char         amzdate[17];          /* YYYYMMDDTHHMMSSZ */
+        char         scope[96];            /* date/region/service/aws4_request */
+        uchar_t      key[S3_SHA256_LEN];
+        char         signature[S3_SHA256_HEXLEN + 1];
+
+        /* Filled in from the response */
+        s3_resp_t    resp;
+        char         errdoc[S3_ERRDOC_MAX];
+        size_t       errlen;
+
+        /* Negative errno of the source or sink that stopped the
+           transfer, 0 when neither did */
+        int32_t      io_err;
+};
+
+size_t _base64_encode (const uchar_t *in, size_t len, char *out);
+void _hex_encode (const uchar_t *in, size_t len, char *out);
+size_t _uri_encode (const char *in, char *out, size_t size,
+                    int32_t keep_slash);
 void _chomp (char *str);
+size_t _xml_unescape (const char *in, size_t len, char *out, size_t size);
+size_t _xml_escape (const char *in, char *out, size_t size);
+int32_t _xml_get_tag (const char *xml, const char *tag, char *out,
+                      size_t size);
+
+int32_t s3_req_init (s3_req_t *req, const char *method,
+                     const struct s3_conf *s3conf, const char *object);
+int32_t s3_req_add_header (s3_req_t *req, const char *name,
+                           const char *value);
+int32_t s3_req_set_header (s3_req_t *req, const char *name,
+                           const char *value);
+int32_t s3_sigv4_sign (struct s3_conf *s3conf, s3_req_t *req, time_t now,
+                       char *auth, size_t size);
+
+int32_t s3_do_request (s3_req_t *req, struct s3_conf *s3conf);
+
+int32_t s3_endpoints_init (struct s3_conf *s3conf);
+void s3_endpoints_fini (struct s3_conf *s3conf);
+int32_t s3_endpoint_get (struct s3_conf *s3conf, int32_t avoid);
+void s3_endpoint_put (struct s3_conf *s3conf, int32_t ep, int32_t failed);
+
+int32_t s3_mux_init (struct s3_conf *s3conf);
+void s3_mux_fini (struct s3_conf *s3conf);
+int32_t s3_mux_perform (struct s3_conf *s3conf, void *handle,
+                        int32_t *result);
+
+int32_t s3_chunked_init (s3_chunked_t *chunked, s3_req_t *req,
+                         s3_source_t *src, size_t chunk_size);
+off_t s3_chunked_length (s3_chunked_t *chunked);
+size_t s3_chunked_read (s3_chunked_t *chunked, char *buf, size_t size);
+int32_t s3_chunked_rewind (s3_chunked_t *chunked);
+void s3_chunked_release (s3_chunked_t *chunked);
+
+#endif /* __S3_PRIV_H__ */
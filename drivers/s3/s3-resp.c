@@ -0,0 +1,259 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+
+#include "s3-resp.h"
+
+#define __NAME_IS(name, len, str)                                       \
+        (((len) == sizeof(str) - 1) && (!strncasecmp ((name), (str), (len))))
+
+static inline
+void __copy (char *dst, size_t size, const char *src, size_t len)
+{
+        if (len >= size)
+                len = size - 1;
+        memcpy (dst, src, len);
+        dst[len] = '\0';
+}
+
+/* Skip leading blanks, drop trailing blanks and the line ending */
+static inline
+const char *__trim (const char *str, size_t *len)
+{
+        size_t n = *len;
+
+        while ((n) && ((*str == ' ') || (*str == '\t'))) {
+                str++;
+                n--;
+        }
+        while ((n) && ((str[n - 1] == '\r') || (str[n - 1] == '\n') ||
+                       (str[n - 1] == ' ') || (str[n - 1] == '\t')))
+                n--;
+
+        *len = n;
+        return str;
+}
+
+/* RFC 1123 date, the only format S3 sends */
+static
+time_t __http_date (const char *str)
+{
+        struct tm tm;
+
+        memset (&tm, 0, sizeof(tm));
+        if (!strptime (str, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+                return 0;
+
+        return timegm (&tm);
+}
+
+static
+void __status_line (s3_resp_t *resp, const char *line, size_t len)
+{
+        const char *sp  = memchr (line, ' ', len);
+        int32_t    code = 0;
+        int32_t    i    = 0;
+
+        /* New response, 100-continue and redirects come first */
+        s3_resp_reset (resp);
+
+        if (!sp)
+                return;
+
+        len -= (sp + 1 - line);
+        line = sp + 1;
+
+        for (i = 0; (i < 3) && ((size_t) i < len); i++) {
+                if ((line[i] < '0') || (line[i] > '9'))
+                        return;
+                code = code * 10 + (line[i] - '0');
+        }
+        resp->code = code;
+
+        if (len > 3) {
+                len -= 3;
+                line = __trim (line + 3, &len);
+                __copy (resp->reply, sizeof(resp->reply), line, len);
+        }
+}
+
+static
+void __add_meta (s3_resp_t *resp, const char *name, size_t nlen,
+                 const char *value, size_t vlen)
+{
+        char   *p = resp->space + resp->used;
+        size_t i  = 0;
+
+        if ((resp->nmeta >= S3_META_MAX) ||
+            (resp->used + nlen + vlen + 2 > sizeof(resp->space))) {
+                resp->dropped++;
+                return;
+        }
+
+        for (i = 0; i < nlen; i++) {
+                p[i] = name[i];
+                if ((p[i] >= 'A') && (p[i] <= 'Z'))
+                        p[i] += 'a' - 'A';
+        }
+        p[nlen] = '\0';
+        resp->meta[resp->nmeta].name = p;
+
+        p += nlen + 1;
+        memcpy (p, value, vlen);
+        p[vlen] = '\0';
+        resp->meta[resp->nmeta].value = p;
+
+        resp->nmeta++;
+        resp->used += nlen + vlen + 2;
+}
+
+void s3_resp_reset (s3_resp_t *resp)
+{
+        if (!resp)
+                return;
+
+        /* 'space' is only read through 'meta', no need to clear it */
+        memset (resp, 0, offsetof(s3_resp_t, space));
+        resp->used           = 0;
+        resp->dropped        = 0;
+        resp->content_length = -1;
+}
+
+/*
+  SYNOPSIS
+
+  s3_resp_copy: copy 'src' into 'dst', 'meta' of 'dst' points into its
+  own 'space' afterwards
+*/
+
+void s3_resp_copy (s3_resp_t *dst, const s3_resp_t *src)
+{
+        int32_t i = 0;
+
+        if ((!dst) || (!src) || (dst == src))
+                return;
+
+        memcpy (dst, src, offsetof(s3_resp_t, space));
+        memcpy (dst->space, src->space, src->used);
+
+        for (i = 0; i < src->nmeta; i++) {
+                dst->meta[i].name  = dst->space +
+                        (src->meta[i].name - src->space);
+                dst->meta[i].value = dst->space +
+                        (src->meta[i].value - src->space);
+        }
+}
+
+/*
+  SYNOPSIS
+
+  s3_resp_header: parse one response header line into 'resp'
+
+  DESCRIPTION
+
+  'line' is the raw line as curl hands it over, not NUL terminated and
+  still carrying its CRLF.  Header names match case-insensitively, a
+  status line starts over with an empty 'resp'.
+
+  RETURN VALUES:
+   0 : Success, unknown or malformed lines are ignored
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_resp_header (s3_resp_t *resp, const char *line, size_t len)
+{
+        const char *colon = NULL;
+        const char *value = NULL;
+        char       num[24];
+        size_t     nlen   = 0;
+        size_t     vlen   = 0;
+
+        if ((!resp) || (!line)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if ((len > 5) && (!strncmp (line, "HTTP/", 5))) {
+                __status_line (resp, line, len);
+                return 0;
+        }
+
+        colon = memchr (line, ':', len);
+        if (!colon)
+                return 0;
+
+        nlen  = colon - line;
+        vlen  = len - nlen - 1;
+        value = __trim (colon + 1, &vlen);
+
+        if ((nlen > 6) && (!strncasecmp (line, "x-amz-", 6))) {
+                if (__NAME_IS (line, nlen, "x-amz-request-id"))
+                        __copy (resp->request_id, sizeof(resp->request_id),
+                                value, vlen);
+                else if (__NAME_IS (line, nlen, "x-amz-id-2"))
+                        __copy (resp->host_id, sizeof(resp->host_id),
+                                value, vlen);
+                else
+                        __add_meta (resp, line, nlen, value, vlen);
+        } else if (__NAME_IS (line, nlen, "etag")) {
+                __copy (resp->etag, sizeof(resp->etag), value, vlen);
+        } else if (__NAME_IS (line, nlen, "content-length")) {
+                __copy (num, sizeof(num), value, vlen);
+                resp->content_length = strtoll (num, NULL, 10);
+        } else if (__NAME_IS (line, nlen, "content-type")) {
+                __copy (resp->content_type, sizeof(resp->content_type),
+                        value, vlen);
+        } else if (__NAME_IS (line, nlen, "last-modified")) {
+                __copy (resp->last_modified, sizeof(resp->last_modified),
+                        value, vlen);
+                resp->mtime = __http_date (resp->last_modified);
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_resp_meta: value of the x-amz-* header 'name' of the response
+
+  RETURN VALUES:
+  value : Header was sent
+  NULL : Header was not sent (or did not fit)
+*/
+
+const char *s3_resp_meta (const s3_resp_t *resp, const char *name)
+{
+        int32_t i = 0;
+
+        if ((!resp) || (!name))
+                return NULL;
+
+        for (i = 0; i < resp->nmeta; i++) {
+                if (!strcasecmp (resp->meta[i].name, name))
+                        return resp->meta[i].value;
+        }
+
+        return NULL;
+}
@@ -0,0 +1,70 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3_RESP_H__
+#define __S3_RESP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "s3-hash.h"
+
+/* x-amz-* headers kept per response, and the space for their text */
+#define S3_META_MAX     32
+#define S3_META_SPACE   4096
+
+typedef struct {
+        const char *name;   /* lower case, points into 'space' */
+        const char *value;  /* points into 'space' */
+} s3_meta_t;
+
+struct s3_resp;
+typedef struct s3_resp s3_resp_t;
+
+/*
+  What S3 answered, filled in from the response headers as they arrive
+  without allocating.  Headers that do not fit are dropped and counted
+  in 'dropped'.
+*/
+
+struct s3_resp {
+        int32_t     code;                   /* HTTP status */
+        char        reply[64];              /* reason phrase */
+        char        etag[S3_ETAG_MAX];      /* as sent, with the quotes */
+        int64_t     content_length;         /* -1 when not sent */
+        char        content_type[128];
+        char        last_modified[32];      /* as sent */
+        time_t      mtime;                  /* 'last_modified', 0 if unset */
+        char        request_id[64];         /* x-amz-request-id */
+        char        host_id[128];           /* x-amz-id-2 */
+        char        error[64];              /* <Code> of an error document */
+
+        /* Every other x-amz-* header, x-amz-meta-* included */
+        s3_meta_t   meta[S3_META_MAX];
+        int32_t     nmeta;
+        char        space[S3_META_SPACE];
+        size_t      used;
+        int32_t     dropped;
+};
+
+void s3_resp_reset (s3_resp_t *resp);
+void s3_resp_copy (s3_resp_t *dst, const s3_resp_t *src);
+int32_t s3_resp_header (s3_resp_t *resp, const char *line, size_t len);
+const char *s3_resp_meta (const s3_resp_t *resp, const char *name);
+
+#endif /* __S3_RESP_H__ */
@@ -0,0 +1,570 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "s3-priv.h"
+
+#define S3_SIGV4_ALGORITHM "AWS4-HMAC-SHA256"
+
+/* Canonical request and string to sign are built here, on the stack */
+#define S3_SIGV4_BUF       16384
+
+struct s3_buf {
+        char   *data;
+        size_t len;
+        size_t size;
+};
+
+static inline
+int32_t __s3_buf_add (struct s3_buf *buf, const char *str, size_t len)
+{
+        if (buf->len + len >= buf->size)
+                return -1;
+
+        memcpy (buf->data + buf->len, str, len);
+        buf->len += len;
+        buf->data[buf->len] = '\0';
+        return 0;
+}
+
+#define S3_BUF_ADD(buf, str) __s3_buf_add (buf, str, strlen (str))
+#define S3_BUF_ADDC(buf, c) __s3_buf_add (buf, (const char []){ c }, 1)
+
+int32_t s3_req_init (s3_req_t *req, const char *method,
+                     const struct s3_conf *s3conf, const char *object)
+{
+        size_t len = 0;
+        size_t ret = 0;
+
+        if ((!req) || (!method) || (!s3conf) || (!s3conf->bucket_name)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (req, 0, sizeof(*req));
+        s3_resp_reset (&req->resp);
+        req->method       = method;
+        req->payload_hash = S3_EMPTY_SHA256;
+
+        /* Path style, "/bucket" or "/bucket/key" */
+        req->uri[len++] = '/';
+        ret = _uri_encode (s3conf->bucket_name, req->uri + len,
+                           sizeof(req->uri) - len, 0);
+        if (ret == (size_t) -1)
+                goto toolong;
+        len += ret;
+
+        if (object) {
+                object += strspn (object, "/");
+                if (len + 1 >= sizeof(req->uri))
+                        goto toolong;
+                req->uri[len++] = '/';
+                ret = _uri_encode (object, req->uri + len,
+                                   sizeof(req->uri) - len, 1);
+                if (ret == (size_t) -1)
+                        goto toolong;
+        }
+
+        return 0;
+toolong:
+        errno = -ENAMETOOLONG;
+        return -1;
+}
+
+int32_t s3_req_add_header (s3_req_t *req, const char *name,
+                           const char *value)
+{
+        if ((!req) || (!name) || (!value)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (req->nhdrs >= S3_MAX_HDRS) {
+                errno = -ENOBUFS;
+                return -1;
+        }
+
+        req->hdrs[req->nhdrs].name  = name;
+        req->hdrs[req->nhdrs].value = value;
+        req->nhdrs++;
+
+        return 0;
+}
+
+/* Like s3_req_add_header(), replacing the value if 'name' is set */
+int32_t s3_req_set_header (s3_req_t *req, const char *name,
+                           const char *value)
+{
+        int32_t i = 0;
+
+        if ((!req) || (!name) || (!value)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        for (i = 0; i < req->nhdrs; i++) {
+                if (!strcmp (req->hdrs[i].name, name)) {
+                        req->hdrs[i].value = value;
+                        return 0;
+                }
+        }
+
+        return s3_req_add_header (req, name, value);
+}
+
+static inline
+void __hmac_sha256 (const uchar_t *key, size_t keylen,
+                    const char *data, size_t len, uchar_t *md)
+{
+        HMAC (EVP_sha256(), key, keylen, (const uchar_t *) data, len,
+              md, NULL);
+}
+
+/*
+  kDate    = HMAC("AWS4" + kSecret, Date)
+  kRegion  = HMAC(kDate, Region)
+  kService = HMAC(kRegion, Service)
+  kSigning = HMAC(kService, "aws4_request")
+
+  Four HMACs per request is most of the signing cost, the result only
+  changes once a day so keep it around per (date, region, service).
+*/
+static
+void __s3_sigv4_key (struct s3_conf *s3conf, const char *date,
+                     const char *region, const char *service,
+                     uchar_t *key)
+{
+        struct s3_sigv4_key *k      = NULL;
+        char                secret[256];
+        uchar_t             md[S3_SHA256_LEN];
+        uint32_t            i       = 0;
+
+        pthread_mutex_lock (&s3conf->lock);
+
+        for (i = 0; i < S3_SIGV4_KEYS; i++) {
+                k = &s3conf->keys[i];
+                if ((k->valid) && (!strcmp (k->date, date)) &&
+                    (!strcmp (k->region, region)) &&
+                    (!strcmp (k->service, service))) {
+                        memcpy (key, k->key, S3_SHA256_LEN);
+                        goto unlock;
+                }
+        }
+
+        snprintf (secret, sizeof(secret), "AWS4%s", s3conf->awskey);
+        __hmac_sha256 ((uchar_t *) secret, strlen (secret),
+                       date, strlen (date), md);
+        __hmac_sha256 (md, sizeof(md), region, strlen (region), md);
+        __hmac_sha256 (md, sizeof(md), service, strlen (service), md);
+        __hmac_sha256 (md, sizeof(md), "aws4_request", 12, key);
+        memset (secret, 0, sizeof(secret));
+
+        k = &s3conf->keys[s3conf->key_next++ % S3_SIGV4_KEYS];
+        snprintf (k->date, sizeof(k->date), "%s", date);
+        snprintf (k->region, sizeof(k->region), "%s", region);
+        snprintf (k->service, sizeof(k->service), "%s", service);
+        memcpy (k->key, key, S3_SHA256_LEN);
+        k->valid = 1;
+unlock:
+        pthread_mutex_unlock (&s3conf->lock);
+}
+
+/*
+  SYNOPSIS
+
+  s3_sigv4_sign: sign 'req' with AWS Signature Version 4
+
+  DESCRIPTION
+
+  Adds x-amz-date and x-amz-content-sha256 to the request headers and
+  writes the Authorization header value into 'auth'.  The signing key,
+  scope and signature are left in 'req' for chunked payload signing.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_sigv4_sign (struct s3_conf *s3conf, s3_req_t *req, time_t now,
+                       char *auth, size_t size)
+{
+        char          canon_data[S3_SIGV4_BUF];
+        char          signed_data[512];
+        struct s3_buf canon  = { canon_data, 0, sizeof(canon_data) };
+        struct s3_buf sigh   = { signed_data, 0, sizeof(signed_data) };
+        const s3_hdr_t *sorted[S3_MAX_HDRS + 1];
+        s3_hdr_t      host   = { "host", NULL };
+        const s3_hdr_t *tmp  = NULL;
+        const char    *region = NULL;
+        uchar_t       md[S3_SHA256_LEN];
+        char          hex[S3_SHA256_HEXLEN + 1];
+        char          date[9];
+        struct tm     utc;
+        int32_t       n      = 0;
+        int32_t       i      = 0;
+        int32_t       j      = 0;
+        int32_t       ret    = 0;
+
+        if ((!s3conf) || (!req) || (!auth)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (!gmtime_r (&now, &utc))
+                return -1;
+
+        strftime (req->amzdate, sizeof(req->amzdate),
+                  "%Y%m%dT%H%M%SZ", &utc);
+
+        region = s3conf->region ? s3conf->region : S3_DEFAULT_REGION;
+        snprintf (req->scope, sizeof(req->scope), "%.8s/%s/%s/aws4_request",
+                  req->amzdate, region, S3_SERVICE);
+
+        /* Set, not added, a retried request is signed again */
+        if ((s3_req_set_header (req, "x-amz-date", req->amzdate) < 0) ||
+            (s3_req_set_header (req, "x-amz-content-sha256",
+                                req->payload_hash) < 0))
+                return -1;
+
+        /* Canonical headers are sorted by their (lower case) name */
+        host.value  = s3conf->s3host;
+        sorted[n++] = &host;
+        for (i = 0; i < req->nhdrs; i++)
+                sorted[n++] = &req->hdrs[i];
+
+        for (i = 1; i < n; i++) {
+                tmp = sorted[i];
+                for (j = i; (j > 0) &&
+                             (strcmp (sorted[j - 1]->name, tmp->name) > 0); j--)
+                        sorted[j] = sorted[j - 1];
+                sorted[j] = tmp;
+        }
+
+        /*
+          CanonicalRequest =
+            Method \n URI \n Query \n Headers \n \n SignedHeaders \n Hash
+        */
+        ret |= S3_BUF_ADD (&canon, req->method);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, req->uri);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, req->query);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        for (i = 0; i < n; i++) {
+                ret |= S3_BUF_ADD (&canon, sorted[i]->name);
+                ret |= S3_BUF_ADDC (&canon, ':');
+                ret |= S3_BUF_ADD (&canon, sorted[i]->value);
+                ret |= S3_BUF_ADDC (&canon, '\n');
+
+                if (i)
+                        ret |= S3_BUF_ADDC (&sigh, ';');
+                ret |= S3_BUF_ADD (&sigh, sorted[i]->name);
+        }
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, sigh.data);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, req->payload_hash);
+        if (ret) {
+                errno = -ENOBUFS;
+                return -1;
+        }
+
+        SHA256 ((uchar_t *) canon.data, canon.len, md);
+        _hex_encode (md, sizeof(md), hex);
+
+        /* StringToSign reuses the canonical request buffer */
+        canon.len = 0;
+        ret |= S3_BUF_ADD (&canon, S3_SIGV4_ALGORITHM "\n");
+        ret |= S3_BUF_ADD (&canon, req->amzdate);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, req->scope);
+        ret |= S3_BUF_ADDC (&canon, '\n');
+        ret |= S3_BUF_ADD (&canon, hex);
+        if (ret) {
+                errno = -ENOBUFS;
+                return -1;
+        }
+
+        memcpy (date, req->amzdate, 8);
+        date[8] = '\0';
+        __s3_sigv4_key (s3conf, date, region, S3_SERVICE, req->key);
+        __hmac_sha256 (req->key, sizeof(req->key), canon.data, canon.len,
+                       md);
+        _hex_encode (md, sizeof(md), req->signature);
+
+        ret = snprintf (auth, size, S3_SIGV4_ALGORITHM " Credential=%s/%s, "
+                        "SignedHeaders=%s, Signature=%s", s3conf->awskey_id,
+                        req->scope, sigh.data, req->signature);
+        if ((ret < 0) || ((size_t) ret >= size)) {
+                errno = -ENOBUFS;
+                return -1;
+        }
+
+        return 0;
+}
+
+static
+size_t __s3_chunk_hdr_len (size_t len)
+{
+        char tmp[20];
+
+        return snprintf (tmp, sizeof(tmp), "%zx", len) + 17 +
+                S3_SHA256_HEXLEN + 2;
+}
+
+/*
+  SYNOPSIS
+
+  s3_chunked_init: send 'src' as an aws-chunked body of 'req'
+
+  DESCRIPTION
+
+  Switches 'req' to STREAMING-AWS4-HMAC-SHA256-PAYLOAD and adds the
+  content headers that have to be signed along with it.  Chunks are
+  signed in s3_chunked_read() as curl pulls them, so the payload is
+  read only once and only a single chunk is ever held in memory.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_chunked_init (s3_chunked_t *chunked, s3_req_t *req,
+                         s3_source_t *src, size_t chunk_size)
+{
+        off_t length = 0;
+
+        if ((!chunked) || (!req) || (!src)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        /* S3 wants at least 8 KB in every chunk but the last one */
+        if (chunk_size < 8192)
+                chunk_size = (chunk_size) ? 8192 : S3_CHUNK_SIZE;
+
+        memset (chunked, 0, sizeof(*chunked));
+        chunked->src        = src;
+        chunked->req        = req;
+        chunked->chunk_size = chunk_size;
+
+        chunked->buf = malloc (S3_CHUNK_HDR_MAX + chunk_size + 2);
+        if (!chunked->buf) {
+                errno = -ENOMEM;
+                return -1;
+        }
+
+        length = s3_source_length (src);
+        chunked->remaining = length;
+
+        snprintf (chunked->decoded_len, sizeof(chunked->decoded_len),
+                  "%lld", (long long) length);
+        snprintf (chunked->encoded_len, sizeof(chunked->encoded_len),
+                  "%lld", (long long) s3_chunked_length (chunked));
+
+        req->chunked      = chunked;
+        req->payload_hash = S3_STREAMING_PAYLOAD;
+
+        if ((s3_req_add_header (req, "content-encoding", "aws-chunked") < 0) ||
+            (s3_req_add_header (req, "content-length",
+                                chunked->encoded_len) < 0) ||
+            (s3_req_add_header (req, "x-amz-decoded-content-length",
+                                chunked->decoded_len) < 0)) {
+                s3_chunked_release (chunked);
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_chunked_length: size of the body on the wire, framing included
+*/
+
+off_t s3_chunked_length (s3_chunked_t *chunked)
+{
+        off_t length = 0;
+        off_t total  = 0;
+        off_t rem    = 0;
+
+        if (!chunked)
+                return -1;
+
+        length = s3_source_length (chunked->src);
+        rem    = length % chunked->chunk_size;
+
+        total = (length / chunked->chunk_size) *
+                (__s3_chunk_hdr_len (chunked->chunk_size) +
+                 chunked->chunk_size + 2);
+        if (rem)
+                total += __s3_chunk_hdr_len (rem) + rem + 2;
+
+        /* Terminating zero length chunk */
+        total += __s3_chunk_hdr_len (0) + 2;
+
+        return total;
+}
+
+/*
+  StringToSign =
+    "AWS4-HMAC-SHA256-PAYLOAD" \n date \n scope \n previous-signature \n
+    hash("") \n hash(chunk-data)
+*/
+static
+int32_t __s3_chunked_fill (s3_chunked_t *chunked)
+{
+        s3_req_t *req   = chunked->req;
+        char     *data  = chunked->buf + S3_CHUNK_HDR_MAX;
+        char     sts[512];
+        char     hdr[S3_CHUNK_HDR_MAX + 1];
+        char     hex[S3_SHA256_HEXLEN + 1];
+        uchar_t  md[S3_SHA256_LEN];
+        size_t   want   = chunked->chunk_size;
+        size_t   len    = 0;
+        size_t   ret    = 0;
+        int32_t  n      = 0;
+
+        /* The first chunk is chained to the header (seed) signature */
+        if (!chunked->started) {
+                memcpy (chunked->prev, req->signature, sizeof(chunked->prev));
+                chunked->started = 1;
+        }
+
+        if ((off_t) want > chunked->remaining)
+                want = chunked->remaining;
+
+        while (len < want) {
+                ret = s3_source_read (chunked->src, data + len, want - len);
+                if (ret == (size_t) -1)
+                        return -1;
+                if (ret == 0) {
+                        errno = -EIO;
+                        return -1;
+                }
+                len += ret;
+        }
+        chunked->remaining -= len;
+
+        /* OpenSSL picks SHA-NI / AVX2 code for this on its own */
+        SHA256 ((uchar_t *) data, len, md);
+        if (req->md5)
+                s3_md5_update (req->md5, data, len);
+        _hex_encode (md, sizeof(md), hex);
+
+        n = snprintf (sts, sizeof(sts), "AWS4-HMAC-SHA256-PAYLOAD\n%s\n%s\n"
+                      "%s\n%s\n%s", req->amzdate, req->scope, chunked->prev,
+                      S3_EMPTY_SHA256, hex);
+        __hmac_sha256 (req->key, sizeof(req->key), sts, n, md);
+        _hex_encode (md, sizeof(md), chunked->prev);
+
+        /* Frame in place, header right in front of the data */
+        n = snprintf (hdr, sizeof(hdr), "%zx;chunk-signature=%s\r\n",
+                      len, chunked->prev);
+        chunked->data = data - n;
+        memcpy (chunked->data, hdr, n);
+        data[len]     = '\r';
+        data[len + 1] = '\n';
+
+        chunked->len = n + len + 2;
+        chunked->pos = 0;
+
+        if (len == 0)
+                chunked->done = 1;
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_chunked_read: copy up to 'size' bytes of the framed body into 'buf'
+
+  RETURN VALUES:
+  N : Total number of bytes copied, 0 after the last chunk
+  -1 : Failure, errno set appropriately
+*/
+
+size_t s3_chunked_read (s3_chunked_t *chunked, char *buf, size_t size)
+{
+        size_t n   = 0;
+        size_t len = 0;
+
+        if ((!chunked) || (!buf)) {
+                errno = -EINVAL;
+                return (size_t) -1;
+        }
+
+        while (n < size) {
+                if (chunked->pos == chunked->len) {
+                        if (chunked->done)
+                                break;
+                        if (__s3_chunked_fill (chunked) < 0)
+                                return (size_t) -1;
+                }
+
+                len = chunked->len - chunked->pos;
+                if (len > size - n)
+                        len = size - n;
+
+                memcpy (buf + n, chunked->data + chunked->pos, len);
+                chunked->pos += len;
+                n += len;
+        }
+
+        return n;
+}
+
+int32_t s3_chunked_rewind (s3_chunked_t *chunked)
+{
+        if (!chunked) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (s3_source_seek (chunked->src, 0) < 0)
+                return -1;
+
+        if (chunked->req->md5)
+                s3_md5_init (chunked->req->md5);
+
+        chunked->remaining = s3_source_length (chunked->src);
+        chunked->started   = 0;
+        chunked->done      = 0;
+        chunked->len       = 0;
+        chunked->pos       = 0;
+
+        return 0;
+}
+
+void s3_chunked_release (s3_chunked_t *chunked)
+{
+        if (!chunked)
+                return;
+
+        if (chunked->buf)
+                free (chunked->buf);
+
+        chunked->buf  = NULL;
+        chunked->data = NULL;
+        if (chunked->req)
+                chunked->req->chunked = NULL;
+}
@@ -0,0 +1,581 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "s3-stream.h"
+
+static
+int32_t __s3_source_init_file (s3_source_t *src, int32_t fd,
+                               off_t offset, off_t length)
+{
+        struct stat st;
+
+        if ((!src) || (fd < 0) || (offset < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        /* Negative length means 'till the end of the file' */
+        if (length < 0) {
+                if (fstat (fd, &st) < 0)
+                        return -1;
+                if (st.st_size < offset) {
+                        errno = -EINVAL;
+                        return -1;
+                }
+                length = st.st_size - offset;
+        }
+
+        memset (src, 0, sizeof(*src));
+        src->fd      = fd;
+        src->offset  = offset;
+        src->length  = length;
+        src->pos     = 0;
+        src->ra_next = 0;
+
+        return 0;
+}
+
+int32_t s3_source_init_iobuf (s3_source_t *src, iobuf_t *iob)
+{
+        if ((!src) || (!iob)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (src, 0, sizeof(*src));
+        src->type   = S3_SOURCE_IOBUF;
+        src->iob    = iob;
+        src->fd     = -1;
+        src->length = iob->len;
+
+        return 0;
+}
+
+int32_t s3_source_init_fd (s3_source_t *src, int32_t fd,
+                           off_t offset, off_t length)
+{
+        if (__s3_source_init_file (src, fd, offset, length) < 0)
+                return -1;
+
+        src->type = S3_SOURCE_FD;
+
+        posix_fadvise (fd, offset, src->length, POSIX_FADV_SEQUENTIAL);
+        return 0;
+}
+
+int32_t s3_source_init_mmap (s3_source_t *src, int32_t fd,
+                             off_t offset, off_t length)
+{
+        if (__s3_source_init_file (src, fd, offset, length) < 0)
+                return -1;
+
+        src->type = S3_SOURCE_MMAP;
+        return 0;
+}
+
+int32_t s3_source_init_buffer (s3_source_t *src, const char *data,
+                               size_t length)
+{
+        if ((!src) || ((!data) && (length))) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (src, 0, sizeof(*src));
+        src->type   = S3_SOURCE_BUFFER;
+        src->data   = data;
+        src->fd     = -1;
+        src->length = length;
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_source_slice: 'length' bytes of 'src' starting 'offset' bytes into
+  it as a source of its own, used for the parts of a multipart upload
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_source_slice (s3_source_t *dst, const s3_source_t *src,
+                         off_t offset, off_t length)
+{
+        if ((!dst) || (!src) || (offset < 0) || (length < 0) ||
+            (offset + length > src->length)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        switch (src->type) {
+        case S3_SOURCE_FD:
+                return s3_source_init_fd (dst, src->fd, src->offset + offset,
+                                          length);
+        case S3_SOURCE_MMAP:
+                return s3_source_init_mmap (dst, src->fd,
+                                            src->offset + offset, length);
+        case S3_SOURCE_BUFFER:
+                return s3_source_init_buffer (dst, src->data + offset,
+                                              length);
+        default:
+                errno = -ESPIPE;
+                return -1;
+        }
+}
+
+/*
+  Hint the kernel about the next S3_SOURCE_READAHEAD bytes and let go
+  of the ones already sent, so neither the page cache nor our mapping
+  grows with the size of the object.
+*/
+static
+void __s3_source_readahead (s3_source_t *src)
+{
+        off_t  behind = 0;
+        off_t  ahead  = 0;
+        char   *addr  = NULL;
+        size_t delta  = 0;
+
+        if (src->pos < src->ra_next)
+                return;
+
+        behind = src->ra_next - S3_SOURCE_READAHEAD;
+        ahead  = src->length - src->pos;
+        if (ahead > S3_SOURCE_READAHEAD)
+                ahead = S3_SOURCE_READAHEAD;
+
+        if (src->type == S3_SOURCE_FD) {
+                posix_fadvise (src->fd, src->offset + src->pos, ahead,
+                               POSIX_FADV_WILLNEED);
+                if (behind > 0)
+                        posix_fadvise (src->fd, src->offset + behind -
+                                       S3_SOURCE_READAHEAD,
+                                       S3_SOURCE_READAHEAD,
+                                       POSIX_FADV_DONTNEED);
+        } else if ((src->type == S3_SOURCE_MMAP) && (src->map)) {
+                addr = src->map + (src->offset + src->pos - src->map_off);
+                if ((size_t)(addr - src->map) + ahead > src->map_len)
+                        ahead = src->map_len - (addr - src->map);
+                /* madvise() wants a page aligned address, the window
+                   grows by what that moved it back */
+                delta = ((uintptr_t) addr) & (sysconf (_SC_PAGESIZE) - 1);
+                madvise (addr - delta, ahead + delta, MADV_WILLNEED);
+        }
+
+        src->ra_next = src->pos + S3_SOURCE_READAHEAD;
+}
+
+static
+int32_t __s3_source_map (s3_source_t *src)
+{
+        off_t  fpos     = src->offset + src->pos;
+        off_t  end      = src->offset + src->length;
+        long   pagesize = sysconf (_SC_PAGESIZE);
+        void   *map     = NULL;
+
+        if ((src->map) && (fpos >= src->map_off) &&
+            (fpos < (off_t)(src->map_off + src->map_len)))
+                return 0;
+
+        if (src->map) {
+                munmap (src->map, src->map_len);
+                src->map = NULL;
+        }
+
+        src->map_off = fpos & ~((off_t) pagesize - 1);
+        src->map_len = S3_SOURCE_MMAP_WINDOW;
+        if ((off_t)(src->map_off + src->map_len) > end)
+                src->map_len = end - src->map_off;
+
+        map = mmap (NULL, src->map_len, PROT_READ, MAP_SHARED,
+                    src->fd, src->map_off);
+        if (map == MAP_FAILED)
+                return -1;
+
+        madvise (map, src->map_len, MADV_SEQUENTIAL);
+        src->map = map;
+
+        /* Fresh window, start hinting from its beginning */
+        src->ra_next = src->pos;
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_source_read: copy up to 'size' bytes of the upload into 'buf'
+
+  RETURN VALUES:
+  N : Total number of bytes copied, 0 at the end of the upload
+  -1 : Failure, errno set appropriately
+*/
+
+size_t s3_source_read (s3_source_t *src, char *buf, size_t size)
+{
+        size_t  len   = 0;
+        ssize_t ret   = 0;
+        off_t   fpos  = 0;
+
+        if ((!src) || (!buf)) {
+                errno = -EINVAL;
+                return (size_t) -1;
+        }
+
+        if (src->type == S3_SOURCE_IOBUF)
+                return s3_iobuf_getline (src->iob, buf, size);
+
+        if ((off_t) size > src->length - src->pos)
+                size = src->length - src->pos;
+
+        if (size == 0)
+                return 0;
+
+        switch (src->type) {
+        case S3_SOURCE_FD:
+                __s3_source_readahead (src);
+                while (len < size) {
+                        ret = pread (src->fd, buf + len, size - len,
+                                     src->offset + src->pos + len);
+                        if (ret < 0) {
+                                if (errno == EINTR)
+                                        continue;
+                                return (size_t) -1;
+                        }
+                        /* File shrunk underneath us */
+                        if (ret == 0) {
+                                errno = -EIO;
+                                return (size_t) -1;
+                        }
+                        len += ret;
+                }
+                break;
+        case S3_SOURCE_MMAP:
+                if (__s3_source_map (src) < 0)
+                        return (size_t) -1;
+                __s3_source_readahead (src);
+                fpos = src->offset + src->pos;
+                len  = src->map_off + src->map_len - fpos;
+                if (len > size)
+                        len = size;
+                memcpy (buf, src->map + (fpos - src->map_off), len);
+                break;
+        case S3_SOURCE_BUFFER:
+                len = size;
+                memcpy (buf, src->data + src->pos, len);
+                break;
+        default:
+                errno = -EINVAL;
+                return (size_t) -1;
+        }
+
+        src->pos += len;
+        return len;
+}
+
+/*
+  SYNOPSIS
+
+  s3_source_seek: move the read position to 'pos' bytes into the upload,
+  used when curl has to resend the body
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, source cannot seek
+*/
+
+int32_t s3_source_seek (s3_source_t *src, off_t pos)
+{
+        if ((!src) || (pos < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if ((src->type == S3_SOURCE_IOBUF) || (pos > src->length)) {
+                errno = -ESPIPE;
+                return -1;
+        }
+
+        src->pos     = pos;
+        src->ra_next = pos;
+        return 0;
+}
+
+off_t s3_source_length (s3_source_t *src)
+{
+        if (!src)
+                return -1;
+
+        return src->length;
+}
+
+void s3_source_release (s3_source_t *src)
+{
+        if (!src)
+                return;
+
+        if (src->map) {
+                munmap (src->map, src->map_len);
+                src->map = NULL;
+        }
+
+        if ((src->type == S3_SOURCE_FD) && (src->length))
+                posix_fadvise (src->fd, src->offset, src->length,
+                               POSIX_FADV_DONTNEED);
+}
+
+int32_t s3_sink_init_iobuf (s3_sink_t *sink, iobuf_t *iob)
+{
+        if ((!sink) || (!iob)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (sink, 0, sizeof(*sink));
+        sink->type = S3_SINK_IOBUF;
+        sink->iob  = iob;
+        sink->fd   = -1;
+
+        return 0;
+}
+
+int32_t s3_sink_init_fd (s3_sink_t *sink, int32_t fd, off_t offset)
+{
+        if ((!sink) || (fd < 0) || (offset < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (sink, 0, sizeof(*sink));
+        sink->type   = S3_SINK_FD;
+        sink->fd     = fd;
+        sink->offset = offset;
+
+        return 0;
+}
+
+int32_t s3_sink_init_buffer (s3_sink_t *sink, char *buf, size_t size)
+{
+        if ((!sink) || (!buf)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (sink, 0, sizeof(*sink));
+        sink->type = S3_SINK_BUFFER;
+        sink->buf  = buf;
+        sink->size = size;
+        sink->fd   = -1;
+
+        return 0;
+}
+
+int32_t s3_sink_init_callback (s3_sink_t *sink, s3_sink_consume_t consume,
+                               s3_sink_ready_t ready, void *opaque)
+{
+        if ((!sink) || (!consume)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        memset (sink, 0, sizeof(*sink));
+        sink->type    = S3_SINK_CALLBACK;
+        sink->consume = consume;
+        sink->ready   = ready;
+        sink->opaque  = opaque;
+        sink->fd      = -1;
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_sink_write: store 'len' bytes of the object at the sink position
+
+  RETURN VALUES:
+  N : 'len', everything was stored
+  S3_SINK_PAUSE : sink is full, hand the same data in again once
+                  s3_sink_ready() says so
+  -1 : Failure, errno set appropriately
+*/
+
+size_t s3_sink_write (s3_sink_t *sink, const char *data, size_t len)
+{
+        size_t   skip = 0;
+        size_t   left = 0;
+        size_t   done = 0;
+        ssize_t  ret  = 0;
+
+        if ((!sink) || (!data)) {
+                errno = -EINVAL;
+                return (size_t) -1;
+        }
+
+        /* Part of this delivery was stored before the pause */
+        skip = sink->skip;
+        if (skip > len)
+                skip = len;
+        data += skip;
+        left  = len - skip;
+
+        sink->paused = 0;
+
+        switch (sink->type) {
+        case S3_SINK_IOBUF:
+                if ((left) && (s3_iobuf_add (sink->iob, (char *) data,
+                                             left) < 0))
+                        return (size_t) -1;
+                done = left;
+                break;
+        case S3_SINK_FD:
+                while (done < left) {
+                        ret = pwrite (sink->fd, data + done, left - done,
+                                      sink->offset + sink->pos + done);
+                        if (ret >= 0) {
+                                done += ret;
+                                continue;
+                        }
+                        if (errno == EINTR)
+                                continue;
+                        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                                return (size_t) -1;
+
+                        if (sink->md5)
+                                s3_md5_update (sink->md5, data, done);
+                        sink->pos   += done;
+                        sink->skip   = skip + done;
+                        sink->paused = 1;
+                        return S3_SINK_PAUSE;
+                }
+                break;
+        case S3_SINK_BUFFER:
+                if ((size_t) sink->pos + left > sink->size) {
+                        errno = -ENOBUFS;
+                        return (size_t) -1;
+                }
+                memcpy (sink->buf + sink->pos, data, left);
+                done = left;
+                break;
+        case S3_SINK_CALLBACK:
+                if (!left)
+                        break;
+                done = sink->consume (data, left, sink->opaque);
+                if (done == S3_SINK_PAUSE) {
+                        sink->skip   = skip;
+                        sink->paused = 1;
+                        return S3_SINK_PAUSE;
+                }
+                if (done != left) {
+                        errno = -EIO;
+                        return (size_t) -1;
+                }
+                break;
+        default:
+                errno = -EINVAL;
+                return (size_t) -1;
+        }
+
+        if (sink->md5)
+                s3_md5_update (sink->md5, data, done);
+        sink->pos += done;
+        sink->skip = 0;
+        return len;
+}
+
+/*
+  SYNOPSIS
+
+  s3_sink_rewind: start storing the object over, used when a download
+  is retried
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, data already handed to an iobuf or to a callback
+       without a rewind hook cannot be taken back (-ESPIPE)
+*/
+
+int32_t s3_sink_rewind (s3_sink_t *sink)
+{
+        if (!sink) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if ((sink->type == S3_SINK_CALLBACK) && (sink->rewind) &&
+            ((sink->pos) || (sink->skip)) &&
+            (sink->rewind (sink->opaque) < 0))
+                return -1;
+
+        if (((sink->type == S3_SINK_IOBUF) ||
+             ((sink->type == S3_SINK_CALLBACK) && (!sink->rewind))) &&
+            ((sink->pos) || (sink->skip))) {
+                errno = -ESPIPE;
+                return -1;
+        }
+
+        sink->pos    = 0;
+        sink->skip   = 0;
+        sink->paused = 0;
+        if (sink->md5)
+                s3_md5_init (sink->md5);
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  s3_sink_ready: check whether a paused sink can take data again
+
+  RETURN VALUES:
+  1 : Ready
+  0 : Still busy
+*/
+
+int32_t s3_sink_ready (s3_sink_t *sink)
+{
+        struct pollfd pfd;
+
+        if (!sink)
+                return 0;
+
+        switch (sink->type) {
+        case S3_SINK_FD:
+                pfd.fd      = sink->fd;
+                pfd.events  = POLLOUT;
+                pfd.revents = 0;
+                return (poll (&pfd, 1, 0) > 0);
+        case S3_SINK_CALLBACK:
+                if (sink->ready)
+                        return (sink->ready (sink->opaque) != 0);
+                return 1;
+        default:
+                return 1;
+        }
+}
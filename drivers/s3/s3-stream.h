@@ -0,0 +1,154 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3_STREAM_H__
+#define __S3_STREAM_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "s3-iobuf.h"
+#include "s3-hash.h"
+
+/* Readahead window hinted to the kernel ahead of the read position */
+#define S3_SOURCE_READAHEAD  (8 * 1024 * 1024)
+
+/* Size of the sliding mmap() window for S3_SOURCE_MMAP */
+#define S3_SOURCE_MMAP_WINDOW (64 * 1024 * 1024)
+
+enum _s3_source_type
+{
+        S3_SOURCE_IOBUF = 0,
+        S3_SOURCE_FD,
+        S3_SOURCE_MMAP,
+        S3_SOURCE_BUFFER
+};
+
+typedef enum _s3_source_type s3_source_type_t;
+
+struct _s3_source;
+typedef struct _s3_source s3_source_t;
+
+struct _s3_source {
+        s3_source_type_t type;
+
+        iobuf_t     *iob;       /* S3_SOURCE_IOBUF */
+
+        const char  *data;      /* S3_SOURCE_BUFFER */
+
+        int32_t     fd;         /* S3_SOURCE_FD, S3_SOURCE_MMAP */
+        off_t       offset;     /* first byte of the upload in 'fd' */
+        off_t       length;     /* total bytes to upload */
+        off_t       pos;        /* bytes handed to curl so far */
+        off_t       ra_next;    /* next readahead boundary */
+
+        char        *map;       /* current mmap() window */
+        off_t       map_off;    /* file offset of 'map' (page aligned) */
+        size_t      map_len;
+};
+
+enum _s3_sink_type
+{
+        S3_SINK_IOBUF = 0,
+        S3_SINK_FD,
+        S3_SINK_BUFFER,
+        S3_SINK_CALLBACK
+};
+
+typedef enum _s3_sink_type s3_sink_type_t;
+
+/* Returned by a sink to ask for the transfer to be paused */
+#define S3_SINK_PAUSE ((size_t) -2)
+
+/*
+  Consumer of downloaded data, returns the number of bytes consumed
+  which must be either all of 'len' or S3_SINK_PAUSE
+*/
+typedef size_t (*s3_sink_consume_t) (const char *data, size_t len,
+                                     void *opaque);
+
+/* Polled while paused, returns non-zero once data can be consumed */
+typedef int32_t (*s3_sink_ready_t) (void *opaque);
+
+/*
+  Called when a retry starts the object over, returns 0 if the consumer
+  can take it again from the start.  Callback sinks without one cannot
+  be retried once data was delivered.
+*/
+typedef int32_t (*s3_sink_rewind_t) (void *opaque);
+
+struct _s3_sink;
+typedef struct _s3_sink s3_sink_t;
+
+struct _s3_sink {
+        s3_sink_type_t type;
+
+        iobuf_t     *iob;       /* S3_SINK_IOBUF */
+
+        int32_t     fd;         /* S3_SINK_FD */
+        off_t       offset;     /* where in 'fd' the object starts */
+
+        char        *buf;       /* S3_SINK_BUFFER */
+        size_t      size;
+
+        s3_sink_consume_t consume;   /* S3_SINK_CALLBACK */
+        s3_sink_ready_t   ready;
+        s3_sink_rewind_t  rewind;
+        void              *opaque;
+
+        off_t       pos;        /* bytes stored so far */
+        s3_md5_t    *md5;       /* hashes every stored byte when set */
+        size_t      skip;       /* bytes of a paused delivery already
+                                   stored, curl hands them in again */
+        int32_t     paused;
+        void        *handle;    /* transfer to resume */
+};
+
+/*
+  Upload sources, the PUT read callback pulls directly from these so
+  memory stays constant regardless of the object size.
+*/
+
+int32_t s3_source_init_iobuf (s3_source_t *src, iobuf_t *iob);
+int32_t s3_source_init_fd (s3_source_t *src, int32_t fd,
+                           off_t offset, off_t length);
+int32_t s3_source_init_mmap (s3_source_t *src, int32_t fd,
+                             off_t offset, off_t length);
+int32_t s3_source_init_buffer (s3_source_t *src, const char *data,
+                               size_t length);
+int32_t s3_source_slice (s3_source_t *dst, const s3_source_t *src,
+                         off_t offset, off_t length);
+size_t s3_source_read (s3_source_t *src, char *buf, size_t size);
+int32_t s3_source_seek (s3_source_t *src, off_t pos);
+off_t s3_source_length (s3_source_t *src);
+void s3_source_release (s3_source_t *src);
+
+/*
+  Download sinks, the GET write callback hands data straight to these
+  so memory stays bounded regardless of the object size.
+*/
+
+int32_t s3_sink_init_iobuf (s3_sink_t *sink, iobuf_t *iob);
+int32_t s3_sink_init_fd (s3_sink_t *sink, int32_t fd, off_t offset);
+int32_t s3_sink_init_buffer (s3_sink_t *sink, char *buf, size_t size);
+int32_t s3_sink_init_callback (s3_sink_t *sink, s3_sink_consume_t consume,
+                               s3_sink_ready_t ready, void *opaque);
+size_t s3_sink_write (s3_sink_t *sink, const char *data, size_t len);
+int32_t s3_sink_rewind (s3_sink_t *sink);
+int32_t s3_sink_ready (s3_sink_t *sink);
+
+#endif /* __S3_STREAM_H__ */
@@ -19,15 +19,13 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <curl/curl.h>
-#include <openssl/hmac.h>
-#include <openssl/evp.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
 
 #include "s3-priv.h"
 #include "s3.h"
@@ -36,410 +34,1758 @@
 /*
   SYNOPSIS
 
-  s3_curl_write: handles writing to I/O buffer
+  __s3_cond_headers: add the preconditions of 'cond' to 'req'
 
   PARAMETERS:
-  @ptr - pointer to the incoming data
-  @size - size of the individual data member
-  @nmemb - total number of data members
-  @stream - stream pointer to allocated io buffer
+  @req - request built with s3_req_init()
+  @cond - preconditions, may be NULL
+  @write - 'req' stores an object, S3 only takes ETag conditions then
 
   RETURN VALUES:
-  N : Total number of bytes processed
+   0 : Success
+  -1 : Failure, errno set appropriately
 */
 
-static size_t s3_curl_write (void *ptr, size_t size, size_t nmemb, void *stream)
+static
+int32_t __s3_cond_headers (s3_req_t *req, const s3_cond_t *cond,
+                           int32_t write)
+{
+        struct tm tm;
+
+        if (!cond)
+                return 0;
+
+        if ((write) && ((cond->if_modified_since) ||
+                        (cond->if_unmodified_since))) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if ((cond->if_match) &&
+            (s3_req_add_header (req, "if-match", cond->if_match) < 0))
+                return -1;
+
+        if ((cond->if_none_match) &&
+            (s3_req_add_header (req, "if-none-match",
+                                cond->if_none_match) < 0))
+                return -1;
+
+        if (cond->if_modified_since) {
+                gmtime_r (&cond->if_modified_since, &tm);
+                strftime (req->since, sizeof(req->since),
+                          "%a, %d %b %Y %H:%M:%S GMT", &tm);
+                if (s3_req_add_header (req, "if-modified-since",
+                                       req->since) < 0)
+                        return -1;
+        }
+
+        if (cond->if_unmodified_since) {
+                gmtime_r (&cond->if_unmodified_since, &tm);
+                strftime (req->unmodified, sizeof(req->unmodified),
+                          "%a, %d %b %Y %H:%M:%S GMT", &tm);
+                if (s3_req_add_header (req, "if-unmodified-since",
+                                       req->unmodified) < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+static
+void __s3_object_headers (s3_req_t *req, struct s3_conf *s3conf)
+{
+        if (s3conf->mime_type)
+                s3_req_add_header (req, "content-type", s3conf->mime_type);
+
+        if (s3conf->acls)
+                s3_req_add_header (req, "x-amz-acl", s3conf->acls);
+
+        if (s3conf->use_rrs)
+                s3_req_add_header (req, "x-amz-storage-class",
+                                   "REDUCED_REDUNDANCY");
+}
+
+/*
+  SYNOPSIS
+
+  __s3_upload: send 'src' as the body of 'req' and check the ETag S3
+  answers with against the MD5 of what was sent
+
+  PARAMETERS:
+  @req - request built with s3_req_init()
+  @s3conf - S3 configuration
+  @src - upload source
+  @md - filled with the MD5 of the payload when verifying, may be NULL
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately (-EIO on an ETag mismatch)
+*/
+
+static
+int32_t __s3_upload (s3_req_t *req, struct s3_conf *s3conf,
+                     s3_source_t *src, unsigned char *md)
+{
+        s3_chunked_t  chunked;
+        s3_md5_t      md5;
+        unsigned char digest[S3_MD5_LEN];
+        uchar_t       sha[S3_SHA256_LEN];
+        char          sha_hex[S3_SHA256_HEXLEN + 1];
+        char          content_md5[32];
+        char          etag[S3_ETAG_MAX];
+        int32_t       ret = -1;
+
+        req->src          = src;
+        req->payload_hash = S3_UNSIGNED_PAYLOAD;
+        s3_md5_init (&md5);
+
+        if (src->type == S3_SOURCE_BUFFER) {
+                /* Payload at hand, let S3 check it before storing it */
+                s3_md5_update (&md5, src->data, src->length);
+                s3_md5_final (&md5, digest);
+                _base64_encode (digest, sizeof(digest), content_md5);
+                if (s3_req_add_header (req, "content-md5", content_md5) < 0)
+                        return -1;
+
+                SHA256 ((const uchar_t *) src->data, src->length, sha);
+                _hex_encode (sha, sizeof(sha), sha_hex);
+                req->payload_hash = sha_hex;
+        } else {
+                /* Hashed as it streams, the data is read only once */
+                if (s3conf->verify)
+                        req->md5 = &md5;
+
+                if ((s3conf->sign_payload) &&
+                    (s3_chunked_init (&chunked, req, src, S3_CHUNK_SIZE) < 0))
+                        return -1;
+        }
+
+        ret = s3_do_request (req, s3conf);
+
+        if (req->chunked)
+                s3_chunked_release (req->chunked);
+
+        if (ret < 0)
+                goto out;
+
+        ret = -1;
+        if ((req->resp.code < 200) || (req->resp.code >= 300)) {
+                errno = -EIO;
+                goto out;
+        }
+
+        if (req->md5)
+                s3_md5_final (req->md5, digest);
+
+        if ((req->md5) || (src->type == S3_SOURCE_BUFFER)) {
+                if (md)
+                        memcpy (md, digest, sizeof(digest));
+
+                /* SSE-KMS/SSE-C ETags are not an MD5 of the data */
+                s3_etag_single (digest, etag);
+                if ((s3conf->verify) &&
+                    (s3_etag_verifiable (req->resp.etag)) &&
+                    (!s3_etag_match (req->resp.etag, etag))) {
+                        errno = -EIO;
+                        goto out;
+                }
+        }
+
+        ret = 0;
+out:
+        req->md5 = NULL;
+        return ret;
+}
+
+static
+int32_t __s3_multipart_query (s3_req_t *req, int32_t part,
+                              const char *upload_id)
+{
+        char   id[512];
+        size_t ret = 0;
+
+        ret = _uri_encode (upload_id, id, sizeof(id), 0);
+        if (ret == (size_t) -1) {
+                errno = -ENAMETOOLONG;
+                return -1;
+        }
+
+        /* Canonical order, partNumber sorts before uploadId */
+        if (part)
+                snprintf (req->query, sizeof(req->query),
+                          "partNumber=%d&uploadId=%s", part, id);
+        else
+                snprintf (req->query, sizeof(req->query), "uploadId=%s", id);
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_multipart_initiate: start a multipart upload of 'object'
+
+  RETURN VALUES:
+   0 : Success, the upload id is in 'upload_id'
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_multipart_initiate (struct s3_conf *s3conf, const char *object,
+                                 char *upload_id, size_t size, s3_req_t *req)
+{
+        s3_sink_t sink;
+        char      xml[S3_XML_MAX];
+        int32_t   ret = -1;
+
+        if (s3_req_init (req, "POST", s3conf, object) < 0)
+                return -1;
+        snprintf (req->query, sizeof(req->query), "uploads=");
+        __s3_object_headers (req, s3conf);
+        s3_sink_init_buffer (&sink, xml, sizeof(xml) - 1);
+        req->sink = &sink;
+
+        ret = s3_do_request (req, s3conf);
+        req->sink = NULL;
+        if (ret < 0)
+                return -1;
+
+        xml[sink.pos] = '\0';
+        if ((req->resp.code != 200) ||
+            (_xml_get_tag (xml, "UploadId", upload_id, size) < 0)) {
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_multipart_complete: assemble the parts listed in 'complete', the
+  <CompleteMultipartUpload> document
+
+  DESCRIPTION
+
+  S3 may fail the assembly after having answered 200, the answer is
+  checked for an <Error> as well.  req->resp.etag gets the ETag of the
+  assembled object.  The preconditions of 'cond' apply to the
+  assembled object.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_multipart_complete (struct s3_conf *s3conf, const char *object,
+                                 const char *upload_id, const char *complete,
+                                 size_t clen, const s3_cond_t *cond,
+                                 s3_req_t *req)
+{
+        s3_sink_t   sink;
+        s3_source_t body;
+        char        xml[S3_XML_MAX];
+        int32_t     ret = -1;
+
+        if ((s3_req_init (req, "POST", s3conf, object) < 0) ||
+            (__s3_multipart_query (req, 0, upload_id) < 0) ||
+            (__s3_cond_headers (req, cond, 1) < 0) ||
+            (s3_source_init_buffer (&body, complete, clen) < 0))
+                return -1;
+        s3_sink_init_buffer (&sink, xml, sizeof(xml) - 1);
+        req->sink = &sink;
+
+        ret = __s3_upload (req, s3conf, &body, NULL);
+        req->sink = NULL;
+        req->src  = NULL;
+        if (ret < 0)
+                return -1;
+
+        xml[sink.pos] = '\0';
+        if ((strstr (xml, "<Error>")) ||
+            (_xml_get_tag (xml, "ETag", req->resp.etag,
+                           sizeof(req->resp.etag)) < 0)) {
+                _xml_get_tag (xml, "Code", req->resp.error,
+                              sizeof(req->resp.error));
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Drop the parts of a failed upload, errno is left alone */
+static
+void __s3_multipart_abort (struct s3_conf *s3conf, const char *object,
+                           const char *upload_id)
+{
+        s3_req_t req;
+        int32_t  err = errno;
+
+        if ((s3_req_init (&req, "DELETE", s3conf, object) == 0) &&
+            (__s3_multipart_query (&req, 0, upload_id) == 0))
+                s3_do_request (&req, s3conf);
+
+        errno = err;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_cond_check: tell with a HEAD whether a PUT with the ETag
+  conditions of 'cond' would be refused
+
+  RETURN VALUES:
+   0 : The PUT may go ahead
+  -1 : Failure, errno set appropriately (-ESTALE when it would fail)
+*/
+
+static
+int32_t __s3_cond_check (struct s3_conf *s3conf, const char *object,
+                         const s3_cond_t *cond)
+{
+        s3_resp_t resp;
+        s3_cond_t head;
+        int32_t   ret = -1;
+
+        memset (&head, 0, sizeof(head));
+        head.if_match      = cond->if_match;
+        head.if_none_match = cond->if_none_match;
+
+        ret = s3_head_if (s3conf, object, &head, &resp);
+        if (ret == 1) {
+                /* 304 to a HEAD is a 412 to a PUT */
+                errno = -ESTALE;
+                return -1;
+        }
+        if ((ret < 0) && (errno == -ENOENT)) {
+                if (cond->if_match) {
+                        errno = -ESTALE;
+                        return -1;
+                }
+                return 0;
+        }
+
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_put_multipart: upload 'src' in s3conf->part_size parts
+
+  DESCRIPTION
+
+  Every part is checked against its own ETag as it completes, and the
+  composite ETag of the object, MD5 of the part MD5s followed by the
+  part count, is checked once S3 assembled it.  The upload is aborted
+  on any failure so no parts are left behind.
+
+  S3 only evaluates the preconditions of 'cond' when the parts are
+  assembled, they are tried with a HEAD first so that a PUT bound to
+  fail does not upload the whole object.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_put_multipart (s3_source_t *src, struct s3_conf *s3conf,
+                            const char *object, const s3_cond_t *cond,
+                            s3_resp_t *resp)
+{
+        unsigned char (*digests)[S3_MD5_LEN] = NULL;
+        s3_req_t      req;
+        s3_source_t   part;
+        char          upload_id[256];
+        char          etag[S3_ETAG_MAX];
+        char          *complete  = NULL;
+        size_t        csize      = 0;
+        size_t        clen       = 0;
+        off_t         length     = s3_source_length (src);
+        off_t         part_size  = s3conf->part_size;
+        off_t         plen       = 0;
+        int32_t       nparts     = 0;
+        int32_t       i          = 0;
+        int32_t       ret        = -1;
+
+        s3_resp_reset (&req.resp);
+
+        if ((cond) && (__s3_cond_check (s3conf, object, cond) < 0))
+                goto free;
+
+        /* Grow the parts when the object would need too many */
+        if ((length + part_size - 1) / part_size > S3_PARTS_MAX)
+                part_size = (length + S3_PARTS_MAX - 1) / S3_PARTS_MAX;
+        nparts = (length + part_size - 1) / part_size;
+
+        digests  = calloc (nparts, S3_MD5_LEN);
+        csize    = 128 + (size_t) nparts * (64 + S3_ETAG_MAX);
+        complete = malloc (csize);
+        if ((!digests) || (!complete)) {
+                errno = -ENOMEM;
+                goto free;
+        }
+
+        if (__s3_multipart_initiate (s3conf, object, upload_id,
+                                     sizeof(upload_id), &req) < 0)
+                goto free;
+
+        clen = snprintf (complete, csize, "<CompleteMultipartUpload>");
+
+        /* Parts */
+        for (i = 0; i < nparts; i++) {
+                plen = length - (off_t) i * part_size;
+                if (plen > part_size)
+                        plen = part_size;
+
+                if (s3_source_slice (&part, src, (off_t) i * part_size,
+                                     plen) < 0)
+                        goto abort;
+
+                ret = s3_req_init (&req, "PUT", s3conf, object);
+                if (ret == 0)
+                        ret = __s3_multipart_query (&req, i + 1, upload_id);
+                if (ret == 0)
+                        ret = __s3_upload (&req, s3conf, &part, digests[i]);
+                s3_source_release (&part);
+                if (ret < 0)
+                        goto abort;
+
+                clen += snprintf (complete + clen, csize - clen,
+                                  "<Part><PartNumber>%d</PartNumber>"
+                                  "<ETag>%s</ETag></Part>", i + 1,
+                                  req.resp.etag);
+        }
+        ret = -1;
+
+        clen += snprintf (complete + clen, csize - clen,
+                          "</CompleteMultipartUpload>");
+
+        if (__s3_multipart_complete (s3conf, object, upload_id, complete,
+                                     clen, cond, &req) < 0)
+                goto abort;
+
+        if ((s3conf->verify) && (s3_etag_verifiable (req.resp.etag))) {
+                s3_etag_multipart ((const unsigned char (*)[S3_MD5_LEN])
+                                   digests, nparts, etag);
+                if (!s3_etag_match (req.resp.etag, etag)) {
+                        errno = -EIO;
+                        goto free;
+                }
+        }
+
+        ret = 0;
+        goto free;
+abort:
+        ret = -1;
+        __s3_multipart_abort (s3conf, object, upload_id);
+free:
+        if (resp)
+                s3_resp_copy (resp, &req.resp);
+        if (complete)
+                free (complete);
+        if (digests)
+                free (digests);
+        return ret;
+}
+
+/*
+  Server side copy
+*/
+
+struct s3_copy {
+        struct s3_conf  *s3conf;
+        const char      *object;
+        const char      *source;        /* x-amz-copy-source */
+        const char      *src_etag;      /* source must not change */
+        const char      *upload_id;
+        off_t           length;
+        off_t           part_size;
+        int32_t         nparts;
+        char            (*etags)[S3_ETAG_MAX];
+
+        pthread_mutex_t lock;
+        int32_t         next;
+        int32_t         err;
+};
+
+/* "/bucket/key" escaped, as both x-amz-copy-source and request URI */
+static
+int32_t __s3_copy_source (const char *bucket, const char *object, char *out,
+                          size_t size)
+{
+        size_t len = 0;
+        size_t ret = 0;
+
+        out[len++] = '/';
+        ret = _uri_encode (bucket, out + len, size - len, 0);
+        if (ret == (size_t) -1)
+                goto toolong;
+        len += ret;
+
+        object += strspn (object, "/");
+        if (len + 1 >= size)
+                goto toolong;
+        out[len++] = '/';
+        ret = _uri_encode (object, out + len, size - len, 1);
+        if (ret == (size_t) -1)
+                goto toolong;
+
+        return 0;
+toolong:
+        errno = -ENAMETOOLONG;
+        return -1;
+}
+
+/* MD5 a single part ETag stands for */
+static
+int32_t __s3_etag_digest (const char *etag, unsigned char *md)
+{
+        char    hex[3] = { 0, 0, 0 };
+        int32_t i      = 0;
+
+        etag += (*etag == '"');
+        if ((strspn (etag, "0123456789abcdefABCDEF") != S3_MD5_HEXLEN) ||
+            ((etag[S3_MD5_HEXLEN]) && (etag[S3_MD5_HEXLEN] != '"')))
+                return -1;
+
+        for (i = 0; i < S3_MD5_LEN; i++) {
+                hex[0] = etag[2 * i];
+                hex[1] = etag[2 * i + 1];
+                md[i]  = strtoul (hex, NULL, 16);
+        }
+
+        return 0;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_copy_request: PUT with x-amz-copy-source, a whole object copy or
+  an UploadPartCopy when 'part' is set
+
+  DESCRIPTION
+
+  Copies answer 200 before they are done and report failures in the
+  body, the <ETag> of the body is the one of the copy.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_copy_request (s3_req_t *req, struct s3_copy *copy, int32_t part)
+{
+        s3_source_t src;
+        s3_sink_t   sink;
+        char        xml[S3_XML_MAX];
+        char        range[64];
+        off_t       first = 0;
+        off_t       last  = 0;
+        int32_t     ret   = -1;
+
+        if (s3_req_init (req, "PUT", copy->s3conf, copy->object) < 0)
+                return -1;
+
+        ret = s3_req_add_header (req, "x-amz-copy-source", copy->source);
+        if ((ret == 0) && (copy->src_etag[0]))
+                ret = s3_req_add_header (req, "x-amz-copy-source-if-match",
+                                         copy->src_etag);
+        if ((ret == 0) && (part)) {
+                first = (off_t) (part - 1) * copy->part_size;
+                last  = first + copy->part_size - 1;
+                if (last >= copy->length)
+                        last = copy->length - 1;
+                snprintf (range, sizeof(range), "bytes=%lld-%lld",
+                          (long long) first, (long long) last);
+                ret = __s3_multipart_query (req, part, copy->upload_id);
+                if (ret == 0)
+                        ret = s3_req_add_header (req,
+                                                 "x-amz-copy-source-range",
+                                                 range);
+        }
+        if (ret < 0)
+                return -1;
+        if (!part)
+                __s3_object_headers (req, copy->s3conf);
+
+        /* An empty body, a PUT without one would go out as GET */
+        s3_source_init_buffer (&src, "", 0);
+        s3_sink_init_buffer (&sink, xml, sizeof(xml) - 1);
+        req->src  = &src;
+        req->sink = &sink;
+        ret = s3_do_request (req, copy->s3conf);
+        req->src  = NULL;
+        req->sink = NULL;
+        if (ret < 0)
+                return -1;
+
+        xml[sink.pos] = '\0';
+        if ((req->resp.code != 200) || (strstr (xml, "<Error>")) ||
+            (_xml_get_tag (xml, "ETag", req->resp.etag,
+                           sizeof(req->resp.etag)) < 0)) {
+                _xml_get_tag (xml, "Code", req->resp.error,
+                              sizeof(req->resp.error));
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+static
+void *__s3_copy_worker (void *arg)
+{
+        struct s3_copy *copy = arg;
+        s3_req_t       *req  = NULL;
+        int32_t        part  = 0;
+
+        req = malloc (sizeof(*req));
+
+        for (;;) {
+                pthread_mutex_lock (&copy->lock);
+                if (!req)
+                        copy->err = -ENOMEM;
+                if ((copy->err) || (copy->next >= copy->nparts)) {
+                        pthread_mutex_unlock (&copy->lock);
+                        break;
+                }
+                part = ++copy->next;
+                pthread_mutex_unlock (&copy->lock);
+
+                if (__s3_copy_request (req, copy, part) < 0) {
+                        pthread_mutex_lock (&copy->lock);
+                        if (!copy->err)
+                                copy->err = errno;
+                        pthread_mutex_unlock (&copy->lock);
+                        break;
+                }
+                memcpy (copy->etags[part - 1], req->resp.etag, S3_ETAG_MAX);
+        }
+
+        free (req);
+        return NULL;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_copy_multipart: copy objects too large for a single copy with
+  UploadPartCopy, S3_COPY_PARALLEL parts at a time
+
+  DESCRIPTION
+
+  The part ETags are MD5s of the part data, the ETag of the assembled
+  object is checked against their composite.  The upload is aborted on
+  any failure so no parts are left behind.
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+static
+int32_t __s3_copy_multipart (struct s3_copy *copy, s3_req_t *req)
+{
+        unsigned char (*digests)[S3_MD5_LEN] = NULL;
+        pthread_t     threads[S3_COPY_PARALLEL];
+        char          upload_id[256];
+        char          etag[S3_ETAG_MAX];
+        char          *complete  = NULL;
+        size_t        csize      = 0;
+        size_t        clen       = 0;
+        int32_t       nthreads   = 0;
+        int32_t       verify     = copy->s3conf->verify;
+        int32_t       i          = 0;
+        int32_t       ret        = -1;
+
+        copy->part_size = S3_COPY_PART_SIZE;
+        if ((copy->length + copy->part_size - 1) / copy->part_size >
+            S3_PARTS_MAX)
+                copy->part_size = (copy->length + S3_PARTS_MAX - 1) /
+                        S3_PARTS_MAX;
+        copy->nparts = (copy->length + copy->part_size - 1) /
+                copy->part_size;
+
+        copy->etags = calloc (copy->nparts, S3_ETAG_MAX);
+        digests     = calloc (copy->nparts, S3_MD5_LEN);
+        csize       = 128 + (size_t) copy->nparts * (64 + S3_ETAG_MAX);
+        complete    = malloc (csize);
+        if ((!copy->etags) || (!digests) || (!complete)) {
+                errno = -ENOMEM;
+                goto free;
+        }
+
+        if (__s3_multipart_initiate (copy->s3conf, copy->object, upload_id,
+                                     sizeof(upload_id), req) < 0)
+                goto free;
+        copy->upload_id = upload_id;
+
+        pthread_mutex_init (&copy->lock, NULL);
+        for (i = 0; (i < S3_COPY_PARALLEL) && (i < copy->nparts); i++) {
+                if (pthread_create (&threads[nthreads], NULL,
+                                    __s3_copy_worker, copy))
+                        break;
+                nthreads++;
+        }
+        if (!nthreads)
+                __s3_copy_worker (copy);
+        for (i = 0; i < nthreads; i++)
+                pthread_join (threads[i], NULL);
+        pthread_mutex_destroy (&copy->lock);
+
+        if (copy->err) {
+                errno = copy->err;
+                goto abort;
+        }
+
+        clen = snprintf (complete, csize, "<CompleteMultipartUpload>");
+        for (i = 0; i < copy->nparts; i++) {
+                clen += snprintf (complete + clen, csize - clen,
+                                  "<Part><PartNumber>%d</PartNumber>"
+                                  "<ETag>%s</ETag></Part>", i + 1,
+                                  copy->etags[i]);
+                if (__s3_etag_digest (copy->etags[i], digests[i]) < 0)
+                        verify = 0;
+        }
+        clen += snprintf (complete + clen, csize - clen,
+                          "</CompleteMultipartUpload>");
+
+        if (__s3_multipart_complete (copy->s3conf, copy->object, upload_id,
+                                     complete, clen, NULL, req) < 0)
+                goto abort;
+
+        if ((verify) && (s3_etag_verifiable (req->resp.etag))) {
+                s3_etag_multipart ((const unsigned char (*)[S3_MD5_LEN])
+                                   digests, copy->nparts, etag);
+                if (!s3_etag_match (req->resp.etag, etag)) {
+                        errno = -EIO;
+                        goto free;
+                }
+        }
+
+        ret = 0;
+        goto free;
+abort:
+        __s3_multipart_abort (copy->s3conf, copy->object, upload_id);
+free:
+        free (complete);
+        free (digests);
+        free (copy->etags);
+        copy->etags = NULL;
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  s3_copy: copy 'src_object' of 'src_bucket' to 'object' server side
+
+  DESCRIPTION
+
+  Objects up to 5GB go in a single x-amz-copy-source PUT, larger ones
+  as a multipart upload of UploadPartCopy parts copied in parallel.
+  The source is pinned to the ETag it had when the copy started.  No
+  object data goes through this host.
+
+  PARAMETERS:
+  @s3conf - S3 configuration, the destination bucket
+  @src_bucket - bucket of the source, NULL for the same bucket
+  @src_object - source object
+  @object - destination object
+  @resp - status and headers of the last response, may be NULL
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately
+*/
+
+int32_t s3_copy (struct s3_conf *s3conf, const char *src_bucket,
+                 const char *src_object, const char *object,
+                 s3_resp_t *resp)
+{
+        struct s3_copy copy;
+        s3_req_t       req;
+        char           source[S3_URI_MAX];
+        char           src_etag[S3_ETAG_MAX];
+        int32_t        ret = -1;
+
+        if ((!s3conf) || (!src_object) || (!object)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (!src_bucket)
+                src_bucket = s3conf->bucket_name;
+
+        /* S3 refuses copying an object onto itself unchanged */
+        if ((!strcmp (src_bucket, s3conf->bucket_name)) &&
+            (!strcmp (src_object + strspn (src_object, "/"),
+                      object + strspn (object, "/")))) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        if (__s3_copy_source (src_bucket, src_object, source,
+                              sizeof(source)) < 0)
+                return -1;
+
+        /* Size and ETag of the source */
+        if (s3_req_init (&req, "HEAD", s3conf, NULL) < 0)
+                return -1;
+        strcpy (req.uri, source);
+        if (s3_do_request (&req, s3conf) < 0)
+                goto out;
+        snprintf (src_etag, sizeof(src_etag), "%s", req.resp.etag);
+
+        memset (&copy, 0, sizeof(copy));
+        copy.s3conf   = s3conf;
+        copy.object   = object;
+        copy.source   = source;
+        copy.src_etag = src_etag;
+        copy.length   = req.resp.content_length;
+
+        if (copy.length > S3_COPY_MAX) {
+                ret = __s3_copy_multipart (&copy, &req);
+                goto out;
+        }
+
+        if (__s3_copy_request (&req, &copy, 0) < 0)
+                goto out;
+
+        /* A single part source keeps its MD5 as ETag */
+        if ((s3conf->verify) && (s3_etag_verifiable (src_etag)) &&
+            (!strchr (src_etag, '-')) &&
+            (s3_etag_verifiable (req.resp.etag)) &&
+            (!s3_etag_match (req.resp.etag, src_etag))) {
+                errno = -EIO;
+                goto out;
+        }
+
+        ret = 0;
+out:
+        if (resp)
+                s3_resp_copy (resp, &req.resp);
+        return ret;
+}
+
+/*
+  Legacy iobuf callers find the response in the iobuf itself
+*/
+static
+void __s3_iobuf_resp (iobuf_t *iob, const s3_resp_t *resp)
+{
+        if (iob->reply)
+                free (iob->reply);
+        if (iob->etag)
+                free (iob->etag);
+        if (iob->lastmod)
+                free (iob->lastmod);
+
+        iob->reply      = (resp->reply[0]) ? strdup (resp->reply) : NULL;
+        iob->etag       = (resp->etag[0]) ? strdup (resp->etag) : NULL;
+        iob->lastmod    = (resp->last_modified[0]) ?
+                strdup (resp->last_modified) : NULL;
+        iob->code       = resp->code;
+        iob->contentlen = resp->content_length;
+}
+
+int32_t s3_put_source_if (s3_source_t *src, struct s3_conf *s3conf,
+                          const char *object, const s3_cond_t *cond,
+                          s3_resp_t *resp)
+{
+        s3_req_t req;
+        int32_t  ret = -1;
+
+        if ((!s3conf) || (!object) || (!src))
+                return -1;
+
+        if ((src->type != S3_SOURCE_IOBUF) &&
+            (s3_source_length (src) > (off_t) s3conf->part_size))
+                return __s3_put_multipart (src, s3conf, object, cond, resp);
+
+        if ((s3_req_init (&req, "PUT", s3conf, object) < 0) ||
+            (__s3_cond_headers (&req, cond, 1) < 0))
+                return -1;
+
+        __s3_object_headers (&req, s3conf);
+
+        ret = __s3_upload (&req, s3conf, src, NULL);
+        if (resp)
+                s3_resp_copy (resp, &req.resp);
+
+        return ret;
+}
+
+int32_t s3_put_source (s3_source_t *src, struct s3_conf *s3conf,
+                       const char *object, s3_resp_t *resp)
+{
+        return s3_put_source_if (src, s3conf, object, NULL, resp);
+}
+
+int32_t s3_put (iobuf_t *iob, struct s3_conf *s3conf, const char *object)
+{
+        s3_source_t src;
+        s3_resp_t   resp;
+        int32_t     ret = -1;
+
+        if (s3_source_init_iobuf (&src, iob) < 0)
+                return -1;
+
+        s3_resp_reset (&resp);
+        ret = s3_put_source (&src, s3conf, object, &resp);
+        __s3_iobuf_resp (iob, &resp);
+
+        return ret;
+}
+
+int32_t s3_put_fd (int32_t fd, off_t offset, off_t length,
+                   struct s3_conf *s3conf, const char *object,
+                   s3_resp_t *resp)
+{
+        s3_source_t src;
+        int32_t     ret = -1;
+
+        if (s3_source_init_fd (&src, fd, offset, length) < 0)
+                return -1;
+
+        ret = s3_put_source (&src, s3conf, object, resp);
+        s3_source_release (&src);
+
+        return ret;
+}
+
+int32_t s3_put_mmap (int32_t fd, off_t offset, off_t length,
+                     struct s3_conf *s3conf, const char *object,
+                     s3_resp_t *resp)
+{
+        s3_source_t src;
+        int32_t     ret = -1;
+
+        if (s3_source_init_mmap (&src, fd, offset, length) < 0)
+                return -1;
+
+        ret = s3_put_source (&src, s3conf, object, resp);
+        s3_source_release (&src);
+
+        return ret;
+}
+
+/*
+  SYNOPSIS
+
+  __s3_verify_get: check a downloaded object against its ETag
+
+  DESCRIPTION
+
+  Single part ETags are compared with the MD5 taken while the data was
+  stored.  Multipart ETags need the part boundaries, objects written to
+  a file are re-hashed S3_MD5_LANES parts at a time when s3conf's part
+  size accounts for the part count S3 reports.
+
+  RETURN VALUES:
+   0 : Success, or the ETag cannot be checked
+  -1 : Mismatch, errno set to -EIO
+*/
+
+static
+int32_t __s3_verify_get (s3_req_t *req, struct s3_conf *s3conf,
+                         s3_sink_t *sink, s3_md5_t *md5)
+{
+        unsigned char digest[S3_MD5_LEN];
+        char          etag[S3_ETAG_MAX];
+        const char    *dash  = NULL;
+        off_t         nparts = 0;
+
+        if ((req->resp.code != 200) ||
+            (!s3_etag_verifiable (req->resp.etag)))
+                return 0;
+
+        dash = strchr (req->resp.etag, '-');
+        if (!dash) {
+                s3_md5_final (md5, digest);
+                s3_etag_single (digest, etag);
+        } else {
+                nparts = (sink->pos + s3conf->part_size - 1) /
+                        s3conf->part_size;
+                if ((sink->type != S3_SINK_FD) ||
+                    (nparts != strtol (dash + 1, NULL, 10)))
+                        return 0;
+                if (s3_etag_fd (sink->fd, sink->offset, sink->pos,
+                                s3conf->part_size, etag) < 0)
+                        return -1;
+        }
+
+        if (!s3_etag_match (req->resp.etag, etag)) {
+                errno = -EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+int32_t s3_get_sink_if (s3_sink_t *sink, struct s3_conf *s3conf,
+                        const char *object, const s3_cond_t *cond,
+                        s3_resp_t *resp)
+{
+        s3_req_t req;
+        s3_md5_t md5;
+        int32_t  ret = -1;
+
+        if ((!s3conf) || (!object) || (!sink))
+                return -1;
+
+        if ((s3_req_init (&req, "GET", s3conf, object) < 0) ||
+            (__s3_cond_headers (&req, cond, 0) < 0))
+                return -1;
+
+        req.sink = sink;
+        if (s3conf->verify) {
+                s3_md5_init (&md5);
+                sink->md5 = &md5;
+        }
+
+        ret = s3_do_request (&req, s3conf);
+        sink->md5 = NULL;
+
+        if ((ret == 0) && (s3conf->verify))
+                ret = __s3_verify_get (&req, s3conf, sink, &md5);
+
+        /* Not modified, the sink was left alone */
+        if ((ret == 0) && (req.resp.code == 304))
+                ret = 1;
+
+        if (resp)
+                s3_resp_copy (resp, &req.resp);
+
+        return ret;
+}
+
+int32_t s3_get_sink (s3_sink_t *sink, struct s3_conf *s3conf,
+                     const char *object, s3_resp_t *resp)
 {
-        return s3_iobuf_add (stream, ptr, (nmemb * size));
+        return s3_get_sink_if (sink, s3conf, object, NULL, resp);
 }
 
-/*
-  SYNOPSIS
+int s3_get (iobuf_t *iob, struct s3_conf *s3conf, const char *object)
+{
+        s3_sink_t sink;
+        s3_resp_t resp;
+        int32_t   ret = -1;
 
-  s3_curl_read: Handles reading through stream per line
+        if (s3_sink_init_iobuf (&sink, iob) < 0)
+                return -1;
 
-  PARAMETERS:
-  @ptr - pointer to the incoming data
-  @size - size of the individual data member
-  @nmemb - total number of data members
-  @stream - stream pointer to allocated io buffer
+        s3_resp_reset (&resp);
+        ret = s3_get_sink (&sink, s3conf, object, &resp);
+        __s3_iobuf_resp (iob, &resp);
 
-  RETURN VALUES:
-  N : Total number of bytes sent
-*/
+        return ret;
+}
 
-static size_t s3_curl_read (void *ptr, size_t size, size_t nmemb, void *stream)
+int32_t s3_get_fd (int32_t fd, off_t offset, struct s3_conf *s3conf,
+                   const char *object, s3_resp_t *resp)
 {
-        return s3_iobuf_getline (stream, ptr, (nmemb * size));
+        s3_sink_t sink;
+
+        if (s3_sink_init_fd (&sink, fd, offset) < 0)
+                return -1;
+
+        return s3_get_sink (&sink, s3conf, object, resp);
 }
 
-/*
-  SYNOPSIS
+int32_t s3_head_if (s3_conf_t *s3conf, const char *object,
+                    const s3_cond_t *cond, s3_resp_t *resp)
+{
+        s3_req_t req;
+        int32_t  ret = -1;
 
-  process_header: Process incoming header
+        if ((!s3conf) || (!object) || (!resp))
+                return -1;
 
-  PARAMETERS:
-  @ptr - pointer to the incoming data
-  @size - size of the individual data member
-  @nmemb - total number of data members
-  @stream - stream pointer to allocated io buffer
+        if ((s3_req_init (&req, "HEAD", s3conf, object) < 0) ||
+            (__s3_cond_headers (&req, cond, 0) < 0))
+                return -1;
 
-  RETURN VALUES:
-  N : Total number of bytes sent
-*/
+        ret = s3_do_request (&req, s3conf);
+        if ((ret == 0) && (req.resp.code == 304))
+                ret = 1;
+        s3_resp_copy (resp, &req.resp);
+
+        return ret;
+}
+
+int32_t s3_head (s3_conf_t *s3conf, const char *object, s3_resp_t *resp)
+{
+        return s3_head_if (s3conf, object, NULL, resp);
+}
 
-static size_t process_header (void *ptr, size_t size, size_t nmemb,
-                              void *stream)
+int s3_delete (iobuf_t *iob, struct s3_conf *s3conf, const char *object)
 {
-        iobuf_t *buf = NULL;
+        s3_req_t req;
+        int32_t  ret = -1;
 
-        if (!stream)
+        if ((!s3conf) || (!object) || (!iob))
                 return -1;
 
-        buf = s3_iobuf_new();
-        if (!buf)
+        if (s3_req_init (&req, "DELETE", s3conf, object) < 0)
                 return -1;
 
-        if (!strncmp (ptr, "HTTP/1.1", 8)) {
-                buf->reply = strdup ((char *)ptr + 9);
-                _chomp (buf->reply);
-                buf->code = atoi ((char *)ptr + 9);
-        } else if (!strncmp (ptr, "Etag: ", 6)) {
-                buf->etag = strdup ((char *)ptr + 6);
-                _chomp (buf->etag);
-        } else if (!strncmp (ptr, "Last-Modified: ", 14)) {
-                buf->lastmod = strdup ((char *)ptr + 15);
-                _chomp (buf->lastmod);
-        } else if (!strncmp (ptr, "Content-Length: ", 15)) {
-                buf->contentlen = atoi ((char *)ptr + 16);
+        ret = s3_do_request (&req, s3conf);
+        __s3_iobuf_resp (iob, &req.resp);
+
+        return ret;
+}
+
+/*
+  Multi-object delete, batches of up to S3_DELETE_KEYS keys go out as
+  DeleteObjects requests, S3_DELETE_PARALLEL of them at once
+*/
+
+struct s3_delete_batch {
+        char                   **keys;
+        size_t                 count;
+        int32_t                owned;   /* 'keys' strdup()ed */
+        struct s3_delete_batch *next;
+};
+
+struct s3_delete {
+        struct s3_conf         *s3conf;
+        s3_delete_err_t        err_cb;
+        void                   *opaque;
+
+        pthread_mutex_t        lock;
+        pthread_cond_t         cond;
+        struct s3_delete_batch *head;
+        struct s3_delete_batch **tail;
+        int32_t                queued;
+        int32_t                closed;
+        int32_t                err;
+        int32_t                failed;  /* keys S3 refused */
+        int32_t                serial;  /* no workers, sent in place */
+
+        struct s3_delete_batch *fill;   /* being filled by s3_delete_prefix */
+};
+
+/* Growing response buffer, a quiet DeleteObjects only lists failures */
+struct s3_delete_resp {
+        char   *data;
+        size_t len;
+        size_t size;
+};
+
+static
+size_t __s3_delete_consume (const char *data, size_t len, void *opaque)
+{
+        struct s3_delete_resp *resp = opaque;
+        char                  *tmp  = NULL;
+
+        if (resp->len + len + 1 > resp->size) {
+                tmp = realloc (resp->data, (resp->len + len) * 2 + 1);
+                if (!tmp)
+                        return (size_t) -1;
+                resp->data = tmp;
+                resp->size = (resp->len + len) * 2 + 1;
         }
+        memcpy (resp->data + resp->len, data, len);
+        resp->len += len;
+        resp->data[resp->len] = '\0';
 
-        return (nmemb * size);
+        return len;
 }
 
 static
-char *__s3_sign (const char *str, const char *awskey)
+int32_t __s3_delete_rewind (void *opaque)
 {
-        uchar_t   *MD;
-        char      *base64 = NULL;
+        struct s3_delete_resp *resp = opaque;
+
+        resp->len = 0;
+        return 0;
+}
 
-        MD = HMAC(EVP_sha1(), awskey, strlen(awskey), (uchar_t *) str,
-                  strlen(str), NULL, NULL);
+static
+void __s3_delete_batch_free (struct s3_delete_batch *batch)
+{
+        size_t i = 0;
 
-        base64 = _base64_encode (MD);
+        if (!batch)
+                return;
 
-        return base64;
+        if (batch->owned) {
+                for (i = 0; i < batch->count; i++)
+                        free (batch->keys[i]);
+                free (batch->keys);
+        }
+        free (batch);
 }
 
 /*
-  Date in HTTP format - RFC2616
-  --------------------------------------------------------
-  HTTP-date    = rfc1123-date | rfc850-date | asctime-date
-  rfc1123-date = wkday "," SP date1 SP time SP "GMT"
-  rfc850-date  = weekday "," SP date2 SP time SP "GMT"
-  asctime-date = wkday SP date3 SP time SP 4DIGIT
-  date1        = 2DIGIT SP month SP 4DIGIT
-                 ; day month year (e.g., 02 Jun 1982)
-  date2        = 2DIGIT "-" month "-" 2DIGIT
-                 ; day-month-year (e.g., 02-Jun-82)
-  date3        = month SP ( 2DIGIT | ( SP 1DIGIT ))
-                 ; month day (e.g., Jun  2)
-  time         = 2DIGIT ":" 2DIGIT ":" 2DIGIT
-                 ; 00:00:00 - 23:59:59
-  wkday        = "Mon" | "Tue" | "Wed"
-               | "Thu" | "Fri" | "Sat" | "Sun"
-  weekday      = "Monday" | "Tuesday" | "Wednesday"
-               | "Thursday" | "Friday" | "Saturday" | "Sunday"
-  month        = "Jan" | "Feb" | "Mar" | "Apr"
-               | "May" | "Jun" | "Jul" | "Aug"
-               | "Sep" | "Oct" | "Nov" | "Dec"
+  SYNOPSIS
+
+  __s3_delete_send: delete the keys of 'batch' with one DeleteObjects
+
+  DESCRIPTION
+
+  Quiet mode, S3 only answers with the keys it could not delete, those
+  are handed to the error callback.  Keys that do not exist are not
+  failures.
+
+  RETURN VALUES:
+  N : Keys S3 refused to delete
+  -1 : Failure of the request, errno set appropriately
 */
 
 static
-int32_t get_http_date (char **date)
+int32_t __s3_delete_send (struct s3_delete *del,
+                          struct s3_delete_batch *batch)
 {
-        char tmp_date[256];
-        time_t t = {0,};
-        const struct tm *utc = NULL;
+        struct s3_delete_resp resp = { NULL, 0, 0 };
+        s3_source_t           src;
+        s3_sink_t             sink;
+        s3_req_t              *req   = NULL;
+        const char            *p     = NULL;
+        char                  *body  = NULL;
+        char                  key[S3_KEY_MAX + 1];
+        char                  code[64];
+        size_t                size   = 64;
+        size_t                len    = 0;
+        size_t                ret    = 0;
+        size_t                i      = 0;
+        int32_t               failed = 0;
+
+        for (i = 0; i < batch->count; i++)
+                size += 6 * strlen (batch->keys[i]) + 32;
+
+        req  = malloc (sizeof(*req));
+        body = malloc (size);
+        if ((!req) || (!body)) {
+                errno = -ENOMEM;
+                failed = -1;
+                goto out;
+        }
 
-        t = time (NULL);
+        len = snprintf (body, size, "<Delete><Quiet>true</Quiet>");
+        for (i = 0; i < batch->count; i++) {
+                len += snprintf (body + len, size - len, "<Object><Key>");
+                ret = _xml_escape (batch->keys[i], body + len, size - len);
+                if (ret == (size_t) -1) {
+                        errno = -ENAMETOOLONG;
+                        failed = -1;
+                        goto out;
+                }
+                len += ret;
+                len += snprintf (body + len, size - len,
+                                 "</Key></Object>");
+        }
+        len += snprintf (body + len, size - len, "</Delete>");
 
-        utc = gmtime (&t);
+        if ((s3_req_init (req, "POST", del->s3conf, NULL) < 0) ||
+            (s3_source_init_buffer (&src, body, len) < 0)) {
+                failed = -1;
+                goto out;
+        }
+        snprintf (req->query, sizeof(req->query), "delete=");
 
-        if (!utc)
-                return -1;
+        s3_sink_init_callback (&sink, __s3_delete_consume, NULL, &resp);
+        sink.rewind = __s3_delete_rewind;
+        req->sink   = &sink;
 
-        strftime (tmp_date, sizeof(tmp_date), "%a, %d %b %Y %H:%M:%S %Z", utc);
+        /* Content-MD5 goes along, S3 insists on it for DeleteObjects */
+        if (__s3_upload (req, del->s3conf, &src, NULL) < 0) {
+                failed = -1;
+                goto out;
+        }
 
-        *date = tmp_date;
+        for (p = (resp.data) ? strstr (resp.data, "<Error>") : NULL; p;
+             p = strstr (p + 7, "<Error>")) {
+                failed++;
+                if (!del->err_cb)
+                        continue;
+                key[0]  = '\0';
+                code[0] = '\0';
+                _xml_get_tag (p, "Key", key, sizeof(key));
+                _xml_get_tag (p, "Code", code, sizeof(code));
+                del->err_cb (key, code, del->opaque);
+        }
+out:
+        free (resp.data);
+        free (body);
+        free (req);
+        return failed;
+}
 
-        return 0;
+static
+void *__s3_delete_worker (void *arg)
+{
+        struct s3_delete       *del   = arg;
+        struct s3_delete_batch *batch = NULL;
+        int32_t                err    = 0;
+        int32_t                ret    = 0;
+
+        pthread_mutex_lock (&del->lock);
+        for (;;) {
+                while ((!del->head) && (!del->closed))
+                        pthread_cond_wait (&del->cond, &del->lock);
+                batch = del->head;
+                if (!batch)
+                        break;
+                del->head = batch->next;
+                if (!del->head)
+                        del->tail = &del->head;
+                del->queued--;
+                err = del->err;
+                pthread_cond_broadcast (&del->cond);
+                pthread_mutex_unlock (&del->lock);
+
+                /* After a failure the rest is only drained */
+                ret = (err) ? 0 : __s3_delete_send (del, batch);
+                __s3_delete_batch_free (batch);
+
+                pthread_mutex_lock (&del->lock);
+                if ((ret < 0) && (!del->err))
+                        del->err = errno;
+                else if (ret > 0)
+                        del->failed += ret;
+        }
+        pthread_mutex_unlock (&del->lock);
+
+        return NULL;
 }
 
+/* Hand 'batch' to the workers, waits while enough are queued already */
 static
-int32_t s3_set_signature_request(char *resource, const char *date,
-                                 const char *method, const char *object,
-                                 const struct s3_conf *s3conf,
-                                 char **signature)
+void __s3_delete_queue (struct s3_delete *del, struct s3_delete_batch *batch)
 {
-        char  sign_hdr [2048];
-        char  acl [32];
-        char  rrs [64];
+        pthread_mutex_lock (&del->lock);
+        while ((!del->serial) && (del->queued >= 2 * S3_DELETE_PARALLEL))
+                pthread_cond_wait (&del->cond, &del->lock);
+        batch->next = NULL;
+        *del->tail  = batch;
+        del->tail   = &batch->next;
+        del->queued++;
+        del->closed = del->serial;
+        pthread_cond_broadcast (&del->cond);
+        pthread_mutex_unlock (&del->lock);
+
+        /* Without workers the batch goes out right away */
+        if (del->serial)
+                __s3_delete_worker (del);
+}
 
-        if (!s3conf)
-                return 0;
+/*
+  SYNOPSIS
 
-        if (object)
-                snprintf (resource, strlen(resource), "%s", object);
+  __s3_delete_run: start the workers, let 'produce' queue the batches
+  and wait for all of them to be deleted
 
-        if (s3conf->acls)
-                snprintf(acl, sizeof(acl), "x-amz-acl:%s\n", s3conf->acls);
-        else
-                acl[0] = 0;
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately (-EIO when S3 refused keys)
+*/
 
-        if (s3conf->use_rrs)
-                strncpy(rrs, "x-amz-storage-class:REDUCED_REDUNDANCY\n",
-                        sizeof(rrs));
-        else
-                rrs[0] = 0;
+static
+int32_t __s3_delete_run (struct s3_delete *del,
+                         int32_t (*produce) (struct s3_delete *, void *),
+                         void *arg)
+{
+        pthread_t threads[S3_DELETE_PARALLEL];
+        int32_t   nthreads = 0;
+        int32_t   ret      = 0;
+        int32_t   i        = 0;
+
+        pthread_mutex_init (&del->lock, NULL);
+        pthread_cond_init (&del->cond, NULL);
+        del->head = NULL;
+        del->tail = &del->head;
+
+        for (i = 0; i < S3_DELETE_PARALLEL; i++) {
+                if (pthread_create (&threads[nthreads], NULL,
+                                    __s3_delete_worker, del))
+                        break;
+                nthreads++;
+        }
+
+        /* No threads, the batches are deleted as they are queued */
+        del->serial = (nthreads == 0);
+        ret = produce (del, arg);
 
-        snprintf (sign_hdr, sizeof(sign_hdr), "%s\n\n%s\n%s\n%s%s/%s",
-                  method, s3conf->mime_type ? s3conf->mime_type : "",
-                  date, acl, rrs, resource);
+        pthread_mutex_lock (&del->lock);
+        if ((ret < 0) && (!del->err))
+                del->err = (errno < 0) ? errno : -EIO;
+        del->closed = 1;
+        pthread_cond_broadcast (&del->cond);
+        pthread_mutex_unlock (&del->lock);
 
-        *signature = __s3_sign (sign_hdr, s3conf->awskey);
+        for (i = 0; i < nthreads; i++)
+                pthread_join (threads[i], NULL);
+
+        pthread_cond_destroy (&del->cond);
+        pthread_mutex_destroy (&del->lock);
+
+        if (del->err) {
+                errno = del->err;
+                return -1;
+        }
+        if (del->failed) {
+                errno = -EIO;
+                return -1;
+        }
 
         return 0;
 }
 
+struct s3_delete_keys {
+        const char *const *keys;
+        size_t            count;
+};
 
 static
-int32_t s3_do_put (iobuf_t *iob, const char *signature,
-                   const char *date, const char *resource,
-                   struct s3_conf *s3conf)
+int32_t __s3_delete_produce_keys (struct s3_delete *del, void *arg)
 {
-        char              request[1024];
-        CURL              *ch = NULL;
-        struct curl_slist *slist = NULL;
-        int32_t           ret = -1;
+        struct s3_delete_keys  *keys  = arg;
+        struct s3_delete_batch *batch = NULL;
+        size_t                 i      = 0;
+
+        for (i = 0; i < keys->count; i += S3_DELETE_KEYS) {
+                batch = calloc (1, sizeof(*batch));
+                if (!batch) {
+                        errno = -ENOMEM;
+                        return -1;
+                }
+                batch->keys  = (char **) (keys->keys + i);
+                batch->count = keys->count - i;
+                if (batch->count > S3_DELETE_KEYS)
+                        batch->count = S3_DELETE_KEYS;
+                __s3_delete_queue (del, batch);
+        }
 
-        if ((!iob) || (!signature) || (!date) || (!resource) || (!s3conf))
-                goto out;
+        return 0;
+}
 
-        ch = curl_easy_init();
+/*
+  SYNOPSIS
 
-        if (s3conf->mime_type) {
-                snprintf (request, sizeof(request), "Content-Type: %s",
-                          s3conf->mime_type);
-                slist = curl_slist_append(slist, request);
-        }
+  s3_delete_objects: delete 'count' keys, S3_DELETE_KEYS per request
 
-        if (s3conf->acls) {
-                snprintf (request, sizeof(request), "x-amz-acl: %s",
-                          s3conf->acls);
-                slist = curl_slist_append(slist, request);
-        }
+  PARAMETERS:
+  @s3conf - S3 configuration
+  @keys - keys to delete
+  @count - number of keys
+  @err_cb - called with every key S3 refused to delete and why, may
+            be NULL
+  @opaque - passed to 'err_cb'
 
-        if (s3conf->use_rrs) {
-                strncpy (request, "x-amz-storage-class: REDUCED_REDUNDANCY",
-                         sizeof(request));
-                slist = curl_slist_append(slist, request);
-        }
+  RETURN VALUES:
+   0 : Success, missing keys included
+  -1 : Failure, errno set appropriately, -EIO when keys were refused
+*/
+
+int32_t s3_delete_objects (struct s3_conf *s3conf, const char *const *keys,
+                           size_t count, s3_delete_err_t err_cb,
+                           void *opaque)
+{
+        struct s3_delete      del;
+        struct s3_delete_keys arg;
+        size_t                i = 0;
 
-        if (date) {
-                snprintf (request, sizeof(request), "Date: %s", date);
-                slist = curl_slist_append(slist, request);
+        if ((!s3conf) || ((count) && (!keys))) {
+                errno = -EINVAL;
+                return -1;
         }
 
-        if ((s3conf->awskey_id && signature)) {
-                snprintf (request, sizeof(request), "Authorization: AWS %s:%s",
-                          s3conf->awskey_id, signature);
-                slist = curl_slist_append(slist, request);
+        for (i = 0; i < count; i++) {
+                if ((!keys[i]) || (!keys[i][0])) {
+                        errno = -EINVAL;
+                        return -1;
+                }
         }
 
-        if (s3conf->s3host && resource)
-                snprintf (request, sizeof(request), "http://%s/%s",
-                          s3conf->s3host, resource);
+        memset (&del, 0, sizeof(del));
+        del.s3conf = s3conf;
+        del.err_cb = err_cb;
+        del.opaque = opaque;
+        arg.keys   = keys;
+        arg.count  = count;
 
-        curl_easy_setopt (ch, CURLOPT_HTTPHEADER, slist);
-        curl_easy_setopt (ch, CURLOPT_URL, request);
-        curl_easy_setopt (ch, CURLOPT_READDATA, iob);
-        curl_easy_setopt (ch, CURLOPT_WRITEFUNCTION, s3_curl_write);
-        curl_easy_setopt (ch, CURLOPT_READFUNCTION, s3_curl_read);
-        curl_easy_setopt (ch, CURLOPT_HEADERFUNCTION, process_header);
-        curl_easy_setopt (ch, CURLOPT_HEADERDATA, iob);
-        curl_easy_setopt (ch, CURLOPT_VERBOSE, 0);
-        curl_easy_setopt (ch, CURLOPT_UPLOAD, 1);
-        curl_easy_setopt (ch, CURLOPT_INFILESIZE, iob->len);
-        curl_easy_setopt (ch, CURLOPT_FOLLOWLOCATION, 1);
-        curl_easy_setopt (ch, CURLOPT_ERRORBUFFER, 1);
+        return __s3_delete_run (&del, __s3_delete_produce_keys, &arg);
+}
 
-        curl_easy_perform (ch);
-        curl_slist_free_all (slist);
-        curl_easy_cleanup (ch);
+static
+int32_t __s3_delete_fail (struct s3_delete *del, int32_t err)
+{
+        pthread_mutex_lock (&del->lock);
+        if (!del->err)
+                del->err = err;
+        pthread_mutex_unlock (&del->lock);
 
-        ret = 0;
-out:
-        return ret;
+        return 1;
 }
 
-
+/* Listing callback, keys are collected into batches as they stream in */
 static
-int32_t s3_do_get (iobuf_t *iob, const char *signature,
-                   const char *date, const char *resource,
-                   struct s3_conf *s3conf)
+int32_t __s3_delete_collect (const s3_entry_t *entry, void *opaque)
 {
-        char              request[1024];
-        CURL              *ch    = NULL;
-        struct curl_slist *slist = NULL;
-        int32_t           ret = -1;
-
-        if ((!iob) || (!signature) || (!date) || (!resource) || (!s3conf))
-                goto out;
+        struct s3_delete       *del   = opaque;
+        struct s3_delete_batch *batch = del->fill;
 
-        ch = curl_easy_init ();
+        if (entry->is_prefix)
+                return 0;
 
-        snprintf (request, sizeof(request), "Date: %s", date);
-        slist = curl_slist_append (slist, request);
+        if (!batch) {
+                batch = calloc (1, sizeof(*batch));
+                if (batch)
+                        batch->keys = calloc (S3_DELETE_KEYS,
+                                              sizeof(*batch->keys));
+                if ((!batch) || (!batch->keys)) {
+                        free (batch);
+                        return __s3_delete_fail (del, -ENOMEM);
+                }
+                batch->owned = 1;
+                del->fill    = batch;
+        }
 
-        snprintf (request, sizeof(request), "Authorization: AWS %s:%s",
-                  s3conf->awskey_id, signature);
-        slist = curl_slist_append(slist, request);
+        batch->keys[batch->count] = strdup (entry->key);
+        if (!batch->keys[batch->count])
+                return __s3_delete_fail (del, -ENOMEM);
+        batch->count++;
 
-        snprintf (request, sizeof(request), "http://%s/%s",
-                  s3conf->s3host, resource);
+        if (batch->count == S3_DELETE_KEYS) {
+                del->fill = NULL;
+                __s3_delete_queue (del, batch);
+        }
 
-        curl_easy_setopt (ch, CURLOPT_HTTPHEADER, slist);
-        curl_easy_setopt (ch, CURLOPT_URL, request);
-        curl_easy_setopt (ch, CURLOPT_WRITEFUNCTION, s3_curl_write);
-        curl_easy_setopt (ch, CURLOPT_WRITEDATA, iob);
-        curl_easy_setopt (ch, CURLOPT_HEADERFUNCTION, process_header);
-        curl_easy_setopt (ch, CURLOPT_HEADERDATA, iob);
-        curl_easy_setopt (ch, CURLOPT_ERRORBUFFER, 1);
+        /* No point listing on once deletes fail */
+        return (__atomic_load_n (&del->err, __ATOMIC_RELAXED) != 0);
+}
 
-        curl_easy_perform(ch);
-        curl_slist_free_all(slist);
-        curl_easy_cleanup(ch);
+static
+int32_t __s3_delete_produce_prefix (struct s3_delete *del, void *arg)
+{
+        int32_t ret = 0;
+
+        ret = s3_list (del->s3conf, arg, NULL, __s3_delete_collect, del);
+        if ((ret < 0) && (errno == -ECANCELED) && (del->err))
+                ret = 0;
+
+        if (del->fill) {
+                if (ret == 0)
+                        __s3_delete_queue (del, del->fill);
+                else
+                        __s3_delete_batch_free (del->fill);
+                del->fill = NULL;
+        }
 
-        ret = 0;
-out:
         return ret;
-
 }
 
-static
-int32_t s3_do_delete (iobuf_t *iob, const char *signature,
-                      const char *date, const char *resource,
-                      struct s3_conf *s3conf)
+/*
+  SYNOPSIS
+
+  s3_delete_prefix: delete every key under 'prefix'
+
+  DESCRIPTION
+
+  Keys are deleted while the listing streams in, one DeleteObjects per
+  S3_DELETE_KEYS keys.  Keys written under 'prefix' meanwhile may or
+  may not be deleted.
+
+  PARAMETERS:
+  @s3conf - S3 configuration
+  @prefix - key prefix, "" for the whole bucket
+  @err_cb - called with every key S3 refused to delete and why, may
+            be NULL
+  @opaque - passed to 'err_cb'
+
+  RETURN VALUES:
+   0 : Success
+  -1 : Failure, errno set appropriately, -EIO when keys were refused
+*/
+
+int32_t s3_delete_prefix (struct s3_conf *s3conf, const char *prefix,
+                          s3_delete_err_t err_cb, void *opaque)
 {
-        char              request[1024];
-        CURL              *ch = NULL;
-        struct curl_slist *slist = NULL;
-        int32_t           ret = -1;
+        struct s3_delete del;
 
-        if ((!iob) || (!signature) || (!date) || (!resource) || (!s3conf))
-                goto out;
+        if ((!s3conf) || (!prefix)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        ch = curl_easy_init ();
+        memset (&del, 0, sizeof(del));
+        del.s3conf = s3conf;
+        del.err_cb = err_cb;
+        del.opaque = opaque;
 
-        snprintf (request, sizeof(request), "Date: %s", date);
-        slist = curl_slist_append(slist, request);
+        return __s3_delete_run (&del, __s3_delete_produce_prefix,
+                                (void *) prefix);
+}
 
-        snprintf (request, sizeof(request), "Authorization: AWS %s:%s",
-                  s3conf->awskey_id, signature);
-        slist = curl_slist_append(slist, request);
+int32_t s3_set_payload_signing (struct s3_conf *s3conf, int32_t enable)
+{
+        if (!s3conf) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        snprintf (request, sizeof(request), "http://%s/%s",
-                  s3conf->s3host, resource);
+        s3conf->sign_payload = (enable != 0);
+        return 0;
+}
 
-        curl_easy_setopt (ch, CURLOPT_CUSTOMREQUEST, "DELETE");
-        curl_easy_setopt (ch, CURLOPT_HTTPHEADER, slist);
-        curl_easy_setopt (ch, CURLOPT_URL, request);
-        curl_easy_setopt (ch, CURLOPT_HEADERFUNCTION, process_header);
-        curl_easy_setopt (ch, CURLOPT_HEADERDATA, iob);
+int32_t s3_set_verify (struct s3_conf *s3conf, int32_t enable)
+{
+        if (!s3conf) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        curl_easy_perform(ch);
-        curl_slist_free_all(slist);
-        curl_easy_cleanup(ch);
+        s3conf->verify = (enable != 0);
+        return 0;
+}
 
-        ret = 0;
-out:
-        return ret;
+int32_t s3_set_part_size (struct s3_conf *s3conf, size_t part_size)
+{
+        if ((!s3conf) || (part_size < S3_PART_SIZE_MIN)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
+        s3conf->part_size = part_size;
+        return 0;
 }
 
+int32_t s3_set_retries (struct s3_conf *s3conf, int32_t max_retries)
+{
+        if ((!s3conf) || (max_retries < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-int32_t s3_put (iobuf_t *iob, struct s3_conf *s3conf, const char*object)
+        s3conf->max_retries = max_retries;
+        return 0;
+}
+
+int32_t s3_set_hedging (struct s3_conf *s3conf, int32_t percentile)
 {
-        char  resource [1024] = "";
-        char *date            = NULL;
-        char *signature       = NULL;
-        int32_t ret           = -1;
+        if ((!s3conf) || (percentile < 0) || (percentile > 99)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        if ((!s3conf) || (!object) || (!iob))
-                goto out;
+        s3conf->hedge_pct = percentile;
+        return 0;
+}
+
+int32_t s3_set_list_parallel (struct s3_conf *s3conf, int32_t ranges)
+{
+        if ((!s3conf) || (ranges < 1) || (ranges > S3_LIST_PARALLEL_MAX)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        get_http_date (&date);
+        s3conf->list_parallel = ranges;
+        return 0;
+}
 
-        s3_set_signature_request (resource, date, "PUT",
-                                  object, s3conf,
-                                  &signature);
+int32_t s3_set_max_connections (struct s3_conf *s3conf, int32_t count)
+{
+        if ((!s3conf) || (count < 0)) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        ret = s3_do_put (iob, signature, date, resource, s3conf);
+        pthread_mutex_lock (&s3conf->mux_lock);
+        s3conf->max_connections = count;
+        if (s3conf->mux_running)
+                curl_multi_wakeup (s3conf->mux);
+        pthread_mutex_unlock (&s3conf->mux_lock);
 
-        if (signature)
-                free (signature);
-out:
-        return ret;
+        return 0;
 }
 
-int s3_get (iobuf_t *iob, struct s3_conf *s3conf, const char *object)
+int32_t s3_set_rate_limit (struct s3_conf *s3conf, uint64_t bytes_per_sec,
+                           uint64_t requests_per_sec)
 {
-        char  resource [1024] = "";
-        char  *date           = NULL;
-        char  *signature      = NULL;
-        int32_t ret           = -1;
+        uint64_t burst = 0;
 
-        if ((!s3conf) || (!object) || (!iob))
-                goto out;
+        if (!s3conf) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        get_http_date (&date);
+        /* A curl buffer at least, or no single write could ever pass */
+        burst = bytes_per_sec / S3_LIMIT_BURST_DIV;
+        if (burst < CURL_MAX_WRITE_SIZE)
+                burst = CURL_MAX_WRITE_SIZE;
+        s3_limit_init (&s3conf->limit_send, bytes_per_sec, burst);
+        s3_limit_init (&s3conf->limit_recv, bytes_per_sec, burst);
+        s3_limit_init (&s3conf->limit_reqs, requests_per_sec,
+                       requests_per_sec / S3_LIMIT_BURST_DIV);
 
-        s3_set_signature_request (resource, date, "GET",
-                                  object, s3conf,
-                                  &signature);
+        return 0;
+}
 
-        ret = s3_do_get (iob, signature, date, resource, s3conf);
+int32_t s3_set_https (struct s3_conf *s3conf, int32_t enable)
+{
+        if (!s3conf) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        if (signature)
-                free (signature);
-out:
-        return ret;
+        s3conf->https = (enable != 0);
+        return 0;
 }
 
-int s3_delete (iobuf_t *iob, struct s3_conf *s3conf, const char *object)
+int32_t s3_set_ca_file (struct s3_conf *s3conf, const char *ca_file)
 {
-        char  resource [1024] = "";
-        char  *date           = NULL;
-        char  *signature      = NULL;
-        int32_t ret           = -1;
+        char *tmp = NULL;
 
-        if ((!s3conf) || (!object) || (!iob))
-                goto out;
+        if (!s3conf) {
+                errno = -EINVAL;
+                return -1;
+        }
 
-        get_http_date (&date);
+        if (ca_file) {
+                tmp = strdup (ca_file);
+                if (!tmp) {
+                        errno = -ENOMEM;
+                        return -1;
+                }
+        }
 
-        s3_set_signature_request (resource, date, "GET",
-                                  object, s3conf,
-                                  &signature);
+        if (s3conf->ca_file)
+                free (s3conf->ca_file);
+        s3conf->ca_file = tmp;
 
-        ret = s3_do_delete (iob, signature, date, resource, s3conf);
+        return 0;
+}
 
-        if (signature)
-                free (signature);
-out:
-        return ret;
+int32_t s3_set_region (struct s3_conf *s3conf, const char *region)
+{
+        char *tmp = NULL;
+
+        if ((!s3conf) || (!region)) {
+                errno = -EINVAL;
+                return -1;
+        }
+
+        tmp = strdup (region);
+        if (!tmp) {
+                errno = -ENOMEM;
+                return -1;
+        }
 
+        pthread_mutex_lock (&s3conf->lock);
+        if (s3conf->region)
+                free (s3conf->region);
+        s3conf->region = tmp;
+        pthread_mutex_unlock (&s3conf->lock);
+
+        return 0;
 }
 
 
@@ -469,12 +1815,30 @@ struct s3_conf *s3_init (const char *account_id,
         s3conf->awskey = strdup (awskey);
         s3conf->s3host = strdup (s3host);
         s3conf->bucket_name = strdup (bktname);
+        s3conf->region = NULL;
+        s3conf->sign_payload = 1;
+        s3conf->verify = 1;
+        s3conf->part_size = S3_PART_SIZE;
+        s3conf->max_retries = S3_RETRIES;
+        s3conf->retry_tokens = S3_RETRY_TOKENS;
+        s3conf->connect_timeout_ms = S3_CONNECT_TIMEOUT_MS;
+        s3conf->stall_timeout = S3_STALL_TIMEOUT;
+        s3conf->hedge_pct = S3_HEDGE_PCT;
+        s3conf->list_parallel = S3_LIST_PARALLEL;
         s3conf->use_rrs = 0;
         s3conf->mime_type = NULL;
         s3conf->acls = NULL;
 
+        pthread_mutex_init (&s3conf->lock, NULL);
+        s3_mux_init (s3conf);
+
         curl_global_init (CURL_GLOBAL_ALL);
 
+        if (s3_endpoints_init (s3conf) < 0) {
+                s3_fini (s3conf);
+                return NULL;
+        }
+
         return s3conf;
 }
 
@@ -483,18 +1847,26 @@ void s3_fini (struct s3_conf *s3conf)
         if (s3conf) {
                 if (s3conf->account_id)
                         free (s3conf->account_id);
-                else if (s3conf->awskey_id)
+                if (s3conf->awskey_id)
                         free (s3conf->awskey_id);
-                else if (s3conf->awskey)
+                if (s3conf->awskey)
                         free (s3conf->awskey);
-                else if (s3conf->s3host)
+                if (s3conf->s3host)
                         free (s3conf->s3host);
-                else if (s3conf->bucket_name)
+                if (s3conf->bucket_name)
                         free (s3conf->bucket_name);
-                else if (s3conf->mime_type)
+                if (s3conf->region)
+                        free (s3conf->region);
+                if (s3conf->ca_file)
+                        free (s3conf->ca_file);
+                if (s3conf->mime_type)
                         free (s3conf->mime_type);
-                else if (s3conf->acls)
+                if (s3conf->acls)
                         free (s3conf->acls);
+                s3_mux_fini (s3conf);
+                s3_endpoints_fini (s3conf);
+                pthread_mutex_destroy (&s3conf->lock);
+                memset (s3conf->keys, 0, sizeof(s3conf->keys));
                 free (s3conf);
         }
 }
@@ -19,6 +19,9 @@ struct s3_conf;
 typedef struct s3_conf s3_conf_t;
 
 #include "s3-iobuf.h"
+#include "s3-stream.h"
+#include "s3-resp.h"
+#include "s3-list.h"
 
 /*
   INIT/FINI
@@ -31,13 +34,186 @@ s3_conf_t *s3_init (const char *account_id,
                     const char *bktname);
 void s3_fini (s3_conf_t *s3conf);
 
+/* Region used in the SigV4 credential scope, "us-east-1" by default */
+int32_t s3_set_region (s3_conf_t *s3conf, const char *region);
+
+/*
+  Rate limits for everything sent through 's3conf': bytes per second,
+  each way, and requests per second (retries and hedges included).  0
+  lifts a limit, both are off by default.  Transfers slow down to the
+  limit rather than bursting into S3 throttling.
+*/
+int32_t s3_set_rate_limit (s3_conf_t *s3conf, uint64_t bytes_per_sec,
+                           uint64_t requests_per_sec);
+
+/*
+  Talk HTTPS, HTTP/2 where the endpoint agrees to it.  TLS sessions are
+  resumed across requests and connections kept open between them.
+  Disabled by default.
+*/
+int32_t s3_set_https (s3_conf_t *s3conf, int32_t enable);
+
+/*
+  CA bundle endpoint certificates are checked against, NULL (the
+  default) for the system one.  Set it before sending requests.
+*/
+int32_t s3_set_ca_file (s3_conf_t *s3conf, const char *ca_file);
+
+/*
+  Sign upload payloads chunk by chunk (aws-chunked) while they stream,
+  enabled by default.  When disabled uploads are sent UNSIGNED-PAYLOAD.
+*/
+int32_t s3_set_payload_signing (s3_conf_t *s3conf, int32_t enable);
+
+/*
+  Check ETags against the MD5 of the data sent or received, enabled by
+  default.  Mismatches fail the transfer with -EIO.
+*/
+int32_t s3_set_verify (s3_conf_t *s3conf, int32_t enable);
+
+/*
+  Uploads larger than 'part_size' (64MB by default, 5MB minimum) go
+  out as multipart uploads
+*/
+int32_t s3_set_part_size (s3_conf_t *s3conf, size_t part_size);
+
+/*
+  Transient failures (5xx, throttling, broken or stalled connections)
+  are retried up to 'max_retries' times with jittered exponential
+  backoff, 3 by default
+*/
+int32_t s3_set_retries (s3_conf_t *s3conf, int32_t max_retries);
+
+/*
+  GETs that have not started answering by the 'percentile' latency of
+  recent GETs get a second copy sent, the slower copy is dropped.  95 by
+  default, 0 disables hedging.
+*/
+int32_t s3_set_hedging (s3_conf_t *s3conf, int32_t percentile);
+
+/*
+  Key ranges s3_list() fetches at once, each with its next page
+  prefetched.  4 by default, 64 at most.
+*/
+int32_t s3_set_list_parallel (s3_conf_t *s3conf, int32_t ranges);
+
+/*
+  Connections opened to one host by requests held in memory (iobuf
+  and buffer bodies), which share them as HTTP/2 streams.  Requests
+  past the limit wait for a stream.  0 (the default) for no limit.
+*/
+int32_t s3_set_max_connections (s3_conf_t *s3conf, int32_t count);
+
+/*
+  Spread requests over 'count' gateways ("host", "host:port" or
+  "[v6addr]:port") serving s3host, the URL and signature keep s3host.
+  Without endpoints (count 0, the default) requests are spread over the
+  addresses s3host resolves to, looked up once a minute.  Requests go
+  where the fewest are in flight, gateways failing 3 times in a row
+  are left out for a while.  -EBUSY while requests are in flight.
+*/
+int32_t s3_set_endpoints (s3_conf_t *s3conf, const char *const *endpoints,
+                          int32_t count);
+
+/*
+  Preconditions of a request, unset fields are not sent.  ETags are
+  given as S3 sends them, with the quotes, "*" matches any object.
+*/
+typedef struct {
+        const char *if_match;
+        const char *if_none_match;
+        time_t     if_modified_since;    /* GET and HEAD only */
+        time_t     if_unmodified_since;  /* GET and HEAD only */
+} s3_cond_t;
+
 /*
   S3 Bucket/Object I/O functions
+
+  Calls taking an 's3_resp_t' fill it with the status and headers of
+  the response when it is not NULL, iobuf based calls fill the iobuf.
 */
 
 int32_t s3_get (iobuf_t *buf, s3_conf_t *s3conf,
                 const char *object);
+int32_t s3_get_sink (s3_sink_t *sink, s3_conf_t *s3conf,
+                     const char *object, s3_resp_t *resp);
+
+/*
+  Write the object into 'fd' starting at 'offset', a non-blocking 'fd'
+  pauses the transfer until it becomes writable again
+*/
+
+int32_t s3_get_fd (int32_t fd, off_t offset, s3_conf_t *s3conf,
+                   const char *object, s3_resp_t *resp);
 int32_t s3_put (iobuf_t *buf, s3_conf_t *s3conf,
                 const char *object);
+int32_t s3_put_source (s3_source_t *src, s3_conf_t *s3conf,
+                       const char *object, s3_resp_t *resp);
+
+/*
+  Stream 'length' bytes at 'offset' of 'fd' without staging them in
+  memory, a negative 'length' uploads till the end of the file
+*/
+
+int32_t s3_put_fd (int32_t fd, off_t offset, off_t length,
+                   s3_conf_t *s3conf, const char *object, s3_resp_t *resp);
+int32_t s3_put_mmap (int32_t fd, off_t offset, off_t length,
+                     s3_conf_t *s3conf, const char *object,
+                     s3_resp_t *resp);
+
+/* Object metadata only, no body is transferred */
+int32_t s3_head (s3_conf_t *s3conf, const char *object, s3_resp_t *resp);
+
+/*
+  Conditional GET, PUT and HEAD, 'cond' may be NULL.  They return 1
+  when S3 answered 304 Not Modified, nothing was transferred and the
+  caller's copy is current, and fail with -ESTALE when S3 answered
+  412 Precondition Failed.  A PUT with if_none_match "*" only creates
+  the object, a multipart one is checked when it is completed.
+*/
+
+int32_t s3_get_sink_if (s3_sink_t *sink, s3_conf_t *s3conf,
+                        const char *object, const s3_cond_t *cond,
+                        s3_resp_t *resp);
+int32_t s3_put_source_if (s3_source_t *src, s3_conf_t *s3conf,
+                          const char *object, const s3_cond_t *cond,
+                          s3_resp_t *resp);
+int32_t s3_head_if (s3_conf_t *s3conf, const char *object,
+                    const s3_cond_t *cond, s3_resp_t *resp);
+
 int32_t s3_delete (iobuf_t *buf, s3_conf_t *s3conf,
                    const char *object);
+
+/*
+  Multi-object delete, S3_DELETE_KEYS (1000) keys per DeleteObjects
+  request with several requests in flight.  Keys S3 refuses to delete
+  are handed to 'err_cb' (when set) and fail the call with -EIO, keys
+  that do not exist are not an error.
+*/
+typedef void (*s3_delete_err_t) (const char *key, const char *code,
+                                 void *opaque);
+
+int32_t s3_delete_objects (s3_conf_t *s3conf, const char *const *keys,
+                           size_t count, s3_delete_err_t err_cb,
+                           void *opaque);
+
+/* Every key under 'prefix', deleted while the listing streams in */
+int32_t s3_delete_prefix (s3_conf_t *s3conf, const char *prefix,
+                          s3_delete_err_t err_cb, void *opaque);
+
+/*
+  Server side copy of 'src_object' in 'src_bucket' (NULL for the same
+  bucket) to 'object', no data goes through this host
+*/
+int32_t s3_copy (s3_conf_t *s3conf, const char *src_bucket,
+                 const char *src_object, const char *object,
+                 s3_resp_t *resp);
+
+/*
+  ListObjectsV2, 'cb' gets every key under 'prefix' (and every common
+  prefix when 'delimiter' is set) while the listing streams in, in no
+  particular order.  Calls never overlap, non-zero from 'cb' stops the
+  listing with -ECANCELED.
+*/
+int32_t s3_list (s3_conf_t *s3conf, const char *prefix,
+                 const char *delimiter, s3_list_cb_t cb, void *opaque);
@@ -39,6 +39,9 @@ extern "C" {
 
 #ifdef DLL
 #define BIGOBJECTS_API __declspec(dllexport)
+#elif defined(__GNUC__) && (__GNUC__ >= 4)
+/* The library is built with -fvisibility=hidden */
+#define BIGOBJECTS_API __attribute__ ((visibility ("default")))
 #else
 #define BIGOBJECTS_API
 #endif  /* DLL */
@@ -110,6 +113,57 @@ BIGOBJECTS_API int32_t bigobject_put (const char *);
 
 BIGOBJECTS_API int32_t bigobject_delete (const char *);
 
+/*
+  SYNOPSIS
+
+  bigobject_copy: copy an object, possibly across durable storages
+
+  DESCRIPTION
+
+  This function copies the object specified by 'URI' to the one
+  specified by the second 'URI'.  When both live behind the same
+  driver and server the driver copies it without a local copy: on the
+  servers where the storage can (S3, a Gluster volume whose gfapi has
+  glfs_copy_file_range()), otherwise streamed through this host's
+  memory.  Otherwise, or when the driver cannot copy, the object is
+  fetched into a temporary file under $TMPDIR (/tmp when unset) and
+  uploaded from there.
+
+  PARAMETERS
+
+  @src: The source uri string
+  @dst: The destination uri string
+
+  RETURN VALUES
+
+   0 : Success, object copied
+  -1 : Failure, errno set appropriately
+*/
+
+BIGOBJECTS_API int32_t bigobject_copy (const char *, const char *);
+
+/*
+  SYNOPSIS
+
+  bigobject_rename: move an object, possibly across durable storages
+
+  DESCRIPTION
+
+  Same as bigobject_copy() followed by deleting the source object.
+
+  PARAMETERS
+
+  @src: The source uri string
+  @dst: The destination uri string
+
+  RETURN VALUES
+
+   0 : Success, object moved
+  -1 : Failure, errno set appropriately
+*/
+
+BIGOBJECTS_API int32_t bigobject_rename (const char *, const char *);
+
 __END_DECLS
 #
 #ifdef __cplusplus
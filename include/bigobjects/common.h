@@ -20,6 +20,7 @@ typedef enum _bfs_boolean bfs_boolean_t;
 /* Supported storage drivers */
 #define STORAGE_DRIVER_GLUSTER "gluster"
 #define STORAGE_DRIVER_FILE "file"
+#define STORAGE_DRIVER_S3 "s3"
 
 /* FIXME: Configurable? */
 #define DEFAULT_DRIVERDIR "/usr/lib/bigobjects/driver"
@@ -36,10 +36,14 @@ typedef int32_t (*op_put_t) (driver_t *this);
 typedef int32_t (*op_get_t) (driver_t *this);
 typedef int32_t (*op_delete_t)  (driver_t *this);
 
+/* Copy this->object to dst->object without moving the data through us */
+typedef int32_t (*op_copy_t) (driver_t *this, driver_t *dst);
+
 struct driver_ops {
         op_put_t      put;
         op_get_t      get;
         op_delete_t   delete;
+        op_copy_t     copy;
 };
 
 int32_t default_put (driver_t *this);
@@ -48,6 +52,8 @@ int32_t default_get (driver_t *this);
 
 int32_t default_delete (driver_t *this);
 
+int32_t default_copy (driver_t *this, driver_t *dst);
+
 typedef struct {
         int32_t               (*init) (driver_t *this);
         void                  (*fini) (driver_t *this);
@@ -61,6 +67,10 @@ struct _driver {
         int32_t               port;
         char                  *object;
 
+        /* Local end of get/put, read from by put and written to by get,
+           -1 when there is none */
+        int32_t               fd;
+
         /* Driver specific private structures */
         void                  *private;
 
@@ -72,6 +82,7 @@ struct _driver {
 };
 
 driver_t *driver_new (struct bigobjects *);
+void driver_free (driver_t *);
 bfs_boolean_t is_driver_valid (const char *);
 int32_t driver_dynload (driver_t *);
 
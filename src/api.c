@@ -18,7 +18,9 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -169,6 +171,164 @@ out:
         return ret;
 }
 
+/*
+  Same driver and same server on both ends, the driver may copy without
+  the data coming through us
+*/
+static
+bfs_boolean_t __bigobject_same_driver (struct bigobjects *src,
+                                       struct bigobjects *dst)
+{
+        if ((strcasecmp (src->driver_scheme, dst->driver_scheme)) ||
+            (strcmp (src->driver_server, dst->driver_server)) ||
+            (src->driver_port != dst->driver_port))
+                return _bfs_false;
+
+        return _bfs_true;
+}
+
+/* Driver for 'bobjs', loaded and initialized */
+static
+driver_t *__bigobject_driver_get (struct bigobjects *bobjs)
+{
+        driver_t *driver = NULL;
+        int32_t  err     = 0;
+
+        driver = driver_new (bobjs);
+        if (!driver)
+                return NULL;
+
+        driver->bucket = bobjs->driver_volname;
+        driver->server = bobjs->driver_server;
+        driver->port   = bobjs->driver_port;
+        driver->object = bobjs->driver_file;
+
+        if (driver->init (driver) < 0) {
+                err = errno;
+                driver_free (driver);
+                errno = err;
+                return NULL;
+        }
+
+        return driver;
+}
+
+static
+void __bigobject_driver_put (driver_t *driver)
+{
+        int32_t err = errno;
+
+        if (!driver)
+                return;
+
+        driver->fini (driver);
+        driver_free (driver);
+        errno = err;
+}
+
+/*
+  Drivers without server side copy, or two different ones, the object
+  is fetched into an unlinked temporary file under $TMPDIR (or /tmp)
+  and uploaded from it
+*/
+static
+int32_t __bigobject_stream (driver_t *from, driver_t *to)
+{
+        const char *dir = getenv ("TMPDIR");
+        char       path[PATH_MAX];
+        int32_t    fd   = -1;
+        int32_t    err  = 0;
+        int32_t    ret  = -1;
+
+        if ((!dir) || (!*dir))
+                dir = "/tmp";
+        if (snprintf (path, sizeof(path), "%s/bigobjects.XXXXXX",
+                      dir) >= (int) sizeof(path)) {
+                errno = -ENAMETOOLONG;
+                goto out;
+        }
+
+        fd = mkstemp (path);
+        if (fd < 0) {
+                errno = -errno;
+                goto out;
+        }
+        unlink (path);
+
+        from->fd = fd;
+        if (from->ops->get (from) < 0)
+                goto out;
+
+        if (lseek (fd, 0, SEEK_SET) < 0) {
+                errno = -errno;
+                goto out;
+        }
+
+        to->fd = fd;
+        ret = to->ops->put (to);
+out:
+        if (fd >= 0) {
+                err = errno;
+                close (fd);
+                errno = err;
+        }
+        from->fd = -1;
+        to->fd   = -1;
+        return ret;
+}
+
+static
+int32_t __bigobject_copy_internal (struct bigobjects *src,
+                                   struct bigobjects *dst,
+                                   bfs_boolean_t move)
+{
+        driver_t *from = NULL;
+        driver_t *to   = NULL;
+        driver_t target;
+        int32_t  ret   = -1;
+
+        if ((!src) || (!dst)) {
+                errno = -EINVAL;
+                goto out;
+        }
+
+        from = __bigobject_driver_get (src);
+        if (!from)
+                goto out;
+
+        if (__bigobject_same_driver (src, dst)) {
+                memset (&target, 0, sizeof(target));
+                target.name   = dst->driver_scheme;
+                target.bucket = dst->driver_volname;
+                target.server = dst->driver_server;
+                target.port   = dst->driver_port;
+                target.object = dst->driver_file;
+                target.fd     = -1;
+
+                ret = from->ops->copy (from, &target);
+                if ((ret < 0) && (errno != -ENOTSUP))
+                        goto out;
+        }
+
+        if (ret < 0) {
+                to = __bigobject_driver_get (dst);
+                if (!to)
+                        goto out;
+
+                ret = __bigobject_stream (from, to);
+                if (ret < 0)
+                        goto out;
+        }
+
+        /* Copied, the source goes only now */
+        if (move)
+                ret = from->ops->delete (from);
+out:
+        __bigobject_driver_put (to);
+        __bigobject_driver_put (from);
+        return ret;
+}
+
 int32_t
 bigobject_put (const char *uristr)
 {
@@ -228,3 +388,47 @@ bigobject_delete (const char *uristr)
 out:
         return ret;
 }
+
+int32_t
+bigobject_copy (const char *src_uristr, const char *dst_uristr)
+{
+        struct bigobjects *src = NULL;
+        struct bigobjects *dst = NULL;
+        int32_t ret            = -1;
+
+        if ((!src_uristr) || (!dst_uristr))
+                goto out;
+
+        src = bigobject_new (src_uristr);
+        dst = bigobject_new (dst_uristr);
+        if ((!src) || (!dst)) {
+                errno = -ENOMEM;
+                goto out;
+        }
+
+        ret = __bigobject_copy_internal (src, dst, _bfs_false);
+out:
+        return ret;
+}
+
+int32_t
+bigobject_rename (const char *src_uristr, const char *dst_uristr)
+{
+        struct bigobjects *src = NULL;
+        struct bigobjects *dst = NULL;
+        int32_t ret            = -1;
+
+        if ((!src_uristr) || (!dst_uristr))
+                goto out;
+
+        src = bigobject_new (src_uristr);
+        dst = bigobject_new (dst_uristr);
+        if ((!src) || (!dst)) {
+                errno = -ENOMEM;
+                goto out;
+        }
+
+        ret = __bigobject_copy_internal (src, dst, _bfs_true);
+out:
+        return ret;
+}
@@ -1,23 +1,24 @@
 #include "bigobjects/driver.h"
 
+/* Nothing to move the data with, copies through us need both */
 int32_t default_put (driver_t *this)
 {
-        int32_t ret = 0;
-
         if (!this)
-                ret = -1;
+                errno = -EINVAL;
+        else
+                errno = -ENOTSUP;
 
-        return ret;
+        return -1;
 }
 
 int32_t default_get (driver_t *this)
 {
-        int32_t ret = 0;
-
         if (!this)
-                ret = -1;
+                errno = -EINVAL;
+        else
+                errno = -ENOTSUP;
 
-        return ret;
+        return -1;
 }
 
 int32_t default_delete (driver_t *this)
@@ -29,3 +30,14 @@ int32_t default_delete (driver_t *this)
 
         return ret;
 }
+
+/* No server side copy, callers move the data themselves */
+int32_t default_copy (driver_t *this, driver_t *dst)
+{
+        if ((!this) || (!dst))
+                errno = -EINVAL;
+        else
+                errno = -ENOTSUP;
+
+        return -1;
+}
@@ -41,6 +41,7 @@ driver_defaults (driver_t *drv)
         SET_DEFAULT_OP (put);
         SET_DEFAULT_OP (get);
         SET_DEFAULT_OP (delete);
+        SET_DEFAULT_OP (copy);
         /* Future OP's go here */
 }
 
@@ -52,9 +53,13 @@ driver_dynload (driver_t *driver)
         void              *handle = NULL;
         class_methods_t   *cm     = NULL;
         char              *error  = NULL;
+        const char        *dir    = getenv ("BIGOBJECTS_DRIVERDIR");
 
+        /* Drivers in the build tree, for tests */
+        if (!dir)
+                dir = DEFAULT_DRIVERDIR;
 
-        ret = asprintf (&name, "%s/%s.so", DEFAULT_DRIVERDIR, driver->name);
+        ret = asprintf (&name, "%s/%s.so", dir, driver->name);
         if (ret < 0)
                 goto out;
 
@@ -119,13 +124,28 @@ driver_new (struct bigobjects *bfs)
         }
 
         driver->name = bfs->driver_scheme;
+        driver->fd   = -1;
 
-        if (driver_dynload(driver) < 0)
+        if (driver_dynload(driver) < 0) {
+                driver_free (driver);
                 return NULL;
+        }
 
         return driver;
 }
 
+/* Counterpart of driver_new(), after fini() when init() succeeded */
+void
+driver_free (driver_t *driver)
+{
+        if (!driver)
+                return;
+
+        if (driver->dlhandle)
+                dlclose (driver->dlhandle);
+        free (driver);
+}
+
 
 bfs_boolean_t
 is_driver_valid (const char *scheme)
@@ -141,6 +161,8 @@ is_driver_valid (const char *scheme)
                 val = _bfs_true;
         else if (!strcasecmp(scheme, STORAGE_DRIVER_FILE))
                 val = _bfs_true;
+        else if (!strcasecmp(scheme, STORAGE_DRIVER_S3))
+                val = _bfs_true;
         else
                 fprintf(stderr, "Unrecognized driver type %s.\n",
                         scheme);
@@ -0,0 +1,595 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Gluster driver benchmarks against a live volume, bench-gluster.sh
+  sets up a single brick one on this host.  Every result is a line of
+  JSON on the output, one object per measurement.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <api/glfs.h>
+
+#include "gluster-priv.h"
+
+#define BENCH_BLOCK     (1024 * 1024)
+
+typedef struct {
+        const char *server;
+        const char *volume;
+        int64_t    seq_size;            /* bytes per sequential object */
+        int32_t    init_iters;
+        int64_t    rand_size;           /* file random reads go over */
+        int32_t    rand_ops;
+        int32_t    rand_block;
+        int32_t    small_ops;
+        int32_t    small_size;
+        int32_t    soak_secs;
+        FILE       *out;
+} bench_t;
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static
+uint64_t __rand (void)
+{
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+}
+
+static
+double __now (void)
+{
+        struct timespec ts;
+
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 'n' per second, 0 rather than inf or nan for no time at all */
+static
+double __rate (double n, double secs)
+{
+        return (secs > 0) ? n / secs : 0;
+}
+
+/* Temporary local file of 'size' random bytes, none of it sparse */
+static
+int __tmpfile (int64_t size)
+{
+        char     path[] = "/tmp/bench-gluster.XXXXXX";
+        char     *buf   = NULL;
+        uint64_t *w     = NULL;
+        int64_t  off    = 0;
+        size_t   len    = 0;
+        size_t   i      = 0;
+        int      fd     = -1;
+
+        fd = mkstemp (path);
+        if (fd < 0)
+                return -1;
+        unlink (path);
+
+        buf = malloc (BENCH_BLOCK);
+        if (!buf)
+                goto err;
+        w = (uint64_t *) buf;
+
+        for (off = 0; off < size; off += len) {
+                for (i = 0; i < BENCH_BLOCK / sizeof(*w); i++)
+                        w[i] = __rand ();
+                len = ((size - off) < BENCH_BLOCK) ?
+                        (size_t) (size - off) : BENCH_BLOCK;
+                if (write (fd, buf, len) != (ssize_t) len)
+                        goto err;
+        }
+        free (buf);
+
+        lseek (fd, 0, SEEK_SET);
+        return fd;
+err:
+        free (buf);
+        close (fd);
+        return -1;
+}
+
+static
+int32_t __driver (bench_t *bench, driver_t *d)
+{
+        memset (d, 0, sizeof(*d));
+        d->name   = (char *) "gluster";
+        d->server = (char *) bench->server;
+        d->bucket = (char *) bench->volume;
+        d->fd     = -1;
+
+        if (bobjs_gluster_init (d) < 0) {
+                fprintf (stderr, "init %s/%s: %s\n", bench->server,
+                         bench->volume, strerror (-errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Bare glfs_init() against the driver init going through the cache */
+static
+int32_t bench_init (bench_t *bench)
+{
+        driver_t d;
+        glfs_t   *fs    = NULL;
+        double   t      = 0;
+        double   total  = 0;
+        double   min    = 0;
+        int32_t  i      = 0;
+
+        for (i = 0; i < bench->init_iters; i++) {
+                t  = __now ();
+                fs = glfs_new (bench->volume);
+                if ((!fs) ||
+                    (glfs_set_volfile_server (fs, "tcp", bench->server,
+                                              0) < 0) ||
+                    (glfs_set_logging (fs, "/dev/null", 4) < 0) ||
+                    (glfs_init (fs) < 0)) {
+                        fprintf (stderr, "glfs_init: %s\n",
+                                 strerror (errno));
+                        if (fs)
+                                glfs_fini (fs);
+                        return -1;
+                }
+                t = __now () - t;
+                glfs_fini (fs);
+
+                total += t;
+                if ((i == 0) || (t < min))
+                        min = t;
+        }
+        fprintf (bench->out, "{\"test\":\"init\",\"mode\":\"glfs\","
+                 "\"iters\":%d,\"avg_ms\":%.3f,\"min_ms\":%.3f}\n",
+                 bench->init_iters, total * 1e3 / bench->init_iters,
+                 min * 1e3);
+
+        /* The first one connects, the others find it cached */
+        total = 0;
+        for (i = 0; i <= bench->init_iters; i++) {
+                t = __now ();
+                if (__driver (bench, &d) < 0)
+                        return -1;
+                t = __now () - t;
+                bobjs_gluster_fini (&d);
+
+                if (i == 0) {
+                        fprintf (bench->out, "{\"test\":\"init\","
+                                 "\"mode\":\"cold\",\"iters\":1,"
+                                 "\"avg_ms\":%.3f,\"min_ms\":%.3f}\n",
+                                 t * 1e3, t * 1e3);
+                        continue;
+                }
+                total += t;
+                if ((i == 1) || (t < min))
+                        min = t;
+        }
+        fprintf (bench->out, "{\"test\":\"init\",\"mode\":\"cached\","
+                 "\"iters\":%d,\"avg_ms\":%.3f,\"min_ms\":%.3f}\n",
+                 bench->init_iters, total * 1e3 / bench->init_iters,
+                 min * 1e3);
+
+        return 0;
+}
+
+static
+void __seq_report (bench_t *bench, const char *test, const char *mode,
+                   int32_t depth, double t)
+{
+        fprintf (bench->out, "{\"test\":\"%s\",\"mode\":\"%s\","
+                 "\"depth\":%d,\"bytes\":%lld,\"secs\":%.3f,"
+                 "\"mb_per_sec\":%.1f}\n", test, mode, depth,
+                 (long long) bench->seq_size, t,
+                 __rate (bench->seq_size / 1e6, t));
+}
+
+/*
+  The baseline for bench_seq(): one file written then read back with
+  blocking glfs_pwrite() and glfs_pread(), a block at a time, as the
+  driver did before its async pipeline.
+*/
+static
+int32_t bench_seq_blocking (bench_t *bench)
+{
+        bobjs_glfs_t *vol   = NULL;
+        glfs_fd_t    *glfd  = NULL;
+        char         *buf   = NULL;
+        int64_t      off    = 0;
+        ssize_t      len    = 0;
+        double       t      = 0;
+        int          in     = -1;
+        int          out    = -1;
+        int32_t      ret    = -1;
+
+        in  = __tmpfile (bench->seq_size);
+        out = __tmpfile (0);
+        vol = bobjs_glfs_get (bench->server, 0, bench->volume);
+        buf = malloc (BENCH_BLOCK);
+        if ((in < 0) || (out < 0) || (!vol) || (!buf))
+                goto out;
+
+        t    = __now ();
+        glfd = glfs_creat (vol->fs, "bench-gluster-seq", O_RDWR|O_TRUNC,
+                           0644);
+        if (!glfd)
+                goto out;
+        for (off = 0; off < bench->seq_size; off += len) {
+                len = pread (in, buf, BENCH_BLOCK, off);
+                if ((len <= 0) ||
+                    (bobjs_glfs_pwrite (glfd, buf, len, off, 0) != len))
+                        goto out;
+        }
+        if (bobjs_glfs_fsync (glfd) < 0)
+                goto out;
+        t = __now () - t;
+        __seq_report (bench, "seq_put", "blocking", 1, t);
+
+        t = __now ();
+        for (off = 0; off < bench->seq_size; off += len) {
+                len = bobjs_glfs_pread (glfd, buf, BENCH_BLOCK, off, 0);
+                if ((len <= 0) || (pwrite (out, buf, len, off) != len))
+                        goto out;
+        }
+        t = __now () - t;
+        __seq_report (bench, "seq_get", "blocking", 1, t);
+        ret = 0;
+out:
+        if (ret < 0)
+                fprintf (stderr, "seq blocking: %s\n", strerror (errno));
+        if (glfd) {
+                glfs_close (glfd);
+                glfs_unlink (vol->fs, "bench-gluster-seq");
+        }
+        bobjs_glfs_put (vol, 0);
+        free (buf);
+        if (in >= 0)
+                close (in);
+        if (out >= 0)
+                close (out);
+        return ret;
+}
+
+/* Put and get of one large object, 'depth' async I/Os per file */
+static
+int32_t bench_seq (bench_t *bench, int32_t depth)
+{
+        driver_t d;
+        char     value[16];
+        double   t     = 0;
+        int      in    = -1;
+        int      out   = -1;
+        int32_t  ret   = -1;
+
+        snprintf (value, sizeof(value), "%d", depth);
+        setenv ("GLUSTER_IO_DEPTH", value, 1);
+
+        in = __tmpfile (bench->seq_size);
+        out = __tmpfile (0);
+        if ((in < 0) || (out < 0) || (__driver (bench, &d) < 0))
+                goto out;
+        d.object = (char *) "bench-gluster/seq";
+
+        d.fd = in;
+        t    = __now ();
+        if (bobjs_gluster_put (&d) < 0) {
+                fprintf (stderr, "put: %s\n", strerror (-errno));
+                goto fini;
+        }
+        t = __now () - t;
+        __seq_report (bench, "seq_put", "async", depth, t);
+
+        d.fd = out;
+        t    = __now ();
+        if (bobjs_gluster_get (&d) < 0) {
+                fprintf (stderr, "get: %s\n", strerror (-errno));
+                goto fini;
+        }
+        t = __now () - t;
+        __seq_report (bench, "seq_get", "async", depth, t);
+
+        ret = bobjs_gluster_delete (&d);
+fini:
+        bobjs_gluster_fini (&d);
+out:
+        unsetenv ("GLUSTER_IO_DEPTH");
+        if (in >= 0)
+                close (in);
+        if (out >= 0)
+                close (out);
+        return ret;
+}
+
+/* Blocking reads at random offsets of one file on the volume */
+static
+int32_t bench_rand (bench_t *bench)
+{
+        bobjs_glfs_t *vol   = NULL;
+        glfs_fd_t    *glfd  = NULL;
+        char         *buf   = NULL;
+        int64_t      off    = 0;
+        int64_t      nblks  = bench->rand_size / bench->rand_block;
+        double       t      = 0;
+        int32_t      i      = 0;
+        int32_t      ret    = -1;
+
+        vol = bobjs_glfs_get (bench->server, 0, bench->volume);
+        buf = malloc (BENCH_BLOCK);
+        if ((!vol) || (!buf) || (nblks < 1))
+                goto out;
+
+        glfd = glfs_creat (vol->fs, "bench-gluster-rand", O_RDWR|O_TRUNC,
+                           0644);
+        if (!glfd)
+                goto out;
+        memset (buf, 0xa5, BENCH_BLOCK);
+        for (off = 0; off < bench->rand_size; off += BENCH_BLOCK) {
+                if (bobjs_glfs_pwrite (glfd, buf, BENCH_BLOCK, off, 0) < 0)
+                        goto out;
+        }
+
+        t = __now ();
+        for (i = 0; i < bench->rand_ops; i++) {
+                off = (int64_t) (__rand () % nblks) * bench->rand_block;
+                if (bobjs_glfs_pread (glfd, buf, bench->rand_block, off,
+                                      0) < 0)
+                        goto out;
+        }
+        t = __now () - t;
+
+        fprintf (bench->out, "{\"test\":\"rand_read\",\"block\":%d,"
+                 "\"ops\":%d,\"secs\":%.3f,\"iops\":%.0f,"
+                 "\"mb_per_sec\":%.1f}\n", bench->rand_block,
+                 bench->rand_ops, t, __rate (bench->rand_ops, t),
+                 __rate ((double) bench->rand_ops * bench->rand_block / 1e6,
+                         t));
+        ret = 0;
+out:
+        if (ret < 0)
+                fprintf (stderr, "rand: %s\n", strerror (errno));
+        if (glfd) {
+                glfs_close (glfd);
+                glfs_unlink (vol->fs, "bench-gluster-rand");
+        }
+        bobjs_glfs_put (vol, 0);
+        free (buf);
+        return ret;
+}
+
+/* Put, get and delete rates of many small objects */
+static
+int32_t bench_small (bench_t *bench)
+{
+        static const char *ops[] = { "small_put", "small_get",
+                                     "small_delete" };
+        driver_t d;
+        char     name[64];
+        double   t     = 0;
+        int      in    = -1;
+        int      out   = -1;
+        int32_t  op    = 0;
+        int32_t  i     = 0;
+        int32_t  ret   = -1;
+
+        in  = __tmpfile (bench->small_size);
+        out = __tmpfile (0);
+        if ((in < 0) || (out < 0) || (__driver (bench, &d) < 0))
+                goto out;
+
+        for (op = 0; op < 3; op++) {
+                t = __now ();
+                for (i = 0; i < bench->small_ops; i++) {
+                        snprintf (name, sizeof(name),
+                                  "bench-gluster/small/%d", i);
+                        d.object = name;
+                        if (op == 0) {
+                                lseek (in, 0, SEEK_SET);
+                                d.fd = in;
+                                ret  = bobjs_gluster_put (&d);
+                        } else if (op == 1) {
+                                lseek (out, 0, SEEK_SET);
+                                d.fd = out;
+                                ret  = bobjs_gluster_get (&d);
+                        } else {
+                                ret = bobjs_gluster_delete (&d);
+                        }
+                        if (ret < 0) {
+                                fprintf (stderr, "%s %s: %s\n", ops[op],
+                                         name, strerror (-errno));
+                                goto fini;
+                        }
+                }
+                t = __now () - t;
+                fprintf (bench->out, "{\"test\":\"%s\",\"size\":%d,"
+                         "\"ops\":%d,\"secs\":%.3f,\"ops_per_sec\":%.1f}\n",
+                         ops[op], bench->small_size, bench->small_ops, t,
+                         __rate (bench->small_ops, t));
+        }
+fini:
+        bobjs_gluster_fini (&d);
+out:
+        if (in >= 0)
+                close (in);
+        if (out >= 0)
+                close (out);
+        return ret;
+}
+
+static
+int32_t __same (int a, int b, int64_t size)
+{
+        static char x[BENCH_BLOCK];
+        static char y[BENCH_BLOCK];
+        int64_t     off = 0;
+        ssize_t     len = 0;
+
+        for (off = 0; off < size; off += len) {
+                len = pread (a, x, sizeof(x), off);
+                if ((len <= 0) || (pread (b, y, len, off) != len) ||
+                    (memcmp (x, y, len)))
+                        return 0;
+        }
+
+        return (pread (b, y, 1, size) == 0);
+}
+
+/* Round trips of random sized objects, every one checked */
+static
+int32_t bench_soak (bench_t *bench)
+{
+        driver_t d;
+        double   end    = __now () + bench->soak_secs;
+        double   t      = __now ();
+        int64_t  size   = 0;
+        int64_t  bytes  = 0;
+        int64_t  rounds = 0;
+        int64_t  errors = 0;
+        int64_t  bad    = 0;
+        int      in     = -1;
+        int      out    = -1;
+
+        if (__driver (bench, &d) < 0)
+                return -1;
+        d.object = (char *) "bench-gluster/soak";
+
+        while (__now () < end) {
+                size = __rand () % (8 * BENCH_BLOCK + 1);
+                in   = __tmpfile (size);
+                out  = __tmpfile (0);
+                if ((in < 0) || (out < 0)) {
+                        errors++;
+                        goto next;
+                }
+
+                d.fd = in;
+                if (bobjs_gluster_put (&d) < 0) {
+                        errors++;
+                        goto next;
+                }
+                d.fd = out;
+                if (bobjs_gluster_get (&d) < 0)
+                        errors++;
+                else if (!__same (in, out, size))
+                        bad++;
+                if (bobjs_gluster_delete (&d) < 0)
+                        errors++;
+                bytes += size;
+next:
+                rounds++;
+                if (in >= 0)
+                        close (in);
+                if (out >= 0)
+                        close (out);
+        }
+        bobjs_gluster_fini (&d);
+
+        t = __now () - t;
+        fprintf (bench->out, "{\"test\":\"soak\",\"secs\":%.1f,"
+                 "\"rounds\":%lld,\"bytes\":%lld,\"errors\":%lld,"
+                 "\"mismatches\":%lld}\n", t, (long long) rounds,
+                 (long long) bytes, (long long) errors, (long long) bad);
+
+        return ((errors) || (bad)) ? -1 : 0;
+}
+
+static
+void usage (const char *prog)
+{
+        fprintf (stderr, "Usage: %s [-s server] -v volume [-S seq_mb] "
+                 "[-i init_iters] [-R rand_mb] [-r rand_ops] "
+                 "[-b rand_block] [-n small_ops] [-z small_size] "
+                 "[-d soak_secs] [-o output]\n", prog);
+}
+
+int main (int argc, char **argv)
+{
+        bench_t bench;
+        int     c    = 0;
+        int     ret  = 0;
+
+        memset (&bench, 0, sizeof(bench));
+        bench.server     = "localhost";
+        bench.seq_size   = 1024LL * 1024 * 1024;
+        bench.init_iters = 5;
+        bench.rand_size  = 256LL * 1024 * 1024;
+        bench.rand_ops   = 2000;
+        bench.rand_block = 64 * 1024;
+        bench.small_ops  = 1000;
+        bench.small_size = 4096;
+        bench.out        = stdout;
+
+        while ((c = getopt (argc, argv, "s:v:S:i:R:r:b:n:z:d:o:h")) != -1) {
+                switch (c) {
+                case 's': bench.server     = optarg;                   break;
+                case 'v': bench.volume     = optarg;                   break;
+                case 'S': bench.seq_size   = atoll (optarg) << 20;     break;
+                case 'i': bench.init_iters = atoi (optarg);            break;
+                case 'R': bench.rand_size  = atoll (optarg) << 20;     break;
+                case 'r': bench.rand_ops   = atoi (optarg);            break;
+                case 'b': bench.rand_block = atoi (optarg);            break;
+                case 'n': bench.small_ops  = atoi (optarg);            break;
+                case 'z': bench.small_size = atoi (optarg);            break;
+                case 'd': bench.soak_secs  = atoi (optarg);            break;
+                case 'o':
+                        bench.out = fopen (optarg, "w");
+                        if (!bench.out) {
+                                perror (optarg);
+                                return 1;
+                        }
+                        break;
+                default:
+                        usage (argv[0]);
+                        return (c == 'h') ? 0 : 1;
+                }
+        }
+
+        if ((!bench.volume) || (bench.seq_size < 0) ||
+            (bench.init_iters < 1) ||
+            (bench.rand_block < 1) || (bench.rand_block > BENCH_BLOCK) ||
+            (bench.small_ops < 1)) {
+                usage (argv[0]);
+                return 1;
+        }
+
+        if ((bench_init (&bench) < 0) ||
+            (bench_seq_blocking (&bench) < 0) ||
+            (bench_seq (&bench, 1) < 0) ||
+            (bench_seq (&bench, 8) < 0) ||
+            (bench_rand (&bench) < 0) ||
+            (bench_small (&bench) < 0) ||
+            ((bench.soak_secs) && (bench_soak (&bench) < 0)))
+                ret = 1;
+
+        if (bench.out != stdout)
+                fclose (bench.out);
+
+        return ret;
+}
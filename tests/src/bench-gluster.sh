@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Runs bench-gluster against a throwaway single brick volume on this
+# host, glusterd has to be running and we have to be root.
+#
+# Usage: bench-gluster.sh [bench-gluster options...]
+#
+
+VOLUME=${VOLUME:-bench-gluster}
+BENCH=${BENCH:-$(dirname "$0")/bench-gluster}
+BRICKS=$(mktemp -d /tmp/bench-gluster.XXXXXX) || exit 1
+
+cleanup ()
+{
+        gluster --mode=script volume stop "$VOLUME" force >/dev/null 2>&1
+        gluster --mode=script volume delete "$VOLUME" >/dev/null 2>&1
+        rm -rf "$BRICKS"
+}
+trap cleanup EXIT INT TERM
+
+gluster --mode=script volume create "$VOLUME" \
+        "$(hostname):$BRICKS/brick" force || exit 1
+gluster --mode=script volume start "$VOLUME" || exit 1
+
+"$BENCH" -s 127.0.0.1 -v "$VOLUME" "$@"
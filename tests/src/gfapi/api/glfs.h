@@ -0,0 +1,129 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  The part of the classic libgfapi API the gluster driver uses, with
+  the same signatures, for building the driver against glfsmock.c.
+  Not the real header: nothing but what the driver calls is here.
+
+  With GLFSMOCK_GFAPI6 defined the I/O calls and their callback are
+  declared as gfapi 6 does, taking the file's stat before and after
+  the operation, and glfs_copy_file_range() is there.  Like the real
+  header that needs _LARGEFILE64_SOURCE for off64_t.
+*/
+
+#ifndef _GLFS_H
+#define _GLFS_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <dirent.h>
+
+struct glfs;
+typedef struct glfs glfs_t;
+
+struct glfs_fd;
+typedef struct glfs_fd glfs_fd_t;
+
+#ifdef GLFSMOCK_GFAPI6
+struct glfs_stat;
+
+typedef void (*glfs_io_cbk) (glfs_fd_t *fd, ssize_t ret,
+                             struct glfs_stat *prestat,
+                             struct glfs_stat *poststat, void *data);
+#else
+typedef void (*glfs_io_cbk) (glfs_fd_t *fd, ssize_t ret, void *data);
+#endif
+
+glfs_t *glfs_new (const char *volname);
+int glfs_set_volfile_server (glfs_t *fs, const char *transport,
+                             const char *host, int port);
+int glfs_set_logging (glfs_t *fs, const char *logfile, int loglevel);
+int glfs_init (glfs_t *fs);
+int glfs_fini (glfs_t *fs);
+
+glfs_fd_t *glfs_open (glfs_t *fs, const char *path, int flags);
+glfs_fd_t *glfs_creat (glfs_t *fs, const char *path, int flags,
+                       mode_t mode);
+int glfs_close (glfs_fd_t *fd);
+
+ssize_t glfs_read (glfs_fd_t *fd, void *buf, size_t count, int flags);
+ssize_t glfs_write (glfs_fd_t *fd, const void *buf, size_t count,
+                    int flags);
+#ifdef GLFSMOCK_GFAPI6
+ssize_t glfs_pread (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                    int flags, struct glfs_stat *poststat);
+ssize_t glfs_pwrite (glfs_fd_t *fd, const void *buf, size_t count,
+                     off_t offset, int flags, struct glfs_stat *prestat,
+                     struct glfs_stat *poststat);
+#else
+ssize_t glfs_pread (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                    int flags);
+ssize_t glfs_pwrite (glfs_fd_t *fd, const void *buf, size_t count,
+                     off_t offset, int flags);
+#endif
+int glfs_pread_async (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                      int flags, glfs_io_cbk fn, void *data);
+int glfs_pwrite_async (glfs_fd_t *fd, const void *buf, int count,
+                       off_t offset, int flags, glfs_io_cbk fn, void *data);
+
+#ifdef GLFSMOCK_GFAPI6
+int glfs_ftruncate (glfs_fd_t *fd, off_t length, struct glfs_stat *prestat,
+                    struct glfs_stat *poststat);
+int glfs_fsync (glfs_fd_t *fd, struct glfs_stat *prestat,
+                struct glfs_stat *poststat);
+#else
+int glfs_ftruncate (glfs_fd_t *fd, off_t length);
+int glfs_fsync (glfs_fd_t *fd);
+#endif
+#ifdef GLFSMOCK_GFAPI6
+ssize_t glfs_copy_file_range (glfs_fd_t *fd_in, off64_t *off_in,
+                              glfs_fd_t *fd_out, off64_t *off_out,
+                              size_t len, unsigned int flags,
+                              struct glfs_stat *statbuf,
+                              struct glfs_stat *prestat,
+                              struct glfs_stat *poststat);
+#endif
+
+int glfs_fallocate (glfs_fd_t *fd, int keep_size, off_t offset, size_t len);
+int glfs_discard (glfs_fd_t *fd, off_t offset, size_t len);
+
+int glfs_stat (glfs_t *fs, const char *path, struct stat *buf);
+int glfs_lstat (glfs_t *fs, const char *path, struct stat *buf);
+int glfs_fstat (glfs_fd_t *fd, struct stat *buf);
+int glfs_statvfs (glfs_t *fs, const char *path, struct statvfs *buf);
+
+int glfs_mkdir (glfs_t *fs, const char *path, mode_t mode);
+int glfs_rmdir (glfs_t *fs, const char *path);
+int glfs_unlink (glfs_t *fs, const char *path);
+int glfs_rename (glfs_t *fs, const char *oldpath, const char *newpath);
+
+glfs_fd_t *glfs_opendir (glfs_t *fs, const char *path);
+int glfs_closedir (glfs_fd_t *fd);
+int glfs_readdir_r (glfs_fd_t *fd, struct dirent *dirent,
+                    struct dirent **result);
+int glfs_readdirplus_r (glfs_fd_t *fd, struct stat *stat,
+                        struct dirent *dirent, struct dirent **result);
+
+ssize_t glfs_getxattr (glfs_t *fs, const char *path, const char *name,
+                       void *value, size_t size);
+int glfs_setxattr (glfs_t *fs, const char *path, const char *name,
+                   const void *value, size_t size, int flags);
+int glfs_removexattr (glfs_t *fs, const char *path, const char *name);
+
+#endif /* _GLFS_H */
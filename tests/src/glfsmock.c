@@ -0,0 +1,666 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/xattr.h>
+
+#include <api/glfs.h>
+
+#include "glfsmock.h"
+
+struct glfs {
+        char    dir[PATH_MAX];  /* the volume's directory */
+        int32_t servers;
+        int32_t down;
+        int32_t hang;
+};
+
+struct glfs_fd {
+        int     fd;
+        DIR     *dir;
+};
+
+/* An async transfer waiting for the completion thread */
+struct glfsmock_aio {
+        struct glfsmock_aio *next;
+        glfs_fd_t           *glfd;
+        char                *buf;
+        size_t              count;
+        off_t               off;
+        int32_t             write;
+        glfs_io_cbk         fn;
+        void                *data;
+        uint64_t            seq;
+};
+
+static struct {
+        pthread_mutex_t     lock;
+        pthread_cond_t      cond;
+        pthread_once_t      once;
+        char                root[PATH_MAX];
+        glfsmock_opts_t     opts;
+        glfsmock_stats_t    stats;
+        struct glfsmock_aio *pending;
+        int32_t             npending;
+        uint64_t            seq;
+} mock = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .once = PTHREAD_ONCE_INIT,
+};
+
+void glfsmock_init (const char *root)
+{
+        pthread_mutex_lock (&mock.lock);
+        snprintf (mock.root, sizeof(mock.root), "%s", root);
+        memset (&mock.opts, 0, sizeof(mock.opts));
+        memset (&mock.stats, 0, sizeof(mock.stats));
+        mock.opts.seed = 1;
+        pthread_mutex_unlock (&mock.lock);
+}
+
+void glfsmock_configure (const glfsmock_opts_t *opts)
+{
+        pthread_mutex_lock (&mock.lock);
+        mock.opts = *opts;
+        if (!mock.opts.seed)
+                mock.opts.seed = 1;
+        pthread_mutex_unlock (&mock.lock);
+}
+
+void glfsmock_stats (glfsmock_stats_t *stats)
+{
+        pthread_mutex_lock (&mock.lock);
+        *stats = mock.stats;
+        pthread_mutex_unlock (&mock.lock);
+}
+
+/* Callers hold mock.lock */
+static
+uint32_t __glfsmock_rand (void)
+{
+        mock.opts.seed ^= mock.opts.seed << 13;
+        mock.opts.seed ^= mock.opts.seed >> 17;
+        mock.opts.seed ^= mock.opts.seed << 5;
+        return mock.opts.seed;
+}
+
+static
+int __glfsmock_path (glfs_t *fs, const char *path, char *out)
+{
+        while (path[0] == '/')
+                path++;
+        if (snprintf (out, PATH_MAX, "%s/%s", fs->dir, path) >= PATH_MAX) {
+                errno = ENAMETOOLONG;
+                return -1;
+        }
+
+        return 0;
+}
+
+static
+glfs_fd_t *__glfsmock_fd (int fd)
+{
+        glfs_fd_t *glfd = NULL;
+
+        if (fd < 0)
+                return NULL;
+
+        glfd = calloc (1, sizeof(*glfd));
+        if (!glfd) {
+                close (fd);
+                errno = ENOMEM;
+                return NULL;
+        }
+        glfd->fd = fd;
+
+        return glfd;
+}
+
+glfs_t *glfs_new (const char *volname)
+{
+        glfs_t *fs = calloc (1, sizeof(*fs));
+
+        if (!fs)
+                return NULL;
+        pthread_mutex_lock (&mock.lock);
+        if (snprintf (fs->dir, sizeof(fs->dir), "%s/%s", mock.root,
+                      volname) >= (int) sizeof(fs->dir)) {
+                pthread_mutex_unlock (&mock.lock);
+                free (fs);
+                errno = ENAMETOOLONG;
+                return NULL;
+        }
+        pthread_mutex_unlock (&mock.lock);
+
+        return fs;
+}
+
+int glfs_set_volfile_server (glfs_t *fs, const char *transport,
+                             const char *host, int port)
+{
+        (void) transport;
+        (void) port;
+
+        if ((fs->servers++ == 0) && (!strcmp (host, "down")))
+                fs->down = 1;
+        if ((fs->servers == 1) && (!strcmp (host, "hang")))
+                fs->hang = 1;
+        return 0;
+}
+
+int glfs_set_logging (glfs_t *fs, const char *logfile, int loglevel)
+{
+        (void) fs;
+        (void) logfile;
+        (void) loglevel;
+
+        return 0;
+}
+
+int glfs_init (glfs_t *fs)
+{
+        if (fs->hang) {
+                sleep (GLFSMOCK_HANG);
+                errno = ETIMEDOUT;
+                return -1;
+        }
+        if (fs->down) {
+                errno = ENOTCONN;
+                return -1;
+        }
+        if ((mkdir (fs->dir, 0755) < 0) && (errno != EEXIST))
+                return -1;
+
+        return 0;
+}
+
+int glfs_fini (glfs_t *fs)
+{
+        free (fs);
+        return 0;
+}
+
+glfs_fd_t *glfs_open (glfs_t *fs, const char *path, int flags)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return NULL;
+        return __glfsmock_fd (open (real, flags));
+}
+
+glfs_fd_t *glfs_creat (glfs_t *fs, const char *path, int flags, mode_t mode)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return NULL;
+        return __glfsmock_fd (open (real, flags | O_CREAT, mode));
+}
+
+int glfs_close (glfs_fd_t *fd)
+{
+        if (fd->dir)
+                closedir (fd->dir);
+        else
+                close (fd->fd);
+        free (fd);
+
+        return 0;
+}
+
+ssize_t glfs_read (glfs_fd_t *fd, void *buf, size_t count, int flags)
+{
+        (void) flags;
+        return read (fd->fd, buf, count);
+}
+
+ssize_t glfs_write (glfs_fd_t *fd, const void *buf, size_t count, int flags)
+{
+        (void) flags;
+        return write (fd->fd, buf, count);
+}
+
+/* gfapi 6 stats before and after the operation are never filled in,
+   the driver passes NULL for them */
+#ifdef GLFSMOCK_GFAPI6
+ssize_t glfs_pread (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                    int flags, struct glfs_stat *poststat)
+{
+        (void) flags;
+        (void) poststat;
+        return pread (fd->fd, buf, count, offset);
+}
+
+ssize_t glfs_pwrite (glfs_fd_t *fd, const void *buf, size_t count,
+                     off_t offset, int flags, struct glfs_stat *prestat,
+                     struct glfs_stat *poststat)
+{
+        (void) flags;
+        (void) prestat;
+        (void) poststat;
+        return pwrite (fd->fd, buf, count, offset);
+}
+#else
+ssize_t glfs_pread (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                    int flags)
+{
+        (void) flags;
+        return pread (fd->fd, buf, count, offset);
+}
+
+ssize_t glfs_pwrite (glfs_fd_t *fd, const void *buf, size_t count,
+                     off_t offset, int flags)
+{
+        (void) flags;
+        return pwrite (fd->fd, buf, count, offset);
+}
+#endif
+
+/*
+  Completes pending transfers one at a time, each a random pick among
+  them, after a random wait that lets more queue up.
+*/
+static
+void *__glfsmock_complete (void *arg)
+{
+        struct glfsmock_aio *aio  = NULL;
+        struct glfsmock_aio **pp  = NULL;
+        struct glfsmock_aio *p    = NULL;
+        ssize_t             ret   = 0;
+        size_t              count = 0;
+        int32_t             pick  = 0;
+        off_t               cut   = 0;
+        char                proc[64];
+
+        (void) arg;
+
+        for (;;) {
+                pthread_mutex_lock (&mock.lock);
+                while (!mock.pending)
+                        pthread_cond_wait (&mock.cond, &mock.lock);
+                if (mock.opts.delay_us) {
+                        pick = __glfsmock_rand () % mock.opts.delay_us;
+                        pthread_mutex_unlock (&mock.lock);
+                        usleep (pick);
+                        pthread_mutex_lock (&mock.lock);
+                }
+
+                pick = __glfsmock_rand () % mock.npending;
+                for (pp = &mock.pending; pick; pick--)
+                        pp = &(*pp)->next;
+                aio = *pp;
+                *pp = aio->next;
+                mock.npending--;
+
+                for (p = mock.pending; p; p = p->next) {
+                        if (p->seq < aio->seq) {
+                                mock.stats.reordered++;
+                                break;
+                        }
+                }
+
+                count = aio->count;
+                if ((count > 1) &&
+                    ((int32_t) (__glfsmock_rand () % 100) <
+                     mock.opts.short_pct)) {
+                        count = 1 + __glfsmock_rand () % (count - 1);
+                        mock.stats.shorts++;
+                }
+                cut = 0;
+                if ((!aio->write) && (mock.opts.truncate_at) &&
+                    (aio->off + (off_t) count > mock.opts.truncate_at)) {
+                        cut = mock.opts.truncate_at;
+                        mock.opts.truncate_at = 0;
+                }
+                pthread_mutex_unlock (&mock.lock);
+
+                /* Someone else truncating the file, the read end of
+                   'fd' cannot */
+                if (cut) {
+                        snprintf (proc, sizeof(proc), "/proc/self/fd/%d",
+                                  aio->glfd->fd);
+                        if (truncate (proc, cut) < 0)
+                                abort ();
+                }
+
+                if (aio->write)
+                        ret = pwrite (aio->glfd->fd, aio->buf, count,
+                                      aio->off);
+                else
+                        ret = pread (aio->glfd->fd, aio->buf, count,
+                                     aio->off);
+#ifdef GLFSMOCK_GFAPI6
+                aio->fn (aio->glfd, ret, NULL, NULL, aio->data);
+#else
+                aio->fn (aio->glfd, ret, aio->data);
+#endif
+                free (aio);
+        }
+
+        return NULL;
+}
+
+static
+void __glfsmock_start (void)
+{
+        pthread_t thread;
+
+        if (pthread_create (&thread, NULL, __glfsmock_complete, NULL) == 0)
+                pthread_detach (thread);
+}
+
+static
+int __glfsmock_async (glfs_fd_t *fd, char *buf, size_t count, off_t offset,
+                      int32_t write, glfs_io_cbk fn, void *data)
+{
+        struct glfsmock_aio *aio = calloc (1, sizeof(*aio));
+
+        if (!aio) {
+                errno = ENOMEM;
+                return -1;
+        }
+        aio->glfd  = fd;
+        aio->buf   = buf;
+        aio->count = count;
+        aio->off   = offset;
+        aio->write = write;
+        aio->fn    = fn;
+        aio->data  = data;
+
+        pthread_once (&mock.once, __glfsmock_start);
+
+        pthread_mutex_lock (&mock.lock);
+        aio->seq     = mock.seq++;
+        aio->next    = mock.pending;
+        mock.pending = aio;
+        mock.npending++;
+        mock.stats.async++;
+        pthread_cond_signal (&mock.cond);
+        pthread_mutex_unlock (&mock.lock);
+
+        return 0;
+}
+
+int glfs_pread_async (glfs_fd_t *fd, void *buf, size_t count, off_t offset,
+                      int flags, glfs_io_cbk fn, void *data)
+{
+        (void) flags;
+        return __glfsmock_async (fd, buf, count, offset, 0, fn, data);
+}
+
+int glfs_pwrite_async (glfs_fd_t *fd, const void *buf, int count,
+                       off_t offset, int flags, glfs_io_cbk fn, void *data)
+{
+        (void) flags;
+        return __glfsmock_async (fd, (char *) buf, count, offset, 1, fn,
+                                 data);
+}
+
+#ifdef GLFSMOCK_GFAPI6
+int glfs_ftruncate (glfs_fd_t *fd, off_t length, struct glfs_stat *prestat,
+                    struct glfs_stat *poststat)
+{
+        (void) prestat;
+        (void) poststat;
+        return ftruncate (fd->fd, length);
+}
+
+int glfs_fsync (glfs_fd_t *fd, struct glfs_stat *prestat,
+                struct glfs_stat *poststat)
+{
+        (void) prestat;
+        (void) poststat;
+        return fsync (fd->fd);
+}
+#else
+int glfs_ftruncate (glfs_fd_t *fd, off_t length)
+{
+        return ftruncate (fd->fd, length);
+}
+
+int glfs_fsync (glfs_fd_t *fd)
+{
+        return fsync (fd->fd);
+}
+#endif
+
+#ifdef GLFSMOCK_GFAPI6
+ssize_t glfs_copy_file_range (glfs_fd_t *fd_in, off64_t *off_in,
+                              glfs_fd_t *fd_out, off64_t *off_out,
+                              size_t len, unsigned int flags,
+                              struct glfs_stat *statbuf,
+                              struct glfs_stat *prestat,
+                              struct glfs_stat *poststat)
+{
+        ssize_t ret = 0;
+
+        (void) statbuf;
+        (void) prestat;
+        (void) poststat;
+
+        ret = copy_file_range (fd_in->fd, off_in, fd_out->fd, off_out, len,
+                               flags);
+        if (ret > 0) {
+                pthread_mutex_lock (&mock.lock);
+                mock.stats.ranged += ret;
+                pthread_mutex_unlock (&mock.lock);
+        }
+
+        return ret;
+}
+#endif
+
+int glfs_fallocate (glfs_fd_t *fd, int keep_size, off_t offset, size_t len)
+{
+        return fallocate (fd->fd, (keep_size) ? FALLOC_FL_KEEP_SIZE : 0,
+                          offset, len);
+}
+
+int glfs_discard (glfs_fd_t *fd, off_t offset, size_t len)
+{
+        return fallocate (fd->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          offset, len);
+}
+
+int glfs_stat (glfs_t *fs, const char *path, struct stat *buf)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return stat (real, buf);
+}
+
+int glfs_lstat (glfs_t *fs, const char *path, struct stat *buf)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return lstat (real, buf);
+}
+
+int glfs_fstat (glfs_fd_t *fd, struct stat *buf)
+{
+        return fstat (fd->fd, buf);
+}
+
+int glfs_statvfs (glfs_t *fs, const char *path, struct statvfs *buf)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return statvfs (real, buf);
+}
+
+int glfs_mkdir (glfs_t *fs, const char *path, mode_t mode)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return mkdir (real, mode);
+}
+
+int glfs_rmdir (glfs_t *fs, const char *path)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return rmdir (real);
+}
+
+int glfs_unlink (glfs_t *fs, const char *path)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return unlink (real);
+}
+
+int glfs_rename (glfs_t *fs, const char *oldpath, const char *newpath)
+{
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+
+        if (__glfsmock_path (fs, oldpath, from) < 0)
+                return -1;
+        if (__glfsmock_path (fs, newpath, to) < 0)
+                return -1;
+        return rename (from, to);
+}
+
+glfs_fd_t *glfs_opendir (glfs_t *fs, const char *path)
+{
+        glfs_fd_t *glfd = NULL;
+        DIR       *dir  = NULL;
+        char      real[PATH_MAX];
+        int32_t   fail  = 0;
+
+        pthread_mutex_lock (&mock.lock);
+        fail = ((mock.opts.fail) && (strstr (path, mock.opts.fail)));
+        pthread_mutex_unlock (&mock.lock);
+        if (fail) {
+                errno = EIO;
+                return NULL;
+        }
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return NULL;
+        dir = opendir (real);
+        if (!dir)
+                return NULL;
+
+        glfd = calloc (1, sizeof(*glfd));
+        if (!glfd) {
+                closedir (dir);
+                errno = ENOMEM;
+                return NULL;
+        }
+        glfd->dir = dir;
+        glfd->fd  = dirfd (dir);
+
+        return glfd;
+}
+
+int glfs_closedir (glfs_fd_t *fd)
+{
+        return glfs_close (fd);
+}
+
+int glfs_readdir_r (glfs_fd_t *fd, struct dirent *dirent,
+                    struct dirent **result)
+{
+        struct dirent *entry = NULL;
+
+        errno = 0;
+        entry = readdir (fd->dir);
+        if (!entry) {
+                *result = NULL;
+                return (errno) ? -1 : 0;
+        }
+
+        memcpy (dirent, entry, sizeof(*dirent));
+        *result = dirent;
+        return 0;
+}
+
+int glfs_readdirplus_r (glfs_fd_t *fd, struct stat *stat,
+                        struct dirent *dirent, struct dirent **result)
+{
+        if (glfs_readdir_r (fd, dirent, result) < 0)
+                return -1;
+
+        if ((*result) && (stat) &&
+            (fstatat (fd->fd, dirent->d_name, stat,
+                      AT_SYMLINK_NOFOLLOW) < 0))
+                memset (stat, 0, sizeof(*stat));
+
+        return 0;
+}
+
+ssize_t glfs_getxattr (glfs_t *fs, const char *path, const char *name,
+                       void *value, size_t size)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return getxattr (real, name, value, size);
+}
+
+int glfs_setxattr (glfs_t *fs, const char *path, const char *name,
+                   const void *value, size_t size, int flags)
+{
+        char    real[PATH_MAX];
+        int32_t noxattr = 0;
+
+        pthread_mutex_lock (&mock.lock);
+        noxattr = mock.opts.noxattr;
+        pthread_mutex_unlock (&mock.lock);
+        if (noxattr) {
+                errno = ENOTSUP;
+                return -1;
+        }
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return setxattr (real, name, value, size, flags);
+}
+
+int glfs_removexattr (glfs_t *fs, const char *path, const char *name)
+{
+        char real[PATH_MAX];
+
+        if (__glfsmock_path (fs, path, real) < 0)
+                return -1;
+        return removexattr (real, name);
+}
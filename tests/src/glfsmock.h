@@ -0,0 +1,66 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __GLFSMOCK_H__
+#define __GLFSMOCK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+  libgfapi stand-in for tests, no glusterd needed; the driver builds
+  against gfapi/api/glfs.h and links this instead of libgfapi.  Every
+  volume is a directory under the root given to glfsmock_init(), calls
+  go to the local file system.
+
+  Async reads and writes complete on a thread of the mock, picked at
+  random among those pending, and may move less than asked.  A first
+  volfile server named "down" fails glfs_init() with ENOTCONN, one
+  named "hang" fails it with ETIMEDOUT after GLFSMOCK_HANG seconds.
+*/
+
+#define GLFSMOCK_HANG   5
+
+struct glfsmock_opts {
+        int32_t    short_pct;   /* % of async transfers cut short */
+        int32_t    delay_us;    /* async completions wait up to this */
+        int32_t    noxattr;     /* glfs_setxattr() fails with ENOTSUP */
+        const char *fail;       /* opening a directory whose path holds
+                                   it fails with EIO, NULL for none */
+        off_t      truncate_at; /* the first async read past it truncates
+                                   the file there, 0 for none */
+        uint32_t   seed;
+};
+
+typedef struct glfsmock_opts glfsmock_opts_t;
+
+struct glfsmock_stats {
+        uint64_t async;         /* async transfers issued */
+        uint64_t reordered;     /* completed ahead of an earlier one */
+        uint64_t shorts;        /* cut short */
+        uint64_t ranged;        /* bytes glfs_copy_file_range() copied */
+};
+
+typedef struct glfsmock_stats glfsmock_stats_t;
+
+/* Volumes go under 'root', which must exist */
+void glfsmock_init (const char *root);
+
+void glfsmock_configure (const glfsmock_opts_t *opts);
+void glfsmock_stats (glfsmock_stats_t *stats);
+
+#endif /* __GLFSMOCK_H__ */
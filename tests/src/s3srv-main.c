@@ -0,0 +1,96 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/* Standalone s3srv for benchmarks, runs until interrupted */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "s3srv.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static
+void __on_signal (int sig)
+{
+        (void) sig;
+        stop = 1;
+}
+
+static
+void usage (const char *prog)
+{
+        fprintf (stderr, "Usage: %s [-p port] [-l latency_ms] "
+                 "[-b bytes_per_sec] [-e error_pct] [-t throttle_pct] "
+                 "[-s seed]\n", prog);
+}
+
+int main (int argc, char **argv)
+{
+        s3srv_opts_t  opts;
+        s3srv_stats_t stats;
+        s3srv_t       *srv = NULL;
+        int           c    = 0;
+
+        memset (&opts, 0, sizeof(opts));
+        opts.port = 8000;
+        opts.seed = 1;
+
+        while ((c = getopt (argc, argv, "p:l:b:e:t:s:h")) != -1) {
+                switch (c) {
+                case 'p': opts.port         = atoi (optarg);            break;
+                case 'l': opts.latency_ms   = atoi (optarg);            break;
+                case 'b': opts.bandwidth    = strtoll (optarg, NULL, 10); break;
+                case 'e': opts.error_pct    = atoi (optarg);            break;
+                case 't': opts.throttle_pct = atoi (optarg);            break;
+                case 's': opts.seed         = strtoul (optarg, NULL, 10); break;
+                default:
+                        usage (argv[0]);
+                        return (c == 'h') ? 0 : 1;
+                }
+        }
+
+        srv = s3srv_start (&opts);
+        if (!srv) {
+                perror ("s3srv_start");
+                return 1;
+        }
+
+        signal (SIGINT, __on_signal);
+        signal (SIGTERM, __on_signal);
+        fprintf (stderr, "s3srv listening on 127.0.0.1:%d\n",
+                 s3srv_port (srv));
+
+        while (!stop)
+                pause ();
+
+        s3srv_stats (srv, &stats);
+        fprintf (stderr, "connections %llu requests %llu injected %llu "
+                 "in %llu out %llu\n",
+                 (unsigned long long) stats.connections,
+                 (unsigned long long) stats.requests,
+                 (unsigned long long) stats.injected,
+                 (unsigned long long) stats.bytes_in,
+                 (unsigned long long) stats.bytes_out);
+        s3srv_stop (srv);
+
+        return 0;
+}
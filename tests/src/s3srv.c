@@ -0,0 +1,1797 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/evp.h>
+
+#include "s3srv.h"
+
+#define S3SRV_HDR_MAX    (16 * 1024)
+#define S3SRV_CONNS_MAX  256
+#define S3SRV_SEND_CHUNK (64 * 1024)
+#define S3SRV_KEYS_MAX   1000
+#define S3SRV_MD5_LEN    16
+#define S3SRV_ETAG_MAX   48
+
+struct s3srv_obj {
+        char             *key;          /* "bucket/key" */
+        char             *data;
+        size_t           len;
+        char             etag[S3SRV_ETAG_MAX];
+        time_t           mtime;
+        struct s3srv_obj *next;         /* sorted by key */
+};
+
+struct s3srv_part {
+        int32_t           num;
+        char              *data;
+        size_t            len;
+        unsigned char     md5[S3SRV_MD5_LEN];
+        struct s3srv_part *next;
+};
+
+struct s3srv_upload {
+        char                id[32];
+        char                *key;
+        struct s3srv_part   *parts;
+        struct s3srv_upload *next;
+};
+
+struct s3srv {
+        s3srv_opts_t        opts;
+        int32_t             fd;
+        int32_t             port;
+        pthread_t           thread;
+        pthread_mutex_t     lock;
+        pthread_cond_t      cond;
+        int32_t             stopping;
+        int32_t             conns[S3SRV_CONNS_MAX];
+        int32_t             nconns;
+        int32_t             inject_code;
+        int32_t             inject_count;
+        int32_t             delay_ms;
+        int32_t             delay_count;
+        uint64_t            next_id;
+        s3srv_stats_t       stats;
+        struct s3srv_obj    *objs;
+        struct s3srv_upload *uploads;
+};
+
+struct s3srv_req {
+        char    method[16];
+        char    bucket[256];
+        char    key[1024];
+        char    query[2048];
+        char    range[128];
+        char    copy_source[1300];      /* "bucket/key", decoded */
+        char    copy_range[128];
+        char    copy_if_match[64];
+        int32_t content_md5;
+        char    if_match[64];
+        char    if_none_match[64];
+        time_t  if_modified_since;
+        time_t  if_unmodified_since;
+        int64_t content_length;
+        int32_t expect;
+        int32_t streaming;
+        int32_t close;
+        char    *body;
+        size_t  len;
+};
+
+struct s3srv_conn {
+        s3srv_t *srv;
+        int32_t fd;
+        int64_t bandwidth;
+        char    buf[S3SRV_HDR_MAX];
+        size_t  have;
+};
+
+/* Growing string for XML responses */
+struct s3srv_buf {
+        char   *data;
+        size_t len;
+        size_t size;
+};
+
+/*
+  ETags come from OpenSSL rather than the driver's s3-hash.c, so the
+  driver checking them is checked against something else
+*/
+static
+void __md5_hex (const void *data, size_t len, unsigned char *md,
+                char *hex)
+{
+        static const char digits[] = "0123456789abcdef";
+        int32_t           i        = 0;
+
+        EVP_Digest (data, len, md, NULL, EVP_md5 (), NULL);
+        for (i = 0; i < S3SRV_MD5_LEN; i++) {
+                hex[2 * i]     = digits[md[i] >> 4];
+                hex[2 * i + 1] = digits[md[i] & 0xf];
+        }
+        hex[2 * S3SRV_MD5_LEN] = '\0';
+}
+
+static __attribute__ ((format (printf, 2, 3)))
+void __buf_printf (struct s3srv_buf *buf, const char *fmt, ...)
+{
+        va_list ap;
+        int     n = 0;
+        char    *tmp = NULL;
+
+        for (;;) {
+                va_start (ap, fmt);
+                n = vsnprintf (buf->data + buf->len, buf->size - buf->len,
+                               fmt, ap);
+                va_end (ap);
+                if ((n >= 0) && ((size_t) n < buf->size - buf->len))
+                        break;
+                tmp = realloc (buf->data, buf->size * 2 + n + 1);
+                if (!tmp)
+                        return;
+                buf->data  = tmp;
+                buf->size  = buf->size * 2 + n + 1;
+        }
+        buf->len += n;
+}
+
+static
+void __buf_escape (struct s3srv_buf *buf, const char *str)
+{
+        for (; *str; str++) {
+                switch (*str) {
+                case '&':  __buf_printf (buf, "&amp;");  break;
+                case '<':  __buf_printf (buf, "&lt;");   break;
+                case '>':  __buf_printf (buf, "&gt;");   break;
+                case '"':  __buf_printf (buf, "&quot;"); break;
+                case '\'': __buf_printf (buf, "&apos;"); break;
+                default:   __buf_printf (buf, "%c", *str); break;
+                }
+        }
+}
+
+static
+int32_t __hexval (char c)
+{
+        if ((c >= '0') && (c <= '9'))
+                return c - '0';
+        if ((c >= 'a') && (c <= 'f'))
+                return c - 'a' + 10;
+        if ((c >= 'A') && (c <= 'F'))
+                return c - 'A' + 10;
+        return -1;
+}
+
+static
+void __url_decode (const char *in, size_t len, char *out, size_t size)
+{
+        size_t o = 0;
+        size_t i = 0;
+
+        for (i = 0; (i < len) && (o + 1 < size); i++) {
+                if ((in[i] == '%') && (i + 2 < len) &&
+                    (__hexval (in[i + 1]) >= 0) &&
+                    (__hexval (in[i + 2]) >= 0)) {
+                        out[o++] = (__hexval (in[i + 1]) << 4) |
+                                __hexval (in[i + 2]);
+                        i += 2;
+                } else if (in[i] == '+') {
+                        out[o++] = ' ';
+                } else {
+                        out[o++] = in[i];
+                }
+        }
+        out[o] = '\0';
+}
+
+/*
+  Look 'name' up in the query string, returns 1 when it is present
+  (possibly with an empty value) and 0 otherwise
+*/
+static
+int32_t __query_get (const char *query, const char *name, char *out,
+                     size_t size)
+{
+        const char *p    = query;
+        const char *end  = NULL;
+        const char *eq   = NULL;
+        size_t     nlen  = strlen (name);
+
+        while ((p) && (*p)) {
+                end = strchr (p, '&');
+                if (!end)
+                        end = p + strlen (p);
+                eq = memchr (p, '=', end - p);
+                if ((((eq) ? (size_t)(eq - p) : (size_t)(end - p)) == nlen) &&
+                    (!strncmp (p, name, nlen))) {
+                        if (out) {
+                                if (eq)
+                                        __url_decode (eq + 1, end - eq - 1,
+                                                      out, size);
+                                else
+                                        out[0] = '\0';
+                        }
+                        return 1;
+                }
+                p = (*end) ? end + 1 : NULL;
+        }
+
+        if (out)
+                out[0] = '\0';
+        return 0;
+}
+
+static
+const char *__status_text (int32_t code)
+{
+        switch (code) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 412: return "Precondition Failed";
+        case 416: return "Requested Range Not Satisfiable";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Slow Down";
+        default:  return "Unknown";
+        }
+}
+
+static
+int32_t __send_all (struct s3srv_conn *conn, const char *data, size_t len,
+                    int32_t throttle)
+{
+        struct timespec start;
+        struct timespec now;
+        struct timespec ts;
+        size_t          sent  = 0;
+        size_t          chunk = 0;
+        ssize_t         ret   = 0;
+        int64_t         due   = 0;
+        int64_t         spent = 0;
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+
+        while (sent < len) {
+                chunk = len - sent;
+                if (chunk > S3SRV_SEND_CHUNK)
+                        chunk = S3SRV_SEND_CHUNK;
+
+                ret = send (conn->fd, data + sent, chunk, MSG_NOSIGNAL);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return -1;
+                }
+                sent += ret;
+
+                if ((!throttle) || (conn->bandwidth <= 0))
+                        continue;
+
+                /* Sleep off whatever we are ahead of the bandwidth cap */
+                clock_gettime (CLOCK_MONOTONIC, &now);
+                due   = (int64_t) sent * 1000000 / conn->bandwidth;
+                spent = (now.tv_sec - start.tv_sec) * 1000000 +
+                        (now.tv_nsec - start.tv_nsec) / 1000;
+                if (due > spent) {
+                        ts.tv_sec  = (due - spent) / 1000000;
+                        ts.tv_nsec = ((due - spent) % 1000000) * 1000;
+                        nanosleep (&ts, NULL);
+                }
+        }
+
+        return 0;
+}
+
+static
+int32_t __reply (struct s3srv_conn *conn, int32_t code, const char *hdrs,
+                 const char *body, size_t len, int32_t head)
+{
+        s3srv_t *srv = conn->srv;
+        char    hdr[2048];
+        int32_t n    = 0;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->next_id++;
+        if (!head)
+                srv->stats.bytes_out += len;
+        n = snprintf (hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\n"
+                      "Content-Length: %zu\r\n"
+                      "x-amz-request-id: %016llX\r\n"
+                      "x-amz-id-2: s3srv\r\n"
+                      "%s\r\n", code, __status_text (code), len,
+                      (unsigned long long) srv->next_id, hdrs ? hdrs : "");
+        pthread_mutex_unlock (&srv->lock);
+
+        if (__send_all (conn, hdr, n, 0) < 0)
+                return -1;
+
+        if ((head) || (!body) || (!len))
+                return 0;
+
+        return __send_all (conn, body, len, 1);
+}
+
+static
+int32_t __error (struct s3srv_conn *conn, int32_t code, const char *s3code,
+                 const char *msg, int32_t head)
+{
+        char body[512];
+        int  n = 0;
+
+        n = snprintf (body, sizeof(body),
+                      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<Error><Code>%s</Code><Message>%s</Message></Error>",
+                      s3code, msg);
+
+        return __reply (conn, code, "Content-Type: application/xml\r\n",
+                        body, n, head);
+}
+
+static
+void __http_date (time_t t, char *out, size_t size)
+{
+        struct tm tm;
+
+        gmtime_r (&t, &tm);
+        strftime (out, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static
+time_t __parse_date (const char *str)
+{
+        struct tm tm;
+
+        memset (&tm, 0, sizeof(tm));
+        if (!strptime (str, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+                return 0;
+
+        return timegm (&tm);
+}
+
+/* 'etag' as sent by a client, quoted, matches the unquoted 'mine' */
+static
+int32_t __etag_is (const char *etag, const char *mine)
+{
+        size_t len = strlen (mine);
+
+        if (!strcmp (etag, "*"))
+                return 1;
+        if (*etag == '"')
+                etag++;
+
+        return ((!strncmp (etag, mine, len)) &&
+                ((etag[len] == '"') || (etag[len] == '\0')));
+}
+
+/*
+  Preconditions of 'req' against 'obj', NULL when there is no such
+  object.  Returns 0 to go ahead, 304 or 412 otherwise, reads only
+  ever get the 304.
+*/
+static
+int32_t __precondition (struct s3srv_req *req, struct s3srv_obj *obj,
+                        int32_t read)
+{
+        if ((req->if_match[0]) &&
+            ((!obj) || (!__etag_is (req->if_match, obj->etag))))
+                return 412;
+
+        if ((req->if_unmodified_since) && (obj) &&
+            (obj->mtime > req->if_unmodified_since))
+                return 412;
+
+        if ((req->if_none_match[0]) && (obj) &&
+            (__etag_is (req->if_none_match, obj->etag)))
+                return (read) ? 304 : 412;
+
+        if ((read) && (!req->if_none_match[0]) &&
+            (req->if_modified_since) && (obj) &&
+            (obj->mtime <= req->if_modified_since))
+                return 304;
+
+        return 0;
+}
+
+static
+void __iso_date (time_t t, char *out, size_t size)
+{
+        struct tm tm;
+
+        gmtime_r (&t, &tm);
+        strftime (out, size, "%Y-%m-%dT%H:%M:%S.000Z", &tm);
+}
+
+/* Undo aws-chunked framing in place, returns the decoded length */
+static
+ssize_t __aws_chunked_decode (char *data, size_t len)
+{
+        size_t in   = 0;
+        size_t out  = 0;
+        size_t size = 0;
+        char   *eol = NULL;
+
+        while (in < len) {
+                size = strtoul (data + in, NULL, 16);
+                eol  = memmem (data + in, len - in, "\r\n", 2);
+                if (!eol)
+                        return -1;
+                in = (eol - data) + 2;
+                if (in + size > len)
+                        return -1;
+                memmove (data + out, data + in, size);
+                out += size;
+                in  += size + 2;
+                if (!size)
+                        break;
+        }
+
+        return out;
+}
+
+/*
+  Object store, a sorted list is plenty for tests and keeps listing
+  trivial.  Callers hold srv->lock.
+*/
+
+static
+struct s3srv_obj *__obj_find (s3srv_t *srv, const char *key)
+{
+        struct s3srv_obj *obj = NULL;
+
+        for (obj = srv->objs; obj; obj = obj->next) {
+                if (!strcmp (obj->key, key))
+                        return obj;
+        }
+
+        return NULL;
+}
+
+static
+void __obj_free (struct s3srv_obj *obj)
+{
+        free (obj->key);
+        free (obj->data);
+        free (obj);
+}
+
+static
+void __obj_store (s3srv_t *srv, struct s3srv_obj *obj)
+{
+        struct s3srv_obj **pp  = &srv->objs;
+        struct s3srv_obj *old  = NULL;
+        int               cmp  = 0;
+
+        for (; *pp; pp = &(*pp)->next) {
+                cmp = strcmp ((*pp)->key, obj->key);
+                if (cmp >= 0)
+                        break;
+        }
+
+        if ((*pp) && (cmp == 0)) {
+                old = *pp;
+                obj->next = old->next;
+                *pp = obj;
+                __obj_free (old);
+                return;
+        }
+
+        obj->next = *pp;
+        *pp = obj;
+}
+
+static
+void __obj_remove (s3srv_t *srv, const char *key)
+{
+        struct s3srv_obj **pp  = &srv->objs;
+        struct s3srv_obj *obj  = NULL;
+
+        for (; *pp; pp = &(*pp)->next) {
+                if (!strcmp ((*pp)->key, key)) {
+                        obj = *pp;
+                        *pp = obj->next;
+                        __obj_free (obj);
+                        return;
+                }
+        }
+}
+
+static
+void __upload_free (struct s3srv_upload *up)
+{
+        struct s3srv_part *part = NULL;
+
+        while (up->parts) {
+                part = up->parts;
+                up->parts = part->next;
+                free (part->data);
+                free (part);
+        }
+        free (up->key);
+        free (up);
+}
+
+static
+struct s3srv_upload *__upload_find (s3srv_t *srv, const char *id,
+                                    int32_t unlink)
+{
+        struct s3srv_upload **pp = &srv->uploads;
+        struct s3srv_upload *up  = NULL;
+
+        for (; *pp; pp = &(*pp)->next) {
+                if (!strcmp ((*pp)->id, id)) {
+                        up = *pp;
+                        if (unlink)
+                                *pp = up->next;
+                        return up;
+                }
+        }
+
+        return NULL;
+}
+
+static
+void __full_key (struct s3srv_req *req, char *out, size_t size)
+{
+        snprintf (out, size, "%s/%s", req->bucket, req->key);
+}
+
+static
+int32_t __do_get (struct s3srv_conn *conn, struct s3srv_req *req,
+                  int32_t head)
+{
+        s3srv_t          *srv  = conn->srv;
+        struct s3srv_obj *obj  = NULL;
+        char             key[1300];
+        char             hdrs[512];
+        char             date[64];
+        char             *data = NULL;
+        int64_t          first = 0;
+        int64_t          last  = 0;
+        int64_t          size  = 0;
+        int32_t          code  = 200;
+        int32_t          n     = 0;
+        int32_t          ret   = 0;
+
+        __full_key (req, key, sizeof(key));
+
+        pthread_mutex_lock (&srv->lock);
+        obj = __obj_find (srv, key);
+        if (!obj) {
+                pthread_mutex_unlock (&srv->lock);
+                return __error (conn, 404, "NoSuchKey",
+                                "The specified key does not exist.", head);
+        }
+
+        code = __precondition (req, obj, 1);
+        if (code == 304) {
+                __http_date (obj->mtime, date, sizeof(date));
+                snprintf (hdrs, sizeof(hdrs), "ETag: \"%s\"\r\n"
+                          "Last-Modified: %s\r\n", obj->etag, date);
+                pthread_mutex_unlock (&srv->lock);
+                return __reply (conn, 304, hdrs, NULL, 0, head);
+        }
+        if (code == 412) {
+                pthread_mutex_unlock (&srv->lock);
+                return __error (conn, 412, "PreconditionFailed",
+                                "At least one of the pre-conditions you "
+                                "specified did not hold", head);
+        }
+        code = 200;
+
+        size = obj->len;
+        last = size - 1;
+        if (req->range[0]) {
+                if (!strncmp (req->range, "bytes=-", 7)) {
+                        first = size - strtoll (req->range + 7, NULL, 10);
+                        if (first < 0)
+                                first = 0;
+                } else if (!strncmp (req->range, "bytes=", 6)) {
+                        first = strtoll (req->range + 6, NULL, 10);
+                        if (strchr (req->range, '-')[1])
+                                last = strtoll (strchr (req->range, '-') + 1,
+                                                NULL, 10);
+                }
+                if (last >= size)
+                        last = size - 1;
+                if ((first >= size) || (first > last)) {
+                        pthread_mutex_unlock (&srv->lock);
+                        return __error (conn, 416, "InvalidRange",
+                                        "The requested range is not "
+                                        "satisfiable", head);
+                }
+                code = 206;
+        }
+
+        __http_date (obj->mtime, date, sizeof(date));
+        n = snprintf (hdrs, sizeof(hdrs), "ETag: \"%s\"\r\n"
+                      "Last-Modified: %s\r\n"
+                      "Content-Type: binary/octet-stream\r\n"
+                      "Accept-Ranges: bytes\r\n", obj->etag, date);
+        if (code == 206)
+                snprintf (hdrs + n, sizeof(hdrs) - n,
+                          "Content-Range: bytes %lld-%lld/%lld\r\n",
+                          (long long) first, (long long) last,
+                          (long long) size);
+
+        /* Copy out, the lock is not held while (slowly) sending */
+        if ((!head) && (last >= first)) {
+                data = malloc (last - first + 1);
+                if (data)
+                        memcpy (data, obj->data + first, last - first + 1);
+        }
+        pthread_mutex_unlock (&srv->lock);
+
+        if ((!head) && (last >= first) && (!data))
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                head);
+
+        ret = __reply (conn, code, hdrs, data,
+                       (last >= first) ? (last - first + 1) : 0, head);
+        free (data);
+        return ret;
+}
+
+static
+int32_t __do_list (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t           *srv   = conn->srv;
+        struct s3srv_obj  *obj   = NULL;
+        struct s3srv_buf  buf    = { NULL, 0, 0 };
+        struct s3srv_buf  items  = { NULL, 0, 0 };
+        char              prefix[1024];
+        char              delim[16];
+        char              token[1024];
+        char              after[1024];
+        char              tmp[32];
+        char              date[64];
+        char              cprefix[1024];
+        char              last_cp[1024] = "";
+        const char        *name  = NULL;
+        const char        *rest  = NULL;
+        const char        *d     = NULL;
+        size_t            blen   = strlen (req->bucket);
+        int32_t           max    = S3SRV_KEYS_MAX;
+        int32_t           count  = 0;
+        int32_t           trunc  = 0;
+        char              next[1024] = "";
+        int32_t           ret    = 0;
+
+        __query_get (req->query, "prefix", prefix, sizeof(prefix));
+        __query_get (req->query, "delimiter", delim, sizeof(delim));
+        __query_get (req->query, "continuation-token", token, sizeof(token));
+        __query_get (req->query, "start-after", after, sizeof(after));
+        if (__query_get (req->query, "max-keys", tmp, sizeof(tmp)) &&
+            (tmp[0])) {
+                max = atoi (tmp);
+                if ((max <= 0) || (max > S3SRV_KEYS_MAX))
+                        max = S3SRV_KEYS_MAX;
+        }
+        if (token[0])
+                strcpy (after, token);
+
+        buf.size   = 4096;
+        buf.data   = malloc (buf.size);
+        items.size = 4096;
+        items.data = malloc (items.size);
+        if ((!buf.data) || (!items.data)) {
+                free (buf.data);
+                free (items.data);
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        }
+
+        __buf_printf (&buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<ListBucketResult xmlns=\"http://s3.amazonaws.com/"
+                      "doc/2006-03-01/\"><Name>");
+        __buf_escape (&buf, req->bucket);
+        __buf_printf (&buf, "</Name><Prefix>");
+        __buf_escape (&buf, prefix);
+        __buf_printf (&buf, "</Prefix><MaxKeys>%d</MaxKeys>", max);
+        if (delim[0]) {
+                __buf_printf (&buf, "<Delimiter>");
+                __buf_escape (&buf, delim);
+                __buf_printf (&buf, "</Delimiter>");
+        }
+
+        pthread_mutex_lock (&srv->lock);
+        for (obj = srv->objs; obj; obj = obj->next) {
+                if ((strncmp (obj->key, req->bucket, blen)) ||
+                    (obj->key[blen] != '/'))
+                        continue;
+                name = obj->key + blen + 1;
+                if (strncmp (name, prefix, strlen (prefix)))
+                        continue;
+                if ((after[0]) && (strcmp (name, after) <= 0))
+                        continue;
+                /* Continuing after a common prefix skips all under it */
+                if ((after[0]) && (delim[0]) &&
+                    (strlen (after) >= strlen (delim)) &&
+                    (!strcmp (after + strlen (after) - strlen (delim),
+                              delim)) &&
+                    (!strncmp (name, after, strlen (after))))
+                        continue;
+
+                cprefix[0] = '\0';
+                if (delim[0]) {
+                        rest = name + strlen (prefix);
+                        d = strstr (rest, delim);
+                        if (d)
+                                snprintf (cprefix, sizeof(cprefix), "%.*s",
+                                          (int) (d - name + strlen (delim)),
+                                          name);
+                }
+                if ((cprefix[0]) && (!strcmp (cprefix, last_cp)))
+                        continue;
+
+                if (count == max) {
+                        trunc = 1;
+                        break;
+                }
+                count++;
+
+                if (cprefix[0]) {
+                        strcpy (last_cp, cprefix);
+                        strcpy (next, cprefix);
+                        __buf_printf (&items, "<CommonPrefixes><Prefix>");
+                        __buf_escape (&items, cprefix);
+                        __buf_printf (&items, "</Prefix></CommonPrefixes>");
+                        continue;
+                }
+
+                snprintf (next, sizeof(next), "%s", name);
+                __iso_date (obj->mtime, date, sizeof(date));
+                __buf_printf (&items, "<Contents><Key>");
+                __buf_escape (&items, name);
+                __buf_printf (&items, "</Key><LastModified>%s</LastModified>"
+                              "<ETag>&quot;%s&quot;</ETag><Size>%zu</Size>"
+                              "<StorageClass>STANDARD</StorageClass>"
+                              "</Contents>", date, obj->etag, obj->len);
+        }
+        pthread_mutex_unlock (&srv->lock);
+
+        /* Like S3, the token goes ahead of the keys */
+        if (trunc) {
+                __buf_printf (&buf, "<NextContinuationToken>");
+                __buf_escape (&buf, next);
+                __buf_printf (&buf, "</NextContinuationToken>");
+        }
+        __buf_printf (&buf, "<KeyCount>%d</KeyCount><IsTruncated>%s"
+                      "</IsTruncated>%.*s</ListBucketResult>", count,
+                      trunc ? "true" : "false", (int) items.len, items.data);
+
+        ret = __reply (conn, 200, "Content-Type: application/xml\r\n",
+                       buf.data, buf.len, 0);
+        free (buf.data);
+        free (items.data);
+        return ret;
+}
+
+/*
+  Server side copies take the (range of the) source object as body,
+  returns 0, or 1 once a failure has been replied
+*/
+static
+int32_t __copy_source (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t          *srv   = conn->srv;
+        struct s3srv_obj *obj   = NULL;
+        const char       *etag  = req->copy_if_match;
+        const char       *code  = NULL;
+        const char       *msg   = NULL;
+        long long        first  = 0;
+        long long        last   = 0;
+        int32_t          status = 0;
+
+        pthread_mutex_lock (&srv->lock);
+        obj = __obj_find (srv, req->copy_source);
+        if (!obj) {
+                status = 404;
+                code   = "NoSuchKey";
+                msg    = "The specified key does not exist.";
+                goto fail;
+        }
+
+        etag += (*etag == '"');
+        if ((etag[0]) && (strncmp (etag, obj->etag, strlen (obj->etag)))) {
+                status = 412;
+                code   = "PreconditionFailed";
+                msg    = "At least one of the pre-conditions you specified "
+                        "did not hold";
+                goto fail;
+        }
+
+        last = (long long) obj->len - 1;
+        if ((req->copy_range[0]) &&
+            ((sscanf (req->copy_range, "bytes=%lld-%lld", &first,
+                      &last) != 2) || (first < 0) || (first > last) ||
+             (last >= (long long) obj->len))) {
+                status = 400;
+                code   = "InvalidArgument";
+                msg    = "The x-amz-copy-source-range value must be of the "
+                        "form bytes=first-last";
+                goto fail;
+        }
+
+        free (req->body);
+        req->len  = last - first + 1;
+        req->body = malloc (req->len + 1);
+        if (!req->body) {
+                status = 500;
+                code   = "InternalError";
+                msg    = "Out of memory";
+                goto fail;
+        }
+        memcpy (req->body, obj->data + first, req->len);
+        pthread_mutex_unlock (&srv->lock);
+
+        return 0;
+fail:
+        pthread_mutex_unlock (&srv->lock);
+        return (__error (conn, status, code, msg, 0) < 0) ? -1 : 1;
+}
+
+/* PUT replies, copies answer with XML instead of an ETag header */
+static
+int32_t __put_reply (struct s3srv_conn *conn, struct s3srv_req *req,
+                     const char *etag, int32_t part)
+{
+        char hdrs[128];
+        char xml[512];
+        char date[64];
+
+        if (!req->copy_source[0]) {
+                snprintf (hdrs, sizeof(hdrs), "ETag: \"%s\"\r\n", etag);
+                return __reply (conn, 200, hdrs, NULL, 0, 0);
+        }
+
+        __iso_date (time (NULL), date, sizeof(date));
+        snprintf (xml, sizeof(xml), "<?xml version=\"1.0\" encoding=\"UTF-8\""
+                  "?>\n<%s><LastModified>%s</LastModified>"
+                  "<ETag>&quot;%s&quot;</ETag></%s>",
+                  part ? "CopyPartResult" : "CopyObjectResult", date, etag,
+                  part ? "CopyPartResult" : "CopyObjectResult");
+        return __reply (conn, 200, "Content-Type: application/xml\r\n", xml,
+                        strlen (xml), 0);
+}
+
+static
+int32_t __do_put (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t             *srv  = conn->srv;
+        struct s3srv_obj    *obj  = NULL;
+        struct s3srv_upload *up   = NULL;
+        struct s3srv_part   *part = NULL;
+        struct s3srv_part   **pp  = NULL;
+        unsigned char       md[S3SRV_MD5_LEN];
+        char                etag[S3SRV_ETAG_MAX];
+        char                id[64];
+        char                num[16];
+        int32_t             ret   = 0;
+
+        if (req->copy_source[0]) {
+                ret = __copy_source (conn, req);
+                if (ret)
+                        return (ret < 0) ? -1 : 0;
+        }
+
+        __md5_hex (req->body, req->len, md, etag);
+
+        if (__query_get (req->query, "uploadId", id, sizeof(id))) {
+                __query_get (req->query, "partNumber", num, sizeof(num));
+                part = calloc (1, sizeof(*part));
+                if (!part)
+                        return __error (conn, 500, "InternalError",
+                                        "Out of memory", 0);
+                part->num  = atoi (num);
+                part->data = req->body;
+                part->len  = req->len;
+                memcpy (part->md5, md, sizeof(md));
+
+                pthread_mutex_lock (&srv->lock);
+                up = __upload_find (srv, id, 0);
+                if (!up) {
+                        pthread_mutex_unlock (&srv->lock);
+                        free (part);
+                        return __error (conn, 404, "NoSuchUpload",
+                                        "The specified upload does not "
+                                        "exist.", 0);
+                }
+                req->body = NULL;
+                for (pp = &up->parts; *pp; pp = &(*pp)->next) {
+                        if ((*pp)->num >= part->num)
+                                break;
+                }
+                if ((*pp) && ((*pp)->num == part->num)) {
+                        part->next = (*pp)->next;
+                        free ((*pp)->data);
+                        free (*pp);
+                } else {
+                        part->next = *pp;
+                }
+                *pp = part;
+                pthread_mutex_unlock (&srv->lock);
+
+                return __put_reply (conn, req, etag, 1);
+        }
+
+        obj = calloc (1, sizeof(*obj));
+        if (obj)
+                obj->key = malloc (strlen (req->bucket) +
+                                   strlen (req->key) + 2);
+        if ((!obj) || (!obj->key)) {
+                free (obj);
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        }
+        __full_key (req, obj->key, strlen (req->bucket) +
+                    strlen (req->key) + 2);
+        obj->data  = req->body;
+        obj->len   = req->len;
+        obj->mtime = time (NULL);
+        memcpy (obj->etag, etag, sizeof(etag));
+
+        pthread_mutex_lock (&srv->lock);
+        if (__precondition (req, __obj_find (srv, obj->key), 0)) {
+                pthread_mutex_unlock (&srv->lock);
+                obj->data = NULL;       /* still req->body */
+                __obj_free (obj);
+                return __error (conn, 412, "PreconditionFailed",
+                                "At least one of the pre-conditions you "
+                                "specified did not hold", 0);
+        }
+        req->body = NULL;
+        __obj_store (srv, obj);
+        pthread_mutex_unlock (&srv->lock);
+
+        return __put_reply (conn, req, etag, 0);
+}
+
+static
+int32_t __do_complete (struct s3srv_conn *conn, struct s3srv_req *req,
+                       const char *id)
+{
+        s3srv_t             *srv     = conn->srv;
+        struct s3srv_upload *up      = NULL;
+        struct s3srv_part   *part    = NULL;
+        struct s3srv_obj    *obj     = NULL;
+        struct s3srv_buf    buf      = { NULL, 0, 0 };
+        unsigned char       (*md5s)[S3SRV_MD5_LEN] = NULL;
+        unsigned char       md[S3SRV_MD5_LEN];
+        const char          *p       = NULL;
+        int32_t             nums[S3SRV_KEYS_MAX * 10];
+        int32_t             nparts   = 0;
+        size_t              total    = 0;
+        int32_t             i        = 0;
+        int32_t             ret      = 0;
+
+        for (p = req->body; (p) && (nparts < (int32_t) (sizeof(nums) /
+                                                      sizeof(nums[0])));) {
+                p = memmem (p, req->len - (p - req->body), "<PartNumber>",
+                            12);
+                if (!p)
+                        break;
+                p += 12;
+                nums[nparts++] = atoi (p);
+        }
+
+        pthread_mutex_lock (&srv->lock);
+        up = __upload_find (srv, id, 0);
+        if (!up) {
+                pthread_mutex_unlock (&srv->lock);
+                return __error (conn, 404, "NoSuchUpload",
+                                "The specified upload does not exist.", 0);
+        }
+
+        for (i = 0; i < nparts; i++) {
+                for (part = up->parts; part; part = part->next) {
+                        if (part->num == nums[i])
+                                break;
+                }
+                if ((!part) || ((i) && (nums[i] <= nums[i - 1]))) {
+                        pthread_mutex_unlock (&srv->lock);
+                        return __error (conn, 400, "InvalidPart",
+                                        "One or more of the specified parts "
+                                        "could not be found.", 0);
+                }
+                total += part->len;
+        }
+
+        obj  = calloc (1, sizeof(*obj));
+        md5s = calloc (nparts + 1, S3SRV_MD5_LEN);
+        if (obj) {
+                obj->data = malloc (total + 1);
+                obj->key  = strdup (up->key);
+        }
+        if ((!obj) || (!md5s) || (!obj->data) || (!obj->key)) {
+                pthread_mutex_unlock (&srv->lock);
+                if (obj) {
+                        free (obj->data);
+                        free (obj->key);
+                }
+                free (obj);
+                free (md5s);
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        }
+
+        for (i = 0; i < nparts; i++) {
+                for (part = up->parts; part->num != nums[i];
+                     part = part->next)
+                        ;
+                memcpy (obj->data + obj->len, part->data, part->len);
+                obj->len += part->len;
+                memcpy (md5s[i], part->md5, S3SRV_MD5_LEN);
+        }
+        /* hex(MD5(MD5(part 1) .. MD5(part N)))-N */
+        __md5_hex (md5s, (size_t) nparts * S3SRV_MD5_LEN, md, obj->etag);
+        snprintf (obj->etag + 2 * S3SRV_MD5_LEN,
+                  S3SRV_ETAG_MAX - 2 * S3SRV_MD5_LEN, "-%d", nparts);
+        obj->mtime = time (NULL);
+
+        if (__precondition (req, __obj_find (srv, obj->key), 0)) {
+                pthread_mutex_unlock (&srv->lock);
+                __obj_free (obj);
+                free (md5s);
+                return __error (conn, 412, "PreconditionFailed",
+                                "At least one of the pre-conditions you "
+                                "specified did not hold", 0);
+        }
+
+        __upload_find (srv, id, 1);
+        __upload_free (up);
+        __obj_store (srv, obj);
+        pthread_mutex_unlock (&srv->lock);
+        free (md5s);
+
+        buf.size = 512;
+        buf.data = malloc (buf.size);
+        if (!buf.data)
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        __buf_printf (&buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<CompleteMultipartUploadResult><Bucket>");
+        __buf_escape (&buf, req->bucket);
+        __buf_printf (&buf, "</Bucket><Key>");
+        __buf_escape (&buf, req->key);
+        __buf_printf (&buf, "</Key><ETag>&quot;%s&quot;</ETag>"
+                      "</CompleteMultipartUploadResult>", obj->etag);
+
+        ret = __reply (conn, 200, "Content-Type: application/xml\r\n",
+                       buf.data, buf.len, 0);
+        free (buf.data);
+        return ret;
+}
+
+/* Decode the XML entities of 'len' bytes of 'in' */
+static
+void __xml_unescape (const char *in, size_t len, char *out, size_t size)
+{
+        static const struct {
+                const char *ent;
+                char       c;
+        } ents[] = {
+                { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' },
+                { "&quot;", '"' }, { "&apos;", '\'' },
+        };
+        const char *end = in + len;
+        size_t     o    = 0;
+        size_t     i    = 0;
+        size_t     n    = 0;
+
+        while ((in < end) && (o + 1 < size)) {
+                if (*in != '&') {
+                        out[o++] = *in++;
+                        continue;
+                }
+                if ((in + 2 < end) && (in[1] == '#')) {
+                        n = (in[2] == 'x') ? strtoul (in + 3, NULL, 16) :
+                                strtoul (in + 2, NULL, 10);
+                        out[o++] = (char) n;
+                        in = memchr (in, ';', end - in);
+                        in = (in) ? in + 1 : end;
+                        continue;
+                }
+                for (i = 0; i < sizeof(ents) / sizeof(ents[0]); i++) {
+                        n = strlen (ents[i].ent);
+                        if ((in + n <= end) && (!memcmp (in, ents[i].ent, n)))
+                                break;
+                }
+                if (i < sizeof(ents) / sizeof(ents[0])) {
+                        out[o++] = ents[i].c;
+                        in += n;
+                } else {
+                        out[o++] = *in++;
+                }
+        }
+        out[o] = '\0';
+}
+
+/* DeleteObjects, "POST /bucket?delete" */
+static
+int32_t __do_delete_multi (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t          *srv   = conn->srv;
+        struct s3srv_buf buf    = { NULL, 0, 0 };
+        const char       *p     = NULL;
+        const char       *end   = NULL;
+        const char       *stop  = req->body + req->len;
+        char             name[1024];
+        char             key[1300];
+        int32_t          quiet  = 0;
+        int32_t          count  = 0;
+        int32_t          ret    = 0;
+
+        if (!req->content_md5)
+                return __error (conn, 400, "InvalidRequest",
+                                "Missing required header for this request: "
+                                "Content-MD5", 0);
+
+        quiet = (req->body) && (memmem (req->body, req->len,
+                                        "<Quiet>true</Quiet>", 19) != NULL);
+
+        buf.size = 512;
+        buf.data = malloc (buf.size);
+        if (!buf.data)
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        __buf_printf (&buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<DeleteResult>");
+
+        for (p = req->body; (p) && (p < stop);) {
+                p = memmem (p, stop - p, "<Key>", 5);
+                if (!p)
+                        break;
+                p += 5;
+                end = memmem (p, stop - p, "</Key>", 6);
+                if (!end)
+                        break;
+                if (++count > 1000) {
+                        free (buf.data);
+                        return __error (conn, 400, "MalformedXML",
+                                        "The XML you provided was not "
+                                        "well-formed", 0);
+                }
+                __xml_unescape (p, end - p, name, sizeof(name));
+                p = end + 6;
+
+                snprintf (key, sizeof(key), "%s/%s", req->bucket, name);
+                pthread_mutex_lock (&srv->lock);
+                __obj_remove (srv, key);
+                pthread_mutex_unlock (&srv->lock);
+
+                if (quiet)
+                        continue;
+                __buf_printf (&buf, "<Deleted><Key>");
+                __buf_escape (&buf, name);
+                __buf_printf (&buf, "</Key></Deleted>");
+        }
+        __buf_printf (&buf, "</DeleteResult>");
+
+        ret = __reply (conn, 200, "Content-Type: application/xml\r\n",
+                       buf.data, buf.len, 0);
+        free (buf.data);
+        return ret;
+}
+
+static
+int32_t __do_post (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t             *srv = conn->srv;
+        struct s3srv_upload *up  = NULL;
+        struct s3srv_buf    buf  = { NULL, 0, 0 };
+        char                id[64];
+        int32_t             ret  = 0;
+
+        if (__query_get (req->query, "uploadId", id, sizeof(id)))
+                return __do_complete (conn, req, id);
+
+        if (!__query_get (req->query, "uploads", NULL, 0))
+                return __error (conn, 501, "NotImplemented",
+                                "A header you provided implies "
+                                "functionality that is not implemented", 0);
+
+        up = calloc (1, sizeof(*up));
+        if (up)
+                up->key = malloc (strlen (req->bucket) +
+                                  strlen (req->key) + 2);
+        if ((!up) || (!up->key)) {
+                free (up);
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        }
+        __full_key (req, up->key, strlen (req->bucket) +
+                    strlen (req->key) + 2);
+
+        pthread_mutex_lock (&srv->lock);
+        snprintf (up->id, sizeof(up->id), "%016llx",
+                  (unsigned long long) ++srv->next_id);
+        up->next = srv->uploads;
+        srv->uploads = up;
+        snprintf (id, sizeof(id), "%s", up->id);
+        pthread_mutex_unlock (&srv->lock);
+
+        buf.size = 512;
+        buf.data = malloc (buf.size);
+        if (!buf.data)
+                return __error (conn, 500, "InternalError", "Out of memory",
+                                0);
+        __buf_printf (&buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                      "<InitiateMultipartUploadResult><Bucket>");
+        __buf_escape (&buf, req->bucket);
+        __buf_printf (&buf, "</Bucket><Key>");
+        __buf_escape (&buf, req->key);
+        __buf_printf (&buf, "</Key><UploadId>%s</UploadId>"
+                      "</InitiateMultipartUploadResult>", id);
+
+        ret = __reply (conn, 200, "Content-Type: application/xml\r\n",
+                       buf.data, buf.len, 0);
+        free (buf.data);
+        return ret;
+}
+
+static
+int32_t __do_delete (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t             *srv = conn->srv;
+        struct s3srv_upload *up  = NULL;
+        char                key[1300];
+        char                id[64];
+
+        pthread_mutex_lock (&srv->lock);
+        if (__query_get (req->query, "uploadId", id, sizeof(id))) {
+                up = __upload_find (srv, id, 1);
+                if (up)
+                        __upload_free (up);
+        } else {
+                __full_key (req, key, sizeof(key));
+                __obj_remove (srv, key);
+        }
+        pthread_mutex_unlock (&srv->lock);
+
+        return __reply (conn, 204, NULL, NULL, 0, 0);
+}
+
+/*
+  Failures on demand, injected ones first then the random rates.
+  Returns the HTTP code to fail with, 0 to serve the request.
+*/
+static
+int32_t __s3srv_fail (s3srv_t *srv)
+{
+        int32_t code = 0;
+        int32_t roll = 0;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->stats.requests++;
+        if (srv->inject_count > 0) {
+                srv->inject_count--;
+                code = srv->inject_code;
+        } else if ((srv->opts.error_pct) || (srv->opts.throttle_pct)) {
+                roll = rand_r (&srv->opts.seed) % 100;
+                if (roll < srv->opts.error_pct)
+                        code = 500;
+                else if (roll < srv->opts.error_pct + srv->opts.throttle_pct)
+                        code = 503;
+        }
+        if (code)
+                srv->stats.injected++;
+        pthread_mutex_unlock (&srv->lock);
+
+        return code;
+}
+
+static
+int32_t __s3srv_handle (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        s3srv_t         *srv  = conn->srv;
+        struct timespec ts;
+        int32_t         head  = !strcmp (req->method, "HEAD");
+        int32_t         code  = 0;
+        int32_t         delay = 0;
+
+        pthread_mutex_lock (&srv->lock);
+        delay           = srv->opts.latency_ms;
+        conn->bandwidth = srv->opts.bandwidth;
+        if (srv->delay_count > 0) {
+                srv->delay_count--;
+                delay += srv->delay_ms;
+        }
+        pthread_mutex_unlock (&srv->lock);
+
+        if (delay > 0) {
+                ts.tv_sec  = delay / 1000;
+                ts.tv_nsec = (delay % 1000) * 1000000;
+                nanosleep (&ts, NULL);
+        }
+
+        code = __s3srv_fail (srv);
+        if (code == 503)
+                return __error (conn, 503, "SlowDown",
+                                "Please reduce your request rate.", head);
+        if (code)
+                return __error (conn, code, "InternalError",
+                                "We encountered an internal error. "
+                                "Please try again.", head);
+
+        if (!req->bucket[0])
+                return __error (conn, 400, "InvalidBucketName",
+                                "The specified bucket is not valid.", head);
+
+        if ((!strcmp (req->method, "GET")) && (!req->key[0]))
+                return __do_list (conn, req);
+        if ((!strcmp (req->method, "GET")) || (head))
+                return __do_get (conn, req, head);
+        if ((!strcmp (req->method, "PUT")) && (req->key[0]))
+                return __do_put (conn, req);
+        if ((!strcmp (req->method, "POST")) && (!req->key[0]) &&
+            (__query_get (req->query, "delete", NULL, 0)))
+                return __do_delete_multi (conn, req);
+        if ((!strcmp (req->method, "POST")) && (req->key[0]))
+                return __do_post (conn, req);
+        if ((!strcmp (req->method, "DELETE")) && (req->key[0]))
+                return __do_delete (conn, req);
+
+        return __error (conn, 501, "NotImplemented",
+                        "A header you provided implies functionality that "
+                        "is not implemented", head);
+}
+
+static
+void __s3srv_parse_target (struct s3srv_req *req, const char *target,
+                           size_t len)
+{
+        const char *q     = memchr (target, '?', len);
+        const char *slash = NULL;
+        size_t     plen   = (q) ? (size_t)(q - target) : len;
+
+        if (q)
+                snprintf (req->query, sizeof(req->query), "%.*s",
+                          (int) (len - plen - 1), q + 1);
+
+        /* Path style, "/bucket/key" */
+        while ((plen) && (*target == '/')) {
+                target++;
+                plen--;
+        }
+        slash = memchr (target, '/', plen);
+        if (!slash) {
+                __url_decode (target, plen, req->bucket, sizeof(req->bucket));
+                return;
+        }
+        __url_decode (target, slash - target, req->bucket,
+                      sizeof(req->bucket));
+        __url_decode (slash + 1, plen - (slash + 1 - target), req->key,
+                      sizeof(req->key));
+}
+
+/*
+  SYNOPSIS
+
+  __s3srv_read: read the next request off 'conn', body included
+
+  RETURN VALUES:
+   1 : Request read
+   0 : Connection closed
+  -1 : Failure
+*/
+
+static
+int32_t __s3srv_read (struct s3srv_conn *conn, struct s3srv_req *req)
+{
+        char    *end   = NULL;
+        char    *line  = NULL;
+        char    *next  = NULL;
+        char    *sp    = NULL;
+        char    *value = NULL;
+        size_t  hlen   = 0;
+        size_t  have   = 0;
+        ssize_t ret    = 0;
+        ssize_t dlen   = 0;
+
+        memset (req, 0, sizeof(*req));
+        req->content_length = 0;
+
+        while (!(end = memmem (conn->buf, conn->have, "\r\n\r\n", 4))) {
+                if (conn->have == sizeof(conn->buf))
+                        return -1;
+                ret = recv (conn->fd, conn->buf + conn->have,
+                            sizeof(conn->buf) - conn->have, 0);
+                if ((ret < 0) && (errno == EINTR))
+                        continue;
+                if (ret <= 0)
+                        return (ret == 0 && conn->have == 0) ? 0 : -1;
+                conn->have += ret;
+        }
+        hlen = end + 4 - conn->buf;
+        *end = '\0';
+
+        /* Request line */
+        line = conn->buf;
+        next = strstr (line, "\r\n");
+        if (next)
+                *next = '\0';
+        sp = strchr (line, ' ');
+        if (!sp)
+                return -1;
+        snprintf (req->method, sizeof(req->method), "%.*s",
+                  (int) (sp - line), line);
+        line = sp + 1;
+        sp = strchr (line, ' ');
+        if (!sp)
+                return -1;
+        __s3srv_parse_target (req, line, sp - line);
+
+        /* Headers */
+        for (line = (next) ? next + 2 : NULL; (line) && (*line);
+             line = (next) ? next + 2 : NULL) {
+                next = strstr (line, "\r\n");
+                if (next)
+                        *next = '\0';
+                value = strchr (line, ':');
+                if (!value)
+                        continue;
+                *value++ = '\0';
+                value += strspn (value, " \t");
+
+                if (!strcasecmp (line, "content-length"))
+                        req->content_length = strtoll (value, NULL, 10);
+                else if (!strcasecmp (line, "range"))
+                        snprintf (req->range, sizeof(req->range), "%s",
+                                  value);
+                else if (!strcasecmp (line, "x-amz-copy-source"))
+                        __url_decode (value + (*value == '/'),
+                                      strlen (value + (*value == '/')),
+                                      req->copy_source,
+                                      sizeof(req->copy_source));
+                else if (!strcasecmp (line, "x-amz-copy-source-range"))
+                        snprintf (req->copy_range, sizeof(req->copy_range),
+                                  "%s", value);
+                else if (!strcasecmp (line, "x-amz-copy-source-if-match"))
+                        snprintf (req->copy_if_match,
+                                  sizeof(req->copy_if_match), "%s", value);
+                else if (!strcasecmp (line, "content-md5"))
+                        req->content_md5 = 1;
+                else if (!strcasecmp (line, "if-match"))
+                        snprintf (req->if_match, sizeof(req->if_match),
+                                  "%s", value);
+                else if (!strcasecmp (line, "if-none-match"))
+                        snprintf (req->if_none_match,
+                                  sizeof(req->if_none_match), "%s", value);
+                else if (!strcasecmp (line, "if-modified-since"))
+                        req->if_modified_since = __parse_date (value);
+                else if (!strcasecmp (line, "if-unmodified-since"))
+                        req->if_unmodified_since = __parse_date (value);
+                else if (!strcasecmp (line, "expect"))
+                        req->expect = !strcasecmp (value, "100-continue");
+                else if (!strcasecmp (line, "x-amz-content-sha256"))
+                        req->streaming = !strncmp (value, "STREAMING-", 10);
+                else if (!strcasecmp (line, "connection"))
+                        req->close = !strcasecmp (value, "close");
+        }
+
+        if (req->content_length < 0)
+                return -1;
+
+        have = conn->have - hlen;
+        if ((req->expect) && (have < (size_t) req->content_length)) {
+                ret = send (conn->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25,
+                            MSG_NOSIGNAL);
+                if (ret < 0)
+                        return -1;
+        }
+
+        req->body = malloc (req->content_length + 1);
+        if (!req->body)
+                return -1;
+        req->len = req->content_length;
+
+        if (have > req->len)
+                have = req->len;
+        memcpy (req->body, conn->buf + hlen, have);
+        memmove (conn->buf, conn->buf + hlen + have,
+                 conn->have - hlen - have);
+        conn->have -= hlen + have;
+
+        while (have < req->len) {
+                ret = recv (conn->fd, req->body + have, req->len - have, 0);
+                if ((ret < 0) && (errno == EINTR))
+                        continue;
+                if (ret <= 0)
+                        return -1;
+                have += ret;
+        }
+        req->body[req->len] = '\0';
+
+        if (req->streaming) {
+                dlen = __aws_chunked_decode (req->body, req->len);
+                if (dlen < 0)
+                        return -1;
+                req->len = dlen;
+        }
+
+        pthread_mutex_lock (&conn->srv->lock);
+        conn->srv->stats.bytes_in += req->content_length;
+        pthread_mutex_unlock (&conn->srv->lock);
+
+        return 1;
+}
+
+static
+void *__s3srv_conn (void *arg)
+{
+        struct s3srv_conn *conn = arg;
+        s3srv_t           *srv  = conn->srv;
+        struct s3srv_req  req;
+        int32_t           i     = 0;
+
+        while (__s3srv_read (conn, &req) > 0) {
+                if (__s3srv_handle (conn, &req) < 0)
+                        req.close = 1;
+                free (req.body);
+                req.body = NULL;
+                if (req.close)
+                        break;
+        }
+        free (req.body);
+
+        pthread_mutex_lock (&srv->lock);
+        for (i = 0; i < srv->nconns; i++) {
+                if (srv->conns[i] == conn->fd) {
+                        srv->conns[i] = srv->conns[--srv->nconns];
+                        break;
+                }
+        }
+        close (conn->fd);
+        pthread_cond_broadcast (&srv->cond);
+        pthread_mutex_unlock (&srv->lock);
+
+        free (conn);
+        return NULL;
+}
+
+static
+void *__s3srv_accept (void *arg)
+{
+        s3srv_t           *srv  = arg;
+        struct s3srv_conn *conn = NULL;
+        struct pollfd     pfd;
+        pthread_attr_t    attr;
+        pthread_t         tid;
+        int32_t           fd    = -1;
+        int               one   = 1;
+
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+        for (;;) {
+                pthread_mutex_lock (&srv->lock);
+                if (srv->stopping) {
+                        pthread_mutex_unlock (&srv->lock);
+                        break;
+                }
+                pthread_mutex_unlock (&srv->lock);
+
+                pfd.fd      = srv->fd;
+                pfd.events  = POLLIN;
+                pfd.revents = 0;
+                if (poll (&pfd, 1, 100) <= 0)
+                        continue;
+
+                fd = accept (srv->fd, NULL, NULL);
+                if (fd < 0)
+                        continue;
+                setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                conn = calloc (1, sizeof(*conn));
+                if (!conn) {
+                        close (fd);
+                        continue;
+                }
+                conn->srv = srv;
+                conn->fd  = fd;
+
+                pthread_mutex_lock (&srv->lock);
+                if (srv->nconns == S3SRV_CONNS_MAX) {
+                        pthread_mutex_unlock (&srv->lock);
+                        close (fd);
+                        free (conn);
+                        continue;
+                }
+                srv->conns[srv->nconns++] = fd;
+                srv->stats.connections++;
+                pthread_mutex_unlock (&srv->lock);
+
+                if (pthread_create (&tid, &attr, __s3srv_conn, conn)) {
+                        pthread_mutex_lock (&srv->lock);
+                        srv->conns[--srv->nconns] = -1;
+                        pthread_mutex_unlock (&srv->lock);
+                        close (fd);
+                        free (conn);
+                }
+        }
+
+        pthread_attr_destroy (&attr);
+        return NULL;
+}
+
+/*
+  SYNOPSIS
+
+  s3srv_start: start serving on 127.0.0.1
+
+  RETURN VALUES:
+  srv : Running server, s3srv_port() tells where
+  NULL : Failure, errno set appropriately
+*/
+
+s3srv_t *s3srv_start (const s3srv_opts_t *opts)
+{
+        s3srv_t            *srv = NULL;
+        struct sockaddr_in addr;
+        socklen_t          len  = sizeof(addr);
+        int                one  = 1;
+
+        srv = calloc (1, sizeof(*srv));
+        if (!srv) {
+                errno = -ENOMEM;
+                return NULL;
+        }
+
+        if (opts)
+                srv->opts = *opts;
+        pthread_mutex_init (&srv->lock, NULL);
+        pthread_cond_init (&srv->cond, NULL);
+
+        srv->fd = socket (AF_INET, SOCK_STREAM, 0);
+        if (srv->fd < 0)
+                goto err;
+        setsockopt (srv->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        memset (&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        addr.sin_port        = htons (srv->opts.port);
+        if ((bind (srv->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+            (listen (srv->fd, 128) < 0) ||
+            (getsockname (srv->fd, (struct sockaddr *) &addr, &len) < 0))
+                goto err;
+        srv->port = ntohs (addr.sin_port);
+
+        if (pthread_create (&srv->thread, NULL, __s3srv_accept, srv))
+                goto err;
+
+        return srv;
+err:
+        if (srv->fd >= 0)
+                close (srv->fd);
+        pthread_mutex_destroy (&srv->lock);
+        pthread_cond_destroy (&srv->cond);
+        free (srv);
+        return NULL;
+}
+
+void s3srv_stop (s3srv_t *srv)
+{
+        struct s3srv_obj    *obj = NULL;
+        struct s3srv_upload *up  = NULL;
+        int32_t             i    = 0;
+
+        if (!srv)
+                return;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->stopping = 1;
+        pthread_mutex_unlock (&srv->lock);
+        pthread_join (srv->thread, NULL);
+
+        /* Kick idle keep-alive connections and wait for them to go */
+        pthread_mutex_lock (&srv->lock);
+        for (i = 0; i < srv->nconns; i++)
+                shutdown (srv->conns[i], SHUT_RDWR);
+        while (srv->nconns)
+                pthread_cond_wait (&srv->cond, &srv->lock);
+        pthread_mutex_unlock (&srv->lock);
+
+        while (srv->objs) {
+                obj = srv->objs;
+                srv->objs = obj->next;
+                __obj_free (obj);
+        }
+        while (srv->uploads) {
+                up = srv->uploads;
+                srv->uploads = up->next;
+                __upload_free (up);
+        }
+
+        close (srv->fd);
+        pthread_mutex_destroy (&srv->lock);
+        pthread_cond_destroy (&srv->cond);
+        free (srv);
+}
+
+int32_t s3srv_port (s3srv_t *srv)
+{
+        return (srv) ? srv->port : -1;
+}
+
+void s3srv_configure (s3srv_t *srv, const s3srv_opts_t *opts)
+{
+        if ((!srv) || (!opts))
+                return;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->opts.latency_ms   = opts->latency_ms;
+        srv->opts.bandwidth    = opts->bandwidth;
+        srv->opts.error_pct    = opts->error_pct;
+        srv->opts.throttle_pct = opts->throttle_pct;
+        srv->opts.seed         = opts->seed;
+        pthread_mutex_unlock (&srv->lock);
+}
+
+void s3srv_inject (s3srv_t *srv, int32_t code, int32_t count)
+{
+        if (!srv)
+                return;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->inject_code  = code;
+        srv->inject_count = count;
+        pthread_mutex_unlock (&srv->lock);
+}
+
+void s3srv_inject_delay (s3srv_t *srv, int32_t ms, int32_t count)
+{
+        if (!srv)
+                return;
+
+        pthread_mutex_lock (&srv->lock);
+        srv->delay_ms    = ms;
+        srv->delay_count = count;
+        pthread_mutex_unlock (&srv->lock);
+}
+
+void s3srv_stats (s3srv_t *srv, s3srv_stats_t *stats)
+{
+        if ((!srv) || (!stats))
+                return;
+
+        pthread_mutex_lock (&srv->lock);
+        *stats = srv->stats;
+        pthread_mutex_unlock (&srv->lock);
+}
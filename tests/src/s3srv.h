@@ -0,0 +1,71 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef __S3SRV_H__
+#define __S3SRV_H__
+
+#include <stdint.h>
+
+/*
+  Embeddable S3 stand-in for tests and benchmarks.  Objects live in
+  memory, every bucket exists and requests are not authenticated.
+
+  Supported: GET (with Range), HEAD, PUT, DELETE, multipart uploads
+  (initiate, upload part, complete, abort) and ListObjectsV2.
+*/
+
+struct s3srv;
+typedef struct s3srv s3srv_t;
+
+struct s3srv_opts {
+        int32_t  port;          /* 0 picks a free port */
+        int32_t  latency_ms;    /* added before every response */
+        int64_t  bandwidth;     /* response bytes/sec per connection,
+                                   0 for no limit */
+        int32_t  error_pct;     /* % answered 500 InternalError */
+        int32_t  throttle_pct;  /* % answered 503 SlowDown */
+        uint32_t seed;          /* for error_pct and throttle_pct */
+};
+
+typedef struct s3srv_opts s3srv_opts_t;
+
+struct s3srv_stats {
+        uint64_t requests;
+        uint64_t injected;      /* requests failed on purpose */
+        uint64_t connections;   /* accepted */
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+};
+
+typedef struct s3srv_stats s3srv_stats_t;
+
+s3srv_t *s3srv_start (const s3srv_opts_t *opts);
+void s3srv_stop (s3srv_t *srv);
+int32_t s3srv_port (s3srv_t *srv);
+
+/* Change latency, bandwidth and failure rates of a running server */
+void s3srv_configure (s3srv_t *srv, const s3srv_opts_t *opts);
+
+/* Answer the next 'count' requests with HTTP 'code' (500, 503, ...) */
+void s3srv_inject (s3srv_t *srv, int32_t code, int32_t count);
+
+/* Hold the next 'count' requests back 'ms' more than the others */
+void s3srv_inject_delay (s3srv_t *srv, int32_t ms, int32_t count);
+
+void s3srv_stats (s3srv_t *srv, s3srv_stats_t *stats);
+
+#endif /* __S3SRV_H__ */
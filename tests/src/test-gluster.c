@@ -0,0 +1,723 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  Gluster driver tests against glfsmock, volumes are directories of a
+  temporary tree and no glusterd is needed
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+
+#include "bigobjects/driver.h"
+#include "gluster.h"
+#include "gluster-priv.h"
+#include "glfsmock.h"
+
+#define CHECK(expr)                                                     \
+        do {                                                            \
+                if (!(expr)) {                                          \
+                        fprintf (stderr, "%s:%d: check failed: %s\n",   \
+                                 __FILE__, __LINE__, #expr);            \
+                        exit (1);                                       \
+                }                                                       \
+        } while (0)
+
+#define MB              (1024 * 1024)
+#define CHUNK_SIZE      (2 * MB)
+#define LARGE_SIZE      (5 * MB + 777)
+#define PLACE_OBJECTS   2000
+#define LIST_OBJECTS    40
+
+static char root[] = "/tmp/test-gluster.XXXXXX";
+
+static
+char *__pattern (size_t len, uint32_t seed)
+{
+        char   *data = malloc (len);
+        size_t i     = 0;
+
+        CHECK (data != NULL);
+        for (i = 0; i < len; i++) {
+                seed = seed * 1103515245 + 12345;
+                data[i] = seed >> 16;
+        }
+
+        return data;
+}
+
+static
+int32_t __tmpfile (const char *data, size_t len)
+{
+        char    path[] = "/tmp/test-gluster-data.XXXXXX";
+        int32_t fd     = mkstemp (path);
+
+        CHECK (fd >= 0);
+        unlink (path);
+        CHECK (write (fd, data, len) == (ssize_t) len);
+        CHECK (lseek (fd, 0, SEEK_SET) == 0);
+
+        return fd;
+}
+
+/* What 'fd' holds is 'data' and nothing more */
+static
+void __check_fd (int32_t fd, const char *data, size_t len)
+{
+        char *back = malloc (len + 1);
+
+        CHECK (back != NULL);
+        CHECK (pread (fd, back, len + 1, 0) == (ssize_t) len);
+        CHECK (memcmp (back, data, len) == 0);
+        free (back);
+}
+
+static
+void __driver (driver_t *d, const char *bucket)
+{
+        memset (d, 0, sizeof(*d));
+        d->name   = (char *) "gluster";
+        d->server = (char *) "localhost";
+        d->bucket = (char *) bucket;
+        d->fd     = -1;
+        CHECK (bobjs_gluster_init (d) == 0);
+}
+
+static
+void __put (driver_t *d, const char *object, const char *data, size_t len)
+{
+        int32_t fd = __tmpfile (data, len);
+
+        d->object = (char *) object;
+        d->fd     = fd;
+        CHECK (bobjs_gluster_put (d) == 0);
+        close (fd);
+}
+
+/* Get 'object' into a new file and check it holds 'data' */
+static
+int32_t __get (driver_t *d, const char *object, const char *data,
+               size_t len)
+{
+        int32_t fd = __tmpfile (NULL, 0);
+
+        d->object = (char *) object;
+        d->fd     = fd;
+        CHECK (bobjs_gluster_get (d) == 0);
+        __check_fd (fd, data, len);
+
+        return fd;
+}
+
+/* Path of 'object' of volume 'vol' on the local file system */
+static
+void __path (char *path, size_t size, const char *vol, const char *object)
+{
+        snprintf (path, size, "%s/%s/%s", root, vol, object);
+}
+
+static
+void test_server (void)
+{
+        char    host[16];
+        int32_t port = 0;
+
+        port = 24007;
+        CHECK (bobjs_glfs_server ("alpha,beta:24008,gamma", 0, host,
+                                  sizeof(host), &port) == 0);
+        CHECK ((!strcmp (host, "alpha")) && (port == 24007));
+        CHECK (bobjs_glfs_server ("alpha,beta:24008,gamma", 1, host,
+                                  sizeof(host), &port) == 0);
+        CHECK ((!strcmp (host, "beta")) && (port == 24008));
+        port = 0;
+        CHECK (bobjs_glfs_server ("alpha,beta:24008,gamma", 2, host,
+                                  sizeof(host), &port) == 0);
+        CHECK ((!strcmp (host, "gamma")) && (port == 0));
+
+        /* Past the end, empty entries, hosts too long for 'host' */
+        CHECK (bobjs_glfs_server ("alpha,beta", 2, host, sizeof(host),
+                                  &port) < 0);
+        CHECK (bobjs_glfs_server ("alpha,,gamma", 1, host, sizeof(host),
+                                  &port) < 0);
+        CHECK (bobjs_glfs_server (":24007", 0, host, sizeof(host),
+                                  &port) < 0);
+        CHECK (bobjs_glfs_server ("a-host-name-longer-than-16", 0, host,
+                                  sizeof(host), &port) < 0);
+}
+
+/* A first server down or hanging holds nobody up, the next is used */
+static
+void test_failover (void)
+{
+        driver_t d;
+        time_t   start;
+
+        memset (&d, 0, sizeof(d));
+        d.server = (char *) "down,localhost";
+        d.bucket = (char *) "failover";
+        CHECK (bobjs_gluster_init (&d) == 0);
+        bobjs_gluster_fini (&d);
+
+        start = time (NULL);
+        d.server = (char *) "hang,localhost";
+        d.bucket = (char *) "failover-hang";
+        CHECK (bobjs_gluster_init (&d) == 0);
+        CHECK (time (NULL) - start < GLFSMOCK_HANG);
+        bobjs_gluster_fini (&d);
+
+        d.server = (char *) "down,down";
+        d.bucket = (char *) "failover";
+        CHECK (bobjs_gluster_init (&d) < 0);
+        CHECK (errno == -ENOTCONN);
+}
+
+static
+void test_zero (void)
+{
+        static const size_t lens[] = { 0, 1, 63, 64, 65, 127, 128, 4096,
+                                       4096 + 17 };
+        char   *buf = bobjs_gluster_buf (8192);
+        size_t i    = 0;
+        size_t j    = 0;
+
+        CHECK (buf != NULL);
+        for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+                memset (buf, 0, 8192);
+                CHECK (bobjs_gluster_zero (buf, lens[i]) == 1);
+
+                /* One byte set anywhere, past 'len' does not count */
+                for (j = 0; j < lens[i]; j++) {
+                        buf[j] = 1;
+                        CHECK (bobjs_gluster_zero (buf, lens[i]) == 0);
+                        buf[j] = 0;
+                }
+                buf[lens[i]] = 1;
+                CHECK (bobjs_gluster_zero (buf, lens[i]) == 1);
+        }
+        free (buf);
+}
+
+/* Volume of every test object over the first 'nvols' of 'names' */
+static
+void __place (const char **names, int32_t nvols, int32_t *where)
+{
+        bobjs_gluster_t priv;
+        bobjs_glfs_t    vols[BOBJS_GLUSTER_VOLUMES_MAX];
+        char            object[64];
+        int32_t         i = 0;
+        int32_t         v = 0;
+
+        memset (&priv, 0, sizeof(priv));
+        memset (vols, 0, sizeof(vols));
+        for (v = 0; v < nvols; v++) {
+                vols[v].volume = (char *) names[v];
+                priv.vols[v]   = &vols[v];
+        }
+        priv.nvols = nvols;
+
+        for (i = 0; i < PLACE_OBJECTS; i++) {
+                snprintf (object, sizeof(object), "dir/object-%d", i);
+                bobjs_gluster_place (&priv, object);
+                for (v = 0; priv.vol != priv.vols[v]; v++)
+                        ;
+                where[i] = v;
+        }
+}
+
+static
+void test_place (void)
+{
+        static const char *names[] = { "vol-a", "vol-b", "vol-c", "vol-d",
+                                       "vol-e" };
+        static const char *reorder[] = { "vol-d", "vol-c", "vol-b",
+                                         "vol-a" };
+        int32_t            four[PLACE_OBJECTS];
+        int32_t            again[PLACE_OBJECTS];
+        int32_t            five[PLACE_OBJECTS];
+        int32_t            count[5];
+        int32_t            i = 0;
+
+        __place (names, 1, four);
+        for (i = 0; i < PLACE_OBJECTS; i++)
+                CHECK (four[i] == 0);
+
+        /* Stable, and spread over every volume */
+        __place (names, 4, four);
+        __place (names, 4, again);
+        CHECK (memcmp (four, again, sizeof(four)) == 0);
+        memset (count, 0, sizeof(count));
+        for (i = 0; i < PLACE_OBJECTS; i++)
+                count[four[i]]++;
+        for (i = 0; i < 4; i++)
+                CHECK (count[i] > PLACE_OBJECTS / 4 / 2);
+
+        /* The order volumes are named in does not matter */
+        __place (reorder, 4, again);
+        for (i = 0; i < PLACE_OBJECTS; i++)
+                CHECK (!strcmp (reorder[again[i]], names[four[i]]));
+
+        /* A volume added only takes objects, it moves none elsewhere */
+        __place (names, 5, five);
+        memset (count, 0, sizeof(count));
+        for (i = 0; i < PLACE_OBJECTS; i++) {
+                CHECK ((five[i] == four[i]) || (five[i] == 4));
+                count[five[i]]++;
+        }
+        CHECK (count[4] > PLACE_OBJECTS / 5 / 2);
+}
+
+/* Large objects through the pipeline, chunks over the threads */
+static
+void test_put_get (driver_t *d)
+{
+        glfsmock_stats_t stats;
+        char             *data = __pattern (LARGE_SIZE, 1);
+        char             real[4096];
+        struct stat      st;
+        int32_t          fd    = -1;
+        int32_t          p[2];
+        pid_t            pid   = 0;
+        int32_t          status = 0;
+
+        __put (d, "large/object", data, LARGE_SIZE);
+
+        /* Three chunks, a manifest and nothing left next to them */
+        __path (real, sizeof(real), "vol0", "large/object/0000000002");
+        CHECK ((stat (real, &st) == 0) &&
+               (st.st_size == LARGE_SIZE - 2 * CHUNK_SIZE));
+        __path (real, sizeof(real), "vol0", "large/object/0000000003");
+        CHECK (stat (real, &st) < 0);
+
+        fd = __get (d, "large/object", data, LARGE_SIZE);
+        close (fd);
+
+        /* Completions came out of order, some transfers short */
+        glfsmock_stats (&stats);
+        CHECK (stats.async > 0);
+        CHECK (stats.reordered > 0);
+        CHECK (stats.shorts > 0);
+
+        /* Streams in and out, chunks one after the other */
+        CHECK (pipe (p) == 0);
+        pid = fork ();
+        CHECK (pid >= 0);
+        if (pid == 0) {
+                close (p[0]);
+                _exit (write (p[1], data, LARGE_SIZE) != LARGE_SIZE);
+        }
+        close (p[1]);
+        d->object = (char *) "large/stream";
+        d->fd     = p[0];
+        CHECK (bobjs_gluster_put (d) == 0);
+        close (p[0]);
+        CHECK ((waitpid (pid, &status, 0) == pid) && (status == 0));
+
+        CHECK (pipe (p) == 0);
+        pid = fork ();
+        CHECK (pid >= 0);
+        if (pid == 0) {
+                char    *back = malloc (LARGE_SIZE + 1);
+                ssize_t got   = 0;
+                ssize_t n     = 0;
+
+                close (p[1]);
+                while ((back) &&
+                       ((n = read (p[0], back + got,
+                                   LARGE_SIZE + 1 - got)) > 0))
+                        got += n;
+                _exit ((!back) || (got != LARGE_SIZE) ||
+                       (memcmp (back, data, LARGE_SIZE)));
+        }
+        close (p[0]);
+        d->fd = p[1];
+        CHECK (bobjs_gluster_get (d) == 0);
+        close (p[1]);
+        CHECK ((waitpid (pid, &status, 0) == pid) && (status == 0));
+
+        d->object = (char *) "large/stream";
+        CHECK (bobjs_gluster_delete (d) == 0);
+        d->object = (char *) "large/object";
+        CHECK (bobjs_gluster_delete (d) == 0);
+        CHECK (bobjs_gluster_get (d) < 0);
+        CHECK (errno == -ENOENT);
+        free (data);
+}
+
+/* Zero blocks come back as holes, a zero tail too */
+static
+void test_holes (driver_t *d)
+{
+        char        *data = __pattern (LARGE_SIZE, 2);
+        char        *old  = NULL;
+        struct stat st;
+        size_t      i     = 0;
+        int32_t     fd    = -1;
+
+        /* Every other MB zero, then the last 1.5 MB */
+        for (i = 0; i < LARGE_SIZE; i++) {
+                if (((i / MB) % 2 == 0) || (i >= LARGE_SIZE - 3 * MB / 2))
+                        data[i] = 0;
+        }
+
+        __put (d, "holes", data, LARGE_SIZE);
+        fd = __get (d, "holes", data, LARGE_SIZE);
+        CHECK (fstat (fd, &st) == 0);
+        CHECK (st.st_size == LARGE_SIZE);
+        CHECK ((int64_t) st.st_blocks * 512 < LARGE_SIZE / 2);
+        close (fd);
+
+        /* Over data already in the file, holes cannot be left there */
+        old = __pattern (LARGE_SIZE, 9);
+        fd  = __tmpfile (old, LARGE_SIZE);
+        free (old);
+        d->fd = fd;
+        CHECK (bobjs_gluster_get (d) == 0);
+        __check_fd (fd, data, LARGE_SIZE);
+        close (fd);
+
+        /* All of it zeros */
+        memset (data, 0, LARGE_SIZE);
+        __put (d, "holes", data, LARGE_SIZE);
+        fd = __get (d, "holes", data, LARGE_SIZE);
+        CHECK (fstat (fd, &st) == 0);
+        CHECK (st.st_size == LARGE_SIZE);
+        close (fd);
+
+        CHECK (bobjs_gluster_delete (d) == 0);
+        free (data);
+}
+
+/* The manifest in an xattr, in a file where the volume takes none */
+static
+void test_manifest (driver_t *d)
+{
+        glfsmock_opts_t opts;
+        char            *data = __pattern (100000, 3);
+        char            real[4096];
+        char            value[256];
+        char            big[BOBJS_GLUSTER_MANIFEST_MAX + 1];
+        char            dir[4096];
+        struct stat     st;
+        ssize_t         len   = 0;
+        int32_t         fd    = -1;
+
+        __put (d, "manifest", data, 100000);
+        __path (dir, sizeof(dir), "vol0", "manifest");
+        len = getxattr (dir, BOBJS_GLUSTER_XATTR, value, sizeof(value));
+        if (len > 0) {
+                __path (real, sizeof(real), "vol0", "manifest/"
+                        BOBJS_GLUSTER_MANIFEST);
+                CHECK (stat (real, &st) < 0);
+
+                /* An xattr too large to be a manifest is an error, a
+                   stray manifest file does not stand in for it */
+                fd = open (real, O_WRONLY | O_CREAT, 0644);
+                CHECK ((fd >= 0) && (write (fd, value, len) == len));
+                close (fd);
+                memset (big, 'x', sizeof(big));
+                CHECK (setxattr (dir, BOBJS_GLUSTER_XATTR, big,
+                                 sizeof(big), 0) == 0);
+                d->fd = fd = __tmpfile (NULL, 0);
+                CHECK (bobjs_gluster_get (d) < 0);
+                CHECK (errno == -ERANGE);
+                close (fd);
+                CHECK (unlink (real) == 0);
+                CHECK (setxattr (dir, BOBJS_GLUSTER_XATTR, value, len,
+                                 0) == 0);
+        } else {
+                fprintf (stderr, "no user xattrs under %s, manifest "
+                         "files only\n", root);
+        }
+
+        memset (&opts, 0, sizeof(opts));
+        opts.noxattr = 1;
+        glfsmock_configure (&opts);
+        __put (d, "manifest", data + 1, 99999);
+        __path (real, sizeof(real), "vol0", "manifest");
+        CHECK (getxattr (real, BOBJS_GLUSTER_XATTR, value,
+                         sizeof(value)) < 0);
+        __path (real, sizeof(real), "vol0", "manifest/"
+                BOBJS_GLUSTER_MANIFEST);
+        CHECK (stat (real, &st) == 0);
+        fd = __get (d, "manifest", data + 1, 99999);
+        close (fd);
+
+        /* Without a manifest the object was never completed */
+        CHECK (unlink (real) == 0);
+        d->fd = fd = __tmpfile (NULL, 0);
+        CHECK (bobjs_gluster_get (d) < 0);
+        close (fd);
+
+        memset (&opts, 0, sizeof(opts));
+        glfsmock_configure (&opts);
+        CHECK (bobjs_gluster_delete (d) == 0);
+        free (data);
+}
+
+/* A chunk truncated while being read fails the get, not cut it short */
+static
+void test_truncated (driver_t *d)
+{
+        glfsmock_opts_t opts;
+        char            *data = __pattern (LARGE_SIZE, 6);
+        int32_t         fd    = -1;
+
+        __put (d, "truncated/object", data, LARGE_SIZE);
+
+        memset (&opts, 0, sizeof(opts));
+        opts.truncate_at = MB / 2;
+        glfsmock_configure (&opts);
+        d->fd = fd = __tmpfile (NULL, 0);
+        CHECK (bobjs_gluster_get (d) < 0);
+        CHECK (errno == -EIO);
+        close (fd);
+
+        memset (&opts, 0, sizeof(opts));
+        glfsmock_configure (&opts);
+        CHECK (bobjs_gluster_delete (d) == 0);
+        free (data);
+}
+
+/* Killed between the two renames of a replace, the object is not lost */
+static
+void test_recover (driver_t *d)
+{
+        char *data = __pattern (100000, 4);
+        char from[4096];
+        char to[4096];
+        int  fd    = -1;
+
+        __put (d, "recover/object", data, 100000);
+        __path (from, sizeof(from), "vol0", "recover/object");
+        CHECK (snprintf (to, sizeof(to), "%s.12345.7f00aa.3.bobjs-old",
+                         from) < (int) sizeof(to));
+
+        CHECK (rename (from, to) == 0);
+        fd = __get (d, "recover/object", data, 100000);
+        close (fd);
+
+        CHECK (rename (from, to) == 0);
+        __put (d, "recover/object", data + 1, 99999);
+        CHECK (access (to, F_OK) < 0);
+        fd = __get (d, "recover/object", data + 1, 99999);
+        close (fd);
+
+        CHECK (bobjs_gluster_delete (d) == 0);
+        free (data);
+}
+
+/* Within a volume, to another one, from a plain file */
+static
+void test_copy (driver_t *d)
+{
+        glfsmock_stats_t before;
+        glfsmock_stats_t after;
+        driver_t         dst;
+        char             *data = __pattern (LARGE_SIZE, 5);
+        char             real[4096];
+        int32_t          fd    = -1;
+        FILE             *f    = NULL;
+
+        __put (d, "copy/from", data, LARGE_SIZE);
+
+        /* The bricks copy within a volume where gfapi can */
+        glfsmock_stats (&before);
+        memset (&dst, 0, sizeof(dst));
+        dst.bucket = (char *) "vol0";
+        dst.object = (char *) "copy/to";
+        d->object  = (char *) "copy/from";
+        CHECK (bobjs_gluster_copy (d, &dst) == 0);
+        fd = __get (d, "copy/to", data, LARGE_SIZE);
+        close (fd);
+        glfsmock_stats (&after);
+#ifdef HAVE_GLFS_COPY_FILE_RANGE
+        CHECK (after.ranged - before.ranged == LARGE_SIZE);
+#else
+        CHECK (after.ranged == before.ranged);
+#endif
+
+        dst.server = (char *) "localhost";
+        dst.bucket = (char *) "vol1";
+        d->object  = (char *) "copy/from";
+        CHECK (bobjs_gluster_copy (d, &dst) == 0);
+        __driver (&dst, "vol1");
+        fd = __get (&dst, "copy/to", data, LARGE_SIZE);
+        close (fd);
+        glfsmock_stats (&before);
+        CHECK (before.ranged == after.ranged);
+        CHECK (bobjs_gluster_delete (&dst) == 0);
+        bobjs_gluster_fini (&dst);
+
+        __path (real, sizeof(real), "vol0", "copy/plain");
+        f = fopen (real, "w");
+        CHECK ((f != NULL) && (fwrite (data, 1, LARGE_SIZE, f) ==
+                               LARGE_SIZE));
+        fclose (f);
+        memset (&dst, 0, sizeof(dst));
+        dst.bucket = (char *) "vol0";
+        dst.object = (char *) "copy/to";
+        d->object  = (char *) "copy/plain";
+        CHECK (bobjs_gluster_copy (d, &dst) == 0);
+        fd = __get (d, "copy/to", data, LARGE_SIZE);
+        close (fd);
+
+        CHECK (bobjs_gluster_delete (d) == 0);
+        d->object = (char *) "copy/from";
+        CHECK (bobjs_gluster_delete (d) == 0);
+        d->object = (char *) "copy/plain";
+        CHECK (bobjs_gluster_delete (d) == 0);
+        free (data);
+}
+
+struct list_seen {
+        int32_t calls;
+        int32_t stop;           /* non-zero after this many calls */
+        char    found[LIST_OBJECTS];
+};
+
+static
+int32_t __list_cb (const bobjs_gluster_entry_t *entry, void *opaque)
+{
+        struct list_seen *seen = opaque;
+        int32_t          i     = 0;
+
+        seen->calls++;
+        if (sscanf (entry->object, "list/%*[a-z]/object-%d", &i) == 1) {
+                CHECK ((i >= 0) && (i < LIST_OBJECTS));
+                CHECK (entry->size == 1000 + i);
+                seen->found[i]++;
+        }
+
+        return ((seen->stop) && (seen->calls >= seen->stop));
+}
+
+static
+void test_list (driver_t *d)
+{
+        static const char *dirs[] = { "aa", "bb", "cc", "dd" };
+        glfsmock_opts_t   opts;
+        struct list_seen  seen;
+        char              *data = __pattern (1000 + LIST_OBJECTS, 6);
+        char              name[64];
+        int32_t           i     = 0;
+
+        for (i = 0; i < LIST_OBJECTS; i++) {
+                snprintf (name, sizeof(name), "list/%s/object-%d",
+                          dirs[i % 4], i);
+                __put (d, name, data, 1000 + i);
+        }
+
+        memset (&seen, 0, sizeof(seen));
+        CHECK (bobjs_gluster_list (d, "list", __list_cb, &seen) == 0);
+        CHECK (seen.calls == LIST_OBJECTS);
+        for (i = 0; i < LIST_OBJECTS; i++)
+                CHECK (seen.found[i] == 1);
+
+        /* A callback asking to stop ends the walk */
+        memset (&seen, 0, sizeof(seen));
+        seen.stop = 3;
+        CHECK (bobjs_gluster_list (d, "list", __list_cb, &seen) < 0);
+        CHECK (errno == -ECANCELED);
+        CHECK (seen.calls >= 3);
+
+        /* So does a directory that cannot be read, with its error */
+        memset (&opts, 0, sizeof(opts));
+        opts.fail = "list/cc";
+        glfsmock_configure (&opts);
+        memset (&seen, 0, sizeof(seen));
+        CHECK (bobjs_gluster_list (d, "list", __list_cb, &seen) < 0);
+        CHECK (errno == -EIO);
+        memset (&opts, 0, sizeof(opts));
+        glfsmock_configure (&opts);
+
+        for (i = 0; i < LIST_OBJECTS; i++) {
+                snprintf (name, sizeof(name), "list/%s/object-%d",
+                          dirs[i % 4], i);
+                d->object = name;
+                CHECK (bobjs_gluster_delete (d) == 0);
+        }
+        free (data);
+}
+
+static
+int __rmtree_cb (const char *path, const struct stat *st, int flag,
+                 struct FTW *ftw)
+{
+        (void) st;
+        (void) flag;
+        (void) ftw;
+
+        return remove (path);
+}
+
+int main (void)
+{
+        glfsmock_opts_t opts;
+        driver_t        d;
+        char            value[32];
+
+        /* A walker or pipeline that never ends fails rather than hangs */
+        alarm (300);
+
+        CHECK (mkdtemp (root) != NULL);
+        glfsmock_init (root);
+
+        snprintf (value, sizeof(value), "%d", CHUNK_SIZE);
+        setenv ("GLUSTER_CHUNK_SIZE", value, 1);
+        setenv ("GLUSTER_IO_DEPTH", "8", 1);
+        setenv ("GLUSTER_THREADS", "4", 1);
+
+        test_server ();
+        test_zero ();
+        test_place ();
+        test_failover ();
+
+        memset (&opts, 0, sizeof(opts));
+        opts.short_pct = 20;
+        opts.delay_us  = 200;
+        opts.seed      = 7;
+        glfsmock_configure (&opts);
+
+        __driver (&d, "vol0");
+        test_put_get (&d);
+
+        memset (&opts, 0, sizeof(opts));
+        glfsmock_configure (&opts);
+
+        test_holes (&d);
+        test_manifest (&d);
+        test_truncated (&d);
+        test_recover (&d);
+        test_copy (&d);
+        test_list (&d);
+        bobjs_gluster_fini (&d);
+
+        nftw (root, __rmtree_cb, 16, FTW_DEPTH | FTW_PHYS);
+
+        return 0;
+}
@@ -0,0 +1,799 @@
+/*
+  Author: Harshavardhana <fharshav@redhat.com>
+  Copyright (c) 2013 Red Hat, Inc. <http://www.redhat.com>
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/*
+  S3 driver tests against the in-process s3srv, no network or
+  credentials needed
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bigobjects/api.h"
+#include "s3.h"
+#include "s3srv.h"
+
+#define CHECK(expr)                                                     \
+        do {                                                            \
+                if (!(expr)) {                                          \
+                        fprintf (stderr, "%s:%d: check failed: %s\n",   \
+                                 __FILE__, __LINE__, #expr);            \
+                        exit (1);                                       \
+                }                                                       \
+        } while (0)
+
+#define SMALL_SIZE      (256 * 1024)
+#define LARGE_SIZE      (12 * 1024 * 1024 + 12345)
+#define LIST_KEYS       2500
+#define LIST_DIRS       7
+#define MUX_THREADS     32
+#define MUX_REQUESTS    4
+
+static
+char *__pattern (size_t len, uint32_t seed)
+{
+        char   *data = malloc (len);
+        size_t i     = 0;
+
+        CHECK (data != NULL);
+        for (i = 0; i < len; i++) {
+                seed = seed * 1103515245 + 12345;
+                data[i] = seed >> 16;
+        }
+
+        return data;
+}
+
+static
+int32_t __tmpfile (const char *data, size_t len)
+{
+        char    path[] = "/tmp/test-s3.XXXXXX";
+        int32_t fd     = mkstemp (path);
+
+        CHECK (fd >= 0);
+        unlink (path);
+        CHECK (write (fd, data, len) == (ssize_t) len);
+
+        return fd;
+}
+
+static
+void test_put_get (s3_conf_t *s3conf)
+{
+        s3_source_t src;
+        s3_sink_t   sink;
+        s3_resp_t   resp;
+        char        *data = __pattern (SMALL_SIZE, 1);
+        char        *back = calloc (1, SMALL_SIZE);
+
+        CHECK (back != NULL);
+        CHECK (s3_source_init_buffer (&src, data, SMALL_SIZE) == 0);
+        CHECK (s3_put_source (&src, s3conf, "small", &resp) == 0);
+        CHECK (resp.code == 200);
+        CHECK (resp.etag[0] == '"');
+        CHECK (resp.request_id[0] != '\0');
+
+        CHECK (s3_sink_init_buffer (&sink, back, SMALL_SIZE) == 0);
+        CHECK (s3_get_sink (&sink, s3conf, "small", &resp) == 0);
+        CHECK (resp.content_length == SMALL_SIZE);
+        CHECK (!memcmp (data, back, SMALL_SIZE));
+
+        free (data);
+        free (back);
+}
+
+static
+void test_multipart (s3_conf_t *s3conf)
+{
+        s3_resp_t resp;
+        char      *data = __pattern (LARGE_SIZE, 2);
+        char      *back = calloc (1, LARGE_SIZE);
+        int32_t   fd    = __tmpfile (data, LARGE_SIZE);
+        int32_t   out   = __tmpfile ("", 0);
+
+        CHECK (back != NULL);
+        CHECK (s3_set_part_size (s3conf, 5 * 1024 * 1024) == 0);
+        CHECK (s3_put_fd (fd, 0, -1, s3conf, "large", &resp) == 0);
+        /* Three parts, the ETag carries the part count */
+        CHECK (strstr (resp.etag, "-3") != NULL);
+
+        CHECK (s3_get_fd (out, 0, s3conf, "large", &resp) == 0);
+        CHECK (pread (out, back, LARGE_SIZE, 0) == LARGE_SIZE);
+        CHECK (!memcmp (data, back, LARGE_SIZE));
+
+        CHECK (s3_head (s3conf, "large", &resp) == 0);
+        CHECK (resp.code == 200);
+        CHECK (resp.content_length == LARGE_SIZE);
+        CHECK (resp.mtime != 0);
+
+        close (fd);
+        close (out);
+        free (data);
+        free (back);
+}
+
+static
+void test_delete (s3_conf_t *s3conf)
+{
+        iobuf_t   *buf = s3_iobuf_new ();
+        s3_resp_t resp;
+
+        CHECK (buf != NULL);
+        CHECK (s3_delete (buf, s3conf, "small") == 0);
+        s3_iobuf_free (buf);
+
+        errno = 0;
+        CHECK (s3_head (s3conf, "small", &resp) < 0);
+        CHECK (errno == -ENOENT);
+        CHECK (resp.code == 404);
+}
+
+static
+void test_retries (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3srv_stats_t before;
+        s3srv_stats_t after;
+        s3_resp_t     resp;
+        s3_sink_t     sink;
+        char          small[1024];
+
+        s3srv_stats (srv, &before);
+        s3srv_inject (srv, 503, 2);
+        CHECK (s3_head (s3conf, "large", &resp) == 0);
+        s3srv_stats (srv, &after);
+        CHECK (after.injected - before.injected == 2);
+
+        /* More failures than retries surface the last one */
+        CHECK (s3_set_retries (s3conf, 1) == 0);
+        s3srv_inject (srv, 500, 2);
+        errno = 0;
+        CHECK (s3_head (s3conf, "large", &resp) < 0);
+        CHECK (resp.code == 500);
+        CHECK (s3_set_retries (s3conf, 3) == 0);
+
+        /* A sink that fails ends the request with its own error */
+        CHECK (s3_sink_init_buffer (&sink, small, sizeof(small)) == 0);
+        errno = 0;
+        CHECK (s3_get_sink (&sink, s3conf, "large", &resp) < 0);
+        CHECK (errno == -ENOBUFS);
+}
+
+/* 'object' of 's3conf' holds 'data' */
+static
+void __check_object (s3_conf_t *s3conf, const char *object,
+                     const char *data, size_t len)
+{
+        s3_sink_t sink;
+        s3_resp_t resp;
+        char      *back = calloc (1, len);
+
+        CHECK (back != NULL);
+        CHECK (s3_sink_init_buffer (&sink, back, len) == 0);
+        CHECK (s3_get_sink (&sink, s3conf, object, &resp) == 0);
+        CHECK (sink.pos == (off_t) len);
+        CHECK (!memcmp (data, back, len));
+        free (back);
+}
+
+static
+void __check_gone (s3_conf_t *s3conf, const char *object)
+{
+        s3_resp_t resp;
+
+        errno = 0;
+        CHECK (s3_head (s3conf, object, &resp) < 0);
+        CHECK (errno == -ENOENT);
+}
+
+/* bigobject_copy() and bigobject_rename() through the s3 driver */
+static
+void test_api_copy (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3srv_opts_t  opts;
+        s3srv_stats_t before;
+        s3srv_stats_t after;
+        s3srv_t       *other    = NULL;
+        s3_conf_t     *s3other  = NULL;
+        s3_source_t   src;
+        char          host[64];
+        char          here[64];
+        char          there[64];
+        char          from[128];
+        char          to[128];
+        char          *data     = __pattern (SMALL_SIZE, 5);
+
+        if (!getenv ("BIGOBJECTS_DRIVERDIR")) {
+                fprintf (stderr, "BIGOBJECTS_DRIVERDIR not set, "
+                         "skipping bigobject_copy tests\n");
+                free (data);
+                return;
+        }
+        setenv ("AWS_ACCESS_KEY_ID", "AKIDTEST", 1);
+        setenv ("AWS_SECRET_ACCESS_KEY", "secret", 1);
+
+        memset (&opts, 0, sizeof(opts));
+        other = s3srv_start (&opts);
+        CHECK (other != NULL);
+        snprintf (host, sizeof(host), "127.0.0.1:%d", s3srv_port (other));
+        s3other = s3_init ("test", "AKIDTEST", "secret", host, "bucket");
+        CHECK (s3other != NULL);
+
+        snprintf (here, sizeof(here), "s3://127.0.0.1:%d/bucket",
+                  s3srv_port (srv));
+        snprintf (there, sizeof(there), "s3://127.0.0.1:%d/bucket",
+                  s3srv_port (other));
+
+        CHECK (s3_source_init_buffer (&src, data, SMALL_SIZE) == 0);
+        CHECK (s3_put_source (&src, s3conf, "api/src", NULL) == 0);
+
+        /* Same server, copied by it and not through us */
+        snprintf (from, sizeof(from), "%s/api/src", here);
+        snprintf (to, sizeof(to), "%s/api/copy", here);
+        s3srv_stats (srv, &before);
+        CHECK (bigobject_copy (from, to) == 0);
+        s3srv_stats (srv, &after);
+        CHECK (after.bytes_out - before.bytes_out < SMALL_SIZE);
+        __check_object (s3conf, "api/copy", data, SMALL_SIZE);
+
+        /* Another server, through a temporary file under $TMPDIR */
+        snprintf (to, sizeof(to), "%s/api/copy", there);
+        setenv ("TMPDIR", "/nonexistent", 1);
+        errno = 0;
+        CHECK (bigobject_copy (from, to) < 0);
+        CHECK (errno == -ENOENT);
+        unsetenv ("TMPDIR");
+        CHECK (bigobject_copy (from, to) == 0);
+        __check_object (s3other, "api/copy", data, SMALL_SIZE);
+        __check_object (s3conf, "api/src", data, SMALL_SIZE);
+
+        /* Renames both ways, the source goes once the copy is there */
+        snprintf (from, sizeof(from), "%s/api/copy", here);
+        snprintf (to, sizeof(to), "%s/api/moved", there);
+        CHECK (bigobject_rename (from, to) == 0);
+        __check_object (s3other, "api/moved", data, SMALL_SIZE);
+        __check_gone (s3conf, "api/copy");
+
+        snprintf (from, sizeof(from), "%s/api/src", here);
+        snprintf (to, sizeof(to), "%s/api/renamed", here);
+        CHECK (bigobject_rename (from, to) == 0);
+        __check_object (s3conf, "api/renamed", data, SMALL_SIZE);
+        __check_gone (s3conf, "api/src");
+
+        /* Nothing to copy, on either path */
+        errno = 0;
+        CHECK (bigobject_copy (from, to) < 0);
+        CHECK (errno == -ENOENT);
+        snprintf (to, sizeof(to), "%s/api/none", there);
+        errno = 0;
+        CHECK (bigobject_rename (from, to) < 0);
+        CHECK (errno == -ENOENT);
+        __check_gone (s3other, "api/none");
+
+        s3_fini (s3other);
+        s3srv_stop (other);
+        free (data);
+}
+
+static
+double __elapsed (const struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return ((now.tv_sec - start->tv_sec) +
+                (now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static
+void __get_hedged (s3_conf_t *s3conf, const char *data, char *back,
+                   double *secs)
+{
+        struct timespec start;
+        s3_sink_t       sink;
+        s3_resp_t       resp;
+
+        memset (back, 0, SMALL_SIZE);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        CHECK (s3_sink_init_buffer (&sink, back, SMALL_SIZE) == 0);
+        CHECK (s3_get_sink (&sink, s3conf, "hedge", &resp) == 0);
+        *secs = __elapsed (&start);
+
+        /* Whichever copy won, only it wrote to the sink */
+        CHECK (resp.code == 200);
+        CHECK (sink.pos == SMALL_SIZE);
+        CHECK (!memcmp (data, back, SMALL_SIZE));
+}
+
+static
+void test_hedging (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3_source_t src;
+        char        *data = __pattern (SMALL_SIZE, 4);
+        char        *back = malloc (SMALL_SIZE);
+        double      secs  = 0;
+        int32_t     i     = 0;
+
+        CHECK (back != NULL);
+        CHECK (s3_source_init_buffer (&src, data, SMALL_SIZE) == 0);
+        CHECK (s3_put_source (&src, s3conf, "hedge", NULL) == 0);
+
+        /* Enough fast GETs for a hedging delay of a few msecs */
+        CHECK (s3_set_hedging (s3conf, 95) == 0);
+        for (i = 0; i < 40; i++)
+                __get_hedged (s3conf, data, back, &secs);
+
+        /* A stuck first copy, the hedge answers for it */
+        s3srv_inject_delay (srv, 2000, 1);
+        __get_hedged (s3conf, data, back, &secs);
+        CHECK (secs < 1);
+
+        /* Both slow, the first copy is still first and the hedge is
+           dropped */
+        s3srv_inject_delay (srv, 300, 2);
+        __get_hedged (s3conf, data, back, &secs);
+        CHECK ((secs >= 0.29) && (secs < 1));
+
+        CHECK (s3_set_hedging (s3conf, 0) == 0);
+        free (data);
+        free (back);
+}
+
+static
+void test_conditional (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3srv_stats_t before;
+        s3srv_stats_t after;
+        s3_source_t   src;
+        s3_sink_t     sink;
+        s3_resp_t     resp;
+        s3_cond_t     cond;
+        char          etag[S3_ETAG_MAX];
+        char          back[4];
+        int32_t       fd    = -1;
+        char          *data = NULL;
+
+        /* Create only */
+        memset (&cond, 0, sizeof(cond));
+        cond.if_none_match = "*";
+        CHECK (s3_source_init_buffer (&src, "one", 3) == 0);
+        CHECK (s3_put_source_if (&src, s3conf, "cond", &cond, &resp) == 0);
+        snprintf (etag, sizeof(etag), "%s", resp.etag);
+        CHECK (s3_source_init_buffer (&src, "two", 3) == 0);
+        errno = 0;
+        CHECK (s3_put_source_if (&src, s3conf, "cond", &cond, &resp) < 0);
+        CHECK (errno == -ESTALE);
+        CHECK (resp.code == 412);
+
+        /* Revalidation is a header exchange */
+        memset (&cond, 0, sizeof(cond));
+        cond.if_none_match = etag;
+        s3srv_stats (srv, &before);
+        CHECK (s3_sink_init_buffer (&sink, back, sizeof(back)) == 0);
+        CHECK (s3_get_sink_if (&sink, s3conf, "cond", &cond, &resp) == 1);
+        s3srv_stats (srv, &after);
+        CHECK (resp.code == 304);
+        CHECK (sink.pos == 0);
+        CHECK (after.bytes_out == before.bytes_out);
+        CHECK (s3_head_if (s3conf, "cond", &cond, &resp) == 1);
+        CHECK (s3_etag_match (resp.etag, etag));
+
+        memset (&cond, 0, sizeof(cond));
+        cond.if_modified_since = resp.mtime;
+        CHECK (s3_head_if (s3conf, "cond", &cond, &resp) == 1);
+        cond.if_modified_since = resp.mtime - 10;
+        CHECK (s3_sink_init_buffer (&sink, back, sizeof(back)) == 0);
+        CHECK (s3_get_sink_if (&sink, s3conf, "cond", &cond, &resp) == 0);
+        CHECK ((sink.pos == 3) && (!memcmp (back, "one", 3)));
+
+        memset (&cond, 0, sizeof(cond));
+        cond.if_match = "\"00000000000000000000000000000000\"";
+        CHECK (s3_sink_init_buffer (&sink, back, sizeof(back)) == 0);
+        errno = 0;
+        CHECK (s3_get_sink_if (&sink, s3conf, "cond", &cond, &resp) < 0);
+        CHECK (errno == -ESTALE);
+
+        /* Replace only what was read */
+        CHECK (s3_source_init_buffer (&src, "two", 3) == 0);
+        errno = 0;
+        CHECK (s3_put_source_if (&src, s3conf, "cond", &cond, &resp) < 0);
+        CHECK (errno == -ESTALE);
+        cond.if_match = etag;
+        CHECK (s3_source_init_buffer (&src, "two", 3) == 0);
+        CHECK (s3_put_source_if (&src, s3conf, "cond", &cond, &resp) == 0);
+
+        /* Only ETags for writes */
+        memset (&cond, 0, sizeof(cond));
+        cond.if_modified_since = time (NULL);
+        CHECK (s3_source_init_buffer (&src, "two", 3) == 0);
+        errno = 0;
+        CHECK (s3_put_source_if (&src, s3conf, "cond", &cond, &resp) < 0);
+        CHECK (errno == -EINVAL);
+
+        /* A multipart PUT bound to fail does not upload anything */
+        data = __pattern (LARGE_SIZE, 2);
+        fd   = __tmpfile (data, LARGE_SIZE);
+        memset (&cond, 0, sizeof(cond));
+        cond.if_none_match = "*";
+        CHECK (s3_set_part_size (s3conf, 5 * 1024 * 1024) == 0);
+        s3srv_stats (srv, &before);
+        CHECK (s3_source_init_fd (&src, fd, 0, LARGE_SIZE) == 0);
+        errno = 0;
+        CHECK (s3_put_source_if (&src, s3conf, "large", &cond, NULL) < 0);
+        CHECK (errno == -ESTALE);
+        s3srv_stats (srv, &after);
+        CHECK (after.requests - before.requests == 1);
+        s3_source_release (&src);
+
+        close (fd);
+        free (data);
+}
+
+static
+void test_copy (s3_conf_t *s3conf)
+{
+        s3_source_t src;
+        s3_sink_t   sink;
+        s3_resp_t   resp;
+        char        *data = __pattern (SMALL_SIZE, 3);
+        char        *back = calloc (1, SMALL_SIZE);
+
+        CHECK (back != NULL);
+        CHECK (s3_source_init_buffer (&src, data, SMALL_SIZE) == 0);
+        CHECK (s3_put_source (&src, s3conf, "copy/src", NULL) == 0);
+
+        CHECK (s3_copy (s3conf, NULL, "copy/src", "copy/dst", &resp) == 0);
+        CHECK (resp.code == 200);
+        CHECK (s3_sink_init_buffer (&sink, back, SMALL_SIZE) == 0);
+        CHECK (s3_get_sink (&sink, s3conf, "copy/dst", &resp) == 0);
+        CHECK (!memcmp (data, back, SMALL_SIZE));
+
+        errno = 0;
+        CHECK (s3_copy (s3conf, NULL, "copy/src", "copy/src", NULL) < 0);
+        CHECK (errno == -EINVAL);
+
+        errno = 0;
+        CHECK (s3_copy (s3conf, NULL, "copy/none", "copy/dst", &resp) < 0);
+        CHECK (errno == -ENOENT);
+
+        free (data);
+        free (back);
+}
+
+static
+void test_rate_limit (s3_conf_t *s3conf)
+{
+        struct timespec start;
+        s3_sink_t       sink;
+        s3_resp_t       resp;
+        char            *back = malloc (SMALL_SIZE);
+        double          secs  = 0;
+        int32_t         i     = 0;
+
+        CHECK (back != NULL);
+
+        /* 50/s with a burst of 5, 30 requests take half a second */
+        CHECK (s3_set_rate_limit (s3conf, 0, 50) == 0);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (i = 0; i < 30; i++)
+                CHECK (s3_head (s3conf, "copy/dst", &resp) == 0);
+        secs = __elapsed (&start);
+        CHECK ((secs >= 0.45) && (secs < 2));
+
+        /* 1MB/s with a 100KB burst, 256KB take about 150ms */
+        CHECK (s3_set_rate_limit (s3conf, 1024 * 1024, 0) == 0);
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        CHECK (s3_sink_init_buffer (&sink, back, SMALL_SIZE) == 0);
+        CHECK (s3_get_sink (&sink, s3conf, "copy/dst", &resp) == 0);
+        secs = __elapsed (&start);
+        CHECK ((secs >= 0.12) && (secs < 2));
+
+        CHECK (s3_set_rate_limit (s3conf, 0, 0) == 0);
+        free (back);
+}
+
+static
+void test_keepalive (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3srv_stats_t before;
+        s3srv_stats_t after;
+        s3_resp_t     resp;
+        int32_t       i = 0;
+
+        s3srv_stats (srv, &before);
+        for (i = 0; i < 20; i++)
+                CHECK (s3_head (s3conf, "large", &resp) == 0);
+        s3srv_stats (srv, &after);
+
+        /* Handles, and their connections, outlive the requests */
+        CHECK (after.requests - before.requests == 20);
+        CHECK (after.connections - before.connections <= 1);
+}
+
+static
+void *__mux_worker (void *arg)
+{
+        s3_conf_t *s3conf = arg;
+        s3_sink_t sink;
+        s3_resp_t resp;
+        char      *back   = malloc (SMALL_SIZE);
+        int32_t   i       = 0;
+
+        CHECK (back != NULL);
+        for (i = 0; i < MUX_REQUESTS; i++) {
+                CHECK (s3_head (s3conf, "mux/obj", &resp) == 0);
+                CHECK (s3_sink_init_buffer (&sink, back, SMALL_SIZE) == 0);
+                CHECK (s3_get_sink (&sink, s3conf, "mux/obj", &resp) == 0);
+                CHECK (sink.pos == SMALL_SIZE);
+        }
+        free (back);
+
+        return NULL;
+}
+
+static
+void test_multiplex (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        s3srv_stats_t before;
+        s3srv_stats_t after;
+        s3_source_t   src;
+        s3_resp_t     resp;
+        pthread_t     threads[MUX_THREADS];
+        iobuf_t       *buf  = s3_iobuf_new ();
+        char          *data = __pattern (SMALL_SIZE, 6);
+        int32_t       i     = 0;
+
+        CHECK (s3_source_init_buffer (&src, data, SMALL_SIZE) == 0);
+        CHECK (s3_put_source (&src, s3conf, "mux/obj", &resp) == 0);
+        CHECK (s3_set_max_connections (s3conf, 4) == 0);
+
+        /* Parallel requests of all threads share the connections of
+           the multiplexer */
+        s3srv_stats (srv, &before);
+        for (i = 0; i < MUX_THREADS; i++)
+                CHECK (pthread_create (&threads[i], NULL, __mux_worker,
+                                       s3conf) == 0);
+        for (i = 0; i < MUX_THREADS; i++)
+                pthread_join (threads[i], NULL);
+        s3srv_stats (srv, &after);
+
+        CHECK (after.requests - before.requests >=
+               MUX_THREADS * MUX_REQUESTS * 2);
+        CHECK (after.connections - before.connections <= 4);
+
+        CHECK (s3_set_max_connections (s3conf, 0) == 0);
+        CHECK (s3_set_max_connections (s3conf, -1) < 0);
+        CHECK (buf != NULL);
+        CHECK (s3_delete (buf, s3conf, "mux/obj") == 0);
+        s3_iobuf_free (buf);
+        free (data);
+}
+
+static
+void test_endpoints (s3_conf_t *s3conf)
+{
+        s3srv_opts_t  opts;
+        s3srv_stats_t stats[2];
+        s3srv_stats_t after;
+        s3srv_t       *gw[2];
+        s3_resp_t     resp;
+        char          hosts[2][64];
+        const char    *endpoints[2] = { hosts[0], hosts[1] };
+        int32_t       i             = 0;
+
+        memset (&opts, 0, sizeof(opts));
+        for (i = 0; i < 2; i++) {
+                gw[i] = s3srv_start (&opts);
+                CHECK (gw[i] != NULL);
+                snprintf (hosts[i], sizeof(hosts[i]), "127.0.0.1:%d",
+                          s3srv_port (gw[i]));
+                s3srv_stats (gw[i], &stats[i]);
+        }
+        CHECK (s3_set_endpoints (s3conf, endpoints, 2) == 0);
+
+        /* Nothing in flight, ties take turns */
+        for (i = 0; i < 20; i++) {
+                CHECK (s3_head (s3conf, "none", &resp) < 0);
+                CHECK (resp.code == 404);
+        }
+        s3srv_stats (gw[0], &after);
+        CHECK (after.requests - stats[0].requests == 10);
+        s3srv_stats (gw[1], &after);
+        CHECK (after.requests - stats[1].requests == 10);
+
+        /* A failing gateway is retried elsewhere, then left out */
+        s3srv_inject (gw[0], 500, 1000);
+        for (i = 0; i < 20; i++) {
+                errno = 0;
+                CHECK (s3_head (s3conf, "none", &resp) < 0);
+                CHECK (errno == -ENOENT);
+        }
+        s3srv_stats (gw[0], &after);
+        CHECK (after.injected - stats[0].injected == 3);
+
+        CHECK (s3_set_endpoints (s3conf, NULL, 0) == 0);
+        for (i = 0; i < 2; i++)
+                s3srv_stop (gw[i]);
+}
+
+struct list_seen {
+        int32_t keys[LIST_KEYS];
+        int32_t dirs[LIST_DIRS];
+        int32_t total;
+        int32_t stop_after;
+};
+
+static
+int32_t __list_cb (const s3_entry_t *entry, void *opaque)
+{
+        struct list_seen *seen = opaque;
+        uint32_t         hash  = 0;
+        int32_t          idx   = 0;
+
+        if (entry->is_prefix) {
+                CHECK (sscanf (entry->key, "list/d%d/", &idx) == 1);
+                CHECK ((idx >= 0) && (idx < LIST_DIRS));
+                seen->dirs[idx]++;
+        } else {
+                CHECK (sscanf (entry->key, "list/%08x-%d", &hash,
+                               &idx) == 2);
+                CHECK ((idx >= 0) && (idx < LIST_KEYS));
+                CHECK (entry->size == 1);
+                CHECK (entry->etag[0] == '"');
+                seen->keys[idx]++;
+        }
+
+        seen->total++;
+        return ((seen->stop_after) && (seen->total >= seen->stop_after));
+}
+
+static
+void test_list (s3_conf_t *s3conf)
+{
+        struct list_seen *seen = calloc (1, sizeof(*seen));
+        s3_source_t      src;
+        char             key[64];
+        int32_t          i     = 0;
+
+        CHECK (seen != NULL);
+        CHECK (s3_set_verify (s3conf, 0) == 0);
+
+        /* Hashed names so the keys spread over the key space */
+        for (i = 0; i < LIST_KEYS; i++) {
+                snprintf (key, sizeof(key), "list/%08x-%d",
+                          (uint32_t) (i * 2654435761u), i);
+                CHECK (s3_source_init_buffer (&src, "x", 1) == 0);
+                CHECK (s3_put_source (&src, s3conf, key, NULL) == 0);
+        }
+        for (i = 0; i < LIST_DIRS; i++) {
+                snprintf (key, sizeof(key), "list/d%d/a", i);
+                CHECK (s3_source_init_buffer (&src, "x", 1) == 0);
+                CHECK (s3_put_source (&src, s3conf, key, NULL) == 0);
+                snprintf (key, sizeof(key), "list/d%d/b", i);
+                CHECK (s3_source_init_buffer (&src, "x", 1) == 0);
+                CHECK (s3_put_source (&src, s3conf, key, NULL) == 0);
+        }
+
+        /* Every key exactly once, whatever the ranges ended up being */
+        CHECK (s3_list (s3conf, "list/", "/", __list_cb, seen) == 0);
+        for (i = 0; i < LIST_KEYS; i++)
+                CHECK (seen->keys[i] == 1);
+        for (i = 0; i < LIST_DIRS; i++)
+                CHECK (seen->dirs[i] == 1);
+        CHECK (seen->total == LIST_KEYS + LIST_DIRS);
+
+        memset (seen, 0, sizeof(*seen));
+        seen->stop_after = 10;
+        errno = 0;
+        CHECK (s3_list (s3conf, "list/", "/", __list_cb, seen) < 0);
+        CHECK (errno == -ECANCELED);
+        CHECK (seen->total == 10);
+
+        CHECK (s3_set_verify (s3conf, 1) == 0);
+        free (seen);
+}
+
+static
+void __delete_err (const char *key, const char *code, void *opaque)
+{
+        fprintf (stderr, "delete %s: %s\n", key, code);
+        (*(int32_t *) opaque)++;
+}
+
+static
+void test_delete_multi (s3_conf_t *s3conf, s3srv_t *srv)
+{
+        const char       *keys[] = { "multi/a&b", "multi/<c>", "multi/d'e",
+                                     "multi/missing" };
+        struct list_seen *seen   = calloc (1, sizeof(*seen));
+        s3srv_stats_t    before;
+        s3srv_stats_t    after;
+        s3_source_t      src;
+        s3_resp_t        resp;
+        int32_t          errors  = 0;
+        int32_t          i       = 0;
+
+        CHECK (seen != NULL);
+        for (i = 0; i < 3; i++) {
+                CHECK (s3_source_init_buffer (&src, "x", 1) == 0);
+                CHECK (s3_put_source (&src, s3conf, keys[i], NULL) == 0);
+        }
+
+        /* Keys that need escaping, missing ones are no failure */
+        CHECK (s3_delete_objects (s3conf, keys, 4, __delete_err,
+                                  &errors) == 0);
+        CHECK (errors == 0);
+        for (i = 0; i < 3; i++) {
+                errno = 0;
+                CHECK (s3_head (s3conf, keys[i], &resp) < 0);
+                CHECK (errno == -ENOENT);
+        }
+
+        /* Everything test_list left behind, a request per 1000 keys */
+        s3srv_stats (srv, &before);
+        CHECK (s3_delete_prefix (s3conf, "list/", __delete_err,
+                                 &errors) == 0);
+        s3srv_stats (srv, &after);
+        CHECK (errors == 0);
+        CHECK (after.requests - before.requests < 20);
+
+        CHECK (s3_list (s3conf, "list/", NULL, __list_cb, seen) == 0);
+        CHECK (seen->total == 0);
+        free (seen);
+}
+
+int main (void)
+{
+        s3srv_opts_t opts;
+        s3srv_t      *srv    = NULL;
+        s3_conf_t    *s3conf = NULL;
+        char         host[64];
+
+        memset (&opts, 0, sizeof(opts));
+        srv = s3srv_start (&opts);
+        CHECK (srv != NULL);
+
+        snprintf (host, sizeof(host), "127.0.0.1:%d", s3srv_port (srv));
+        s3conf = s3_init ("test", "AKIDTEST", "secret", host, "bucket");
+        CHECK (s3conf != NULL);
+        CHECK (s3_set_hedging (s3conf, 0) == 0);
+
+        test_put_get (s3conf);
+        test_multipart (s3conf);
+        test_delete (s3conf);
+        test_retries (s3conf, srv);
+        test_hedging (s3conf, srv);
+        test_conditional (s3conf, srv);
+        test_keepalive (s3conf, srv);
+        test_multiplex (s3conf, srv);
+        test_copy (s3conf);
+        test_api_copy (s3conf, srv);
+        test_rate_limit (s3conf);
+        test_endpoints (s3conf);
+        test_list (s3conf);
+        test_delete_multi (s3conf, srv);
+
+        s3_fini (s3conf);
+        s3srv_stop (srv);
+
+        return 0;
+}